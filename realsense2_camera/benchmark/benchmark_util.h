@@ -0,0 +1,63 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace realsense2_camera
+{
+namespace benchmark
+{
+    // Median wall time of one call of f, in milliseconds, over iterations calls after a warm-up call.
+    template <class F>
+    double medianMs(F f, int iterations)
+    {
+        f();
+        std::vector<double> times;
+        for (int i = 0; i < std::max(iterations, 1); ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            f();
+            times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+        return times[times.size() / 2];
+    }
+
+    // A frameset of a librealsense recording (e.g. the bags of scripts/rs2_test.py) holding a frame of each of
+    // streams: the one after skip such framesets, past the auto exposure settling, or the last one of a shorter
+    // recording. The playback is not real time, so no frame is dropped while reading.
+    inline rs2::frameset readFrameset(const std::string& bag_filename, const std::vector<rs2_stream>& streams, int skip = 30)
+    {
+        rs2::config config;
+        config.enable_device_from_file(bag_filename, false);
+        rs2::pipeline pipeline;
+        rs2::pipeline_profile profile = pipeline.start(config);
+        profile.get_device().as<rs2::playback>().set_real_time(false);
+        rs2::frameset found;
+        rs2::frameset frameset;
+        int complete_count(0);
+        while (complete_count <= skip && pipeline.try_wait_for_frames(&frameset, 1000))
+        {
+            bool complete = std::all_of(streams.begin(), streams.end(),
+                                        [&frameset](rs2_stream stream) { return bool(frameset.first_or_default(stream)); });
+            if (complete)
+            {
+                frameset.keep();
+                found = frameset;
+                ++complete_count;
+            }
+        }
+        pipeline.stop();
+        if (!found)
+            throw std::runtime_error("No frameset with all the requested streams in " + bag_filename);
+        return found;
+    }
+}
+}
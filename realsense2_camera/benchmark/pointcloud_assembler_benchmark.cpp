@@ -0,0 +1,260 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+// Compares the loop that wrote the pointcloud through PointCloud2Iterators before PointCloudAssembler with
+// PointCloudAssembler::assemble(), on the points rs2::pointcloud computes for a recorded frameset, and checks that
+// both write the same bytes.
+//
+// Usage: pointcloud_assembler_benchmark <recording.bag> [iterations]
+//        pointcloud_assembler_benchmark --synthetic [iterations]
+
+#include "benchmark_util.h"
+#include "../include/pointcloud_assembler.h"
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace realsense2_camera;
+
+namespace
+{
+    struct Cloud
+    {
+        int width;                                  // of the depth frame
+        int height;
+        std::vector<float> vertices;                // xyz triplets
+        std::vector<float> texture_coordinates;     // uv pairs
+        std::vector<uint8_t> texture;               // RGB8
+        int texture_width;
+        int texture_height;
+    };
+
+    Cloud readCloud(const std::string& bag_filename)
+    {
+        rs2::frameset frameset(benchmark::readFrameset(bag_filename, {RS2_STREAM_DEPTH, RS2_STREAM_COLOR}));
+        rs2::video_frame color(frameset.get_color_frame());
+        if (color.get_profile().format() != RS2_FORMAT_RGB8)
+            throw std::runtime_error("The recording's color stream is not RGB8");
+        rs2::pointcloud pointcloud;
+        pointcloud.map_to(color);
+        rs2::depth_frame depth(frameset.get_depth_frame());
+        rs2::points points(pointcloud.calculate(depth));
+        Cloud cloud;
+        cloud.width = depth.get_width();
+        cloud.height = depth.get_height();
+        const float* vertices = reinterpret_cast<const float*>(points.get_vertices());
+        const float* texture_coordinates = reinterpret_cast<const float*>(points.get_texture_coordinates());
+        cloud.vertices.assign(vertices, vertices + 3 * points.size());
+        cloud.texture_coordinates.assign(texture_coordinates, texture_coordinates + 2 * points.size());
+        const uint8_t* texture = static_cast<const uint8_t*>(color.get_data());
+        cloud.texture.assign(texture, texture + color.get_height() * color.get_stride_in_bytes());
+        cloud.texture_width = color.get_width();
+        cloud.texture_height = color.get_height();
+        return cloud;
+    }
+
+    // A 1280x720 depth frame of a slanted wall with 15% holes, textured by a 1280x720 color frame that misses
+    // its left 10%.
+    Cloud syntheticCloud()
+    {
+        const int width(1280), height(720);
+        std::mt19937 rng(5);
+        Cloud cloud;
+        cloud.width = width;
+        cloud.height = height;
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                float z = (rng() % 100 < 15) ? 0.0f : 1.0f + 0.002f * x;
+                cloud.vertices.push_back(z * (x - 640.0f) / 640.0f);
+                cloud.vertices.push_back(z * (y - 360.0f) / 640.0f);
+                cloud.vertices.push_back(z);
+                cloud.texture_coordinates.push_back((x + 0.5f) / width * 1.1f - 0.1f);
+                cloud.texture_coordinates.push_back((y + 0.5f) / height);
+            }
+        }
+        cloud.texture_width = width;
+        cloud.texture_height = height;
+        cloud.texture.resize(width * height * 3);
+        for (uint8_t& value : cloud.texture)
+            value = static_cast<uint8_t>(rng());
+        return cloud;
+    }
+
+    void reverse_memcpy(unsigned char* dst, const unsigned char* src, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            dst[n - 1 - i] = src[i];
+    }
+
+    // The loop of publishPointCloud before PointCloudAssembler, for an RGB8 texture.
+    size_t iteratorLoop(const Cloud& cloud, bool use_texture, bool ordered_pc, sensor_msgs::PointCloud2& msg_pointcloud)
+    {
+        const bool allow_no_texture_points(false);
+        size_t size(cloud.vertices.size() / 3);
+        const rs2::vertex* vertex = reinterpret_cast<const rs2::vertex*>(cloud.vertices.data());
+        const rs2::texture_coordinate* color_point = reinterpret_cast<const rs2::texture_coordinate*>(cloud.texture_coordinates.data());
+
+        sensor_msgs::PointCloud2Modifier modifier(msg_pointcloud);
+        modifier.setPointCloud2FieldsByString(1, "xyz");
+        modifier.resize(size);
+        if (ordered_pc)
+        {
+            msg_pointcloud.width = cloud.width;
+            msg_pointcloud.height = cloud.height;
+            msg_pointcloud.is_dense = false;
+        }
+
+        size_t valid_count(0);
+        if (use_texture)
+        {
+            int texture_width = cloud.texture_width;
+            int texture_height = cloud.texture_height;
+            int num_colors = 3;
+            const uint8_t* color_data = cloud.texture.data();
+            std::string format_str = "rgb";
+            msg_pointcloud.point_step = addPointField(msg_pointcloud, format_str.c_str(), 1, sensor_msgs::PointField::FLOAT32, msg_pointcloud.point_step);
+            msg_pointcloud.row_step = msg_pointcloud.width * msg_pointcloud.point_step;
+            msg_pointcloud.data.resize(msg_pointcloud.height * msg_pointcloud.row_step);
+
+            sensor_msgs::PointCloud2Iterator<float>iter_x(msg_pointcloud, "x");
+            sensor_msgs::PointCloud2Iterator<float>iter_y(msg_pointcloud, "y");
+            sensor_msgs::PointCloud2Iterator<float>iter_z(msg_pointcloud, "z");
+            sensor_msgs::PointCloud2Iterator<uint8_t>iter_color(msg_pointcloud, format_str);
+
+            float color_pixel[2];
+            for (size_t point_idx=0; point_idx < size; point_idx++, vertex++, color_point++)
+            {
+                float i(color_point->u);
+                float j(color_point->v);
+                bool valid_color_pixel(i >= 0.f && i <=1.f && j >= 0.f && j <=1.f);
+                bool valid_pixel(vertex->z > 0 && (valid_color_pixel || allow_no_texture_points));
+                if (valid_pixel || ordered_pc)
+                {
+                    *iter_x = vertex->x;
+                    *iter_y = vertex->y;
+                    *iter_z = vertex->z;
+
+                    if (valid_color_pixel)
+                    {
+                        color_pixel[0] = i * texture_width;
+                        color_pixel[1] = j * texture_height;
+                        int pixx = static_cast<int>(color_pixel[0]);
+                        int pixy = static_cast<int>(color_pixel[1]);
+                        int offset = (pixy * texture_width + pixx) * num_colors;
+                        reverse_memcpy(&(*iter_color), color_data+offset, num_colors);  // PointCloud2 order of rgb is bgr.
+                    }
+                    ++iter_x; ++iter_y; ++iter_z;
+                    ++iter_color;
+                    ++valid_count;
+                }
+            }
+        }
+        else
+        {
+            msg_pointcloud.row_step = msg_pointcloud.width * msg_pointcloud.point_step;
+            msg_pointcloud.data.resize(msg_pointcloud.height * msg_pointcloud.row_step);
+
+            sensor_msgs::PointCloud2Iterator<float>iter_x(msg_pointcloud, "x");
+            sensor_msgs::PointCloud2Iterator<float>iter_y(msg_pointcloud, "y");
+            sensor_msgs::PointCloud2Iterator<float>iter_z(msg_pointcloud, "z");
+
+            for (size_t point_idx=0; point_idx < size; point_idx++, vertex++)
+            {
+                bool valid_pixel(vertex->z > 0);
+                if (valid_pixel || ordered_pc)
+                {
+                    *iter_x = vertex->x;
+                    *iter_y = vertex->y;
+                    *iter_z = vertex->z;
+
+                    ++iter_x; ++iter_y; ++iter_z;
+                    ++valid_count;
+                }
+            }
+        }
+        if (!ordered_pc)
+        {
+            msg_pointcloud.width = valid_count;
+            msg_pointcloud.height = 1;
+            msg_pointcloud.is_dense = true;
+            modifier.resize(valid_count);
+        }
+        return valid_count;
+    }
+
+    // What publishPointCloud does now, for the default xyz32 layout.
+    size_t assemble(PointCloudAssembler& assembler, const Cloud& cloud, bool use_texture, bool ordered_pc, sensor_msgs::PointCloud2& msg_pointcloud)
+    {
+        size_t size(cloud.vertices.size() / 3);
+        PointCloudAssembler::Texture texture = {cloud.texture.data(), cloud.texture_width, cloud.texture_height, 3};
+        pointcloud_layout::setFields(msg_pointcloud, PointCloudLayout::XYZ32, use_texture ? 3 : 0);
+        msg_pointcloud.data.resize(size * msg_pointcloud.point_step);
+        size_t valid_count = assembler.assemble(cloud.vertices.data(), cloud.texture_coordinates.data(), size,
+                                                use_texture ? &texture : nullptr, ordered_pc, false,
+                                                PointCloudLayout::XYZ32, msg_pointcloud.data.data());
+        if (!ordered_pc)
+            msg_pointcloud.data.resize(valid_count * msg_pointcloud.point_step);
+        return valid_count;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::printf("Usage: %s <recording.bag> | --synthetic [iterations]\n", argv[0]);
+        return 1;
+    }
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 100;
+    Cloud cloud;
+    try
+    {
+        cloud = std::strcmp(argv[1], "--synthetic") ? readCloud(argv[1]) : syntheticCloud();
+    }
+    catch (const std::exception& e)
+    {
+        std::printf("Could not read %s: %s\n", argv[1], e.what());
+        return 1;
+    }
+    size_t size(cloud.vertices.size() / 3);
+    std::printf("%zu points, AVX2 classification: %s, NEON classification: %s, median of %d runs\n", size,
+                PointCloudAssembler::classifyAVX2() ? "yes" : "no", PointCloudAssembler::classifyNEON() ? "yes" : "no", iterations);
+
+    PointCloudAssembler assembler;
+    sensor_msgs::PointCloud2 loop_msg, assembled_msg;
+    for (bool use_texture : {true, false})
+    {
+        for (bool ordered_pc : {false, true})
+        {
+            size_t loop_count(0), assembled_count(0);
+            double loop_ms = benchmark::medianMs([&]() { loop_count = iteratorLoop(cloud, use_texture, ordered_pc, loop_msg); }, iterations);
+            double assemble_ms = benchmark::medianMs([&]() { assembled_count = assemble(assembler, cloud, use_texture, ordered_pc, assembled_msg); }, iterations);
+            if (loop_count != assembled_count)
+            {
+                std::printf("Point counts differ: %zu with the loop, %zu assembled\n", loop_count, assembled_count);
+                return 1;
+            }
+            // The timed runs reuse the messages, which leaves stale bytes where the loop writes nothing (padding,
+            // colors of untextured points), so the clouds are compared on fresh ones.
+            sensor_msgs::PointCloud2 loop_cloud, assembled_cloud;
+            iteratorLoop(cloud, use_texture, ordered_pc, loop_cloud);
+            assemble(assembler, cloud, use_texture, ordered_pc, assembled_cloud);
+            if (loop_cloud.data.size() != assembled_cloud.data.size() ||
+                std::memcmp(loop_cloud.data.data(), assembled_cloud.data.data(), loop_cloud.data.size()))
+            {
+                std::printf("The %s %s clouds differ\n", use_texture ? "textured" : "untextured", ordered_pc ? "ordered" : "unordered");
+                return 1;
+            }
+            // Points per second are counted over the input points, which both have to look at.
+            std::printf("%-10s %-9s: loop %7.2f ms (%6.1f Mpts/s), assemble %7.2f ms (%6.1f Mpts/s), %.2fx\n",
+                        use_texture ? "textured" : "untextured", ordered_pc ? "ordered" : "unordered",
+                        loop_ms, size / loop_ms / 1000, assemble_ms, size / assemble_ms / 1000, loop_ms / assemble_ms);
+        }
+    }
+    return 0;
+}
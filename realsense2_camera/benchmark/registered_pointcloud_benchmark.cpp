@@ -0,0 +1,109 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+// Compares the per-frame cost of the cloud of depth aligned to color through the two librealsense filters the node
+// runs without the lookup tables, rs2::align then rs2::pointcloud and PointCloudAssembler, with DepthAligner then
+// PointCloudGenerator on the registered color texture, as with align_depth_lut and pointcloud_lut. Both run on the
+// calling thread, or on the OpenMP threads when built with OpenMP.
+//
+// The filters only take librealsense frames, so this one needs a recording with depth and RGB8 color.
+//
+// Usage: registered_pointcloud_benchmark <recording.bag> [iterations]
+
+#include "benchmark_util.h"
+#include "../include/depth_aligner.h"
+#include "../include/pointcloud_assembler.h"
+#include "../include/pointcloud_generator.h"
+#include <cstdio>
+#include <cstdlib>
+
+using namespace realsense2_camera;
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::printf("Usage: %s <recording.bag> [iterations]\n", argv[0]);
+        return 1;
+    }
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 100;
+    rs2::frameset frameset;
+    try
+    {
+        frameset = benchmark::readFrameset(argv[1], {RS2_STREAM_DEPTH, RS2_STREAM_COLOR});
+        if (frameset.get_color_frame().get_profile().format() != RS2_FORMAT_RGB8)
+            throw std::runtime_error("The recording's color stream is not RGB8");
+    }
+    catch (const std::exception& e)
+    {
+        std::printf("Could not read %s: %s\n", argv[1], e.what());
+        return 1;
+    }
+    rs2::depth_frame depth(frameset.get_depth_frame());
+    rs2::video_frame color(frameset.get_color_frame());
+    rs2::video_stream_profile depth_profile(depth.get_profile().as<rs2::video_stream_profile>());
+    rs2::video_stream_profile color_profile(color.get_profile().as<rs2::video_stream_profile>());
+    rs2_intrinsics color_intrinsics(color_profile.get_intrinsics());
+    PointCloudAssembler::Texture texture = {static_cast<const uint8_t*>(color.get_data()), color.get_width(), color.get_height(), 3};
+    const uint32_t point_step(PointCloudAssembler::pointStep(&texture));
+    std::printf("%dx%d depth aligned to %dx%d color, median of %d runs\n", depth.get_width(), depth.get_height(),
+                color.get_width(), color.get_height(), iterations);
+
+    // rs2::align + rs2::pointcloud, the points assembled as publishPointCloud does.
+    rs2::align align(RS2_STREAM_COLOR);
+    rs2::pointcloud pointcloud;
+    PointCloudAssembler assembler;
+    std::vector<uint8_t> filters_out;
+    rs2::depth_frame filters_aligned(depth);
+    rs2::points points;
+    size_t filters_count(0);
+    auto alignWithFilter = [&]() { filters_aligned = rs2::frameset(align.process(frameset)).get_depth_frame(); };
+    auto calculatePoints = [&]()
+    {
+        pointcloud.map_to(color);
+        points = pointcloud.calculate(filters_aligned);
+    };
+    auto assemblePoints = [&]()
+    {
+        filters_out.resize(points.size() * point_step);
+        filters_count = assembler.assemble(reinterpret_cast<const float*>(points.get_vertices()),
+                                           reinterpret_cast<const float*>(points.get_texture_coordinates()), points.size(),
+                                           &texture, false, false, PointCloudLayout::XYZ32, filters_out.data());
+    };
+    double filters_align_ms = benchmark::medianMs(alignWithFilter, iterations);
+    double filters_points_ms = benchmark::medianMs(calculatePoints, iterations);
+    double filters_assemble_ms = benchmark::medianMs(assemblePoints, iterations);
+    double filters_ms = benchmark::medianMs([&]() { alignWithFilter(); calculatePoints(); assemblePoints(); }, iterations);
+
+    // The lookup tables, configured once per profile in the node, so outside of the timing.
+    DepthAligner aligner;
+    aligner.configure(depth_profile.get_intrinsics(), depth.get_units());
+    if (depth.get_stride_in_bytes() != depth.get_width() * static_cast<int>(sizeof(uint16_t)) ||
+        !aligner.addTarget(color_intrinsics, depth_profile.get_extrinsics_to(color_profile)))
+    {
+        std::printf("align_depth_lut does not support this recording\n");
+        return 1;
+    }
+    PointCloudGenerator generator;
+    generator.configure(color_intrinsics, depth.get_units());
+    rs2_extrinsics identity = {{1, 0, 0, 0, 1, 0, 0, 0, 1}, {0, 0, 0}};
+    generator.setTexture(color_intrinsics, identity);
+    std::vector<uint16_t> aligned(generator.size());
+    uint16_t* aligned_outputs[] = {aligned.data()};
+    std::vector<uint8_t> registered_out(generator.size() * point_step);
+    size_t registered_count(0);
+    auto alignWithTables = [&]() { aligner.align(static_cast<const uint16_t*>(depth.get_data()), aligned_outputs); };
+    auto generatePoints = [&]()
+    {
+        registered_count = generator.generate(aligned.data(), &texture, false, false, PointCloudLayout::XYZ32, registered_out.data());
+    };
+    double registered_align_ms = benchmark::medianMs(alignWithTables, iterations);
+    double registered_points_ms = benchmark::medianMs(generatePoints, iterations);
+    double registered_ms = benchmark::medianMs([&]() { alignWithTables(); generatePoints(); }, iterations);
+
+    std::printf("rs2::align + rs2::pointcloud + assembly : align %7.2f ms, points %7.2f ms, assembly %6.2f ms, total %7.2f ms, %zu points\n",
+                filters_align_ms, filters_points_ms, filters_assemble_ms, filters_ms, filters_count);
+    std::printf("DepthAligner + registered generator     : align %7.2f ms, points %7.2f ms,                 total %7.2f ms, %zu points, %.1fx\n",
+                registered_align_ms, registered_points_ms, registered_ms, registered_count, filters_ms / registered_ms);
+    return 0;
+}
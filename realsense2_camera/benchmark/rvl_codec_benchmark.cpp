@@ -0,0 +1,160 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+// Measures the RVL codec of the rvl depth topics on a recorded depth frame: the encode and decode rates, the
+// compression ratio, and the rate of encoding frames on a WorkerPool as RvlDepthPublisher does. PNG, which the
+// compressedDepth image_transport plugin uses, is measured on the same frame for reference.
+//
+// Usage: rvl_codec_benchmark <recording.bag> [iterations]
+//        rvl_codec_benchmark --synthetic [iterations]
+
+#include "benchmark_util.h"
+#include "../include/rvl_codec.h"
+#include "../include/worker_pool.h"
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+
+using namespace realsense2_camera;
+
+namespace
+{
+    struct DepthImage
+    {
+        uint32_t width;
+        uint32_t height;
+        std::vector<uint16_t> data;
+    };
+
+    DepthImage readDepth(const std::string& bag_filename)
+    {
+        rs2::depth_frame depth(benchmark::readFrameset(bag_filename, {RS2_STREAM_DEPTH}).get_depth_frame());
+        if (depth.get_profile().format() != RS2_FORMAT_Z16)
+            throw std::runtime_error("The recording's depth stream is not Z16");
+        DepthImage image;
+        image.width = depth.get_width();
+        image.height = depth.get_height();
+        for (uint32_t y = 0; y < image.height; ++y)
+        {
+            const uint16_t* row = reinterpret_cast<const uint16_t*>(static_cast<const uint8_t*>(depth.get_data()) + y * depth.get_stride_in_bytes());
+            image.data.insert(image.data.end(), row, row + image.width);
+        }
+        return image;
+    }
+
+    // An 848x480 room: a back wall, a floor and a few boxes, with sensor noise and 10% holes along edges.
+    DepthImage syntheticDepth()
+    {
+        DepthImage image = {848, 480, std::vector<uint16_t>()};
+        std::mt19937 rng(7);
+        std::normal_distribution<float> noise(0.0f, 3.0f);
+        for (uint32_t y = 0; y < image.height; ++y)
+        {
+            for (uint32_t x = 0; x < image.width; ++x)
+            {
+                float depth = y > 300 ? 300000.0f / (y - 250) : 4000.0f;
+                if (x > 100 + y / 8 && x < 300 && y > 150 && y < 400)
+                    depth = 1500.0f + x;
+                if (x > 500 && x < 700 && y > 100 && y < 250)
+                    depth = 2500.0f;
+                bool hole = (x % 200 < 20 && rng() % 2) || rng() % 50 == 0;
+                image.data.push_back(hole ? 0 : static_cast<uint16_t>(depth + noise(rng)));
+            }
+        }
+        return image;
+    }
+
+    // Encodes jobs copies of the image on a WorkerPool of num_threads threads. Returns the elapsed time in ms.
+    double encodeOnWorkers(const DepthImage& image, std::size_t num_threads, std::size_t jobs)
+    {
+        std::vector<std::vector<uint8_t> > outputs(jobs);
+        std::mutex mutex;
+        std::condition_variable done_cv;
+        std::size_t done(0);
+        auto start = std::chrono::steady_clock::now();
+        {
+            WorkerPool workers(num_threads, jobs);
+            for (std::size_t job = 0; job < jobs; ++job)
+            {
+                workers.submit([&, job]()
+                {
+                    rvl::encodeImage(image.data.data(), image.width, image.height, outputs[job]);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (++done == jobs)
+                        done_cv.notify_one();
+                });
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            done_cv.wait(lock, [&]() { return done == jobs; });
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::printf("Usage: %s <recording.bag> | --synthetic [iterations]\n", argv[0]);
+        return 1;
+    }
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 100;
+    DepthImage image;
+    try
+    {
+        image = std::strcmp(argv[1], "--synthetic") ? readDepth(argv[1]) : syntheticDepth();
+    }
+    catch (const std::exception& e)
+    {
+        std::printf("Could not read %s: %s\n", argv[1], e.what());
+        return 1;
+    }
+    const double raw_mb = image.data.size() * sizeof(uint16_t) / 1e6;
+    std::size_t valid = image.data.size() - std::count(image.data.begin(), image.data.end(), 0);
+    std::printf("%ux%u depth, %.0f%% valid, median of %d runs. Rates are of raw depth.\n", image.width, image.height,
+                100.0 * valid / image.data.size(), iterations);
+
+    std::vector<uint8_t> encoded;
+    double encode_ms = benchmark::medianMs([&]() { rvl::encodeImage(image.data.data(), image.width, image.height, encoded); }, iterations);
+    std::vector<uint16_t> decoded;
+    uint32_t width(0), height(0);
+    double decode_ms = benchmark::medianMs([&]() { rvl::decodeImage(encoded.data(), encoded.size(), decoded, width, height); }, iterations);
+    if (decoded != image.data || width != image.width || height != image.height)
+    {
+        std::printf("The decoded image differs from the original\n");
+        return 1;
+    }
+    std::printf("rvl       : encode %7.2f ms (%6.0f MB/s), decode %7.2f ms (%6.0f MB/s), %zu bytes, ratio %.2f\n",
+                encode_ms, raw_mb / encode_ms * 1000, decode_ms, raw_mb / decode_ms * 1000, encoded.size(),
+                image.data.size() * sizeof(uint16_t) / double(encoded.size()));
+
+    cv::Mat mat(image.height, image.width, CV_16UC1, image.data.data());
+    for (int level : {1, 9})
+    {
+        std::vector<uchar> png;
+        std::vector<int> params = {cv::IMWRITE_PNG_COMPRESSION, level};
+        double png_ms = benchmark::medianMs([&]() { cv::imencode(".png", mat, png, params); }, std::max(iterations / 10, 1));
+        std::printf("png (%d)   : encode %7.2f ms (%6.0f MB/s), %zu bytes, ratio %.2f\n", level, png_ms, raw_mb / png_ms * 1000,
+                    png.size(), image.data.size() * sizeof(uint16_t) / double(png.size()));
+    }
+
+    // Whole frames per worker, as the rvl topics are encoded.
+    const std::size_t jobs(64);
+    std::size_t max_threads(std::max(1u, std::thread::hardware_concurrency()));
+    for (std::size_t num_threads = 1; ; num_threads = std::min(2 * num_threads, max_threads))
+    {
+        double elapsed_ms = encodeOnWorkers(image, num_threads, jobs);
+        std::printf("rvl on %2zu worker threads: %7.1f frames/s (%6.0f MB/s)\n", num_threads, jobs / elapsed_ms * 1000,
+                    jobs * raw_mb / elapsed_ms * 1000);
+        if (num_threads == max_threads)
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+// Compares the per-stream lookups of a published frame through the std::maps the node kept before
+// StreamContextRegistry with a single registry lookup, for the seven streams of a D435i with confidence.
+// The frames cycle through the image streams, as they arrive from a device.
+//
+// Usage: stream_context_benchmark [iterations]
+
+#include "benchmark_util.h"
+#include "../include/base_realsense_node.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+using namespace realsense2_camera;
+
+namespace
+{
+    const std::vector<stream_index_pair> streams = {DEPTH, INFRA1, INFRA2, COLOR, CONFIDENCE, GYRO, ACCEL};
+    const std::vector<stream_index_pair> frame_streams = {DEPTH, INFRA1, INFRA2, COLOR, CONFIDENCE};
+    const int frames_per_run(100000);
+
+    // The maps of the node that publishFrame and dispatchFrame looked up for every frame.
+    struct StreamMaps
+    {
+        std::map<stream_index_pair, std::size_t> processing_queues;
+        std::map<stream_index_pair, cv::Mat> images;
+        std::map<stream_index_pair, int> seq;
+        std::map<stream_index_pair, ros::Publisher> info_publishers;
+        std::map<stream_index_pair, ImagePublisherWithFrequencyDiagnostics> image_publishers;
+        std::map<stream_index_pair, sensor_msgs::CameraInfo> camera_info;
+        std::map<stream_index_pair, ros::Publisher> frame_image_publishers;
+    };
+
+    // The addresses are summed so the lookups cannot be optimized away.
+    uintptr_t lookUpMaps(StreamMaps& maps, const stream_index_pair& stream)
+    {
+        uintptr_t sum(0);
+        std::map<stream_index_pair, std::size_t>::const_iterator queue = maps.processing_queues.find(stream);
+        if (queue != maps.processing_queues.end())
+            sum += queue->second;
+        sum += reinterpret_cast<uintptr_t>(&maps.images[stream]);
+        sum += ++maps.seq[stream];
+        sum += reinterpret_cast<uintptr_t>(&maps.info_publishers.at(stream));
+        sum += reinterpret_cast<uintptr_t>(&maps.image_publishers.at(stream));
+        sum += reinterpret_cast<uintptr_t>(&maps.camera_info.at(stream));
+        auto frame_image_publisher = maps.frame_image_publishers.find(stream);
+        if (frame_image_publisher != maps.frame_image_publishers.end())
+            sum += reinterpret_cast<uintptr_t>(&frame_image_publisher->second);
+        return sum;
+    }
+
+    uintptr_t lookUpRegistry(StreamContextRegistry& registry, const stream_index_pair& stream)
+    {
+        uintptr_t sum(0);
+        StreamContext* context(registry.find(stream.first, stream.second));
+        if (!context)
+            return sum;
+        if (context->has_processing_queue)
+            sum += context->processing_queue;
+        const StreamOutput& output(context->output);
+        sum += reinterpret_cast<uintptr_t>(output.image);
+        sum += ++(*output.seq);
+        sum += reinterpret_cast<uintptr_t>(output.info_publisher);
+        sum += reinterpret_cast<uintptr_t>(output.image_publisher);
+        sum += reinterpret_cast<uintptr_t>(output.camera_info);
+        sum += reinterpret_cast<uintptr_t>(output.frame_image_publisher);
+        return sum;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 100;
+
+    StreamMaps maps;
+    StreamContextRegistry registry;
+    std::size_t queue_index(0);
+    for (const stream_index_pair& stream : streams)
+    {
+        maps.processing_queues[stream] = queue_index++;
+        maps.images[stream];
+        maps.seq[stream] = 0;
+        maps.info_publishers[stream];
+        maps.image_publishers[stream];
+        maps.camera_info[stream];
+        maps.frame_image_publishers[stream];
+    }
+    // Pointing into the same maps, as setupStreamContexts does.
+    for (const stream_index_pair& stream : streams)
+    {
+        StreamContext& context(registry.add(stream));
+        context.has_processing_queue = true;
+        context.processing_queue = maps.processing_queues[stream];
+        context.seq = &maps.seq[stream];
+        StreamOutput& output(context.output);
+        output.image = &maps.images[stream];
+        output.seq = context.seq;
+        output.info_publisher = &maps.info_publishers[stream];
+        output.image_publisher = &maps.image_publishers[stream];
+        output.camera_info = &maps.camera_info[stream];
+        output.frame_image_publisher = &maps.frame_image_publishers[stream];
+    }
+
+    volatile uintptr_t sink(0);
+    double maps_ms = benchmark::medianMs([&]()
+    {
+        uintptr_t sum(0);
+        for (int i = 0; i < frames_per_run; ++i)
+            sum += lookUpMaps(maps, frame_streams[i % frame_streams.size()]);
+        sink = sink + sum;
+    }, iterations);
+    double registry_ms = benchmark::medianMs([&]()
+    {
+        uintptr_t sum(0);
+        for (int i = 0; i < frames_per_run; ++i)
+            sum += lookUpRegistry(registry, frame_streams[i % frame_streams.size()]);
+        sink = sink + sum;
+    }, iterations);
+
+    std::printf("%zu streams, median of %d runs of %d frames\n", streams.size(), iterations, frames_per_run);
+    std::printf("std::map lookups : %6.1f ns per frame\n", maps_ms * 1e6 / frames_per_run);
+    std::printf("registry lookup  : %6.1f ns per frame, %.1fx\n", registry_ms * 1e6 / frames_per_run, maps_ms / registry_ms);
+    return 0;
+}
@@ -4,6 +4,23 @@
 #pragma once
 
 #include "../include/realsense_node_factory.h"
+#include "../include/depth_aligner.h"
+#include "../include/depth_kernels.h"
+#include "../include/filter_pipeline.h"
+#include "../include/frame_image.h"
+#include "../include/imu_batch_publisher.h"
+#include "../include/imu_decimator.h"
+#include "../include/imu_interpolator.h"
+#include "../include/imu_preintegrator.h"
+#include "../include/message_pool.h"
+#include "../include/metadata_publisher.h"
+#include "../include/orientation_filter.h"
+#include "../include/pointcloud_assembler.h"
+#include "../include/pointcloud_generator.h"
+#include "../include/processing_engine.h"
+#include "../include/rvl_depth_publisher.h"
+#include "../include/voxel_grid.h"
+#include "../include/worker_pool.h"
 #include <realsense2_camera/DeviceInfo.h>
 #include "realsense2_camera/Metadata.h"
 #include <ddynamic_reconfigure/ddynamic_reconfigure.h>
@@ -20,6 +37,7 @@
 #include <condition_variable>
 
 #include <queue>
+#include <set>
 #include <mutex>
 #include <atomic>
 #include <thread>
@@ -77,13 +95,104 @@ namespace realsense2_camera
         public:
             std::string _name;
             std::shared_ptr<rs2::filter> _filter;
+            // Bit of the filter in FramesetJob::filters.
+            uint64_t _mask;
 
         public:
             NamedFilter(std::string name, std::shared_ptr<rs2::filter> filter):
-            _name(name), _filter(filter)
+            _name(name), _filter(filter), _mask(0)
             {}
     };
 
+    // Where frames are published to: the topics of a stream, or of the depth aligned to it. Points into the node's maps.
+    struct StreamOutput
+    {
+        StreamOutput() :
+            image(nullptr), scaled_image(nullptr), info_publisher(nullptr), image_publisher(nullptr), frame_image_publisher(nullptr),
+            rvl_publisher(nullptr), metadata_publisher(nullptr), seq(nullptr), camera_info(nullptr), encoding(nullptr)
+        {}
+        bool isValid() const { return image_publisher != nullptr; }
+
+        cv::Mat* image;
+        cv::Mat* scaled_image;
+        const ros::Publisher* info_publisher;
+        const ImagePublisherWithFrequencyDiagnostics* image_publisher;
+        const ros::Publisher* frame_image_publisher;
+        RvlDepthPublisher* rvl_publisher;
+        MetadataPublisher* metadata_publisher;
+        int* seq;
+        sensor_msgs::CameraInfo* camera_info;
+        const std::string* encoding;
+    };
+
+    // Everything the frame path needs about a stream, resolved once when the publishers are set up.
+    struct StreamContext
+    {
+        StreamContext() :
+            frame_id(nullptr), optical_frame_id(nullptr), imu_publisher(nullptr), imu_batch_publisher(nullptr), imu_decimator(nullptr),
+            metadata_publisher(nullptr),
+            seq(nullptr), has_processing_queue(false), processing_queue(0)
+        {}
+
+        stream_index_pair stream;
+        const std::string* frame_id;
+        const std::string* optical_frame_id;
+        StreamOutput output;
+        StreamOutput aligned_output;
+        const ros::Publisher* imu_publisher;
+        ImuBatchPublisher* imu_batch_publisher;
+        ImuDecimator* imu_decimator;
+        MetadataPublisher* metadata_publisher;
+        int* seq;
+        bool has_processing_queue;
+        std::size_t processing_queue;
+    };
+
+    /**
+     * Stream contexts stored contiguously and found by stream type and index through a small table, instead of a
+     * std::map lookup per stream attribute. All contexts are added before the sensors start, so lookups need no lock.
+     */
+    class StreamContextRegistry
+    {
+        public:
+            static const int MAX_STREAM_INDEX = 4;
+
+            StreamContextRegistry()
+            {
+                for (auto& ids : _ids)
+                    std::fill(std::begin(ids), std::end(ids), -1);
+            }
+
+            StreamContext& add(const stream_index_pair& stream)
+            {
+                if (stream.first < 0 || stream.first >= RS2_STREAM_COUNT || stream.second < 0 || stream.second >= MAX_STREAM_INDEX)
+                    throw std::runtime_error("Stream index out of range for the stream context registry.");
+                int8_t& id(_ids[stream.first][stream.second]);
+                if (id < 0)
+                {
+                    id = static_cast<int8_t>(_contexts.size());
+                    _contexts.emplace_back();
+                    _contexts.back().stream = stream;
+                }
+                return _contexts[id];
+            }
+
+            // nullptr if the stream has no context.
+            StreamContext* find(rs2_stream type, int index)
+            {
+                if (type < 0 || type >= RS2_STREAM_COUNT || index < 0 || index >= MAX_STREAM_INDEX)
+                    return nullptr;
+                int8_t id(_ids[type][index]);
+                return id < 0 ? nullptr : &_contexts[id];
+            }
+            StreamContext* find(const stream_index_pair& stream) { return find(stream.first, stream.second); }
+            StreamContext* find(const rs2::stream_profile& profile) { return find(profile.stream_type(), profile.stream_index()); }
+
+        private:
+            std::vector<StreamContext> _contexts;
+            int8_t _ids[RS2_STREAM_COUNT][MAX_STREAM_INDEX];
+    };
+
 	class PipelineSyncer : public rs2::asynchronous_syncer
 	{
 	public: 
@@ -93,28 +202,57 @@ namespace realsense2_camera
 		}
 	};
 
+    enum class ImuOverflowPolicy { DROP_OLDEST, DROP_NEWEST, FLUSH };
+
+    bool parseImuOverflowPolicy(const std::string& name, ImuOverflowPolicy& policy);
+    const char* imuOverflowPolicyName(ImuOverflowPolicy policy);
+
+    /**
+     * Publishes the united imu topic. When enabled, messages are held back while frames are processed, so
+     * that an image is never published after an Imu message stamped later than it: frameArrived() and
+     * framePublished() report the frames by their timestamps, and a held message goes out once every frame
+     * stamped before it has been published.
+     *
+     * Held messages wait in a preallocated single-producer single-consumer ring. The imu thread is the only
+     * producer and never takes a lock; whichever thread releases messages is the consumer for the time. A
+     * message that finds the ring full is handled by the overflow policy:
+     *  DROP_OLDEST - discard the oldest held message.
+     *  DROP_NEWEST - discard the new message.
+     *  FLUSH       - publish the oldest held message ahead of its frames.
+     */
     class SyncedImuPublisher
     {
         public:
-            SyncedImuPublisher() {_is_enabled=false;};
-            SyncedImuPublisher(ros::Publisher imu_publisher, std::size_t waiting_list_size=1000);
+            SyncedImuPublisher();
+            SyncedImuPublisher(ros::Publisher imu_publisher, std::size_t capacity=1000, ImuOverflowPolicy overflow_policy=ImuOverflowPolicy::FLUSH);
             ~SyncedImuPublisher();
-            void Pause();   // Pause sending messages. All messages from now on are saved in queue.
-            void Resume();  // Send all pending messages and allow sending future messages.
-            void Publish(sensor_msgs::Imu msg);     //either send or hold message.
+            void frameArrived(const ros::Time& t);      // Hold back messages stamped after t until the frame is published.
+            void framePublished(const ros::Time& t);    // Release the messages older than every frame still in processing.
+            void Publish(sensor_msgs::Imu msg);         // Either send or hold message. Imu thread only.
             uint32_t getNumSubscribers() { return _publisher.getNumSubscribers();};
             void Enable(bool is_enabled) {_is_enabled=is_enabled;};
-        
+            bool isEnabled() const { return _is_enabled; }
+
+            std::size_t capacity() const { return _messages.capacity(); }
+            uint64_t dropped() const { return _dropped.load(); }
+            uint64_t flushed() const { return _flushed.load(); }
+
         private:
-            void PublishPendingMessages();
+            void publishReleased();
+            bool takeOldest();
 
         private:
-            std::mutex                    _mutex;
-            ros::Publisher                _publisher;
-            bool                          _pause_mode;
-            std::queue<sensor_msgs::Imu>  _pending_messages;
-            std::size_t                     _waiting_list_size;
-            bool                          _is_enabled;
+            ros::Publisher                      _publisher;
+            SpscQueue<sensor_msgs::Imu>         _messages;
+            ImuOverflowPolicy                   _overflow_policy;
+            bool                                _is_enabled;
+            std::atomic<double>                 _release_stamp;
+            std::mutex                          _frames_mutex;
+            std::multiset<double>               _frames_in_flight;     // Stamps of the frames reported and not yet published.
+            std::atomic_flag                    _releasing;
+            std::atomic<bool>                   _release_requested;
+            std::atomic<uint64_t>               _dropped;
+            std::atomic<uint64_t>               _flushed;
     };
 
     class BaseRealSenseNode : public InterfaceRealSenseNode
@@ -164,6 +302,9 @@ namespace realsense2_camera
         std::map<stream_index_pair, std::string> _depth_aligned_frame_id;
         ros::NodeHandle& _node_handle, _pnh;
         bool _align_depth;
+        bool _align_depth_lut;
+        std::vector<stream_index_pair> _align_depth_to;
+        bool _align_depth_to_color;
         std::vector<rs2_option> _monitor_options;
         std::shared_ptr<ros::ServiceServer> _device_info_srv;
 
@@ -180,19 +321,29 @@ namespace realsense2_camera
 
 
     private:
-        class CimuData
+        // A frameset on its way through the filters.
+        struct FramesetJob
         {
-            public:
-                CimuData() : m_time(-1) {};
-                CimuData(const stream_index_pair type, Eigen::Vector3d data, double time):
-                    m_type(type),
-                    m_data(data),
-                    m_time(time){};
-                bool is_set() {return m_time > 0;};
-            public:
-                stream_index_pair m_type;
-                Eigen::Vector3d m_data;
-                double          m_time;
+            FramesetJob() : condition_depth(true), filters(~uint64_t(0)), aligned_targets(~uint64_t(0)), depth_aligned_to_color(false), has_depth(false), generate_pointcloud(false), frame_time(0) {}
+            rs2::frameset frameset;
+            // A frame the syncer could not match, in place of the frameset. It skips the filters and is published as is.
+            rs2::frame single_frame;
+            // The stages to run, decided by the subscribers when the frameset arrived.
+            bool condition_depth;
+            uint64_t filters;
+            // The targets align_depth aligns to, as bits of their index in _align_targets.
+            uint64_t aligned_targets;
+            // Published on the depth topic when aligning, colorized by the colorizer.
+            rs2::frame unaligned_depth_frame;
+            // Whether the depth of the frameset was replaced by the depth aligned to color.
+            bool depth_aligned_to_color;
+            // Depth aligned to the other targets.
+            std::vector<std::pair<stream_index_pair, rs2::frame>> aligned_depth_frames;
+            bool has_depth;
+            // Whether the pointcloud is generated from the depth when publishing, rather than by rs2::pointcloud.
+            bool generate_pointcloud;
+            ros::Time t;
+            double frame_time;
         };
 
         static std::string getNamespaceStr();
@@ -200,47 +351,67 @@ namespace realsense2_camera
         void setupDevice();
         void setupErrorCallback();
         void setupPublishers();
+        void setupProcessingEngine();
+        void setupFilterPipeline();
+        void setupStreamContexts();
         void enable_devices();
         void setupFilters();
+        void updateFilterDemand();
+        bool hasAlignedDepthSubscribers(const stream_index_pair& stream) const;
+        void onSubscribersChanged();
+        std::set<stream_index_pair> getDemandedStreams();
+        void applyActiveStreams(const std::set<stream_index_pair>& streams);
+        void autoStreams();
         void setupStreams();
         bool setBaseTime(double frame_time, rs2_timestamp_domain time_domain);
         double frameSystemTimeSec(rs2::frame frame);
-        cv::Mat& fix_depth_scale(const cv::Mat& from_image, cv::Mat& to_image);
-        void clip_depth(rs2::depth_frame depth_frame, float clipping_dist);
+        DepthConditioning getDepthConditioning(bool rescale) const;
+        rs2::frame conditionDepthFrames(rs2::frame frame, const rs2::frame_source& source);
+        rs2::frame conditionDepthFrame(rs2::frame depth, rs2::frame confidence, const rs2::frame_source& source);
+        rs2::frame alignDepthFrames(rs2::frame frame, const rs2::frame_source& source);
         void updateStreamCalibData(const rs2::video_stream_profile& video_profile);
         void SetBaseStream();
         void publishStaticTransforms();
         void publishDynamicTransforms();
         void publishIntrinsics();
         void runFirstFrameInitialization(rs2_stream stream_type);
-        void publishPointCloud(rs2::points f, const ros::Time& t, const rs2::frameset& frameset);
+        // Without points, the pointcloud is generated from the depth of the frameset. The cloud is in the color
+        // optical frame when that depth was aligned to color.
+        void publishPointCloud(rs2::points f, const ros::Time& t, const rs2::frameset& frameset, bool depth_aligned_to_color);
+        rs2::frame findPointCloudTexture(const rs2::frameset& frameset, rs2_stream texture_source_id) const;
+        bool canGeneratePointCloud(const rs2::frameset& frameset) const;
+        bool configurePointCloudGenerator(const rs2::depth_frame& depth, const rs2::frame& texture);
+        // Builds the crop volume, which the first frames already use. Runs before the streams start.
+        void setupPointCloudCrop();
+        void registerPointCloudCropOptions();
+        void updateCropVolume();
         Extrinsics rsExtrinsicsToMsg(const rs2_extrinsics& extrinsics, const std::string& frame_id) const;
 
         IMUInfo getImuInfo(const stream_index_pair& stream_index);
+        ImuPreintegrator::Calibration getImuCalibration(const stream_index_pair& stream_index, bool corrected_by_librealsense, double default_variance);
+        void setupImuPreintegration();
+        void setupImuOrientation();
+        void setupImuDecimation();
         void publishFrame(rs2::frame f, const ros::Time& t,
-                          const stream_index_pair& stream,
-                          std::map<stream_index_pair, cv::Mat>& images,
-                          const std::map<stream_index_pair, ros::Publisher>& info_publishers,
-                          const std::map<stream_index_pair, ImagePublisherWithFrequencyDiagnostics>& image_publishers,
-                          const bool is_publishMetadata,
-                          std::map<stream_index_pair, int>& seq,
-                          std::map<stream_index_pair, sensor_msgs::CameraInfo>& camera_info,
-                          const std::map<rs2_stream, std::string>& encoding,
+                          const StreamOutput& output,
                           bool copy_data_from_frame = true);
-        void publishMetadata(rs2::frame f, const std::string& frame_id);
+        void publishMetadata(rs2::frame f, const StreamContext& context, const std::string& frame_id);
         bool getEnabledProfile(const stream_index_pair& stream_index, rs2::stream_profile& profile);
 
         void publishAlignedDepthToOthers(rs2::frameset frames, const ros::Time& t);
-        sensor_msgs::Imu CreateUnitedMessage(const CimuData accel_data, const CimuData gyro_data);
 
-        void FillImuData_Copy(const CimuData imu_data, std::deque<sensor_msgs::Imu>& imu_msgs);
         void ImuMessage_AddDefaultValues(sensor_msgs::Imu& imu_msg);
-        void FillImuData_LinearInterpolation(const CimuData imu_data, std::deque<sensor_msgs::Imu>& imu_msgs);
+        void publishUnitedImu(double time, const Eigen::Vector3d& accel, const Eigen::Vector3d& gyro);
+        void publishUnitedImuMessage(double time, const Eigen::Vector3d& accel, const Eigen::Vector3d& gyro);
         void imu_callback(rs2::frame frame);
         void imu_callback_sync(rs2::frame frame, imu_sync_method sync_method=imu_sync_method::COPY);
         void pose_callback(rs2::frame frame);
         void multiple_message_callback(rs2::frame frame, imu_sync_method sync_method);
+        void dispatchFrame(rs2::frame frame);
         void frame_callback(rs2::frame frame);
+        void conditionFrameset(FramesetJob& job);
+        void applyFilter(const NamedFilter& nfilter, FramesetJob& job);
+        void publishFrameset(const FramesetJob& job);
         void registerDynamicOption(ros::NodeHandle& nh, rs2::options sensor, std::string& module_name);
         void registerHDRoptions();
         void set_sensor_parameter_to_ros(const std::string& module_name, rs2::options sensor, rs2_option option);
@@ -253,6 +424,7 @@ namespace realsense2_camera
         void startMonitoring();
         void publish_temperature();
         void publish_frequency_update();
+        void publish_processing_update();
         void publishServices();
 
         rs2::device _dev;
@@ -264,13 +436,60 @@ namespace realsense2_camera
         std::string _serial_no;
         float _depth_scale_meters;
         float _clipping_distance;
+        float _min_distance;
+        int _confidence_threshold;
         bool _allow_no_texture_points;
         bool _ordered_pc;
+        bool _pointcloud_lut;
+        float _voxel_leaf_size;
+        int _voxel_min_points;
+        bool _voxel_only;
+        PointCloudLayout _pointcloud_layout;
+        // The crop limits, set by the parameters and dynamic reconfigure. Angles are in degrees.
+        struct CropParams
+        {
+            bool box;
+            bool box_in_base_frame;
+            double box_min[3];
+            double box_max[3];
+            double near;
+            double far;
+            double horizontal_fov;
+            double vertical_fov;
+        };
+        CropParams _crop_params;
+        // Maps the pointcloud's optical frame to the base frame, in ROS axes.
+        rs2_extrinsics _pointcloud_to_base;
+        // Guards _crop_params and _crop_volume, which is copied by each pointcloud.
+        std::mutex _crop_mutex;
+        CropVolume _crop_volume;
+        bool _zero_copy_images;
+        bool _rvl_depth;
+        int _rvl_threads;
+        int _processing_threads;
+        int _processing_queue_size;
+        DropPolicy _drop_policy;
+        std::map<stream_index_pair, DropPolicy> _stream_drop_policy;
+        bool _pipeline_filters;
+        bool _lazy_filters;
+        bool _auto_streams;
+        double _auto_streams_hold_time;
+        int _pipeline_queue_size;
 
 
         double _linear_accel_cov;
         double _angular_velocity_cov;
         bool  _hold_back_imu_for_frames;
+        int _hold_back_imu_queue_size;
+        ImuOverflowPolicy _hold_back_imu_overflow_policy;
+        ImuBatchMode _imu_batch_mode;
+        int _imu_batch_size;
+        int _imu_decimation_factor;
+        int _imu_decimation_taps;
+        double _imu_decimation_cutoff;
+        bool _imu_preintegration;
+        bool _imu_orientation;
+        double _imu_orientation_gain;
 
         std::map<stream_index_pair, rs2_intrinsics> _stream_intrinsics;
         std::map<stream_index_pair, int> _width;
@@ -287,11 +506,26 @@ namespace realsense2_camera
         std::shared_ptr<std::thread> _tf_t, _update_functions_t;
 
         std::map<stream_index_pair, ImagePublisherWithFrequencyDiagnostics> _image_publishers;
+        std::map<stream_index_pair, ros::Publisher> _frame_image_publishers;
+        std::map<stream_index_pair, std::shared_ptr<RvlDepthPublisher>> _rvl_publishers;
         std::map<stream_index_pair, ros::Publisher> _imu_publishers;
         std::shared_ptr<SyncedImuPublisher> _synced_imu_publisher;
+        std::mutex _imu_sync_mutex;
+        int _imu_sync_seq;
+        ImuInterpolator _imu_interpolator;
+        ImuInterpolator::Sample _last_accel;
+        std::shared_ptr<ImuBatchPublisher> _united_imu_batch_publisher;
+        std::shared_ptr<ImuPreintegrator> _imu_preintegrator;
+        std::shared_ptr<OrientationFilter> _orientation_filter;
+        std::atomic<double> _imu_orientation_stddev;
+        stream_index_pair _imu_preintegration_stream;
+        std::map<stream_index_pair, std::shared_ptr<ImuBatchPublisher>> _imu_batch_publishers;
+        std::map<stream_index_pair, std::shared_ptr<ImuDecimator>> _imu_decimators;
         std::map<rs2_stream, int> _image_format;
         std::map<stream_index_pair, ros::Publisher> _info_publisher;
-        std::map<stream_index_pair, std::shared_ptr<ros::Publisher>> _metadata_publishers;
+        std::map<stream_index_pair, std::shared_ptr<MetadataPublisher>> _metadata_publishers;
+        std::set<std::string> _metadata_fields;
+        StreamContextRegistry _stream_contexts;
         std::map<stream_index_pair, cv::Mat> _image;
         std::map<rs2_stream, std::string> _encoding;
 
@@ -299,10 +533,22 @@ namespace realsense2_camera
         std::map<rs2_stream, int> _unit_step_size;
         std::map<stream_index_pair, sensor_msgs::CameraInfo> _camera_info;
         std::atomic_bool _is_initialized_time_base;
+        std::atomic_bool _filter_demand_changed;
+        uint64_t _filter_demand;
+        uint64_t _align_target_demand;
+        bool _depth_demanded;
+        std::mutex _sensors_mutex;
+        bool _sensors_enabled;
+        std::set<stream_index_pair> _active_streams;
+        std::mutex _auto_streams_mutex;
+        std::condition_variable _auto_streams_cv;
+        bool _stream_demand_changed;
+        std::shared_ptr<std::thread> _auto_streams_t;
         double _camera_time_base;
         std::map<stream_index_pair, std::vector<rs2::stream_profile>> _enabled_profiles;
 
         ros::Publisher _pointcloud_publisher;
+        ros::Publisher _voxel_pointcloud_publisher;
         ros::Time _ros_time_base;
         bool _sync_frames;
         bool _pointcloud;
@@ -313,6 +559,23 @@ namespace realsense2_camera
         PipelineSyncer _syncer;
         std::vector<NamedFilter> _filters;
         std::shared_ptr<rs2::filter> _colorizer, _pointcloud_filter;
+        std::shared_ptr<rs2::filter> _depth_conditioning_filter;
+        // The state of alignDepthFrames, only used on the thread of the align_depth stage.
+        struct AlignTarget
+        {
+            stream_index_pair stream;
+            int profile_id;
+            int engine_index;       // The target's index in _depth_aligner, -1 when aligned by fallback.
+            rs2::stream_profile aligned_profile;
+            std::shared_ptr<rs2::align> fallback;
+        };
+        std::shared_ptr<DepthAligner> _depth_aligner;
+        std::vector<AlignTarget> _align_targets;
+        int _depth_aligner_depth_id;
+        float _depth_aligner_units;
+        uint64_t _align_stage_targets;
+        bool _depth_aligned_to_color;
+        std::vector<std::pair<stream_index_pair, rs2::frame>> _aligned_depth_frames;
         std::vector<rs2::sensor> _dev_sensors;
 
         std::map<stream_index_pair, cv::Mat> _depth_aligned_image;
@@ -322,6 +585,8 @@ namespace realsense2_camera
         std::map<stream_index_pair, int> _depth_aligned_seq;
         std::map<stream_index_pair, ros::Publisher> _depth_aligned_info_publisher;
         std::map<stream_index_pair, ImagePublisherWithFrequencyDiagnostics> _depth_aligned_image_publishers;
+        std::map<stream_index_pair, ros::Publisher> _depth_aligned_frame_image_publishers;
+        std::map<stream_index_pair, std::shared_ptr<RvlDepthPublisher>> _depth_aligned_rvl_publishers;
         std::map<stream_index_pair, ros::Publisher> _depth_to_other_extrinsics_publishers;
         std::map<stream_index_pair, rs2_extrinsics> _depth_to_other_extrinsics;
         std::map<std::string, rs2::region_of_interest> _auto_exposure_roi;
@@ -337,8 +602,24 @@ namespace realsense2_camera
         stream_index_pair _base_stream;
         const std::string _namespace;
 
-        sensor_msgs::PointCloud2 _msg_pointcloud;
+        MessagePool<sensor_msgs::PointCloud2> _pointcloud_pool;
+        PointCloudAssembler _pointcloud_assembler;
+        // The state of the pointcloud generator, only used on the thread publishing the framesets.
+        PointCloudGenerator _pointcloud_generator;
+        int _pointcloud_generator_depth_id;
+        int _pointcloud_generator_texture_id;
+        float _pointcloud_generator_units;
+        bool _pointcloud_generator_textured;
+        VoxelGrid _voxel_grid;
+        std::vector<uint8_t> _xyz32_points, _xyz32_voxels;
         std::vector< unsigned int > _valid_pc_indices;
+        // Declared last: its threads are joined before the publishers they use are destroyed.
+        std::unique_ptr<WorkerPool> _rvl_workers;
+        std::unique_ptr<ProcessingEngine> _processing_engine;
+        std::map<stream_index_pair, std::size_t> _processing_queues;
+        std::size_t _frameset_queue;
+        std::shared_ptr<diagnostic_updater::Updater> _processing_diagnostics;
+        std::unique_ptr<FilterPipeline<FramesetJob> > _filter_pipeline;
     };//end class
 
 }
@@ -0,0 +1,203 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Bounded lock-free multi-producer multi-consumer queue (D. Vyukov's array queue). Every cell carries a
+     * sequence number telling producers and consumers whose turn it is, so try_push and try_pop only
+     * contend on one atomic index each and never block. The capacity is rounded up to a power of two.
+     */
+    template <class T>
+    class BoundedQueue
+    {
+        public:
+            explicit BoundedQueue(std::size_t capacity) :
+                _cells(roundUpToPowerOfTwo(capacity)),
+                _mask(_cells.size() - 1),
+                _enqueue_pos(0),
+                _dequeue_pos(0)
+            {
+                for (std::size_t i = 0; i < _cells.size(); ++i)
+                    _cells[i]._sequence.store(i, std::memory_order_relaxed);
+            }
+
+            BoundedQueue(const BoundedQueue&) = delete;
+            BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+            // Returns false if the queue is full.
+            bool try_push(T item)
+            {
+                std::size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+                Cell* cell;
+                while (true)
+                {
+                    cell = &_cells[pos & _mask];
+                    std::size_t sequence = cell->_sequence.load(std::memory_order_acquire);
+                    std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+                    if (diff == 0)
+                    {
+                        if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (diff < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        pos = _enqueue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+                cell->_item = std::move(item);
+                cell->_sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Returns false if the queue is empty.
+            bool try_pop(T& item)
+            {
+                std::size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+                Cell* cell;
+                while (true)
+                {
+                    cell = &_cells[pos & _mask];
+                    std::size_t sequence = cell->_sequence.load(std::memory_order_acquire);
+                    std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+                    if (diff == 0)
+                    {
+                        if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (diff < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        pos = _dequeue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+                item = std::move(cell->_item);
+                // Release what the cell held now, not when the cell is reused.
+                cell->_item = T();
+                cell->_sequence.store(pos + _mask + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Approximate while producers or consumers are active.
+            std::size_t size() const
+            {
+                std::size_t enqueue_pos = _enqueue_pos.load(std::memory_order_relaxed);
+                std::size_t dequeue_pos = _dequeue_pos.load(std::memory_order_relaxed);
+                return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+            }
+
+            std::size_t capacity() const { return _cells.size(); }
+
+        private:
+            static std::size_t roundUpToPowerOfTwo(std::size_t capacity)
+            {
+                std::size_t size(2);
+                while (size < capacity)
+                    size <<= 1;
+                return size;
+            }
+
+            struct Cell
+            {
+                Cell() : _sequence(0) {}
+                Cell(const Cell&) : _sequence(0) {}
+                std::atomic<std::size_t> _sequence;
+                T _item;
+            };
+
+            std::vector<Cell> _cells;
+            const std::size_t _mask;
+            // Padding keeps producers and consumers from invalidating each other's cache line.
+            char _padding0[64];
+            std::atomic<std::size_t> _enqueue_pos;
+            char _padding1[64];
+            std::atomic<std::size_t> _dequeue_pos;
+    };
+
+    /**
+     * Bounded lock-free single-producer single-consumer ring. Only one thread may push and only one may pop
+     * at a time; each side owns its index and just reads the other's. The capacity is rounded up to a power
+     * of two.
+     */
+    template <class T>
+    class SpscQueue
+    {
+        public:
+            explicit SpscQueue(std::size_t capacity) :
+                _items(roundUpToPowerOfTwo(capacity)),
+                _mask(_items.size() - 1),
+                _head(0),
+                _tail(0)
+            {}
+
+            SpscQueue(const SpscQueue&) = delete;
+            SpscQueue& operator=(const SpscQueue&) = delete;
+
+            // Producer only. Returns false if the queue is full, leaving item untouched.
+            bool try_push(T& item)
+            {
+                std::size_t tail = _tail.load(std::memory_order_relaxed);
+                if (tail - _head.load(std::memory_order_acquire) == _items.size())
+                    return false;
+                _items[tail & _mask] = std::move(item);
+                _tail.store(tail + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Consumer only. Returns false if the queue is empty.
+            bool try_pop(T& item)
+            {
+                std::size_t head = _head.load(std::memory_order_relaxed);
+                if (head == _tail.load(std::memory_order_acquire))
+                    return false;
+                item = std::move(_items[head & _mask]);
+                // Release what the slot held now, not when the slot is reused.
+                _items[head & _mask] = T();
+                _head.store(head + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Consumer only. The item try_pop would return, nullptr if the queue is empty.
+            T* front()
+            {
+                std::size_t head = _head.load(std::memory_order_relaxed);
+                if (head == _tail.load(std::memory_order_acquire))
+                    return nullptr;
+                return &_items[head & _mask];
+            }
+
+            bool empty() const { return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire); }
+            bool full() const { return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire) == _items.size(); }
+            std::size_t capacity() const { return _items.size(); }
+
+        private:
+            static std::size_t roundUpToPowerOfTwo(std::size_t capacity)
+            {
+                std::size_t size(1);
+                while (size < capacity)
+                    size <<= 1;
+                return size;
+            }
+
+            std::vector<T> _items;
+            const std::size_t _mask;
+            char _padding0[64];
+            std::atomic<std::size_t> _head;
+            char _padding1[64];
+            std::atomic<std::size_t> _tail;
+    };
+}
@@ -43,10 +43,39 @@ namespace realsense2_camera
     
 
     const bool ALIGN_DEPTH             = false;
+    const bool ALIGN_DEPTH_LUT         = false;
+    const std::string ALIGN_DEPTH_TO   = "color";
     const bool POINTCLOUD              = false;
     const bool ALLOW_NO_TEXTURE_POINTS = false;
     const bool ORDERED_POINTCLOUD      = false;
+    const bool POINTCLOUD_LUT          = false;
+    const float VOXEL_LEAF_SIZE        = -1.0;
+    const int VOXEL_MIN_POINTS         = 1;
+    const bool VOXEL_ONLY              = false;
+    const std::string POINTCLOUD_LAYOUT = "xyz32";
+    const bool CROP_BOX                = false;
+    const std::string CROP_BOX_FRAME   = "base";
+    const double CROP_BOX_MIN          = -10.0;
+    const double CROP_BOX_MAX          = 10.0;
+    const double CROP_NEAR             = 0.0;
+    const double CROP_FAR              = 0.0;
+    const double CROP_HORIZONTAL_FOV   = 0.0;
+    const double CROP_VERTICAL_FOV     = 0.0;
     const bool SYNC_FRAMES             = false;
+    const bool ZERO_COPY_IMAGES        = false;
+    const bool RVL_DEPTH               = false;
+    const int RVL_THREADS              = 2;
+    const int PROCESSING_THREADS       = 0;
+    const int PROCESSING_QUEUE_SIZE    = 2;
+    const std::string DROP_POLICY      = "drop_oldest";
+    const bool PIPELINE_FILTERS        = false;
+    const int PIPELINE_QUEUE_SIZE      = 1;
+    const bool LAZY_FILTERS            = true;
+    const bool AUTO_STREAMS            = false;
+    const double AUTO_STREAMS_HOLD_TIME = 5.0;
+    const std::string METADATA_FIELDS  = "";
+    const float MIN_DISTANCE           = -1.0;
+    const int CONFIDENCE_THRESHOLD     = 0;
 
     const bool PUBLISH_TF        = true;
     const double TF_PUBLISH_RATE = 0; // Static transform
@@ -65,6 +94,17 @@ namespace realsense2_camera
     const bool ENABLE_FISHEYE = true;
     const bool ENABLE_IMU     = true;
     const bool HOLD_BACK_IMU_FOR_FRAMES = false;
+    const int HOLD_BACK_IMU_QUEUE_SIZE = 1000;
+    const std::string HOLD_BACK_IMU_OVERFLOW_POLICY = "flush";
+    const std::string IMU_BATCH_MODE = "none";
+    const int IMU_BATCH_SIZE = 50;
+    const int IMU_DECIMATION_FACTOR = 1;
+    const int IMU_DECIMATION_TAPS = 0;
+    const double IMU_DECIMATION_CUTOFF = 0.8;
+    const bool IMU_PREINTEGRATION = false;
+    const bool IMU_ORIENTATION = false;
+    const double IMU_ORIENTATION_GAIN = 0.1;
+    const double IMU_ORIENTATION_STDDEV = 0.0;
     const bool PUBLISH_ODOM_TF = true;
 
 
@@ -0,0 +1,108 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace realsense2_camera
+{
+    /**
+     * A convex volume the pointcloud is cropped to while it is assembled, so the points outside are never
+     * written. It is kept as up to max_planes half-spaces n . p + d >= 0 in the frame of the cloud: a box, possibly
+     * in another frame, near and far limits along the optical axis, and an angular frustum around it.
+     *
+     * The crop() functions test 8 points at a time with SIMD (selected at runtime), giving the same results as
+     * contains().
+     */
+    struct CropVolume
+    {
+        static const int max_planes = 12;
+
+        int num_planes;
+        float normals[max_planes][3];
+        float offsets[max_planes];
+
+        CropVolume() : num_planes(0) {}
+
+        bool empty() const { return num_planes == 0; }
+
+        // Keeps the points with n . p + d >= 0. Planes past max_planes are ignored.
+        void addPlane(float nx, float ny, float nz, float d)
+        {
+            if (num_planes == max_planes)
+                return;
+            normals[num_planes][0] = nx;
+            normals[num_planes][1] = ny;
+            normals[num_planes][2] = nz;
+            offsets[num_planes] = d;
+            ++num_planes;
+        }
+
+        // The box [min, max] of the frame that to_box maps the cloud's points into.
+        void addBox(const float min[3], const float max[3], const rs2_extrinsics& to_box)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                // Row i of the column major rotation gives coordinate i of the point in the box frame.
+                const float* r = to_box.rotation;
+                addPlane(r[i], r[3 + i], r[6 + i], to_box.translation[i] - min[i]);
+                addPlane(-r[i], -r[3 + i], -r[6 + i], max[i] - to_box.translation[i]);
+            }
+        }
+
+        // Depth along the optical axis. A non-positive far keeps everything beyond near.
+        void addRange(float near, float far)
+        {
+            if (near > 0)
+                addPlane(0, 0, 1, -near);
+            if (far > 0)
+                addPlane(0, 0, -1, far);
+        }
+
+        // Full angles in radians around the optical axis. Angles of pi and above don't crop.
+        void addFrustum(float horizontal_fov, float vertical_fov)
+        {
+            if (horizontal_fov > 0 && horizontal_fov < M_PI)
+            {
+                float slope = std::tan(horizontal_fov / 2);
+                addPlane(-1, 0, slope, 0);
+                addPlane(1, 0, slope, 0);
+            }
+            if (vertical_fov > 0 && vertical_fov < M_PI)
+            {
+                float slope = std::tan(vertical_fov / 2);
+                addPlane(0, -1, slope, 0);
+                addPlane(0, 1, slope, 0);
+            }
+        }
+
+        bool contains(const float p[3]) const
+        {
+            for (int i = 0; i < num_planes; ++i)
+            {
+                if (normals[i][0] * p[0] + normals[i][1] * p[1] + normals[i][2] * p[2] + offsets[i] < 0)
+                    return false;
+            }
+            return true;
+        }
+
+        // Clear the bits of masks (bit i % 8 of masks[i / 8] for point i of count) whose points are outside the
+        // volume. Only groups of 8 points with bits set are tested, so bits past the last point must be clear.
+        // Return the number of bits left set.
+        // vertices: xyz triplets.
+        std::size_t crop(const float* vertices, std::size_t count, uint8_t* masks) const;
+        // The points at raw depth z along their rays, as x, y and z planes (see PointCloudGenerator).
+        std::size_t crop(const uint16_t* depth, const float* const rays[3], std::size_t count, uint8_t* masks) const;
+
+        // Sets the bits of the count points of masks, clearing the bits past them.
+        static void fillMasks(std::size_t count, uint8_t* masks)
+        {
+            for (std::size_t group = 0; group < count; group += 8)
+                masks[group / 8] = count - group < 8 ? static_cast<uint8_t>((1u << (count - group)) - 1) : 0xff;
+        }
+    };
+}
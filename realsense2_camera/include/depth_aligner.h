@@ -0,0 +1,83 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include "pixel_projection.h"
+#include <librealsense2/rs.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Aligns Z16 depth to other streams the way rs2::align does: every valid depth pixel is mapped through
+     * its top-left and bottom-right corners onto the target image, and the rectangle between them receives the
+     * depth value, keeping the nearest where rectangles overlap.
+     *
+     * The intrinsics and extrinsics don't change while streaming, so configure() deprojects the pixel corners
+     * once, with the depth scale folded in: a corner of raw depth z lies at z * ray. align() then runs two passes.
+     * The corners of each depth row are deprojected with SIMD (selected at runtime), once for all targets, and
+     * transformed and projected into the rectangles of every target while still in registers. Each target image
+     * is then filled in bands of rows, each band only written by one thread, so the z-buffer needs no atomics.
+     * Both passes run in parallel when built with OpenMP. All kernels give bit-exact results.
+     *
+     * Targets with Brown-Conrady style distortion (or none) are supported; addTarget() refuses others.
+     */
+    class DepthAligner
+    {
+        public:
+            static const std::size_t max_targets = 8;
+
+            DepthAligner();
+
+            // Drops the targets.
+            bool configure(const rs2_intrinsics& depth, float depth_scale_meters);
+            // Returns false, without adding it, if the target's distortion model is not supported.
+            bool addTarget(const rs2_intrinsics& target, const rs2_extrinsics& depth_to_target);
+            std::size_t numTargets() const { return _targets.size(); }
+            int targetWidth(std::size_t target) const { return _targets[target].projection.width; }
+            int targetHeight(std::size_t target) const { return _targets[target].projection.height; }
+
+            // depth holds the configured depth resolution, aligned[i] the resolution of target i; all are dense rows.
+            // Targets whose aligned[i] is null are skipped.
+            void align(const uint16_t* depth, uint16_t* const* aligned);
+
+            typedef PixelProjection Projection;
+            // Target rectangles of a depth row. An invalid pixel gets an empty rectangle (x0 > x1).
+            struct Rectangles
+            {
+                int16_t* x0;
+                int16_t* y0;
+                int16_t* x1;
+                int16_t* y1;
+            };
+            // Projects a depth row into the rectangles of num_targets targets. rays_top and rays_bottom are the corner
+            // rays above and below the row, as x, y and z planes. Returns the first and last rows touched in each
+            // target through first_rows and last_rows (first > last if none).
+            typedef void (*ProjectRowFunc)(const uint16_t* depth, int width, const float* const rays_top[3], const float* const rays_bottom[3],
+                                           const Projection* const* projections, const Rectangles* rectangles, std::size_t num_targets,
+                                           int* first_rows, int* last_rows);
+            static void projectRowScalar(const uint16_t* depth, int width, const float* const rays_top[3], const float* const rays_bottom[3],
+                                         const Projection* const* projections, const Rectangles* rectangles, std::size_t num_targets,
+                                         int* first_rows, int* last_rows);
+            // Returns nullptr when the kernel is not compiled in or not supported by the running CPU.
+            static ProjectRowFunc projectRowAVX2();
+
+        private:
+            struct Target
+            {
+                Projection projection;
+                std::vector<int16_t> rectangles[4];
+                std::vector<int> first_rows;
+                std::vector<int> last_rows;
+            };
+
+            int _depth_width;
+            int _depth_height;
+            // The (width + 1) x (height + 1) pixel corners, one plane per coordinate.
+            std::vector<float> _rays[3];
+            std::vector<Target> _targets;
+    };
+}
@@ -0,0 +1,44 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace realsense2_camera
+{
+    struct DepthConditioning
+    {
+        DepthConditioning() : min_value(0), max_value(65535), confidence_threshold(0), rescale(false), depth_scale_meters(0.001f) {}
+        bool isIdentity() const { return min_value == 0 && max_value == 65535 && confidence_threshold == 0 && !rescale; }
+
+        uint16_t min_value;             // Values below are invalidated (set to 0).
+        uint16_t max_value;             // Values above are invalidated.
+        uint8_t confidence_threshold;   // Pixels with a lower confidence are invalidated, when a confidence buffer is given.
+        bool rescale;                   // Convert the valid values to millimeters (see conditionDepth).
+        float depth_scale_meters;
+    };
+
+    /**
+     * Clips, masks and rescales Z16 depth in a single pass over memory, writing into to (which may be from).
+     * Rescaling converts from device units of depth_scale_meters to millimeters: value * depth_scale_meters / 0.001,
+     * truncated and saturated to 65535. The fastest kernel supported by the running CPU is selected on first use;
+     * all kernels give bit-exact results. confidence is optional and holds one byte per depth pixel. The buffer is split into static, cache sized
+     * tiles that are processed in parallel when built with OpenMP.
+     */
+    void conditionDepth(const uint16_t* from, const uint8_t* confidence, uint16_t* to, std::size_t count, const DepthConditioning& conditioning);
+
+    namespace depth_kernels
+    {
+        typedef void (*ConditionDepthFunc)(const uint16_t* from, const uint8_t* confidence, uint16_t* to, std::size_t count, const DepthConditioning& conditioning);
+
+        void conditionDepthScalar(const uint16_t* from, const uint8_t* confidence, uint16_t* to, std::size_t count, const DepthConditioning& conditioning);
+        // Return nullptr when the kernel is not compiled in or not supported by the running CPU.
+        ConditionDepthFunc conditionDepthSSE41();
+        ConditionDepthFunc conditionDepthAVX2();
+        ConditionDepthFunc conditionDepthNEON();
+
+        const char* depthKernelsName();
+    }
+}
@@ -0,0 +1,218 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include "bounded_queue.h"
+#include <ros/ros.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Runs a chain of stages as a pipeline: every stage has its own thread and passes its jobs to the next
+     * through a single-producer single-consumer ring, so consecutive jobs are in different stages at the same
+     * time. Each stage sees the jobs one at a time in push order, which stateful stages (e.g. the temporal
+     * filter) depend on. Throughput is bounded by the slowest stage instead of the sum of all of them.
+     *
+     * push() never waits: a job that finds the first ring full is dropped. Between stages a job waits for
+     * room, so a job that entered the pipeline is never lost. A stage that throws drops its job, after handing
+     * it to the drop handler.
+     */
+    template <class Job>
+    class FilterPipeline
+    {
+        public:
+            typedef std::function<void(Job&)> Stage;
+
+            explicit FilterPipeline(std::size_t queue_size) :
+                _queue_size(std::max<std::size_t>(queue_size, 1)),
+                _stop(false),
+                _in_flight(0),
+                _pushed(0),
+                _dropped(0)
+            {}
+
+            ~FilterPipeline()
+            {
+                stop();
+            }
+
+            FilterPipeline(const FilterPipeline&) = delete;
+            FilterPipeline& operator=(const FilterPipeline&) = delete;
+
+            // Stages must all be added before start().
+            void addStage(const std::string& name, Stage stage)
+            {
+                _names.push_back(name);
+                _stages.push_back(stage);
+                _links.emplace_back(new Link(_queue_size));
+            }
+
+            // Called on the stage's thread with the job of a stage that threw, before the job is released, so the
+            // producer can account for it as for a job done. Jobs push() refuses are not passed to it. Set before start().
+            void setDropHandler(Stage handler)
+            {
+                _drop_handler = handler;
+            }
+
+            void start()
+            {
+                for (std::size_t i = 0; i < _stages.size(); ++i)
+                    _threads.emplace_back([this, i]() { run(i); });
+            }
+
+            // Joins the stage threads. Jobs in the pipeline are released unprocessed, later pushes are dropped.
+            void stop()
+            {
+                _stop = true;
+                for (std::unique_ptr<Link>& link : _links)
+                {
+                    std::lock_guard<std::mutex> lock_guard(link->_mutex);
+                    link->_cv.notify_all();
+                }
+                for (std::thread& thread : _threads)
+                    thread.join();
+                _threads.clear();
+            }
+
+            // Single producer. Returns false if the job was dropped.
+            bool push(Job job)
+            {
+                ++_pushed;
+                if (_stop || _links.empty())
+                {
+                    ++_dropped;
+                    return false;
+                }
+                Link& link = *_links.front();
+                ++_in_flight;
+                if (!link._jobs.try_push(job))
+                {
+                    --_in_flight;
+                    ++_dropped;
+                    return false;
+                }
+                notify(link, link._consumer_waiting);
+                return true;
+            }
+
+            // Jobs pushed that have not yet left the pipeline, either through the last stage or by being dropped.
+            std::size_t inFlight() const { return _in_flight.load(); }
+            std::size_t numStages() const { return _stages.size(); }
+            uint64_t pushed() const { return _pushed.load(); }
+            uint64_t dropped() const { return _dropped.load(); }
+
+        private:
+            struct Link
+            {
+                explicit Link(std::size_t capacity) :
+                    _jobs(capacity),
+                    _consumer_waiting(false),
+                    _producer_waiting(false)
+                {}
+
+                SpscQueue<Job> _jobs;
+                std::mutex _mutex;
+                std::condition_variable _cv;
+                std::atomic<bool> _consumer_waiting;
+                std::atomic<bool> _producer_waiting;
+            };
+
+            // Sleeps until ready() or stop. The flag is raised before looking at the ring and the other side looks
+            // at the flag after changing the ring, so at least one of them sees the other.
+            template <class Ready>
+            bool wait(Link& link, std::atomic<bool>& waiting, Ready ready)
+            {
+                waiting = true;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!ready() && !_stop)
+                {
+                    std::unique_lock<std::mutex> lock(link._mutex);
+                    link._cv.wait(lock, [this, &ready]() { return _stop || ready(); });
+                }
+                waiting = false;
+                return !_stop;
+            }
+
+            void notify(Link& link, std::atomic<bool>& waiting)
+            {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (waiting)
+                {
+                    std::lock_guard<std::mutex> lock_guard(link._mutex);
+                    link._cv.notify_all();
+                }
+            }
+
+            void run(std::size_t stage)
+            {
+                Link& input = *_links[stage];
+                Link* output = (stage + 1 < _links.size()) ? _links[stage + 1].get() : nullptr;
+                Job job;
+                while (true)
+                {
+                    while (!input._jobs.try_pop(job))
+                    {
+                        if (!wait(input, input._consumer_waiting, [&input]() { return !input._jobs.empty(); }))
+                            return;
+                    }
+                    notify(input, input._producer_waiting);
+
+                    bool failed(false);
+                    try
+                    {
+                        _stages[stage](job);
+                    }
+                    catch(const std::exception& ex)
+                    {
+                        ROS_ERROR_STREAM("Pipeline stage " << _names[stage] << " failed: " << ex.what());
+                        failed = true;
+                    }
+                    if (failed && _drop_handler)
+                    {
+                        try
+                        {
+                            _drop_handler(job);
+                        }
+                        catch(const std::exception& ex)
+                        {
+                            ROS_ERROR_STREAM("Pipeline drop handler failed: " << ex.what());
+                        }
+                    }
+
+                    // The job leaves the pipeline once the last stage is done with it, or when a stage drops it.
+                    if (failed || !output)
+                    {
+                        job = Job();
+                        --_in_flight;
+                        continue;
+                    }
+                    while (!output->_jobs.try_push(job))
+                    {
+                        if (!wait(*output, output->_producer_waiting, [output]() { return !output->_jobs.full(); }))
+                            return;
+                    }
+                    notify(*output, output->_consumer_waiting);
+                }
+            }
+
+            const std::size_t _queue_size;
+            std::vector<std::string> _names;
+            std::vector<Stage> _stages;
+            Stage _drop_handler;
+            std::vector<std::unique_ptr<Link> > _links;
+            std::vector<std::thread> _threads;
+            std::atomic<bool> _stop;
+            std::atomic<std::size_t> _in_flight;
+            std::atomic<uint64_t> _pushed;
+            std::atomic<uint64_t> _dropped;
+    };
+}
@@ -0,0 +1,93 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include <sensor_msgs/Image.h>
+#include <memory>
+#include <type_traits>
+
+namespace realsense2_camera
+{
+    class FrameBuffer
+    {
+        public:
+            FrameBuffer(rs2::frame frame) : _frame(frame), _in_use(false) {}
+            rs2::frame _frame;
+            bool _in_use;
+    };
+
+    /**
+     * Allocator that lets a sensor_msgs::Image_ data vector point directly at the buffer of an rs2::frame.
+     * The first allocation matching the frame's data size is served from the frame itself; every other
+     * allocation (strings, copies, resizes) falls back to the heap. The frame is released together with
+     * the last copy of the allocator, i.e. when the last subscriber drops the message.
+     */
+    template <class T>
+    class FrameBufferAllocator
+    {
+        public:
+            typedef T value_type;
+            template <class U> struct rebind { typedef FrameBufferAllocator<U> other; };
+
+            FrameBufferAllocator() {}
+            explicit FrameBufferAllocator(rs2::frame frame) : _buffer(std::make_shared<FrameBuffer>(frame)) {}
+            template <class U> FrameBufferAllocator(const FrameBufferAllocator<U>& other) : _buffer(other._buffer) {}
+
+            T* allocate(std::size_t n)
+            {
+                if (std::is_same<T, uint8_t>::value && _buffer && !_buffer->_in_use &&
+                    n * sizeof(T) == static_cast<std::size_t>(_buffer->_frame.get_data_size()))
+                {
+                    _buffer->_in_use = true;
+                    return reinterpret_cast<T*>(const_cast<void*>(_buffer->_frame.get_data()));
+                }
+                return static_cast<T*>(::operator new(n * sizeof(T)));
+            }
+
+            void deallocate(T* p, std::size_t)
+            {
+                if (_buffer && _buffer->_in_use && p == reinterpret_cast<const T*>(_buffer->_frame.get_data()))
+                {
+                    _buffer->_in_use = false;
+                    return;
+                }
+                ::operator delete(p);
+            }
+
+            // Default-insertion leaves the memory untouched, so resizing the data vector over the frame
+            // buffer keeps the frame's pixels and resizing a heap buffer does not zero it first.
+            template <class U> void construct(U* p) { ::new(static_cast<void*>(p)) U; }
+            template <class U, class... Args> void construct(U* p, Args&&... args) { ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...); }
+            template <class U> void destroy(U* p) { p->~U(); }
+
+            // Copies of a message never share the frame buffer.
+            FrameBufferAllocator select_on_container_copy_construction() const { return FrameBufferAllocator(); }
+
+            template <class U> bool operator==(const FrameBufferAllocator<U>& other) const { return _buffer == other._buffer; }
+            template <class U> bool operator!=(const FrameBufferAllocator<U>& other) const { return _buffer != other._buffer; }
+
+            std::shared_ptr<FrameBuffer> _buffer;
+    };
+
+    // Serializes exactly like sensor_msgs::Image (same MD5 and definition), so any subscriber can receive it.
+    // Nodelets in the same manager that subscribe with FrameImage::ConstPtr receive the frame without a copy.
+    typedef sensor_msgs::Image_<FrameBufferAllocator<void> > FrameImage;
+    typedef boost::shared_ptr<FrameImage> FrameImagePtr;
+    typedef boost::shared_ptr<FrameImage const> FrameImageConstPtr;
+
+    // Wrap the given frame's buffer when it is laid out as a tightly packed image of height x step bytes.
+    // Otherwise the returned message owns a heap buffer of that size, to be filled by the caller.
+    inline FrameImagePtr createFrameImage(rs2::frame f, uint32_t height, uint32_t step)
+    {
+        std::size_t size(static_cast<std::size_t>(height) * step);
+        bool wrap_frame(f && static_cast<std::size_t>(f.get_data_size()) == size);
+        FrameImagePtr img = boost::make_shared<FrameImage>(wrap_frame ? FrameBufferAllocator<void>(f) : FrameBufferAllocator<void>());
+        img->data.reserve(size);
+        img->data.resize(size);
+        img->height = height;
+        img->step = step;
+        return img;
+    }
+}
@@ -0,0 +1,66 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <realsense2_camera/ImuBatch.h>
+#include <ros/ros.h>
+#include <eigen3/Eigen/Core>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace realsense2_camera
+{
+    enum class ImuBatchMode { NONE, SAMPLES, FRAMES };
+
+    bool parseImuBatchMode(const std::string& name, ImuBatchMode& mode);
+
+    /**
+     * Collects Imu samples into ImuBatch messages. In SAMPLES mode a batch is published every batch_size
+     * samples. In FRAMES mode it is published when a camera frame arrives and holds the samples stamped
+     * since the previous frame up to this one; samples stamped after the frame wait for the next one. Then
+     * batch_size only bounds a batch, for when frames stop coming.
+     *
+     * add() is called on the imu thread and frameArrived() on the frame threads.
+     */
+    class ImuBatchPublisher
+    {
+        public:
+            ImuBatchPublisher(ros::Publisher publisher, const std::string& frame_id, ImuBatchMode mode, std::size_t batch_size,
+                              bool has_gyro, bool has_accel, double angular_velocity_cov, double linear_accel_cov);
+
+            uint32_t getNumSubscribers() const { return _publisher.getNumSubscribers(); }
+            ImuBatchMode mode() const { return _mode; }
+
+            // Samples must come in time order. The reading the batch does not carry is ignored.
+            void add(double time, const Eigen::Vector3d& gyro, const Eigen::Vector3d& accel);
+            void frameArrived(double time);
+            // Drops the collected samples, e.g. while nobody subscribes.
+            void clear();
+
+        private:
+            struct Sample
+            {
+                double time;
+                float gyro[3];
+                float accel[3];
+            };
+
+            // Called with _mutex held. Publishes the first count samples and keeps the rest.
+            void publishBatch(std::size_t count, double window_end);
+
+            ros::Publisher _publisher;
+            const std::string _frame_id;
+            const ImuBatchMode _mode;
+            const std::size_t _batch_size;
+            const bool _has_gyro;
+            const bool _has_accel;
+            const double _angular_velocity_cov;
+            const double _linear_accel_cov;
+            std::mutex _mutex;
+            std::vector<Sample> _samples;
+            double _window_start;
+            uint32_t _seq;
+    };
+}
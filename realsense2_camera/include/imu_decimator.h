@@ -0,0 +1,49 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/StdVector>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Decimates a stream of 3 axis imu readings by an integer factor, after a linear phase low-pass FIR filter
+     * so that what lies above the output Nyquist frequency does not alias into the published signal.
+     *
+     * The taps are a Hamming windowed sinc, normalized to unit gain at DC so gravity passes unchanged. The cutoff
+     * is given as a fraction of the output Nyquist frequency. A reading is held as the 4 floats of a single SIMD
+     * register, the three axes and a padding lane, and the history is stored twice in a row so that the filter
+     * runs over contiguous memory without wrapping.
+     *
+     * An output is stamped at the time of the center tap, which compensates the filter's delay. Nothing is
+     * output until the history is full. A decimator serves a single thread.
+     */
+    class ImuDecimator
+    {
+        public:
+            // taps is rounded up to an odd count, so the center tap falls on a reading.
+            ImuDecimator(int factor, int taps, double cutoff);
+
+            int factor() const { return _factor; }
+            int taps() const { return static_cast<int>(_taps.size()); }
+
+            // Forgets the history, e.g. while nobody subscribes.
+            void reset();
+            // Readings must come in time order. Returns true when the reading completes an output, given in out_time and out.
+            bool add(double time, const Eigen::Vector3f& reading, double& out_time, Eigen::Vector3f& out);
+
+        private:
+            typedef std::vector<Eigen::Array4f, Eigen::aligned_allocator<Eigen::Array4f>> History;
+
+            const int _factor;
+            std::vector<float> _taps;
+            History _history;
+            std::vector<double> _times;
+            std::size_t _position;
+            std::size_t _filled;
+            int _phase;
+    };
+}
@@ -0,0 +1,148 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <eigen3/Eigen/Core>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Unites the accel and gyro streams into one sample per gyro reading, with the acceleration linearly
+     * interpolated at the gyro's time. Samples are kept in fixed-capacity rings allocated up front: a gyro
+     * reading newer than the last accel one waits until the next accel reading brackets it, any other is
+     * emitted right away. Each call does O(1) work per emitted sample and never allocates.
+     *
+     * Gyro readings older than every kept accel reading cannot be interpolated and are dropped, as are
+     * readings that arrive after the waiting ring is full (the oldest one is dropped then).
+     * Not thread safe.
+     */
+    class ImuInterpolator
+    {
+        public:
+            struct Sample
+            {
+                Sample() : time(-1) {}
+                Sample(double t, const Eigen::Vector3d& d) : time(t), data(d) {}
+                double time;
+                Eigen::Vector3d data;
+            };
+
+            explicit ImuInterpolator(std::size_t capacity = 32) :
+                _accels(capacity),
+                _gyros(capacity),
+                _dropped(0)
+            {}
+
+            void reset()
+            {
+                _accels.clear();
+                _gyros.clear();
+            }
+
+            // emit(time, accel, gyro) is called for every gyro reading this accel reading brackets.
+            template <class Emit>
+            void addAccel(double time, const Eigen::Vector3d& accel, Emit emit)
+            {
+                if (!_accels.empty() && time <= _accels.back().time)
+                {
+                    ++_dropped;
+                    return;
+                }
+                _accels.push(Sample(time, accel));
+                while (!_gyros.empty() && _gyros.front().time <= time)
+                {
+                    unite(_gyros.front(), emit);
+                    _gyros.pop();
+                }
+            }
+
+            // emit(time, accel, gyro) is called at once if the accel readings already bracket this one.
+            template <class Emit>
+            void addGyro(double time, const Eigen::Vector3d& gyro, Emit emit)
+            {
+                if (_accels.empty() || time < _accels.front().time)
+                {
+                    ++_dropped;
+                    return;
+                }
+                if (time <= _accels.back().time)
+                {
+                    unite(Sample(time, gyro), emit);
+                    return;
+                }
+                if (_gyros.full())
+                {
+                    _gyros.pop();
+                    ++_dropped;
+                }
+                _gyros.push(Sample(time, gyro));
+            }
+
+            uint64_t dropped() const { return _dropped; }
+
+        private:
+            class Ring
+            {
+                public:
+                    explicit Ring(std::size_t capacity) : _items(std::max<std::size_t>(capacity, 2)), _head(0), _size(0) {}
+
+                    bool empty() const { return _size == 0; }
+                    bool full() const { return _size == _items.size(); }
+                    std::size_t size() const { return _size; }
+                    void clear() { _head = 0; _size = 0; }
+
+                    // Overwrites the oldest sample when full.
+                    void push(const Sample& sample)
+                    {
+                        _items[(_head + _size) % _items.size()] = sample;
+                        if (full())
+                            _head = (_head + 1) % _items.size();
+                        else
+                            ++_size;
+                    }
+                    void pop()
+                    {
+                        _head = (_head + 1) % _items.size();
+                        --_size;
+                    }
+
+                    // 0 is the oldest sample.
+                    const Sample& operator[](std::size_t i) const { return _items[(_head + i) % _items.size()]; }
+                    const Sample& front() const { return (*this)[0]; }
+                    const Sample& back() const { return (*this)[_size - 1]; }
+
+                private:
+                    std::vector<Sample> _items;
+                    std::size_t _head;
+                    std::size_t _size;
+            };
+
+            // The gyro reading lies within the kept accel readings. They are searched from the newest, which
+            // brackets it almost always.
+            template <class Emit>
+            void unite(const Sample& gyro, Emit& emit)
+            {
+                std::size_t i(_accels.size() - 1);
+                while (i > 0 && _accels[i - 1].time > gyro.time)
+                    --i;
+                if (i == 0)
+                {
+                    emit(gyro.time, _accels[0].data, gyro.data);
+                    return;
+                }
+                const Sample& accel0(_accels[i - 1]);
+                const Sample& accel1(_accels[i]);
+                const double alpha = (gyro.time - accel0.time) / (accel1.time - accel0.time);
+                emit(gyro.time, Eigen::Vector3d(accel0.data * (1.0 - alpha) + accel1.data * alpha), gyro.data);
+            }
+
+            Ring _accels;
+            Ring _gyros;
+            uint64_t _dropped;
+    };
+}
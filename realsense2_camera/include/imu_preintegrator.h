@@ -0,0 +1,72 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <realsense2_camera/ImuPreintegration.h>
+#include <ros/ros.h>
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Geometry>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Pre-integrates the united gyro and accel samples between consecutive camera frames and publishes one
+     * ImuPreintegration message per frame: the rotation, velocity and position deltas in the imu frame at the
+     * previous frame, and their propagated 9x9 covariance (on-manifold pre-integration, Forster et al.).
+     *
+     * Each reading is held from its timestamp to the next one, so an interval is covered exactly from frame
+     * to frame. Samples are kept until the frame after them arrives, since frames reach the node later than
+     * the imu samples taken at the same time. The readings are corrected as corrected = scale * raw - bias,
+     * the same correction librealsense applies with motion correction enabled.
+     *
+     * add() is called on the imu thread and frameArrived() on the frame threads.
+     */
+    class ImuPreintegrator
+    {
+        public:
+            struct Calibration
+            {
+                Calibration() : scale(Eigen::Matrix3d::Identity()), bias(Eigen::Vector3d::Zero()), noise_variances(Eigen::Vector3d::Zero()) {}
+                Eigen::Matrix3d scale;
+                Eigen::Vector3d bias;
+                // Variance of a single reading, per axis.
+                Eigen::Vector3d noise_variances;
+            };
+
+            ImuPreintegrator(ros::Publisher publisher, const std::string& frame_id, const Calibration& gyro, const Calibration& accel);
+
+            uint32_t getNumSubscribers() const { return _publisher.getNumSubscribers(); }
+
+            // Samples must come in time order.
+            void add(double time, const Eigen::Vector3d& gyro, const Eigen::Vector3d& accel);
+            void frameArrived(double time);
+            // Drops the collected samples and the last frame, e.g. while nobody subscribes.
+            void clear();
+
+        private:
+            struct Sample
+            {
+                double time;
+                Eigen::Vector3d gyro;
+                Eigen::Vector3d accel;
+            };
+
+            typedef Eigen::Matrix<double, 9, 9> Covariance;
+
+            // Called with _mutex held. Integrates the samples up to time into a message and drops them, but the last.
+            void integrate(double time, realsense2_camera::ImuPreintegration& msg);
+
+            ros::Publisher _publisher;
+            const std::string _frame_id;
+            const Calibration _gyro;
+            const Calibration _accel;
+            std::mutex _mutex;
+            std::vector<Sample> _samples;
+            double _last_frame_time;
+            uint32_t _seq;
+    };
+}
@@ -0,0 +1,85 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <boost/shared_ptr.hpp>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Pool of reusable messages. acquire() hands out a message as a shared pointer that can be published
+     * directly: intra-process subscribers receive the pointer itself, and once the last of them releases it
+     * the message, together with the capacity of its buffers, returns to the pool for the next frame.
+     */
+    template <class M>
+    class MessagePool
+    {
+        public:
+            MessagePool(std::size_t max_free_messages = 4) :
+                _storage(std::make_shared<Storage>(max_free_messages))
+            {}
+
+            boost::shared_ptr<M> acquire()
+            {
+                M* msg(nullptr);
+                {
+                    std::lock_guard<std::mutex> lock_guard(_storage->_mutex);
+                    if (!_storage->_free_messages.empty())
+                    {
+                        msg = _storage->_free_messages.back();
+                        _storage->_free_messages.pop_back();
+                    }
+                }
+                if (!msg)
+                    msg = new M();
+                return boost::shared_ptr<M>(msg, Recycler(_storage));
+            }
+
+        private:
+            class Storage
+            {
+                public:
+                    Storage(std::size_t max_free_messages) : _max_free_messages(max_free_messages) {}
+                    ~Storage()
+                    {
+                        for (M* msg : _free_messages)
+                            delete msg;
+                    }
+
+                    std::mutex _mutex;
+                    std::vector<M*> _free_messages;
+                    std::size_t _max_free_messages;
+            };
+
+            // Deleter of the handed out pointers. Outlives the pool safely: if the pool is gone, or already
+            // holds enough free messages, the message is simply deleted.
+            class Recycler
+            {
+                public:
+                    Recycler(std::weak_ptr<Storage> storage) : _storage(storage) {}
+                    void operator()(M* msg) const
+                    {
+                        std::shared_ptr<Storage> storage(_storage.lock());
+                        if (storage)
+                        {
+                            std::lock_guard<std::mutex> lock_guard(storage->_mutex);
+                            if (storage->_free_messages.size() < storage->_max_free_messages)
+                            {
+                                storage->_free_messages.push_back(msg);
+                                return;
+                            }
+                        }
+                        delete msg;
+                    }
+
+                private:
+                    std::weak_ptr<Storage> _storage;
+            };
+
+            std::shared_ptr<Storage> _storage;
+    };
+}
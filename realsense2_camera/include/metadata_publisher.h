@@ -0,0 +1,53 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include <ros/ros.h>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Publishes the metadata of a stream's frames on <stream>/metadata (json, Metadata) and
+     * <stream>/binary_metadata (BinaryMetadata), and the names of the binary fields on the latched
+     * <stream>/metadata_fields. Which fields the stream supports is looked up, and their names built, once
+     * per stream profile instead of for every frame. Only the selected fields are published, all the
+     * supported ones if the selection is empty.
+     */
+    class MetadataPublisher
+    {
+        public:
+            MetadataPublisher(ros::NodeHandle& node_handle, const std::string& stream_name, const std::set<std::string>& selected_fields,
+                              const ros::SubscriberStatusCallback& status_changed = ros::SubscriberStatusCallback());
+
+            uint32_t getNumSubscribers() const;
+
+            void publish(rs2::frame f, const ros::Time& t, const std::string& frame_id);
+
+        private:
+            struct Field
+            {
+                rs2_frame_metadata_value id;
+                std::string name;
+                std::string json_key;
+            };
+
+            void updateFields(const rs2::frame& f);
+            void publishJson(const rs2::frame& f, const ros::Time& t, const std::string& frame_id);
+            void publishBinary(const rs2::frame& f, const ros::Time& t, const std::string& frame_id);
+
+            ros::Publisher _json_publisher;
+            ros::Publisher _binary_publisher;
+            ros::Publisher _fields_publisher;
+            std::set<std::string> _selected_fields;
+            std::vector<std::string> _clock_domain_names;
+            std::mutex _mutex;
+            int _profile_id;
+            std::vector<Field> _fields;
+    };
+}
@@ -0,0 +1,42 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Geometry>
+#include <atomic>
+
+namespace realsense2_camera
+{
+    /**
+     * Estimates the orientation of the imu from its gyro and accel readings with Madgwick's gradient descent
+     * filter, as imu_filter_madgwick does without a magnetometer. The orientation is that of the imu frame
+     * in a world frame whose z axis points up, against gravity; its yaw starts at zero and drifts with the
+     * gyro bias, since nothing observes it. The first reading sets roll and pitch from the accel.
+     *
+     * The gain weighs the accel correction against the gyro integration and may be changed from any thread.
+     * update() does no allocation.
+     */
+    class OrientationFilter
+    {
+        public:
+            explicit OrientationFilter(double gain);
+
+            void setGain(double gain) { _gain = gain; }
+            double gain() const { return _gain.load(); }
+
+            void reset() { _initialized = false; }
+            bool initialized() const { return _initialized; }
+
+            // Readings in rad/sec and m/s^2, in time order. Returns the orientation after the reading.
+            const Eigen::Quaterniond& update(double time, const Eigen::Vector3d& gyro, const Eigen::Vector3d& accel);
+            const Eigen::Quaterniond& orientation() const { return _orientation; }
+
+        private:
+            std::atomic<double> _gain;
+            Eigen::Quaterniond _orientation;
+            double _last_time;
+            bool _initialized;
+    };
+}
@@ -0,0 +1,165 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RS2_PIXEL_PROJECTION_X86
+#include <immintrin.h>
+#endif
+
+namespace realsense2_camera
+{
+    /**
+     * Maps points of one camera to the pixels of another, as rs2_transform_point_to_point followed by
+     * rs2_project_point_to_pixel do, for the distortion models of the streams a depth camera is registered to:
+     * none and the Brown-Conrady variants.
+     *
+     * The scalar and the AVX2 functions perform the same single precision operations in the same order, without
+     * fused multiply-adds, so their results match bit for bit. The AVX2 ones may only be called from functions
+     * compiled for AVX2.
+     */
+    struct PixelProjection
+    {
+        enum class Distortion { NONE, MODIFIED_BROWN_CONRADY, BROWN_CONRADY };
+
+        float rotation[9];      // Column major, as in rs2_extrinsics.
+        float translation[3];
+        float fx, fy, ppx, ppy;
+        float coeffs[5];
+        Distortion distortion;
+        int width;
+        int height;
+
+        // Returns false if the distortion model of intrinsics is not supported.
+        static bool create(const rs2_intrinsics& intrinsics, const rs2_extrinsics& extrinsics, PixelProjection& projection)
+        {
+            bool has_coeffs(false);
+            for (int i = 0; i < 5; ++i)
+                has_coeffs = has_coeffs || intrinsics.coeffs[i] != 0;
+            switch (intrinsics.model)
+            {
+                case RS2_DISTORTION_NONE:
+                    projection.distortion = Distortion::NONE;
+                    break;
+                case RS2_DISTORTION_MODIFIED_BROWN_CONRADY:
+                case RS2_DISTORTION_INVERSE_BROWN_CONRADY:
+                    projection.distortion = has_coeffs ? Distortion::MODIFIED_BROWN_CONRADY : Distortion::NONE;
+                    break;
+                case RS2_DISTORTION_BROWN_CONRADY:
+                    projection.distortion = has_coeffs ? Distortion::BROWN_CONRADY : Distortion::NONE;
+                    break;
+                default:
+                    return false;
+            }
+            std::copy(extrinsics.rotation, extrinsics.rotation + 9, projection.rotation);
+            std::copy(extrinsics.translation, extrinsics.translation + 3, projection.translation);
+            projection.fx = intrinsics.fx;
+            projection.fy = intrinsics.fy;
+            projection.ppx = intrinsics.ppx;
+            projection.ppy = intrinsics.ppy;
+            std::copy(intrinsics.coeffs, intrinsics.coeffs + 5, projection.coeffs);
+            projection.width = intrinsics.width;
+            projection.height = intrinsics.height;
+            return true;
+        }
+    };
+
+    // Pixel coordinates (u, v) of the point (px, py, pz).
+    inline void projectToPixel(float px, float py, float pz, const PixelProjection& p, float& u, float& v)
+    {
+        const float* r = p.rotation;
+        float x = r[0] * px + r[3] * py + r[6] * pz + p.translation[0];
+        float y = r[1] * px + r[4] * py + r[7] * pz + p.translation[1];
+        float w = r[2] * px + r[5] * py + r[8] * pz + p.translation[2];
+        x = x / w;
+        y = y / w;
+        if (p.distortion != PixelProjection::Distortion::NONE)
+        {
+            const float* c = p.coeffs;
+            float r2 = x * x + y * y;
+            float f = 1 + c[0] * r2 + c[1] * r2 * r2 + c[4] * r2 * r2 * r2;
+            float xf = x * f;
+            float yf = y * f;
+            // The modified model also applies the tangential terms to the radially distorted point.
+            if (p.distortion == PixelProjection::Distortion::MODIFIED_BROWN_CONRADY)
+            {
+                x = xf;
+                y = yf;
+            }
+            float dx = xf + 2 * c[2] * x * y + c[3] * (r2 + 2 * x * x);
+            float dy = yf + 2 * c[3] * x * y + c[2] * (r2 + 2 * y * y);
+            x = dx;
+            y = dy;
+        }
+        u = x * p.fx + p.ppx;
+        v = y * p.fy + p.ppy;
+    }
+
+#ifdef RS2_PIXEL_PROJECTION_X86
+    // A PixelProjection broadcast to 8 lanes.
+    struct PixelProjectionAVX2
+    {
+        __m256 rotation[9];
+        __m256 translation[3];
+        __m256 fx, fy, ppx, ppy;
+        __m256 coeffs[5];
+        PixelProjection::Distortion distortion;
+    };
+
+    __attribute__((target("avx2")))
+    inline void broadcastAVX2(const PixelProjection& p, PixelProjectionAVX2& v)
+    {
+        for (int i = 0; i < 9; ++i)
+            v.rotation[i] = _mm256_set1_ps(p.rotation[i]);
+        for (int i = 0; i < 3; ++i)
+            v.translation[i] = _mm256_set1_ps(p.translation[i]);
+        v.fx = _mm256_set1_ps(p.fx);
+        v.fy = _mm256_set1_ps(p.fy);
+        v.ppx = _mm256_set1_ps(p.ppx);
+        v.ppy = _mm256_set1_ps(p.ppy);
+        for (int i = 0; i < 5; ++i)
+            v.coeffs[i] = _mm256_set1_ps(p.coeffs[i]);
+        v.distortion = p.distortion;
+    }
+
+    __attribute__((target("avx2")))
+    inline void projectToPixel8AVX2(__m256 px, __m256 py, __m256 pz, const PixelProjectionAVX2& v, __m256& u_out, __m256& v_out)
+    {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 two = _mm256_set1_ps(2.0f);
+        const __m256* r = v.rotation;
+        __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r[0], px), _mm256_mul_ps(r[3], py)), _mm256_mul_ps(r[6], pz)), v.translation[0]);
+        __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r[1], px), _mm256_mul_ps(r[4], py)), _mm256_mul_ps(r[7], pz)), v.translation[1]);
+        __m256 w = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r[2], px), _mm256_mul_ps(r[5], py)), _mm256_mul_ps(r[8], pz)), v.translation[2]);
+        x = _mm256_div_ps(x, w);
+        y = _mm256_div_ps(y, w);
+        if (v.distortion != PixelProjection::Distortion::NONE)
+        {
+            const __m256* c = v.coeffs;
+            __m256 r2 = _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y));
+            __m256 f = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(one, _mm256_mul_ps(c[0], r2)),
+                                                   _mm256_mul_ps(_mm256_mul_ps(c[1], r2), r2)),
+                                     _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(c[4], r2), r2), r2));
+            __m256 xf = _mm256_mul_ps(x, f);
+            __m256 yf = _mm256_mul_ps(y, f);
+            if (v.distortion == PixelProjection::Distortion::MODIFIED_BROWN_CONRADY)
+            {
+                x = xf;
+                y = yf;
+            }
+            __m256 dx = _mm256_add_ps(_mm256_add_ps(xf, _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(two, c[2]), x), y)),
+                                      _mm256_mul_ps(c[3], _mm256_add_ps(r2, _mm256_mul_ps(_mm256_mul_ps(two, x), x))));
+            __m256 dy = _mm256_add_ps(_mm256_add_ps(yf, _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(two, c[3]), x), y)),
+                                      _mm256_mul_ps(c[2], _mm256_add_ps(r2, _mm256_mul_ps(_mm256_mul_ps(two, y), y))));
+            x = dx;
+            y = dy;
+        }
+        u_out = _mm256_add_ps(_mm256_mul_ps(x, v.fx), v.ppx);
+        v_out = _mm256_add_ps(_mm256_mul_ps(y, v.fy), v.ppy);
+    }
+#endif
+}
@@ -0,0 +1,74 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include "crop_volume.h"
+#include "pointcloud_layout.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Writes librealsense points straight into one of the PointCloud2 layouts published by the node (see
+     * PointCloudLayout). The color of a textured point is the texture pixel in bgr order (or the intensity),
+     * zero where the texture is invalid. Padding is zeroed.
+     *
+     * Points are classified with SIMD (selected at runtime) in chunks, processed in parallel when built with
+     * OpenMP. Unordered clouds are compacted using a prefix sum over the valid point counts of the chunks.
+     */
+    class PointCloudAssembler
+    {
+        public:
+            struct Texture
+            {
+                const uint8_t* data;
+                int width;
+                int height;
+                int bytes_per_pixel;    // 3 (RGB8) or 1 (Y8)
+            };
+
+            // vertices: xyz triplets, texture_coordinates: uv pairs (ignored without texture).
+            // out must hold count points of pointStep(texture, layout) bytes. Returns the number of points
+            // written, which is count for ordered clouds. Points outside crop, if given, are left out of unordered
+            // clouds and written as zero points, like those without depth, in ordered ones.
+            std::size_t assemble(const float* vertices, const float* texture_coordinates, std::size_t count,
+                                 const Texture* texture, bool ordered, bool allow_no_texture_points,
+                                 PointCloudLayout layout, uint8_t* out, const CropVolume* crop = nullptr);
+
+            // Rewrites count points of the XYZ32 layout (e.g. the output of VoxelGrid) into another layout.
+            static void convert(const uint8_t* points, std::size_t count, int bytes_per_pixel, PointCloudLayout layout, uint8_t* out);
+
+            static uint32_t pointStep(const Texture* texture, PointCloudLayout layout = PointCloudLayout::XYZ32)
+            {
+                return pointcloud_layout::pointStep(layout, texture ? texture->bytes_per_pixel : 0);
+            }
+
+            struct ClassifyParams
+            {
+                bool textured;
+                bool allow_no_texture_points;
+                int texture_width;
+                int texture_height;
+                int bytes_per_pixel;
+            };
+            // Sets bit (i % 8) of valid_masks[i / 8] for each valid point i and, when textured, stores the byte offset
+            // of its texture pixel in color_offsets[i] (-1 when the texture coordinate is out of the texture).
+            // Returns the number of valid points.
+            typedef std::size_t (*ClassifyFunc)(const float* vertices, const float* texture_coordinates, std::size_t count,
+                                                const ClassifyParams& params, uint8_t* valid_masks, int32_t* color_offsets);
+            static std::size_t classifyScalar(const float* vertices, const float* texture_coordinates, std::size_t count,
+                                              const ClassifyParams& params, uint8_t* valid_masks, int32_t* color_offsets);
+            // Return nullptr when the kernel is not compiled in or not supported by the running CPU.
+            static ClassifyFunc classifyAVX2();
+            static ClassifyFunc classifyNEON();
+
+        private:
+            std::vector<uint8_t> _valid_masks;
+            std::vector<int32_t> _color_offsets;
+            std::vector<uint8_t> _crop_masks;
+            std::vector<std::size_t> _chunk_offsets;
+    };
+}
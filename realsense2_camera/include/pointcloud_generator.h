@@ -0,0 +1,80 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include "crop_volume.h"
+#include "pixel_projection.h"
+#include "pointcloud_assembler.h"
+#include "pointcloud_layout.h"
+#include <librealsense2/rs.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Builds the published pointcloud straight from a Z16 depth image into one of the PointCloud2 layouts,
+     * without going through rs2::pointcloud and its rs2::points frame. The points and their colors are the ones
+     * PointCloudAssembler writes for the vertices and texture coordinates of rs2::pointcloud, up to rounding.
+     *
+     * The intrinsics don't change while streaming, so configure() deprojects the depth pixels once, with the
+     * depth scale folded in: a pixel of raw depth z lies at z * ray. generate() classifies the pixels, with SIMD
+     * selected at runtime, projecting the valid ones onto the texture, then writes the points, computed again
+     * from their rays, straight into the output. Both passes work in chunks, in parallel when built with OpenMP,
+     * and unordered clouds are compacted using a prefix sum over the valid point counts of the chunks. All kernels
+     * give bit-exact results.
+     *
+     * A texture registered to the depth, as color is to the depth aligned to it (same intrinsics, identity
+     * extrinsics), needs no projection: each point takes the texture pixel at its own position. The cloud of depth
+     * aligned to color thus reuses the projection of the alignment instead of projecting the depth a second time.
+     */
+    class PointCloudGenerator
+    {
+        public:
+            PointCloudGenerator();
+
+            // Drops the texture.
+            bool configure(const rs2_intrinsics& depth, float depth_scale_meters);
+            // Returns false if the texture's distortion model is not supported, unless it is registered to the depth.
+            bool setTexture(const rs2_intrinsics& texture, const rs2_extrinsics& depth_to_texture);
+            std::size_t size() const { return static_cast<std::size_t>(_width) * _height; }
+
+            // depth holds the configured resolution in dense rows. texture, if not null, has the resolution given to
+            // setTexture(). out must hold size() points of PointCloudAssembler::pointStep(texture, layout) bytes.
+            // Returns the number of points written, which is size() for ordered clouds. Points outside crop are dropped
+            // as by PointCloudAssembler::assemble().
+            std::size_t generate(const uint16_t* depth, const PointCloudAssembler::Texture* texture, bool ordered,
+                                 bool allow_no_texture_points, PointCloudLayout layout, uint8_t* out,
+                                 const CropVolume* crop = nullptr);
+
+            struct ClassifyParams
+            {
+                const PixelProjection* texture;     // nullptr for an untextured cloud.
+                bool allow_no_texture_points;
+                int bytes_per_pixel;
+            };
+            // Like PointCloudAssembler::ClassifyFunc, for count pixels of depth and their rays, as x, y and z planes.
+            // A pixel without depth has no texture pixel.
+            typedef std::size_t (*ClassifyFunc)(const uint16_t* depth, const float* const rays[3], std::size_t count,
+                                                const ClassifyParams& params, uint8_t* valid_masks, int32_t* color_offsets);
+            static std::size_t classifyScalar(const uint16_t* depth, const float* const rays[3], std::size_t count,
+                                              const ClassifyParams& params, uint8_t* valid_masks, int32_t* color_offsets);
+            // Returns nullptr when the kernel is not compiled in or not supported by the running CPU.
+            static ClassifyFunc classifyAVX2();
+
+        private:
+            int _width;
+            int _height;
+            rs2_intrinsics _depth_intrinsics;
+            std::vector<float> _rays[3];
+            bool _has_texture;
+            bool _registered;
+            PixelProjection _texture;
+            std::vector<uint8_t> _valid_masks;
+            std::vector<int32_t> _color_offsets;
+            std::vector<uint8_t> _crop_masks;
+            std::vector<std::size_t> _chunk_offsets;
+    };
+}
@@ -0,0 +1,312 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Field layouts of the published pointcloud (parameter pointcloud_layout). Color, when present, follows
+     * the coordinates as bgr (or a single intensity byte).
+     *  XYZ32  - "xyz32":  x, y, z FLOAT32 in meters, 4 bytes padding, "rgb"/"intensity" FLOAT32. 16/20 bytes.
+     *  XYZ16  - "xyz16":  x_mm, y_mm, z_mm INT16 in millimeters, "bgr" UINT8[3]/"intensity" UINT8. 6/9 bytes.
+     *  XYZF16 - "xyzf16": x_f16, y_f16, z_f16 as IEEE half floats (UINT16) in meters, color as XYZ16. 6/9 bytes.
+     *  Z16    - "z16":    z_mm UINT16 in millimeters, color as XYZ16. 2/5 bytes. Ordered clouds only: x and y
+     *                     are recovered from the pixel position and the intrinsics of the cloud's camera_info.
+     * Only XYZ32 is understood by generic PointCloud2 consumers; decodePointCloud() reads all of them.
+     */
+    enum class PointCloudLayout { XYZ32, XYZ16, XYZF16, Z16 };
+
+    namespace pointcloud_layout
+    {
+        inline bool parseLayout(const std::string& name, PointCloudLayout& layout)
+        {
+            if (name == "xyz32")       layout = PointCloudLayout::XYZ32;
+            else if (name == "xyz16")  layout = PointCloudLayout::XYZ16;
+            else if (name == "xyzf16") layout = PointCloudLayout::XYZF16;
+            else if (name == "z16")    layout = PointCloudLayout::Z16;
+            else return false;
+            return true;
+        }
+
+        // IEEE 754 binary16 conversions, rounding to nearest even.
+        inline uint16_t floatToHalf(float value)
+        {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            uint32_t sign = (bits >> 16) & 0x8000;
+            uint32_t magnitude = bits & 0x7fffffff;
+            if (magnitude >= 0x7f800000)                        // inf, nan
+                return static_cast<uint16_t>(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+            if (magnitude >= 0x477ff000)                        // rounds beyond the largest half
+                return static_cast<uint16_t>(sign | 0x7c00);
+            if (magnitude < 0x38800000)                         // subnormal half or zero
+            {
+                if (magnitude < 0x33000000)
+                    return static_cast<uint16_t>(sign);
+                uint32_t exponent = magnitude >> 23;
+                uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+                uint32_t shift = 126 - exponent;
+                uint32_t half = mantissa >> shift;
+                uint32_t remainder = mantissa & ((1u << shift) - 1);
+                uint32_t halfway = 1u << (shift - 1);
+                if (remainder > halfway || (remainder == halfway && (half & 1)))
+                    ++half;
+                return static_cast<uint16_t>(sign | half);
+            }
+            uint32_t half = (magnitude - 0x38000000) >> 13;
+            uint32_t remainder = magnitude & 0x1fff;
+            if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+                ++half;
+            return static_cast<uint16_t>(sign | half);
+        }
+
+        inline float halfToFloat(uint16_t half)
+        {
+            uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+            uint32_t exponent = (half >> 10) & 0x1f;
+            uint32_t mantissa = half & 0x3ff;
+            uint32_t bits;
+            if (exponent == 0x1f)
+            {
+                bits = sign | 0x7f800000 | (mantissa << 13);
+            }
+            else if (exponent == 0)
+            {
+                float value = std::ldexp(static_cast<float>(mantissa), -24);
+                return sign ? -value : value;
+            }
+            else
+            {
+                bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+            }
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        inline int16_t toMillimeters16(float meters)
+        {
+            float mm = meters * 1000.f;
+            if (!(mm > -32768.f)) return (mm != mm) ? 0 : -32768;
+            if (mm >= 32767.f) return 32767;
+            return static_cast<int16_t>(std::floor(mm + 0.5f));
+        }
+
+        inline uint16_t toMillimetersU16(float meters)
+        {
+            float mm = meters * 1000.f;
+            if (!(mm > 0.f)) return 0;
+            if (mm >= 65535.f) return 65535;
+            return static_cast<uint16_t>(mm + 0.5f);
+        }
+
+        template <PointCloudLayout L> struct Layout;
+
+        template <> struct Layout<PointCloudLayout::XYZ32>
+        {
+            static const uint32_t xyz_size = 16;
+            static uint32_t colorSize(int bytes_per_pixel) { return bytes_per_pixel ? 4 : 0; }
+            static void writeXYZ(uint8_t* out, const float* xyz)
+            {
+                static const float padding(0);
+                memcpy(out, xyz, 3 * sizeof(float));
+                memcpy(out + 12, &padding, sizeof(padding));
+            }
+        };
+
+        template <> struct Layout<PointCloudLayout::XYZ16>
+        {
+            static const uint32_t xyz_size = 6;
+            static uint32_t colorSize(int bytes_per_pixel) { return bytes_per_pixel; }
+            static void writeXYZ(uint8_t* out, const float* xyz)
+            {
+                int16_t mm[3] = {toMillimeters16(xyz[0]), toMillimeters16(xyz[1]), toMillimeters16(xyz[2])};
+                memcpy(out, mm, sizeof(mm));
+            }
+        };
+
+        template <> struct Layout<PointCloudLayout::XYZF16>
+        {
+            static const uint32_t xyz_size = 6;
+            static uint32_t colorSize(int bytes_per_pixel) { return bytes_per_pixel; }
+            static void writeXYZ(uint8_t* out, const float* xyz)
+            {
+                uint16_t half[3] = {floatToHalf(xyz[0]), floatToHalf(xyz[1]), floatToHalf(xyz[2])};
+                memcpy(out, half, sizeof(half));
+            }
+        };
+
+        template <> struct Layout<PointCloudLayout::Z16>
+        {
+            static const uint32_t xyz_size = 2;
+            static uint32_t colorSize(int bytes_per_pixel) { return bytes_per_pixel; }
+            static void writeXYZ(uint8_t* out, const float* xyz)
+            {
+                uint16_t mm = toMillimetersU16(xyz[2]);
+                memcpy(out, &mm, sizeof(mm));
+            }
+        };
+
+        // Writes one point. color holds BytesPerPixel bytes, already in bgr order.
+        template <PointCloudLayout L, int BytesPerPixel>
+        inline void writePoint(uint8_t* out, const float* xyz, const uint8_t* color)
+        {
+            Layout<L>::writeXYZ(out, xyz);
+            if (BytesPerPixel)
+            {
+                uint8_t* out_color = out + Layout<L>::xyz_size;
+                const uint32_t color_size = Layout<L>::colorSize(BytesPerPixel);
+                memcpy(out_color, color, BytesPerPixel);
+                if (color_size > static_cast<uint32_t>(BytesPerPixel))
+                    memset(out_color + BytesPerPixel, 0, color_size - BytesPerPixel);
+            }
+        }
+
+        inline uint32_t pointStep(PointCloudLayout layout, int bytes_per_pixel)
+        {
+            switch (layout)
+            {
+                case PointCloudLayout::XYZ16:  return Layout<PointCloudLayout::XYZ16>::xyz_size + Layout<PointCloudLayout::XYZ16>::colorSize(bytes_per_pixel);
+                case PointCloudLayout::XYZF16: return Layout<PointCloudLayout::XYZF16>::xyz_size + Layout<PointCloudLayout::XYZF16>::colorSize(bytes_per_pixel);
+                case PointCloudLayout::Z16:    return Layout<PointCloudLayout::Z16>::xyz_size + Layout<PointCloudLayout::Z16>::colorSize(bytes_per_pixel);
+                default:                       return Layout<PointCloudLayout::XYZ32>::xyz_size + Layout<PointCloudLayout::XYZ32>::colorSize(bytes_per_pixel);
+            }
+        }
+
+        // Sets the fields and point_step of msg for the layout. bytes_per_pixel is 3 (rgb), 1 (intensity) or 0.
+        inline void setFields(sensor_msgs::PointCloud2& msg, PointCloudLayout layout, int bytes_per_pixel)
+        {
+            using sensor_msgs::PointField;
+            msg.fields.clear();
+            uint32_t offset(0);
+            switch (layout)
+            {
+                case PointCloudLayout::XYZ32:
+                    offset = addPointField(msg, "x", 1, PointField::FLOAT32, offset);
+                    offset = addPointField(msg, "y", 1, PointField::FLOAT32, offset);
+                    offset = addPointField(msg, "z", 1, PointField::FLOAT32, offset);
+                    offset += 4;
+                    if (bytes_per_pixel)
+                        offset = addPointField(msg, bytes_per_pixel == 3 ? "rgb" : "intensity", 1, PointField::FLOAT32, offset);
+                    break;
+                case PointCloudLayout::XYZ16:
+                case PointCloudLayout::XYZF16:
+                {
+                    bool is_half(layout == PointCloudLayout::XYZF16);
+                    uint8_t datatype = is_half ? PointField::UINT16 : PointField::INT16;
+                    offset = addPointField(msg, is_half ? "x_f16" : "x_mm", 1, datatype, offset);
+                    offset = addPointField(msg, is_half ? "y_f16" : "y_mm", 1, datatype, offset);
+                    offset = addPointField(msg, is_half ? "z_f16" : "z_mm", 1, datatype, offset);
+                    break;
+                }
+                case PointCloudLayout::Z16:
+                    offset = addPointField(msg, "z_mm", 1, PointField::UINT16, offset);
+                    break;
+            }
+            if (layout != PointCloudLayout::XYZ32 && bytes_per_pixel)
+                offset = addPointField(msg, bytes_per_pixel == 3 ? "bgr" : "intensity", bytes_per_pixel, PointField::UINT8, offset);
+            msg.point_step = offset;
+        }
+
+        inline const sensor_msgs::PointField* findField(const sensor_msgs::PointCloud2& msg, const std::string& name)
+        {
+            for (const sensor_msgs::PointField& field : msg.fields)
+            {
+                if (field.name == name)
+                    return &field;
+            }
+            return nullptr;
+        }
+
+        // Detects the layout of a published cloud and its color size (0, 1 or 3 bytes per pixel).
+        inline bool detectLayout(const sensor_msgs::PointCloud2& msg, PointCloudLayout& layout, int& bytes_per_pixel)
+        {
+            if (findField(msg, "x_mm"))       layout = PointCloudLayout::XYZ16;
+            else if (findField(msg, "x_f16")) layout = PointCloudLayout::XYZF16;
+            else if (findField(msg, "z_mm"))  layout = PointCloudLayout::Z16;
+            else if (findField(msg, "x"))     layout = PointCloudLayout::XYZ32;
+            else return false;
+            bytes_per_pixel = findField(msg, "rgb") || findField(msg, "bgr") ? 3 : (findField(msg, "intensity") ? 1 : 0);
+            return msg.point_step == pointStep(layout, bytes_per_pixel);
+        }
+    }
+
+    /**
+     * Decodes a pointcloud published in any PointCloudLayout into xyz triplets in meters and, optionally, bgr
+     * triplets (an intensity is replicated to all three). camera_info (matching the cloud's frame) is only
+     * needed for the Z16 layout, whose invalid pixels decode to (0, 0, 0). Returns false if the layout is
+     * unknown or camera_info is missing.
+     */
+    inline bool decodePointCloud(const sensor_msgs::PointCloud2& msg, const sensor_msgs::CameraInfo* camera_info,
+                                 std::vector<float>& xyz, std::vector<uint8_t>* bgr = nullptr)
+    {
+        using namespace pointcloud_layout;
+        PointCloudLayout layout;
+        int bytes_per_pixel;
+        if (!detectLayout(msg, layout, bytes_per_pixel) || (layout == PointCloudLayout::Z16 && !camera_info))
+            return false;
+
+        std::size_t count = static_cast<std::size_t>(msg.width) * msg.height;
+        xyz.resize(3 * count);
+        if (bgr)
+            bgr->assign(3 * count, 0);
+
+        uint32_t xyz_size = pointStep(layout, 0);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const uint8_t* point = msg.data.data() + (i / msg.width) * msg.row_step + (i % msg.width) * msg.point_step;
+            float* out = xyz.data() + 3 * i;
+            switch (layout)
+            {
+                case PointCloudLayout::XYZ32:
+                    memcpy(out, point, 3 * sizeof(float));
+                    break;
+                case PointCloudLayout::XYZ16:
+                {
+                    int16_t mm[3];
+                    memcpy(mm, point, sizeof(mm));
+                    for (int c = 0; c < 3; ++c)
+                        out[c] = mm[c] * 0.001f;
+                    break;
+                }
+                case PointCloudLayout::XYZF16:
+                {
+                    uint16_t half[3];
+                    memcpy(half, point, sizeof(half));
+                    for (int c = 0; c < 3; ++c)
+                        out[c] = halfToFloat(half[c]);
+                    break;
+                }
+                case PointCloudLayout::Z16:
+                {
+                    uint16_t mm;
+                    memcpy(&mm, point, sizeof(mm));
+                    float z = mm * 0.001f;
+                    float u = static_cast<float>(i % msg.width);
+                    float v = static_cast<float>(i / msg.width);
+                    out[0] = (u - static_cast<float>(camera_info->K[2])) / static_cast<float>(camera_info->K[0]) * z;
+                    out[1] = (v - static_cast<float>(camera_info->K[5])) / static_cast<float>(camera_info->K[4]) * z;
+                    out[2] = z;
+                    break;
+                }
+            }
+            if (bgr && bytes_per_pixel)
+            {
+                const uint8_t* color = point + xyz_size;
+                for (int c = 0; c < 3; ++c)
+                    (*bgr)[3 * i + c] = color[bytes_per_pixel == 3 ? c : 0];
+            }
+        }
+        return true;
+    }
+}
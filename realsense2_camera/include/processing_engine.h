@@ -0,0 +1,98 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include "bounded_queue.h"
+#include <librealsense2/rs.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace realsense2_camera
+{
+    enum class DropPolicy { DROP_OLDEST, DROP_NEWEST, BLOCK };
+
+    bool parseDropPolicy(const std::string& name, DropPolicy& policy);
+    const char* dropPolicyName(DropPolicy policy);
+
+    /**
+     * Moves frame processing off the librealsense callback threads. push() only puts the frame into the
+     * bounded lock-free queue of its stream, applying the queue's policy when it is full:
+     *  DROP_OLDEST - discard the oldest queued frame, keeping latency low.
+     *  DROP_NEWEST - discard the pushed frame.
+     *  BLOCK       - wait for room, holding back the librealsense thread as inline processing did.
+     * A pool of worker threads serves all queues. A queue is processed by one worker at a time, so the
+     * frames of a stream are handled in order and never concurrently, like on their librealsense thread.
+     */
+    class ProcessingEngine
+    {
+        public:
+            typedef std::function<void(rs2::frame)> Handler;
+
+            struct QueueStats
+            {
+                std::string name;
+                DropPolicy policy;
+                std::size_t capacity;
+                std::size_t depth;
+                std::size_t max_depth;
+                uint64_t pushed;
+                uint64_t processed;
+                uint64_t dropped;
+            };
+
+            ProcessingEngine();
+            ~ProcessingEngine();
+
+            // Queues must all be added before start().
+            std::size_t addQueue(const std::string& name, std::size_t capacity, DropPolicy policy, Handler handler);
+            void start(std::size_t num_threads);
+            // Joins the workers. Queued frames are released unprocessed and later pushes are dropped.
+            void stop();
+
+            void push(std::size_t queue_id, rs2::frame frame);
+
+            std::size_t numQueues() const { return _queues.size(); }
+            QueueStats stats(std::size_t queue_id) const;
+
+        private:
+            struct Queue
+            {
+                Queue(const std::string& name, std::size_t capacity, DropPolicy policy, Handler handler);
+
+                std::string _name;
+                std::size_t _capacity;
+                DropPolicy _policy;
+                Handler _handler;
+                BoundedQueue<rs2::frame> _frames;
+                std::atomic<std::size_t> _depth;
+                std::atomic<std::size_t> _max_depth;
+                std::atomic<uint64_t> _pushed;
+                std::atomic<uint64_t> _processed;
+                std::atomic<uint64_t> _dropped;
+                std::atomic_flag _busy;
+            };
+
+            bool reserve(Queue& queue);
+            bool processOne(Queue& queue);
+            void run(std::size_t first_queue);
+            void wakeWorkers();
+
+            std::vector<std::unique_ptr<Queue> > _queues;
+            std::vector<std::thread> _threads;
+            std::atomic<bool> _stop;
+
+            // Idle workers sleep until the generation, bumped by every push, changes.
+            std::atomic<uint64_t> _generation;
+            std::atomic<int> _sleeping_workers;
+            std::mutex _mutex;
+            std::condition_variable _work_cv;
+            std::condition_variable _room_cv;
+    };
+}
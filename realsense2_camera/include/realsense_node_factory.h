@@ -23,6 +23,9 @@
 #include <thread>
 #include <std_srvs/Empty.h>
 
+// Lower case, with the characters ROS names don't allow replaced by underscores.
+std::string create_graph_resource_name(const std::string &original_name);
+
 namespace realsense2_camera
 {
     const stream_index_pair COLOR{RS2_STREAM_COLOR, 0};
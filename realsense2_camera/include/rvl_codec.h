@@ -0,0 +1,41 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Lossless depth codec after A. D. Wilson, "Fast Lossless Depth Image Compression" (RVL). Runs of zero
+     * (invalid) pixels alternate with runs of valid pixels, which are coded as zigzag deltas to the previous
+     * valid pixel. All numbers are variable length codes of 3 bit nibbles, packed 8 to a little endian
+     * 32 bit word. Depth images of a structured scene typically shrink 3-5x at several hundred MB/s.
+     *
+     * Image payload of the node's rvl topics: uint32 width, uint32 height (little endian), then the RVL words
+     * of the width * height Z16 pixels in row-major order.
+     *
+     * This header and rvl_codec.cpp have no dependencies: they build as the realsense2_camera_rvl library,
+     * for subscribers that only need to decode.
+     */
+    namespace rvl
+    {
+        static const std::size_t IMAGE_HEADER_SIZE = 8;
+
+        // Upper bound of the encoded size of count pixels, in bytes.
+        std::size_t maxEncodedSize(std::size_t count);
+
+        // Encodes count pixels into out, which must hold maxEncodedSize(count) bytes. Returns the encoded size.
+        std::size_t encode(const uint16_t* depth, std::size_t count, uint8_t* out);
+
+        // Decodes exactly count pixels. Returns false if the data is truncated or holds more pixels.
+        bool decode(const uint8_t* data, std::size_t size, uint16_t* depth, std::size_t count);
+
+        // Image payload, including the header.
+        std::size_t encodeImage(const uint16_t* depth, uint32_t width, uint32_t height, std::vector<uint8_t>& out);
+        bool decodeImage(const uint8_t* data, std::size_t size, std::vector<uint16_t>& depth, uint32_t& width, uint32_t& height);
+    }
+}
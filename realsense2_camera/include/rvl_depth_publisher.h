@@ -0,0 +1,48 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include "depth_kernels.h"
+#include "message_pool.h"
+#include "worker_pool.h"
+#include <librealsense2/rs.hpp>
+#include <ros/ros.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <condition_variable>
+#include <mutex>
+
+namespace realsense2_camera
+{
+    /**
+     * Publishes Z16 depth as RVL compressed sensor_msgs::CompressedImage (format "16UC1; rvl", payload as
+     * described in rvl_codec.h). The frame is conditioned and encoded on the worker pool, so the callback
+     * thread only queues it. Messages leave in the order the frames were queued, whichever worker
+     * encodes them; frames that find the queue full are dropped.
+     */
+    class RvlDepthPublisher
+    {
+        public:
+            static const std::string FORMAT;
+
+            // workers must outlive the publisher. status_changed is called when a subscriber connects or disconnects.
+            RvlDepthPublisher(ros::NodeHandle& node_handle, const std::string& topic, WorkerPool& workers,
+                              const ros::SubscriberStatusCallback& status_changed = ros::SubscriberStatusCallback());
+
+            uint32_t getNumSubscribers() const { return _publisher.getNumSubscribers(); }
+
+            // Returns false if the frame was dropped.
+            bool publish(rs2::frame depth, const std_msgs::Header& header, const DepthConditioning& conditioning);
+
+        private:
+            void encode(rs2::frame depth, const std_msgs::Header& header, const DepthConditioning& conditioning, uint64_t ticket);
+
+            ros::Publisher _publisher;
+            WorkerPool& _workers;
+            MessagePool<sensor_msgs::CompressedImage> _pool;
+            std::mutex _mutex;
+            std::condition_variable _cv;
+            uint64_t _next_ticket;
+            uint64_t _next_publish_ticket;
+    };
+}
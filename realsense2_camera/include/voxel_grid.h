@@ -0,0 +1,48 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Voxel grid downsampling of the packed clouds written by PointCloudAssembler (x, y, z as FLOAT32 at
+     * offsets 0, 4 and 8, and optionally a 4 byte color at offset 16). Each occupied voxel becomes one point:
+     * the centroid of its points with the per byte average of their colors.
+     *
+     * Voxels are accumulated in an open addressing hash table that is kept between frames, so a frame costs a
+     * single pass over its points without any allocation once the table has grown to size.
+     */
+    class VoxelGrid
+    {
+        public:
+            VoxelGrid() : _epoch(0), _table_bits(0) {}
+
+            // Points with z <= 0 are ignored and voxels holding fewer than min_points points are dropped.
+            // out must hold count points of point_step bytes. Returns the number of points written, ordered by
+            // the first point that fell into each voxel.
+            std::size_t filter(const uint8_t* points, std::size_t count, uint32_t point_step, bool has_color,
+                               float leaf_size, int min_points, uint8_t* out);
+
+        private:
+            struct Voxel
+            {
+                uint64_t key;
+                uint32_t epoch;     // The voxel is empty unless it matches the current epoch.
+                uint32_t count;
+                float sum[3];
+                uint32_t color_sum[4];
+            };
+
+            void prepareTable(std::size_t count);
+
+            std::vector<Voxel> _table;
+            std::vector<uint32_t> _occupied;
+            uint32_t _epoch;
+            int _table_bits;
+    };
+}
@@ -0,0 +1,40 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace realsense2_camera
+{
+    /**
+     * Fixed set of threads running jobs off the librealsense callback thread. The queue is bounded and
+     * submit() never blocks: when the workers fall behind, new jobs are refused and the caller drops the frame.
+     */
+    class WorkerPool
+    {
+        public:
+            WorkerPool(std::size_t num_threads, std::size_t max_queued_jobs);
+            ~WorkerPool();
+
+            // Returns false, without running the job, if the queue is full.
+            bool submit(std::function<void()> job);
+
+            std::size_t size() const { return _threads.size(); }
+
+        private:
+            void run();
+
+            std::mutex _mutex;
+            std::condition_variable _cv;
+            std::deque<std::function<void()> > _jobs;
+            std::size_t _max_queued_jobs;
+            bool _stop;
+            std::vector<std::thread> _threads;
+    };
+}
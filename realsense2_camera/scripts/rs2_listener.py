@@ -56,6 +56,7 @@ class CWaitForMessage:
                        'alignedDepthColor': {'topic': '/camera/aligned_depth_to_color/image_raw', 'callback': self.imageColorCallback, 'msg_type': msg_Image},
                        'static_tf': {'topic': '/camera/color/image_raw', 'callback': self.imageColorCallback, 'msg_type': msg_Image},
                        'accelStream': {'topic': '/camera/accel/sample', 'callback': self.imuCallback, 'msg_type': msg_Imu},
+                       'imuOrientation': {'topic': '/camera/imu', 'callback': self.imuOrientationCallback, 'msg_type': msg_Imu},
                        }
 
         self.func_data = dict()
@@ -85,6 +86,19 @@ class CWaitForMessage:
             self.func_data[theme_name]['ros_value'].append(rotated)
         return _imuCallback            
 
+    def imuOrientationCallback(self, theme_name):
+        def _imuOrientationCallback(data):
+            self.prev_time = time.time()
+            self.func_data[theme_name].setdefault('stamp', [])
+            self.func_data[theme_name].setdefault('orientation', [])
+            self.func_data[theme_name].setdefault('orientation_covariance', [])
+            self.func_data[theme_name].setdefault('accel', [])
+            self.func_data[theme_name]['stamp'].append(data.header.stamp.to_sec())
+            self.func_data[theme_name]['orientation'].append(np.array([data.orientation.x, data.orientation.y, data.orientation.z, data.orientation.w]))
+            self.func_data[theme_name]['orientation_covariance'].append(data.orientation_covariance[0])
+            self.func_data[theme_name]['accel'].append(np.array([data.linear_acceleration.x, data.linear_acceleration.y, data.linear_acceleration.z]))
+        return _imuOrientationCallback
+
     def imageColorCallback(self, theme_name):
         def _imageColorCallback(data):
             self.prev_time = time.time()
@@ -42,6 +42,56 @@ def AccelGetDataDeviceStandStraight(rec_filename):
     gt_data['ros_max_diff'] = np.array([1.97013582e-02, 4.65862500e-09, 4.06165277e-02])
     return gt_data
 
+def AccelGetDataUpDirection(rec_filename):
+    # res['up'] = the direction of the mean accel of the recording, against gravity, in the imu frame.
+    bag = rosbag.Bag(rec_filename)
+    values = np.array([[msg.linear_acceleration.x, msg.linear_acceleration.y, msg.linear_acceleration.z]
+                       for topic, msg, t in bag.read_messages(topics='/device_0/sensor_2/Accel_0/imu/data')])
+    mean = values.mean(0)
+    res = dict()
+    res['up'] = mean / np.linalg.norm(mean)
+    res['settle_secs'] = 1.0
+    res['max_angle'] = 0.05
+    res['max_spread'] = 0.02
+    return res
+
+def ImuOrientationTest(data, gt_data):
+    # check that the estimated orientation of the imu, which stands still, turns the recorded up direction onto
+    # the world z axis and that its roll and pitch do not wander. Yaw is not observed and is not checked.
+    try:
+        stamps = np.array(data['stamp'])
+        msg = 'Expect an orientation in all the imu messages. Got %d of %d.' % ((np.array(data['orientation_covariance']) >= 0).sum(), len(stamps))
+        print (msg)
+        if len(stamps) == 0 or (np.array(data['orientation_covariance']) < 0).any():
+            return False, msg
+        settled = stamps >= stamps.min() + gt_data['settle_secs']
+        msg = 'Expect imu messages past the first %.1f sec. Got %d.' % (gt_data['settle_secs'], settled.sum())
+        print (msg)
+        if not settled.any():
+            return False, msg
+        ups = []
+        for quat, is_settled in zip(data['orientation'], settled):
+            if is_settled:
+                # The world z axis in the imu frame: the last row of the rotation from the imu to the world.
+                ups.append(tf.transformations.quaternion_matrix(quat)[2, :3])
+        ups = np.array(ups)
+        angles = np.arccos(np.clip(ups.dot(gt_data['up']), -1, 1))
+        msg = 'Expect the orientation to be within %.3f rad of gravity. Got %.3f rad.' % (gt_data['max_angle'], angles.max())
+        print (msg)
+        if angles.max() > gt_data['max_angle']:
+            return False, msg
+        mean_up = ups.mean(0) / np.linalg.norm(ups.mean(0))
+        spread = np.arccos(np.clip(ups.dot(mean_up), -1, 1)).max()
+        msg = 'Expect the tilt to stay within %.3f rad. Got %.3f rad.' % (gt_data['max_spread'], spread)
+        print (msg)
+        if spread > gt_data['max_spread']:
+            return False, msg
+    except Exception as e:
+        msg = '%s' % e
+        print ('Test Failed: %s' % msg)
+        return False, msg
+    return True, ''
+
 def ImuTest(data, gt_data):
     # check that the imu data received is the same as in the recording. 
     # check that in the rotated imu received the g-accelartation is pointing up according to ROS standards.
@@ -116,6 +166,60 @@ def ImageDepthInColorShapeGetData(rec_filename):
     gt_data['ok_percent']['epsilon'] *= 3
     return gt_data
 
+def AlignedDepthColorGetData(rec_filename):
+    # res['frames'] = [average, non-zero fraction] of the depth of every frameset of the recording, aligned to color
+    # by librealsense's rs2::align.
+    import pyrealsense2 as rs2
+    config = rs2.config()
+    rs2.config.enable_device_from_file(config, rec_filename, repeat_playback=False)
+    pipeline = rs2.pipeline()
+    profile = pipeline.start(config)
+    profile.get_device().as_playback().set_real_time(False)
+    align = rs2.align(rs2.stream.color)
+    res = dict()
+    res['frames'] = []
+    while True:
+        success, frameset = pipeline.try_wait_for_frames(1000)
+        if not success:
+            break
+        if not frameset.get_depth_frame() or not frameset.get_color_frame():
+            continue
+        aligned = align.process(frameset).get_depth_frame()
+        pyimg = np.asanyarray(aligned.get_data())
+        ok_number = (pyimg != 0).sum()
+        res['frames'].append([float(pyimg.sum()) / ok_number, float(ok_number) / pyimg.size])
+        res['shape'] = pyimg.shape
+    pipeline.stop()
+    res['frames'] = np.array(res['frames'])
+    # The lookup tables and rs2::align may round a pixel boundary differently: allow 100 pixels in a million.
+    res['ok_percent_epsilon'] = 1e-4
+    res['avg_epsilon'] = 1e-3
+    return res
+
+def AlignedDepthMatchTest(data, gt_data):
+    # check that every aligned depth image received is one of the recording aligned by rs2::align: each is matched
+    # to the frame of the nearest non-zero fraction, as the aligned depth only depends on the depth frame.
+    try:
+        msg = 'Expected shape to be %s. Got %s' % (gt_data['shape'], set(data['shape']))
+        print (msg)
+        if len(gt_data['frames']) == 0 or len(set(data['shape'])) != 1 or list(set(data['shape']))[0] != gt_data['shape']:
+            return False, msg
+        worst_ok, worst_avg = 0, 0
+        for avg, ok_percent in zip(data['avg'], data['ok_percent']):
+            nearest = gt_data['frames'][abs(gt_data['frames'][:, 1] - ok_percent).argmin()]
+            worst_ok = max(worst_ok, abs(nearest[1] - ok_percent))
+            worst_avg = max(worst_avg, abs(nearest[0] - avg) / nearest[0])
+        msg = 'Expect no holes percent within %.5f and average within %.4f of rs2::align. Got %.5f and %.4f in %d images.' % \
+              (gt_data['ok_percent_epsilon'], gt_data['avg_epsilon'], worst_ok, worst_avg, len(data['avg']))
+        print (msg)
+        if worst_ok > gt_data['ok_percent_epsilon'] or worst_avg > gt_data['avg_epsilon']:
+            return False, msg
+    except Exception as e:
+        msg = '%s' % e
+        print ('Test Failed: %s' % msg)
+        return False, msg
+    return True, ''
+
 def ImageDepthGetData_decimation(rec_filename):
     gt_data = ImageDepthGetData(rec_filename)
     gt_data['shape'] = [x/2 for x in gt_data['shape']]
@@ -219,6 +323,9 @@ test_types = {'vis_avg': {'listener_theme': 'colorStream',
               'align_depth_color': {'listener_theme': 'alignedDepthColor',
                                    'data_func': ImageDepthInColorShapeGetData,
                                    'test_func': ImageColorTest_3epsilon},
+              'align_depth_lut_color': {'listener_theme': 'alignedDepthColor',
+                                   'data_func': AlignedDepthColorGetData,
+                                   'test_func': AlignedDepthMatchTest},
               'depth_avg_decimation': {'listener_theme': 'depthStream',
                                    'data_func': ImageDepthGetData_decimation,
                                    'test_func': ImageColorTest},
@@ -237,6 +344,9 @@ test_types = {'vis_avg': {'listener_theme': 'colorStream',
               'accel_up':   {'listener_theme': 'accelStream',
                                   'data_func': AccelGetDataDeviceStandStraight,
                                   'test_func': ImuTest},
+              'imu_orientation': {'listener_theme': 'imuOrientation',
+                                  'data_func': AccelGetDataUpDirection,
+                                  'test_func': ImuOrientationTest},
               }
 
 
@@ -348,11 +458,13 @@ def main():
                  {'name': 'depth_w_cloud_1', 'type': 'depth_avg', 'params': {'rosbag_filename': outdoors_filename, 'enable_pointcloud': 'true'}},
                 #  {'name': 'points_cloud_1', 'type': 'pointscloud_avg', 'params': {'rosbag_filename': outdoors_filename, 'enable_pointcloud': 'true'}},
                 #  {'name': 'align_depth_color_1', 'type': 'align_depth_color', 'params': {'rosbag_filename': outdoors_filename, 'align_depth': 'true'}},
+                 {'name': 'align_depth_lut_color_1', 'type': 'align_depth_lut_color', 'params': {'rosbag_filename': outdoors_filename, 'align_depth': 'true', 'align_depth_lut': 'true'}},
                 #  {'name': 'align_depth_ir1_1', 'type': 'align_depth_ir1', 'params': {'rosbag_filename': outdoors_filename, 'align_depth': 'true'}},
                  {'name': 'depth_avg_decimation_1', 'type': 'depth_avg_decimation', 'params': {'rosbag_filename': outdoors_filename, 'filters': 'decimation'}},
                 #  {'name': 'align_depth_ir1_decimation_1', 'type': 'align_depth_ir1_decimation', 'params': {'rosbag_filename': outdoors_filename, 'filters': 'decimation', 'align_depth': 'true'}},
                 #  {'name': 'static_tf_1', 'type': 'static_tf', 'params': {'rosbag_filename': outdoors_filename}},   # Not working in Travis...
                 #  {'name': 'accel_up_1', 'type': 'accel_up', 'params': {'rosbag_filename': './records/D435i_Depth_and_IMU_Stands_still.bag'}},  # Keeps failing on Travis CI. See https://github.com/IntelRealSense/realsense-ros/pull/1504#issuecomment-744226704
+                 {'name': 'imu_orientation_1', 'type': 'imu_orientation', 'params': {'rosbag_filename': './records/D435i_Depth_and_IMU_Stands_still.bag', 'unite_imu_method': 'linear_interpolation', 'imu_orientation': 'true'}},
                  ]
 
     # Normalize parameters:
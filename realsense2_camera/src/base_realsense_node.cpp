@@ -3,6 +3,7 @@
 #include <boost/algorithm/string.hpp>
 #include <algorithm>
 #include <cctype>
+#include <limits>
 #include <mutex>
 
 #include <dynamic_reconfigure/IntParameter.h>
@@ -18,58 +19,131 @@ using namespace ddynamic_reconfigure;
 #define OPTICAL_FRAME_ID(sip) (static_cast<std::ostringstream&&>(std::ostringstream() << "camera_" << STREAM_NAME(sip) << "_optical_frame")).str()
 #define ALIGNED_DEPTH_TO_FRAME_ID(sip) (static_cast<std::ostringstream&&>(std::ostringstream() << "camera_aligned_depth_to_" << STREAM_NAME(sip) << "_frame")).str()
 
-SyncedImuPublisher::SyncedImuPublisher(ros::Publisher imu_publisher, std::size_t waiting_list_size):
-            _publisher(imu_publisher), _pause_mode(false),
-            _waiting_list_size(waiting_list_size)
-            {}
-
-SyncedImuPublisher::~SyncedImuPublisher()
+bool realsense2_camera::parseImuOverflowPolicy(const std::string& name, ImuOverflowPolicy& policy)
 {
-    PublishPendingMessages();
+    if (name == "drop_oldest")      policy = ImuOverflowPolicy::DROP_OLDEST;
+    else if (name == "drop_newest") policy = ImuOverflowPolicy::DROP_NEWEST;
+    else if (name == "flush")       policy = ImuOverflowPolicy::FLUSH;
+    else return false;
+    return true;
 }
 
-void SyncedImuPublisher::Publish(sensor_msgs::Imu imu_msg)
+const char* realsense2_camera::imuOverflowPolicyName(ImuOverflowPolicy policy)
 {
-    std::lock_guard<std::mutex> lock_guard(_mutex);
-    if (_pause_mode)
-    {
-        if (_pending_messages.size() >= _waiting_list_size)
-        {
-            throw std::runtime_error("SyncedImuPublisher inner list reached maximum size of " + std::to_string(_pending_messages.size()));
-        }
-        _pending_messages.push(imu_msg);
-    }
-    else
+    switch (policy)
     {
-        _publisher.publish(imu_msg);
-        // ROS_INFO_STREAM("iid1:" << imu_msg.header.seq << ", time: " << std::setprecision (20) << imu_msg.header.stamp.toSec());
+        case ImuOverflowPolicy::DROP_OLDEST: return "drop_oldest";
+        case ImuOverflowPolicy::DROP_NEWEST: return "drop_newest";
+        default:                             return "flush";
     }
-    return;
 }
 
-void SyncedImuPublisher::Pause()
+SyncedImuPublisher::SyncedImuPublisher() :
+    SyncedImuPublisher(ros::Publisher(), 1)
+{}
+
+SyncedImuPublisher::SyncedImuPublisher(ros::Publisher imu_publisher, std::size_t capacity, ImuOverflowPolicy overflow_policy):
+            _publisher(imu_publisher),
+            _messages(std::max<std::size_t>(capacity, 1)),
+            _overflow_policy(overflow_policy),
+            _is_enabled(false),
+            _release_stamp(std::numeric_limits<double>::infinity()),
+            _release_requested(false),
+            _dropped(0),
+            _flushed(0)
+{
+    _releasing.clear();
+}
+
+SyncedImuPublisher::~SyncedImuPublisher()
+{
+    _release_stamp = std::numeric_limits<double>::infinity();
+    publishReleased();
+}
+
+void SyncedImuPublisher::frameArrived(const ros::Time& t)
 {
     if (!_is_enabled) return;
-    std::lock_guard<std::mutex> lock_guard(_mutex);
-    _pause_mode = true;
+    std::lock_guard<std::mutex> lock_guard(_frames_mutex);
+    _frames_in_flight.insert(t.toSec());
+    _release_stamp = *_frames_in_flight.begin();
 }
 
-void SyncedImuPublisher::Resume()
+void SyncedImuPublisher::framePublished(const ros::Time& t)
 {
-    std::lock_guard<std::mutex> lock_guard(_mutex);
-    PublishPendingMessages();
-    _pause_mode = false;
+    if (!_is_enabled) return;
+    {
+        std::lock_guard<std::mutex> lock_guard(_frames_mutex);
+        auto frame = _frames_in_flight.find(t.toSec());
+        if (frame == _frames_in_flight.end())
+            return;
+        // Frames may be published out of order, e.g. by the workers of different streams: the messages stay held
+        // until the oldest frame still in processing is published.
+        _frames_in_flight.erase(frame);
+        _release_stamp = _frames_in_flight.empty() ? std::numeric_limits<double>::infinity() : *_frames_in_flight.begin();
+    }
+    publishReleased();
 }
 
-void SyncedImuPublisher::PublishPendingMessages()
+void SyncedImuPublisher::Publish(sensor_msgs::Imu imu_msg)
 {
-    // ROS_INFO_STREAM("publish imu: " << _pending_messages.size());
-    while (!_pending_messages.empty())
+    if (!_is_enabled)
     {
-        const sensor_msgs::Imu &imu_msg = _pending_messages.front();
         _publisher.publish(imu_msg);
-        // ROS_INFO_STREAM("iid2:" << imu_msg.header.seq << ", time: " << std::setprecision (20) << imu_msg.header.stamp.toSec());
-        _pending_messages.pop();
+        return;
+    }
+    while (!_messages.try_push(imu_msg))
+    {
+        if (_overflow_policy == ImuOverflowPolicy::DROP_NEWEST)
+        {
+            ++_dropped;
+            return;
+        }
+        // A thread releasing messages makes room anyway.
+        if (!takeOldest())
+            std::this_thread::yield();
+    }
+    publishReleased();
+}
+
+// Makes room for a new message according to the overflow policy. False if another thread is the consumer.
+bool SyncedImuPublisher::takeOldest()
+{
+    if (_releasing.test_and_set(std::memory_order_acquire))
+        return false;
+    sensor_msgs::Imu oldest;
+    if (_messages.try_pop(oldest))
+    {
+        if (_overflow_policy == ImuOverflowPolicy::FLUSH)
+        {
+            _publisher.publish(oldest);
+            ++_flushed;
+        }
+        else
+        {
+            ++_dropped;
+        }
+    }
+    _releasing.clear(std::memory_order_release);
+    return true;
+}
+
+// Any thread may ask; one releases at a time. A request made while another thread releases is picked up by it.
+void SyncedImuPublisher::publishReleased()
+{
+    _release_requested = true;
+    while (_release_requested.load() && !_releasing.test_and_set(std::memory_order_acquire))
+    {
+        _release_requested = false;
+        double release_stamp(_release_stamp.load());
+        const sensor_msgs::Imu* imu_msg;
+        while ((imu_msg = _messages.front()) && imu_msg->header.stamp.toSec() <= release_stamp)
+        {
+            _publisher.publish(*imu_msg);
+            sensor_msgs::Imu released;
+            _messages.try_pop(released);
+        }
+        _releasing.clear(std::memory_order_release);
     }
 }
 
@@ -87,8 +161,23 @@ BaseRealSenseNode::BaseRealSenseNode(ros::NodeHandle& nodeHandle,
     _is_running(true), _base_frame_id(""),  _node_handle(nodeHandle),
     _pnh(privateNodeHandle), _dev(dev), _json_file_path(""),
     _serial_no(serial_no),
+    _imu_sync_seq(0),
     _is_initialized_time_base(false),
-    _namespace(getNamespaceStr())
+    _filter_demand_changed(true),
+    _filter_demand(~uint64_t(0)),
+    _align_target_demand(~uint64_t(0)),
+    _depth_demanded(true),
+    _sensors_enabled(true),
+    _stream_demand_changed(true),
+    _depth_aligner_depth_id(-1),
+    _depth_aligner_units(0),
+    _align_stage_targets(0),
+    _depth_aligned_to_color(false),
+    _namespace(getNamespaceStr()),
+    _pointcloud_generator_depth_id(-1),
+    _pointcloud_generator_texture_id(-1),
+    _pointcloud_generator_units(0),
+    _pointcloud_generator_textured(false)
 {
     // Types for depth stream
     _format[RS2_STREAM_DEPTH] = RS2_FORMAT_Z16;
@@ -110,6 +199,7 @@ BaseRealSenseNode::BaseRealSenseNode(ros::NodeHandle& nodeHandle,
     _encoding[RS2_STREAM_INFRARED] = sensor_msgs::image_encodings::MONO8; // ROS message type
     _unit_step_size[RS2_STREAM_INFRARED] = sizeof(uint8_t); // sensor_msgs::ImagePtr row step size
     _stream_name[RS2_STREAM_INFRARED] = "infra";
+    _depth_aligned_encoding[RS2_STREAM_INFRARED] = sensor_msgs::image_encodings::TYPE_16UC1;
 
     // Types for color stream
     _image_format[RS2_STREAM_COLOR] = CV_8UC3;    // CVBridge type
@@ -123,6 +213,7 @@ BaseRealSenseNode::BaseRealSenseNode(ros::NodeHandle& nodeHandle,
     _encoding[RS2_STREAM_FISHEYE] = sensor_msgs::image_encodings::MONO8; // ROS message type
     _unit_step_size[RS2_STREAM_FISHEYE] = sizeof(uint8_t); // sensor_msgs::ImagePtr row step size
     _stream_name[RS2_STREAM_FISHEYE] = "fisheye";
+    _depth_aligned_encoding[RS2_STREAM_FISHEYE] = sensor_msgs::image_encodings::TYPE_16UC1;
 
     // Types for Motion-Module streams
     _stream_name[RS2_STREAM_GYRO] = "gyro";
@@ -139,6 +230,9 @@ BaseRealSenseNode::~BaseRealSenseNode()
     // Kill dynamic transform thread
     _is_running = false;
     _cv_tf.notify_one();
+    _auto_streams_cv.notify_one();
+    if (_auto_streams_t && _auto_streams_t->joinable())
+        _auto_streams_t->join();
     if (_tf_t && _tf_t->joinable())
         _tf_t->join();
     if (_update_functions_t && _update_functions_t->joinable())
@@ -150,9 +244,16 @@ BaseRealSenseNode::~BaseRealSenseNode()
         _monitoring_t->join();
     }
 
+    if (_auto_streams)
+    {
+        std::lock_guard<std::mutex> lock_guard(_sensors_mutex);
+        applyActiveStreams(std::set<stream_index_pair>());
+    }
     std::set<std::string> module_names;
     for (const std::pair<stream_index_pair, std::vector<rs2::stream_profile>>& profile : _enabled_profiles)
     {
+        if (_auto_streams)
+            break;
         try
         {
             std::string module_name = _sensors[profile.first].get_info(RS2_CAMERA_INFO_NAME);
@@ -168,10 +269,25 @@ BaseRealSenseNode::~BaseRealSenseNode()
             ROS_ERROR_STREAM("Exception: " << e.what());
         }
     }
+    // The sensors are stopped, join the workers before the members they use are destroyed.
+    if (_processing_engine)
+        _processing_engine->stop();
+    if (_filter_pipeline)
+        _filter_pipeline->stop();
 }
 
 void BaseRealSenseNode::toggleSensors(bool enabled)
 {
+  if (_auto_streams)
+  {
+    // The streams with subscribers are opened again by the auto_streams thread.
+    std::lock_guard<std::mutex> lock_guard(_sensors_mutex);
+    _sensors_enabled = enabled;
+    if (!enabled)
+        applyActiveStreams(std::set<stream_index_pair>());
+    onSubscribersChanged();
+    return;
+  }
   if(enabled)
   {
     std::map<std::string, std::vector<rs2::stream_profile> > profiles;
@@ -247,8 +363,13 @@ void BaseRealSenseNode::publishTopics()
     setupErrorCallback();
     enable_devices();
     setupPublishers();
-    setupStreams();
+    setupProcessingEngine();
+    setupFilterPipeline();
+    setupStreamContexts();
     SetBaseStream();
+    setupPointCloudCrop();
+    setupStreams();
+    registerPointCloudCropOptions();
     registerAutoExposureROIOptions(_node_handle);
     publishStaticTransforms();
     publishIntrinsics();
@@ -729,6 +850,23 @@ void BaseRealSenseNode::getParameters()
     }
 
     _pnh.param("align_depth", _align_depth, ALIGN_DEPTH);
+    _pnh.param("align_depth_lut", _align_depth_lut, ALIGN_DEPTH_LUT);
+    std::string align_depth_to_str;
+    _pnh.param("align_depth_to", align_depth_to_str, ALIGN_DEPTH_TO);
+    std::vector<std::string> align_depth_to;
+    boost::split(align_depth_to, align_depth_to_str, [](char c){return c == ',';});
+    for (std::string& name : align_depth_to)
+    {
+        name.erase(std::remove_if(name.begin(), name.end(), isspace), name.end());
+        if (name.empty())
+            continue;
+        auto stream = std::find_if(IMAGE_STREAMS.begin(), IMAGE_STREAMS.end(), [&](const stream_index_pair& sip){return STREAM_NAME(sip) == name;});
+        if (stream == IMAGE_STREAMS.end() || *stream == DEPTH || *stream == CONFIDENCE)
+            ROS_WARN_STREAM("Cannot align depth to " << name << ". Ignored.");
+        else if (std::find(_align_depth_to.begin(), _align_depth_to.end(), *stream) == _align_depth_to.end())
+            _align_depth_to.push_back(*stream);
+    }
+    _align_depth_to_color = _align_depth && std::find(_align_depth_to.begin(), _align_depth_to.end(), COLOR) != _align_depth_to.end();
     _pnh.param("enable_pointcloud", _pointcloud, POINTCLOUD);
     std::string pc_texture_stream("");
     int pc_texture_idx;
@@ -748,6 +886,31 @@ void BaseRealSenseNode::getParameters()
 
     _pnh.param("json_file_path", _json_file_path, std::string(""));
 
+    _pnh.param("processing_threads", _processing_threads, PROCESSING_THREADS);
+    _pnh.param("processing_queue_size", _processing_queue_size, PROCESSING_QUEUE_SIZE);
+    std::string drop_policy_str;
+    _pnh.param("drop_policy", drop_policy_str, DROP_POLICY);
+    if (!parseDropPolicy(drop_policy_str, _drop_policy))
+    {
+        ROS_WARN_STREAM("Unknown drop_policy " << drop_policy_str << ". Using " << DROP_POLICY);
+        parseDropPolicy(DROP_POLICY, _drop_policy);
+    }
+    _pnh.param("pipeline_filters", _pipeline_filters, PIPELINE_FILTERS);
+    _pnh.param("lazy_filters", _lazy_filters, LAZY_FILTERS);
+    _pnh.param("auto_streams", _auto_streams, AUTO_STREAMS);
+    std::string metadata_fields_str;
+    _pnh.param("metadata_fields", metadata_fields_str, METADATA_FIELDS);
+    std::vector<std::string> metadata_fields;
+    boost::split(metadata_fields, metadata_fields_str, [](char c){return c == ',';});
+    for (std::string& field : metadata_fields)
+    {
+        field.erase(std::remove_if(field.begin(), field.end(), isspace), field.end());
+        if (!field.empty())
+            _metadata_fields.insert(field);
+    }
+    _pnh.param("auto_streams_hold_time", _auto_streams_hold_time, AUTO_STREAMS_HOLD_TIME);
+    _pnh.param("pipeline_queue_size", _pipeline_queue_size, PIPELINE_QUEUE_SIZE);
+
     for (auto& stream : IMAGE_STREAMS)
     {
         std::string param_name(_stream_name[stream.first] + "_width");
@@ -762,6 +925,13 @@ void BaseRealSenseNode::getParameters()
         param_name = "enable_" + STREAM_NAME(stream);
         _pnh.param(param_name, _enable[stream], true);
         ROS_DEBUG_STREAM("parameter:" << param_name << " = " << _enable[stream]);
+        param_name = STREAM_NAME(stream) + "_drop_policy";
+        _pnh.param(param_name, drop_policy_str, std::string(dropPolicyName(_drop_policy)));
+        if (!parseDropPolicy(drop_policy_str, _stream_drop_policy[stream]))
+        {
+            ROS_WARN_STREAM("Unknown " << param_name << " " << drop_policy_str << ". Using drop_policy.");
+            _stream_drop_policy[stream] = _drop_policy;
+        }
     }
 
     for (auto& stream : HID_STREAMS)
@@ -802,18 +972,84 @@ void BaseRealSenseNode::getParameters()
         _pnh.param("imu_optical_frame_id", _optical_frame_id[GYRO], DEFAULT_IMU_OPTICAL_FRAME_ID);
     }
 
+    for (const stream_index_pair& stream : _align_depth_to)
     {
-        stream_index_pair stream(COLOR);
         std::string param_name(static_cast<std::ostringstream&&>(std::ostringstream() << "aligned_depth_to_" << STREAM_NAME(stream) << "_frame_id").str());
         _pnh.param(param_name, _depth_aligned_frame_id[stream], ALIGNED_DEPTH_TO_FRAME_ID(stream));
     }
 
     _pnh.param("allow_no_texture_points", _allow_no_texture_points, ALLOW_NO_TEXTURE_POINTS);
     _pnh.param("ordered_pc", _ordered_pc, ORDERED_POINTCLOUD);
+    _pnh.param("pointcloud_lut", _pointcloud_lut, POINTCLOUD_LUT);
+    _pnh.param("voxel_leaf_size", _voxel_leaf_size, VOXEL_LEAF_SIZE);
+    _pnh.param("voxel_min_points", _voxel_min_points, VOXEL_MIN_POINTS);
+    _pnh.param("voxel_only", _voxel_only, VOXEL_ONLY);
+    std::string pointcloud_layout;
+    _pnh.param("pointcloud_layout", pointcloud_layout, POINTCLOUD_LAYOUT);
+    if (!pointcloud_layout::parseLayout(pointcloud_layout, _pointcloud_layout))
+    {
+        ROS_WARN_STREAM("Unknown pointcloud_layout " << pointcloud_layout << ". Using " << POINTCLOUD_LAYOUT);
+        pointcloud_layout::parseLayout(POINTCLOUD_LAYOUT, _pointcloud_layout);
+    }
+    if (_pointcloud_layout == PointCloudLayout::Z16 && !_ordered_pc)
+    {
+        ROS_WARN_STREAM("pointcloud_layout z16 requires an ordered pointcloud. Setting ordered_pc to true.");
+        _ordered_pc = true;
+    }
+    _pnh.param("crop_box", _crop_params.box, CROP_BOX);
+    std::string crop_box_frame;
+    _pnh.param("crop_box_frame", crop_box_frame, CROP_BOX_FRAME);
+    if (crop_box_frame != "base" && crop_box_frame != "optical")
+    {
+        ROS_WARN_STREAM("Unknown crop_box_frame " << crop_box_frame << ". Using " << CROP_BOX_FRAME);
+        crop_box_frame = CROP_BOX_FRAME;
+    }
+    _crop_params.box_in_base_frame = (crop_box_frame == "base");
+    const std::string axes("xyz");
+    for (int i = 0; i < 3; ++i)
+    {
+        _pnh.param(std::string("crop_box_min_") + axes[i], _crop_params.box_min[i], CROP_BOX_MIN);
+        _pnh.param(std::string("crop_box_max_") + axes[i], _crop_params.box_max[i], CROP_BOX_MAX);
+    }
+    _pnh.param("crop_near", _crop_params.near, CROP_NEAR);
+    _pnh.param("crop_far", _crop_params.far, CROP_FAR);
+    _pnh.param("crop_horizontal_fov", _crop_params.horizontal_fov, CROP_HORIZONTAL_FOV);
+    _pnh.param("crop_vertical_fov", _crop_params.vertical_fov, CROP_VERTICAL_FOV);
+    _pnh.param("zero_copy_images", _zero_copy_images, ZERO_COPY_IMAGES);
+    _pnh.param("rvl_depth", _rvl_depth, RVL_DEPTH);
+    _pnh.param("rvl_threads", _rvl_threads, RVL_THREADS);
     _pnh.param("clip_distance", _clipping_distance, static_cast<float>(-1.0));
+    _pnh.param("min_distance", _min_distance, MIN_DISTANCE);
+    _pnh.param("confidence_threshold", _confidence_threshold, CONFIDENCE_THRESHOLD);
+    _confidence_threshold = std::max(0, std::min(_confidence_threshold, 255));
     _pnh.param("linear_accel_cov", _linear_accel_cov, static_cast<double>(0.01));
     _pnh.param("angular_velocity_cov", _angular_velocity_cov, static_cast<double>(0.01));
     _pnh.param("hold_back_imu_for_frames", _hold_back_imu_for_frames, HOLD_BACK_IMU_FOR_FRAMES);
+    _pnh.param("hold_back_imu_queue_size", _hold_back_imu_queue_size, HOLD_BACK_IMU_QUEUE_SIZE);
+    std::string imu_overflow_policy_str;
+    _pnh.param("hold_back_imu_overflow_policy", imu_overflow_policy_str, HOLD_BACK_IMU_OVERFLOW_POLICY);
+    if (!parseImuOverflowPolicy(imu_overflow_policy_str, _hold_back_imu_overflow_policy))
+    {
+        ROS_WARN_STREAM("Unknown hold_back_imu_overflow_policy " << imu_overflow_policy_str << ". Using " << HOLD_BACK_IMU_OVERFLOW_POLICY);
+        parseImuOverflowPolicy(HOLD_BACK_IMU_OVERFLOW_POLICY, _hold_back_imu_overflow_policy);
+    }
+    std::string imu_batch_mode_str;
+    _pnh.param("imu_batch_mode", imu_batch_mode_str, IMU_BATCH_MODE);
+    if (!parseImuBatchMode(imu_batch_mode_str, _imu_batch_mode))
+    {
+        ROS_WARN_STREAM("Unknown imu_batch_mode " << imu_batch_mode_str << ". Using " << IMU_BATCH_MODE);
+        parseImuBatchMode(IMU_BATCH_MODE, _imu_batch_mode);
+    }
+    _pnh.param("imu_batch_size", _imu_batch_size, IMU_BATCH_SIZE);
+    _pnh.param("imu_decimation_factor", _imu_decimation_factor, IMU_DECIMATION_FACTOR);
+    _pnh.param("imu_decimation_taps", _imu_decimation_taps, IMU_DECIMATION_TAPS);
+    _pnh.param("imu_decimation_cutoff", _imu_decimation_cutoff, IMU_DECIMATION_CUTOFF);
+    _pnh.param("imu_preintegration", _imu_preintegration, IMU_PREINTEGRATION);
+    _pnh.param("imu_orientation", _imu_orientation, IMU_ORIENTATION);
+    _pnh.param("imu_orientation_gain", _imu_orientation_gain, IMU_ORIENTATION_GAIN);
+    double imu_orientation_stddev;
+    _pnh.param("imu_orientation_stddev", imu_orientation_stddev, IMU_ORIENTATION_STDDEV);
+    _imu_orientation_stddev = imu_orientation_stddev;
     _pnh.param("publish_odom_tf", _publish_odom_tf, PUBLISH_ODOM_TF);
 }
 
@@ -875,13 +1111,13 @@ void BaseRealSenseNode::setupDevice()
             frame_callback_function = _syncer;
 
             auto frame_callback_inner = [this](rs2::frame frame){
-                frame_callback(frame);
+                dispatchFrame(frame);
             };
             _syncer.start(frame_callback_inner);
         }
         else
         {
-            frame_callback_function = [this](rs2::frame frame){frame_callback(frame);};
+            frame_callback_function = [this](rs2::frame frame){dispatchFrame(frame);};
         }
 
         if (_imu_sync_method == imu_sync_method::NONE)
@@ -963,12 +1199,20 @@ void BaseRealSenseNode::setupPublishers()
 {
     ROS_INFO("setupPublishers...");
     image_transport::ImageTransport image_transport(_node_handle);
+    // Which filters run depends on the subscribers. A change is only flagged here, the next frameset recomputes it.
+    ros::SubscriberStatusCallback demand_changed = [this](const ros::SingleSubscriberPublisher&){onSubscribersChanged();};
+    image_transport::SubscriberStatusCallback image_demand_changed = [this](const image_transport::SingleSubscriberPublisher&){onSubscribersChanged();};
+    if (_rvl_depth && !_rvl_workers)
+    {
+        std::size_t num_threads(std::max(1, _rvl_threads));
+        _rvl_workers.reset(new WorkerPool(num_threads, 2 * num_threads));
+    }
 
     for (auto& stream : IMAGE_STREAMS)
     {
         if (_enable[stream])
         {
-            std::stringstream image_raw, camera_info, topic_metadata;
+            std::stringstream image_raw, camera_info;
             bool rectified_image = false;
             if (stream == DEPTH || stream == CONFIDENCE || stream == INFRA1 || stream == INFRA2)
                 rectified_image = true;
@@ -976,14 +1220,21 @@ void BaseRealSenseNode::setupPublishers()
             std::string stream_name(STREAM_NAME(stream));
             image_raw << stream_name << "/image_" << ((rectified_image)?"rect_":"") << "raw";
             camera_info << stream_name << "/camera_info";
-            topic_metadata << stream_name << "/metadata";
 
             std::shared_ptr<FrequencyDiagnostics> frequency_diagnostics(new FrequencyDiagnostics(_fps[stream], stream_name, _serial_no));
-            _image_publishers[stream] = {image_transport.advertise(image_raw.str(), 1), frequency_diagnostics};
-            _info_publisher[stream] = _node_handle.advertise<sensor_msgs::CameraInfo>(camera_info.str(), 1);
-            _metadata_publishers[stream] = std::make_shared<ros::Publisher>(_node_handle.advertise<realsense2_camera::Metadata>(topic_metadata.str(), 1));
+            _image_publishers[stream] = {image_transport.advertise(image_raw.str(), 1, image_demand_changed, image_demand_changed), frequency_diagnostics};
+            if (_zero_copy_images)
+            {
+                _frame_image_publishers[stream] = _node_handle.advertise<FrameImage>(image_raw.str(), 1, demand_changed, demand_changed);
+            }
+            if (_rvl_depth && stream == DEPTH)
+            {
+                _rvl_publishers[stream] = std::make_shared<RvlDepthPublisher>(_node_handle, image_raw.str() + "/rvl", *_rvl_workers, demand_changed);
+            }
+            _info_publisher[stream] = _node_handle.advertise<sensor_msgs::CameraInfo>(camera_info.str(), 1, demand_changed, demand_changed);
+            _metadata_publishers[stream] = std::make_shared<MetadataPublisher>(_node_handle, stream_name, _metadata_fields, demand_changed);
 
-            if (_align_depth && stream == COLOR)
+            if (_align_depth && _depth_aligned_frame_id.find(stream) != _depth_aligned_frame_id.end())
             {
                 std::stringstream aligned_image_raw, aligned_camera_info;
                 aligned_image_raw << "aligned_depth_to_" << stream_name << "/image_raw";
@@ -991,42 +1242,99 @@ void BaseRealSenseNode::setupPublishers()
 
                 std::string aligned_stream_name = "aligned_depth_to_" + stream_name;
                 std::shared_ptr<FrequencyDiagnostics> frequency_diagnostics(new FrequencyDiagnostics(_fps[stream], aligned_stream_name, _serial_no));
-                _depth_aligned_image_publishers[stream] = {image_transport.advertise(aligned_image_raw.str(), 1), frequency_diagnostics};
-                _depth_aligned_info_publisher[stream] = _node_handle.advertise<sensor_msgs::CameraInfo>(aligned_camera_info.str(), 1);
+                _depth_aligned_image_publishers[stream] = {image_transport.advertise(aligned_image_raw.str(), 1, image_demand_changed, image_demand_changed), frequency_diagnostics};
+                if (_zero_copy_images)
+                {
+                    _depth_aligned_frame_image_publishers[stream] = _node_handle.advertise<FrameImage>(aligned_image_raw.str(), 1, demand_changed, demand_changed);
+                }
+                if (_rvl_depth)
+                {
+                    _depth_aligned_rvl_publishers[stream] = std::make_shared<RvlDepthPublisher>(_node_handle, aligned_image_raw.str() + "/rvl", *_rvl_workers, demand_changed);
+                }
+                _depth_aligned_info_publisher[stream] = _node_handle.advertise<sensor_msgs::CameraInfo>(aligned_camera_info.str(), 1, demand_changed, demand_changed);
             }
 
             if (stream == DEPTH && _pointcloud)
             {
-                _pointcloud_publisher = _node_handle.advertise<sensor_msgs::PointCloud2>("depth/color/points", 1);
+                _pointcloud_publisher = _node_handle.advertise<sensor_msgs::PointCloud2>("depth/color/points", 1, demand_changed, demand_changed);
+                if (_voxel_leaf_size > 0 && !_voxel_only)
+                {
+                    _voxel_pointcloud_publisher = _node_handle.advertise<sensor_msgs::PointCloud2>("depth/color/voxel_points", 1, demand_changed, demand_changed);
+                }
             }
         }
     }
 
+    setupImuDecimation();
     _synced_imu_publisher = std::make_shared<SyncedImuPublisher>();
     if (_imu_sync_method > imu_sync_method::NONE && _enable[GYRO] && _enable[ACCEL])
     {
         ROS_INFO("Start publisher IMU");
-        _synced_imu_publisher = std::make_shared<SyncedImuPublisher>(_node_handle.advertise<sensor_msgs::Imu>("imu", 5));
+        _synced_imu_publisher = std::make_shared<SyncedImuPublisher>(_node_handle.advertise<sensor_msgs::Imu>("imu", 5),
+                                                                     std::max(1, _hold_back_imu_queue_size), _hold_back_imu_overflow_policy);
         _synced_imu_publisher->Enable(_hold_back_imu_for_frames);
+        if (_hold_back_imu_for_frames)
+        {
+            if (!_processing_diagnostics)
+            {
+                _processing_diagnostics = std::make_shared<diagnostic_updater::Updater>(ros::NodeHandle(), ros::NodeHandle("~"), ros::this_node::getName() + "_processing");
+                _processing_diagnostics->setHardwareID(_serial_no);
+            }
+            uint64_t last_lost(0);
+            _processing_diagnostics->add("imu hold back",
+                [this, last_lost](diagnostic_updater::DiagnosticStatusWrapper& status) mutable
+                {
+                    uint64_t lost(_synced_imu_publisher->dropped() + _synced_imu_publisher->flushed());
+                    if (lost > last_lost)
+                        status.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Queue overflow");
+                    else
+                        status.summary(diagnostic_msgs::DiagnosticStatus::OK, "OK");
+                    last_lost = lost;
+                    status.add("Capacity", _synced_imu_publisher->capacity());
+                    status.add("Overflow policy", imuOverflowPolicyName(_hold_back_imu_overflow_policy));
+                    status.add("Dropped", _synced_imu_publisher->dropped());
+                    status.add("Flushed", _synced_imu_publisher->flushed());
+                });
+        }
+        if (_imu_batch_mode != ImuBatchMode::NONE)
+        {
+            _united_imu_batch_publisher = std::make_shared<ImuBatchPublisher>(_node_handle.advertise<realsense2_camera::ImuBatch>("imu_batch", 5),
+                                                                              _optical_frame_id[GYRO], _imu_batch_mode, std::max(1, _imu_batch_size),
+                                                                              true, true, _angular_velocity_cov, _linear_accel_cov);
+        }
+        setupImuPreintegration();
+        setupImuOrientation();
     }
     else
     {
         if (_enable[GYRO])
         {
             _imu_publishers[GYRO] = _node_handle.advertise<sensor_msgs::Imu>("gyro/sample", 100);
-            _metadata_publishers[GYRO] = std::make_shared<ros::Publisher>(_node_handle.advertise<realsense2_camera::Metadata>("gyro/metadata", 1));
+            if (_imu_batch_mode != ImuBatchMode::NONE)
+            {
+                _imu_batch_publishers[GYRO] = std::make_shared<ImuBatchPublisher>(_node_handle.advertise<realsense2_camera::ImuBatch>("gyro/sample_batch", 5),
+                                                                                  _optical_frame_id[GYRO], _imu_batch_mode, std::max(1, _imu_batch_size),
+                                                                                  true, false, _angular_velocity_cov, _linear_accel_cov);
+            }
+            _metadata_publishers[GYRO] = std::make_shared<MetadataPublisher>(_node_handle, "gyro", _metadata_fields);
         }
 
         if (_enable[ACCEL])
         {
             _imu_publishers[ACCEL] = _node_handle.advertise<sensor_msgs::Imu>("accel/sample", 100);
-            _metadata_publishers[ACCEL] = std::make_shared<ros::Publisher>(_node_handle.advertise<realsense2_camera::Metadata>("accel/metadata", 1));
+            if (_imu_batch_mode != ImuBatchMode::NONE)
+            {
+                _imu_batch_publishers[ACCEL] = std::make_shared<ImuBatchPublisher>(_node_handle.advertise<realsense2_camera::ImuBatch>("accel/sample_batch", 5),
+                                                                                   _optical_frame_id[ACCEL], _imu_batch_mode, std::max(1, _imu_batch_size),
+                                                                                   false, true, _angular_velocity_cov, _linear_accel_cov);
+            }
+            _metadata_publishers[ACCEL] = std::make_shared<MetadataPublisher>(_node_handle, "accel", _metadata_fields);
         }
     }
     if (_enable[POSE])
     {
         _imu_publishers[POSE] = _node_handle.advertise<nav_msgs::Odometry>("odom/sample", 100);
-        _metadata_publishers[POSE] = std::make_shared<ros::Publisher>(_node_handle.advertise<realsense2_camera::Metadata>("odom/metadata", 1));
+        _metadata_publishers[POSE] = std::make_shared<MetadataPublisher>(_node_handle, "odom", _metadata_fields);
     }
 
 
@@ -1184,6 +1492,11 @@ void BaseRealSenseNode::enable_devices()
 
 void BaseRealSenseNode::setupFilters()
 {
+    _depth_conditioning_filter = std::make_shared<rs2::filter>([this](rs2::frame frame, rs2::frame_source& source)
+    {
+        source.frame_ready(conditionDepthFrames(frame, source));
+    });
+
     std::vector<std::string> filters_str;
     boost::split(filters_str, _filters_str, [](char c){return c == ',';});
     bool use_disparity_filter(false);
@@ -1256,7 +1569,17 @@ void BaseRealSenseNode::setupFilters()
     }
     if (_align_depth)
     {
-        _filters.push_back(NamedFilter("align_to_color", std::make_shared<rs2::align>(RS2_STREAM_COLOR)));
+        if (_align_depth_lut)
+        {
+            ROS_INFO("Aligning depth with lookup tables.");
+            _depth_aligner = std::make_shared<DepthAligner>();
+        }
+        for (const stream_index_pair& stream : _align_depth_to)
+            _align_targets.push_back({stream, -1, -1, rs2::stream_profile(), nullptr});
+        _filters.push_back(NamedFilter("align_depth", std::make_shared<rs2::filter>([this](rs2::frame frame, rs2::frame_source& source)
+        {
+            source.frame_ready(alignDepthFrames(frame, source));
+        })));
     }
     if (use_colorizer_filter)
     {
@@ -1267,7 +1590,8 @@ void BaseRealSenseNode::setupFilters()
         _image_format[DEPTH.first] = _image_format[COLOR.first];    // CVBridge type
         _encoding[DEPTH.first] = _encoding[COLOR.first]; // ROS message type
         _unit_step_size[DEPTH.first] = _unit_step_size[COLOR.first]; // sensor_msgs::ImagePtr row step size
-        _depth_aligned_encoding[RS2_STREAM_COLOR] = _encoding[COLOR.first]; // ROS message type
+        for (const stream_index_pair& stream : _align_depth_to)
+            _depth_aligned_encoding[stream.first] = _encoding[COLOR.first]; // ROS message type
 
         _width[DEPTH] = _width[COLOR];
         _height[DEPTH] = _height[COLOR];
@@ -1280,153 +1604,480 @@ void BaseRealSenseNode::setupFilters()
         _filters.push_back(NamedFilter("pointcloud", _pointcloud_filter));
     }
     ROS_INFO("num_filters: %d", static_cast<int>(_filters.size()));
+    if (_filters.size() > 64)
+        throw std::runtime_error("Too many filters.");
+    for (std::size_t i = 0; i < _filters.size(); ++i)
+        _filters[i]._mask = uint64_t(1) << i;
 }
 
-cv::Mat& BaseRealSenseNode::fix_depth_scale(const cv::Mat& from_image, cv::Mat& to_image)
+namespace
 {
-    static const float meter_to_mm = 0.001f;
-    if (fabs(_depth_scale_meters - meter_to_mm) < 1e-6)
+    template <class Publishers>
+    bool hasSubscribers(const Publishers& publishers, const stream_index_pair& stream)
+    {
+        auto publisher = publishers.find(stream);
+        return publisher != publishers.end() && publisher->second.getNumSubscribers() > 0;
+    }
+
+    bool hasImageSubscribers(const std::map<stream_index_pair, ImagePublisherWithFrequencyDiagnostics>& publishers, const stream_index_pair& stream)
     {
-        to_image = from_image;
-        return to_image;
+        auto publisher = publishers.find(stream);
+        return publisher != publishers.end() && publisher->second.first.getNumSubscribers() > 0;
     }
 
-    if (to_image.size() != from_image.size())
+    bool hasRvlSubscribers(const std::map<stream_index_pair, std::shared_ptr<RvlDepthPublisher>>& publishers, const stream_index_pair& stream)
     {
-        to_image.create(from_image.rows, from_image.cols, from_image.type());
+        auto publisher = publishers.find(stream);
+        return publisher != publishers.end() && publisher->second->getNumSubscribers() > 0;
     }
+}
 
-    CV_Assert(from_image.depth() == _image_format[RS2_STREAM_DEPTH]);
+bool BaseRealSenseNode::hasAlignedDepthSubscribers(const stream_index_pair& stream) const
+{
+    return hasImageSubscribers(_depth_aligned_image_publishers, stream) || hasSubscribers(_depth_aligned_info_publisher, stream) ||
+           hasSubscribers(_depth_aligned_frame_image_publishers, stream) || hasRvlSubscribers(_depth_aligned_rvl_publishers, stream);
+}
 
-    int nRows = from_image.rows;
-    int nCols = from_image.cols;
+// Works out which stages the subscribed outputs depend on. The depth topic is published from the depth before the
+// filters when aligning, and from the end of the chain otherwise. Filters that may change other streams than depth
+// (decimation, hdr_merge, sequence_id_filter) always run. The align_depth stage only aligns to the targets in demand;
+// the pointcloud is built from the depth aligned to color when color is a target.
+void BaseRealSenseNode::updateFilterDemand()
+{
+    if (!_lazy_filters)
+        return;
+    bool depth(hasImageSubscribers(_image_publishers, DEPTH) || hasSubscribers(_info_publisher, DEPTH) ||
+               hasSubscribers(_frame_image_publishers, DEPTH) || hasRvlSubscribers(_rvl_publishers, DEPTH));
+    bool pointcloud(_pointcloud_publisher.getNumSubscribers() > 0 || _voxel_pointcloud_publisher.getNumSubscribers() > 0);
+    bool aligned(false);
+    uint64_t align_targets(0);
+    for (std::size_t i = 0; i < _align_targets.size(); ++i)
+    {
+        bool subscribed(hasAlignedDepthSubscribers(_align_targets[i].stream));
+        aligned = aligned || subscribed;
+        if (subscribed || (pointcloud && _align_targets[i].stream == COLOR))
+            align_targets |= uint64_t(1) << i;
+    }
+    bool filtered_depth(aligned || pointcloud || (depth && !_align_depth));
+
+    uint64_t demand(0);
+    std::stringstream skipped;
+    for (const NamedFilter& nfilter : _filters)
+    {
+        bool needed(true);
+        if (nfilter._name == "pointcloud")
+            needed = pointcloud;
+        else if (nfilter._name == "align_depth")
+            needed = align_targets != 0;
+        else if (nfilter._name == "colorizer")
+            needed = depth || aligned || pointcloud;
+        else if (nfilter._name == "spatial" || nfilter._name == "temporal" || nfilter._name == "hole_filling" ||
+                 nfilter._name == "disparity_start" || nfilter._name == "disparity_end")
+            needed = filtered_depth;
+        if (needed)
+            demand |= nfilter._mask;
+        else
+            skipped << " " << nfilter._name;
+    }
+    _filter_demand = demand;
+    _align_target_demand = align_targets;
+    _depth_demanded = depth || aligned || pointcloud;
+    ROS_DEBUG_STREAM("Filters skipped for lack of subscribers:" << (skipped.str().empty() ? " none" : skipped.str()));
+}
 
-    if (from_image.isContinuous())
+void BaseRealSenseNode::onSubscribersChanged()
+{
+    _filter_demand_changed = true;
     {
-        nCols *= nRows;
-        nRows = 1;
+        std::lock_guard<std::mutex> lock_guard(_auto_streams_mutex);
+        _stream_demand_changed = true;
     }
+    _auto_streams_cv.notify_one();
+}
 
-    int i,j;
-    const uint16_t* p_from;
-    uint16_t* p_to;
-    for( i = 0; i < nRows; ++i)
+// The streams whose own topics, or topics derived from them, have subscribers. Motion and pose streams always run.
+std::set<stream_index_pair> BaseRealSenseNode::getDemandedStreams()
+{
+    std::set<stream_index_pair> streams;
+    for (const std::pair<stream_index_pair, std::vector<rs2::stream_profile>>& profile : _enabled_profiles)
     {
-        p_from = from_image.ptr<uint16_t>(i);
-        p_to = to_image.ptr<uint16_t>(i);
-        for ( j = 0; j < nCols; ++j)
+        const stream_index_pair& stream(profile.first);
+        if (std::find(IMAGE_STREAMS.begin(), IMAGE_STREAMS.end(), stream) == IMAGE_STREAMS.end() ||
+            hasImageSubscribers(_image_publishers, stream) || hasSubscribers(_info_publisher, stream) ||
+            hasSubscribers(_frame_image_publishers, stream) || hasRvlSubscribers(_rvl_publishers, stream))
         {
-            p_to[j] = p_from[j] * _depth_scale_meters / meter_to_mm;
+            streams.insert(stream);
         }
+        else
+        {
+            auto md_publisher = _metadata_publishers.find(stream);
+            if (md_publisher != _metadata_publishers.end() && md_publisher->second->getNumSubscribers() > 0)
+                streams.insert(stream);
+        }
+    }
+    for (const stream_index_pair& target : _align_depth_to)
+    {
+        if (hasAlignedDepthSubscribers(target))
+        {
+            streams.insert(DEPTH);
+            streams.insert(target);
+        }
+    }
+    bool pointcloud(_pointcloud_publisher.getNumSubscribers() > 0 || _voxel_pointcloud_publisher.getNumSubscribers() > 0);
+    if (pointcloud)
+    {
+        streams.insert(DEPTH);
+        if (_pointcloud_texture.first != RS2_STREAM_ANY)
+            streams.insert(_pointcloud_texture);
+    }
+    if (streams.count(DEPTH) && _confidence_threshold > 0)
+        streams.insert(CONFIDENCE);
+    // Only streams that are enabled can be opened.
+    for (std::set<stream_index_pair>::iterator stream = streams.begin(); stream != streams.end();)
+    {
+        if (_enabled_profiles.find(*stream) == _enabled_profiles.end())
+            stream = streams.erase(stream);
+        else
+            ++stream;
     }
-    return to_image;
+    return streams;
 }
 
-void BaseRealSenseNode::clip_depth(rs2::depth_frame depth_frame, float clipping_dist)
+// Reopens the sensors whose set of active streams changes. Called with _sensors_mutex held.
+void BaseRealSenseNode::applyActiveStreams(const std::set<stream_index_pair>& streams)
 {
-    uint16_t* p_depth_frame = reinterpret_cast<uint16_t*>(const_cast<void*>(depth_frame.get_data()));
-    uint16_t clipping_value = static_cast<uint16_t>(clipping_dist / _depth_scale_meters);
-
-    int width = depth_frame.get_width();
-    int height = depth_frame.get_height();
+    std::map<std::string, rs2::sensor> sensors;
+    std::map<std::string, std::vector<stream_index_pair> > active, wanted;
+    std::map<std::string, std::vector<rs2::stream_profile> > wanted_profiles;
+    for (const std::pair<stream_index_pair, std::vector<rs2::stream_profile>>& profile : _enabled_profiles)
+    {
+        std::string module_name = _sensors[profile.first].get_info(RS2_CAMERA_INFO_NAME);
+        sensors[module_name] = _sensors[profile.first];
+        if (_active_streams.count(profile.first))
+            active[module_name].push_back(profile.first);
+        if (streams.count(profile.first))
+        {
+            wanted[module_name].push_back(profile.first);
+            wanted_profiles[module_name].insert(wanted_profiles[module_name].end(), profile.second.begin(), profile.second.end());
+        }
+    }
 
-    #ifdef _OPENMP
-    #pragma omp parallel for schedule(dynamic) //Using OpenMP to try to parallelise the loop
-    #endif
-    for (int y = 0; y < height; y++)
+    for (const std::pair<std::string, rs2::sensor>& module : sensors)
     {
-        auto depth_pixel_index = y * width;
-        for (int x = 0; x < width; x++, ++depth_pixel_index)
+        const std::string& module_name(module.first);
+        if (active[module_name] == wanted[module_name])
+            continue;
+        rs2::sensor sensor(module.second);
+        try
         {
-            // Check if the depth value is greater than the threashold
-            if (p_depth_frame[depth_pixel_index] > clipping_value)
+            if (!active[module_name].empty())
+            {
+                sensor.stop();
+                sensor.close();
+                for (const stream_index_pair& stream : active[module_name])
+                    _active_streams.erase(stream);
+            }
+            if (!wanted[module_name].empty())
             {
-                p_depth_frame[depth_pixel_index] = 0; //Set to invalid (<=0) value.
+                sensor.open(wanted_profiles[module_name]);
+                sensor.start(_sensors_callback[module_name]);
+                _active_streams.insert(wanted[module_name].begin(), wanted[module_name].end());
             }
+            std::stringstream names;
+            for (const stream_index_pair& stream : wanted[module_name])
+                names << " " << STREAM_NAME(stream);
+            ROS_INFO_STREAM(module_name << " streaming:" << (names.str().empty() ? " none" : names.str()));
+        }
+        catch(const std::exception& ex)
+        {
+            ROS_ERROR_STREAM("Failed to switch the streams of " << module_name << ": " << ex.what());
         }
     }
 }
 
-sensor_msgs::Imu BaseRealSenseNode::CreateUnitedMessage(const CimuData accel_data, const CimuData gyro_data)
+// Opens the streams that have subscribers right away, and closes the others once they had none for auto_streams_hold_time,
+// so that a subscriber reconnecting does not restart the sensor.
+void BaseRealSenseNode::autoStreams()
 {
-    sensor_msgs::Imu imu_msg;
-    ros::Time t(gyro_data.m_time);
-    imu_msg.header.seq = 0;
-    imu_msg.header.stamp = t;
-
-    imu_msg.angular_velocity.x = gyro_data.m_data.x();
-    imu_msg.angular_velocity.y = gyro_data.m_data.y();
-    imu_msg.angular_velocity.z = gyro_data.m_data.z();
-
-    imu_msg.linear_acceleration.x = accel_data.m_data.x();
-    imu_msg.linear_acceleration.y = accel_data.m_data.y();
-    imu_msg.linear_acceleration.z = accel_data.m_data.z();
-    return imu_msg;
+    typedef std::chrono::steady_clock clock;
+    std::map<stream_index_pair, clock::time_point> last_demanded;
+    std::chrono::duration<double> hold_time(std::max(0.0, _auto_streams_hold_time));
+    std::unique_lock<std::mutex> lock(_auto_streams_mutex);
+    while (_is_running)
+    {
+        _auto_streams_cv.wait_for(lock, std::chrono::milliseconds(250), [this]{return !_is_running || _stream_demand_changed;});
+        if (!_is_running)
+            break;
+        _stream_demand_changed = false;
+        lock.unlock();
+
+        clock::time_point now(clock::now());
+        std::set<stream_index_pair> demanded(getDemandedStreams());
+        std::set<stream_index_pair> streams;
+        for (const stream_index_pair& stream : demanded)
+            last_demanded[stream] = now;
+        for (const std::pair<stream_index_pair, clock::time_point>& demand : last_demanded)
+        {
+            if (demanded.count(demand.first) || now - demand.second < hold_time)
+                streams.insert(demand.first);
+        }
+        {
+            std::lock_guard<std::mutex> lock_guard(_sensors_mutex);
+            if (_sensors_enabled)
+                applyActiveStreams(streams);
+        }
+        lock.lock();
+    }
 }
 
-template <typename T> T lerp(const T &a, const T &b, const double t) {
-  return a * (1.0 - t) + b * t;
+DepthConditioning BaseRealSenseNode::getDepthConditioning(bool rescale) const
+{
+    static const float meter_to_mm = 0.001f;
+    DepthConditioning conditioning;
+    if (_min_distance > 0)
+    {
+        conditioning.min_value = static_cast<uint16_t>(std::min(std::ceil(_min_distance / _depth_scale_meters), 65535.0f));
+    }
+    if (_clipping_distance > 0)
+    {
+        conditioning.max_value = static_cast<uint16_t>(std::min(_clipping_distance / _depth_scale_meters, 65535.0f));
+    }
+    conditioning.rescale = rescale && (fabs(_depth_scale_meters - meter_to_mm) >= 1e-6);
+    conditioning.depth_scale_meters = _depth_scale_meters;
+    return conditioning;
 }
 
-void BaseRealSenseNode::FillImuData_LinearInterpolation(const CimuData imu_data, std::deque<sensor_msgs::Imu>& imu_msgs)
+rs2::frame BaseRealSenseNode::conditionDepthFrames(rs2::frame frame, const rs2::frame_source& source)
 {
-    static std::deque<CimuData> _imu_history;
-    _imu_history.push_back(imu_data);
-    stream_index_pair type(imu_data.m_type);
-    imu_msgs.clear();
+    if (!frame.is<rs2::frameset>())
+    {
+        return frame.is<rs2::depth_frame>() ? conditionDepthFrame(frame, rs2::frame(), source) : frame;
+    }
+    rs2::frameset frameset(frame);
+    rs2::frame confidence(frameset.first_or_default(RS2_STREAM_CONFIDENCE));
+    std::vector<rs2::frame> frames;
+    for (auto it = frameset.begin(); it != frameset.end(); ++it)
+    {
+        rs2::frame f(*it);
+        bool is_depth(f.is<rs2::depth_frame>() && f.get_profile().format() == RS2_FORMAT_Z16);
+        frames.push_back(is_depth ? conditionDepthFrame(f, confidence, source) : f);
+    }
+    return source.allocate_composite_frame(frames);
+}
 
-    if ((type != ACCEL) || _imu_history.size() < 3)
-        return;
-    
-    std::deque<CimuData> gyros_data;
-    CimuData accel0, accel1, crnt_imu;
+rs2::frame BaseRealSenseNode::conditionDepthFrame(rs2::frame depth, rs2::frame confidence, const rs2::frame_source& source)
+{
+    rs2::video_frame depth_frame(depth);
+    int width = depth_frame.get_width();
+    int height = depth_frame.get_height();
+    rs2::frame conditioned = source.allocate_video_frame(depth.get_profile(), depth, 0, 0, 0, 0, RS2_EXTENSION_DEPTH_FRAME);
 
-    while (_imu_history.size()) 
+    // Filters work in device units, so only clipping and masking are done here.
+    DepthConditioning conditioning(getDepthConditioning(false));
+    const uint8_t* p_confidence(nullptr);
+    if (confidence && _confidence_threshold > 0)
     {
-        crnt_imu = _imu_history.front();
-        _imu_history.pop_front();
-        if (!accel0.is_set() && crnt_imu.m_type == ACCEL) 
+        rs2::video_frame confidence_frame(confidence);
+        if (confidence_frame.get_width() == width && confidence_frame.get_height() == height &&
+            confidence_frame.get_stride_in_bytes() == width && depth_frame.get_stride_in_bytes() == width * static_cast<int>(sizeof(uint16_t)))
         {
-            accel0 = crnt_imu;
-        } 
-        else if (accel0.is_set() && crnt_imu.m_type == ACCEL) 
+            p_confidence = static_cast<const uint8_t*>(confidence.get_data());
+            conditioning.confidence_threshold = static_cast<uint8_t>(_confidence_threshold);
+        }
+        else
+        {
+            ROS_WARN_ONCE("Confidence frame does not match the depth frame's layout. Depth is not masked by confidence.");
+        }
+    }
+
+    // The output is a new frame allocated above, so writing to it leaves the librealsense frame untouched.
+    conditionDepth(static_cast<const uint16_t*>(depth.get_data()), p_confidence,
+                   static_cast<uint16_t*>(const_cast<void*>(conditioned.get_data())),
+                   depth.get_data_size() / sizeof(uint16_t), conditioning);
+    return conditioned;
+}
+
+// Aligns depth to the targets of the current job in the frameset. The lookup table engine deprojects the depth once
+// for all the targets it supports; the others, and all of them without align_depth_lut, are aligned by rs2::align.
+// The depth aligned to color replaces the depth of the frameset, the others are left in _aligned_depth_frames.
+rs2::frame BaseRealSenseNode::alignDepthFrames(rs2::frame frame, const rs2::frame_source& source)
+{
+    _depth_aligned_to_color = false;
+    _aligned_depth_frames.clear();
+    if (!frame.is<rs2::frameset>())
+        return frame;
+    rs2::frameset frameset(frame);
+    rs2::frame depth(frameset.first_or_default(RS2_STREAM_DEPTH, RS2_FORMAT_Z16));
+    if (!depth)
+        return frame;
+    std::vector<rs2::frame> targets(_align_targets.size());
+    bool has_target(false);
+    for (auto it = frameset.begin(); it != frameset.end(); ++it)
+    {
+        rs2::frame f(*it);
+        stream_index_pair stream{f.get_profile().stream_type(), f.get_profile().stream_index()};
+        for (std::size_t i = 0; i < _align_targets.size(); ++i)
         {
-            accel1 = crnt_imu;
-            const double dt = accel1.m_time - accel0.m_time;
+            if ((_align_stage_targets & (uint64_t(1) << i)) && _align_targets[i].stream == stream && !targets[i])
+            {
+                targets[i] = f;
+                has_target = true;
+            }
+        }
+    }
+    if (!has_target)
+        return frame;
 
-            while (gyros_data.size())
+    // The tables only change with the profiles, e.g. when the decimation filter changes the depth resolution.
+    rs2::video_stream_profile depth_profile(depth.get_profile().as<rs2::video_stream_profile>());
+    if (_depth_aligner)
+    {
+        float units(rs2::depth_frame(depth).get_units());
+        bool reconfigure(depth_profile.unique_id() != _depth_aligner_depth_id || units != _depth_aligner_units);
+        for (std::size_t i = 0; i < _align_targets.size(); ++i)
+            reconfigure = reconfigure || (targets[i] && targets[i].get_profile().unique_id() != _align_targets[i].profile_id);
+        if (reconfigure)
+        {
+            _depth_aligner_depth_id = depth_profile.unique_id();
+            _depth_aligner_units = units;
+            _depth_aligner->configure(depth_profile.get_intrinsics(), units);
+            for (std::size_t i = 0; i < _align_targets.size(); ++i)
             {
-                CimuData crnt_gyro = gyros_data.front();
-                gyros_data.pop_front();
-                const double alpha = (crnt_gyro.m_time - accel0.m_time) / dt;
-                CimuData crnt_accel(ACCEL, lerp(accel0.m_data, accel1.m_data, alpha), crnt_gyro.m_time);
-                imu_msgs.push_back(CreateUnitedMessage(crnt_accel, crnt_gyro));
+                AlignTarget& target(_align_targets[i]);
+                target.profile_id = -1;
+                target.engine_index = -1;
+                if (!targets[i])
+                    continue;
+                rs2::video_stream_profile target_profile(targets[i].get_profile().as<rs2::video_stream_profile>());
+                rs2_intrinsics target_intrinsics(target_profile.get_intrinsics());
+                target.profile_id = target_profile.unique_id();
+                if (_depth_aligner->addTarget(target_intrinsics, depth_profile.get_extrinsics_to(target_profile)))
+                {
+                    target.engine_index = static_cast<int>(_depth_aligner->numTargets()) - 1;
+                    target.aligned_profile = depth_profile.clone(RS2_STREAM_DEPTH, depth_profile.stream_index(), RS2_FORMAT_Z16,
+                                                                 target_intrinsics.width, target_intrinsics.height, target_intrinsics);
+                    rs2_extrinsics identity = {{1, 0, 0, 0, 1, 0, 0, 0, 1}, {0, 0, 0}};
+                    target.aligned_profile.register_extrinsics_to(target_profile, identity);
+                }
+                else
+                {
+                    ROS_WARN_STREAM("align_depth_lut does not support the distortion model of the " << STREAM_NAME(target.stream) << " stream. Aligning with librealsense.");
+                }
             }
-            accel0 = accel1;
-        } 
-        else if (accel0.is_set() && crnt_imu.m_time >= accel0.m_time && crnt_imu.m_type == GYRO)
+        }
+    }
+
+    rs2::video_frame depth_frame(depth);
+    bool is_dense(depth_frame.get_stride_in_bytes() == depth_frame.get_width() * static_cast<int>(sizeof(uint16_t)));
+    std::vector<rs2::frame> aligned(_align_targets.size());
+    uint16_t* engine_outputs[DepthAligner::max_targets] = {};
+    bool use_engine(false);
+    for (std::size_t i = 0; i < _align_targets.size(); ++i)
+    {
+        AlignTarget& target(_align_targets[i]);
+        if (!targets[i])
+            continue;
+        if (_depth_aligner && target.engine_index >= 0 && is_dense)
+        {
+            int width(_depth_aligner->targetWidth(target.engine_index));
+            int height(_depth_aligner->targetHeight(target.engine_index));
+            aligned[i] = source.allocate_video_frame(target.aligned_profile, depth, 0, width, height,
+                                                     width * static_cast<int>(sizeof(uint16_t)), RS2_EXTENSION_DEPTH_FRAME);
+            engine_outputs[target.engine_index] = static_cast<uint16_t*>(const_cast<void*>(aligned[i].get_data()));
+            use_engine = true;
+        }
+        else
         {
-            gyros_data.push_back(crnt_imu);
+            // rs2::align picks the first frame of the target's type, so it only gets to see the depth and the target.
+            if (!target.fallback)
+                target.fallback = std::make_shared<rs2::align>(target.stream.first);
+            rs2::frameset depth_and_target(source.allocate_composite_frame({depth, targets[i]}));
+            aligned[i] = rs2::frameset(target.fallback->process(depth_and_target)).first_or_default(RS2_STREAM_DEPTH);
         }
     }
-    _imu_history.push_back(crnt_imu);
-    return;
+    if (use_engine)
+        _depth_aligner->align(static_cast<const uint16_t*>(depth.get_data()), engine_outputs);
+
+    rs2::frame aligned_to_color;
+    for (std::size_t i = 0; i < _align_targets.size(); ++i)
+    {
+        if (!aligned[i])
+            continue;
+        if (_align_targets[i].stream == COLOR)
+            aligned_to_color = aligned[i];
+        else
+            _aligned_depth_frames.emplace_back(_align_targets[i].stream, aligned[i]);
+    }
+    if (!aligned_to_color)
+        return frame;
+
+    _depth_aligned_to_color = true;
+    std::vector<rs2::frame> frames;
+    bool replaced(false);
+    for (auto it = frameset.begin(); it != frameset.end(); ++it)
+    {
+        rs2::frame f(*it);
+        bool is_depth(!replaced && f.get_profile().stream_type() == RS2_STREAM_DEPTH && f.get_profile().format() == RS2_FORMAT_Z16);
+        frames.push_back(is_depth ? aligned_to_color : f);
+        replaced = replaced || is_depth;
+    }
+    return source.allocate_composite_frame(frames);
 }
 
-void BaseRealSenseNode::FillImuData_Copy(const CimuData imu_data, std::deque<sensor_msgs::Imu>& imu_msgs)
+void BaseRealSenseNode::publishUnitedImu(double time, const Eigen::Vector3d& accel, const Eigen::Vector3d& gyro)
 {
-    stream_index_pair type(imu_data.m_type);
+    // Batches and pre-integration keep the full rate.
+    if (_united_imu_batch_publisher)
+        _united_imu_batch_publisher->add(time, gyro, accel);
+    if (_imu_preintegrator)
+        _imu_preintegrator->add(time, gyro, accel);
 
-    static CimuData _accel_data(ACCEL, {0,0,0}, -1.0);
-    if (ACCEL == type)
+    StreamContext* gyro_context(_stream_contexts.find(GYRO));
+    StreamContext* accel_context(_stream_contexts.find(ACCEL));
+    if (gyro_context && gyro_context->imu_decimator && accel_context && accel_context->imu_decimator)
     {
-        _accel_data = imu_data;
+        // Both are fed the same times, so they complete their outputs together.
+        double decimated_time, accel_time;
+        Eigen::Vector3f decimated_gyro, decimated_accel;
+        bool ready(gyro_context->imu_decimator->add(time, gyro.cast<float>(), decimated_time, decimated_gyro));
+        accel_context->imu_decimator->add(time, accel.cast<float>(), accel_time, decimated_accel);
+        if (ready)
+            publishUnitedImuMessage(decimated_time, decimated_accel.cast<double>(), decimated_gyro.cast<double>());
         return;
     }
-    if (_accel_data.m_time < 0)
-        return;
+    publishUnitedImuMessage(time, accel, gyro);
+}
+
+void BaseRealSenseNode::publishUnitedImuMessage(double time, const Eigen::Vector3d& accel, const Eigen::Vector3d& gyro)
+{
+    sensor_msgs::Imu imu_msg;
+    ImuMessage_AddDefaultValues(imu_msg);
+    imu_msg.header.seq = _imu_sync_seq;
+    imu_msg.header.stamp = ros::Time(time);
+
+    imu_msg.angular_velocity.x = gyro.x();
+    imu_msg.angular_velocity.y = gyro.y();
+    imu_msg.angular_velocity.z = gyro.z();
 
-    imu_msgs.push_back(CreateUnitedMessage(_accel_data, imu_data));
+    imu_msg.linear_acceleration.x = accel.x();
+    imu_msg.linear_acceleration.y = accel.y();
+    imu_msg.linear_acceleration.z = accel.z();
+
+    if (_orientation_filter)
+    {
+        const Eigen::Quaterniond& q(_orientation_filter->update(time, gyro, accel));
+        if (_orientation_filter->initialized())
+        {
+            imu_msg.orientation.x = q.x();
+            imu_msg.orientation.y = q.y();
+            imu_msg.orientation.z = q.z();
+            imu_msg.orientation.w = q.w();
+            double variance(_imu_orientation_stddev * _imu_orientation_stddev);
+            imu_msg.orientation_covariance = { variance, 0.0, 0.0, 0.0, variance, 0.0, 0.0, 0.0, variance};
+        }
+    }
+    _synced_imu_publisher->Publish(std::move(imu_msg));
+    ROS_DEBUG("Publish united imu stream");
 }
 
 void BaseRealSenseNode::ImuMessage_AddDefaultValues(sensor_msgs::Imu& imu_msg)
@@ -1444,13 +2095,9 @@ void BaseRealSenseNode::ImuMessage_AddDefaultValues(sensor_msgs::Imu& imu_msg)
 
 void BaseRealSenseNode::imu_callback_sync(rs2::frame frame, imu_sync_method sync_method)
 {
-    static std::mutex m_mutex;
-    static int seq = 0;
-
-    m_mutex.lock();
+    std::lock_guard<std::mutex> lock_guard(_imu_sync_mutex);
 
     auto stream = frame.get_profile().stream_type();
-    auto stream_index = (stream == GYRO.first)?GYRO:ACCEL;
     double frame_time = frame.get_timestamp();
 
     bool placeholder_false(false);
@@ -1459,35 +2106,49 @@ void BaseRealSenseNode::imu_callback_sync(rs2::frame frame, imu_sync_method sync
         _is_initialized_time_base = setBaseTime(frame_time, frame.get_frame_timestamp_domain());
     }
 
-    seq += 1;
+    _imu_sync_seq += 1;
 
-    if (0 != _synced_imu_publisher->getNumSubscribers())
+    bool batch_subscribed(_united_imu_batch_publisher && 0 != _united_imu_batch_publisher->getNumSubscribers());
+    if (_united_imu_batch_publisher && !batch_subscribed)
+        _united_imu_batch_publisher->clear();
+    bool preintegration_subscribed(_imu_preintegrator && 0 != _imu_preintegrator->getNumSubscribers());
+    if (_imu_preintegrator && !preintegration_subscribed)
+        _imu_preintegrator->clear();
+    if (0 == _synced_imu_publisher->getNumSubscribers() && !batch_subscribed && !preintegration_subscribed)
     {
-        auto crnt_reading = *(reinterpret_cast<const float3*>(frame.get_data()));
-        Eigen::Vector3d v(crnt_reading.x, crnt_reading.y, crnt_reading.z);
-        CimuData imu_data(stream_index, v, frameSystemTimeSec(frame));
-        std::deque<sensor_msgs::Imu> imu_msgs;
-        switch (sync_method)
-        {
-            case NONE: //Cannot really be NONE. Just to avoid compilation warning.
-            case COPY:
-                FillImuData_Copy(imu_data, imu_msgs);
-                break;
-            case LINEAR_INTERPOLATION:
-                FillImuData_LinearInterpolation(imu_data, imu_msgs);
-                break;
-        }
-        while (imu_msgs.size())
-        {
-            sensor_msgs::Imu imu_msg = imu_msgs.front();
-            imu_msg.header.seq = seq;
-            ImuMessage_AddDefaultValues(imu_msg);
-            _synced_imu_publisher->Publish(imu_msg);
-            ROS_DEBUG("Publish united %s stream", rs2_stream_to_string(frame.get_profile().stream_type()));
-            imu_msgs.pop_front();
-        }
+        // Readings kept from before the last subscriber left would be united with ones long after them.
+        _imu_interpolator.reset();
+        _last_accel = ImuInterpolator::Sample();
+        if (_orientation_filter)
+            _orientation_filter->reset();
+        for (auto& decimator : _imu_decimators)
+            decimator.second->reset();
+        return;
+    }
+
+    auto crnt_reading = *(reinterpret_cast<const float3*>(frame.get_data()));
+    Eigen::Vector3d v(crnt_reading.x, crnt_reading.y, crnt_reading.z);
+    double t(frameSystemTimeSec(frame));
+    auto publish = [this](double time, const Eigen::Vector3d& accel, const Eigen::Vector3d& gyro)
+    {
+        publishUnitedImu(time, accel, gyro);
+    };
+    switch (sync_method)
+    {
+        case NONE: //Cannot really be NONE. Just to avoid compilation warning.
+        case COPY:
+            if (stream == ACCEL.first)
+                _last_accel = ImuInterpolator::Sample(t, v);
+            else if (_last_accel.time >= 0)
+                publish(t, _last_accel.data, v);
+            break;
+        case LINEAR_INTERPOLATION:
+            if (stream == ACCEL.first)
+                _imu_interpolator.addAccel(t, v, publish);
+            else
+                _imu_interpolator.addGyro(t, v, publish);
+            break;
     }
-    m_mutex.unlock();
 }
 
 void BaseRealSenseNode::imu_callback(rs2::frame frame)
@@ -1506,49 +2167,165 @@ void BaseRealSenseNode::imu_callback(rs2::frame frame)
                 rs2_timestamp_domain_to_string(frame.get_frame_timestamp_domain()));
 
     auto stream_index = (stream == GYRO.first)?GYRO:ACCEL;
+    StreamContext* context(_stream_contexts.find(stream_index));
+    if (!context || !context->imu_publisher)
+        return;
     ros::Time t(frameSystemTimeSec(frame));
-    if (0 != _imu_publishers[stream_index].getNumSubscribers())
+    auto crnt_reading = *(reinterpret_cast<const float3*>(frame.get_data()));
+    if (context->imu_batch_publisher)
     {
-        auto imu_msg = sensor_msgs::Imu();
-        ImuMessage_AddDefaultValues(imu_msg);
-        imu_msg.header.frame_id = _optical_frame_id[stream_index];
-
-        auto crnt_reading = *(reinterpret_cast<const float3*>(frame.get_data()));
-        if (GYRO == stream_index)
+        if (0 != context->imu_batch_publisher->getNumSubscribers())
         {
-            imu_msg.angular_velocity.x = crnt_reading.x;
-            imu_msg.angular_velocity.y = crnt_reading.y;
-            imu_msg.angular_velocity.z = crnt_reading.z;
+            Eigen::Vector3d v(crnt_reading.x, crnt_reading.y, crnt_reading.z);
+            context->imu_batch_publisher->add(t.toSec(), v, v);
         }
-        else if (ACCEL == stream_index)
+        else
         {
-            imu_msg.linear_acceleration.x = crnt_reading.x;
-            imu_msg.linear_acceleration.y = crnt_reading.y;
-            imu_msg.linear_acceleration.z = crnt_reading.z;
+            context->imu_batch_publisher->clear();
         }
-        _seq[stream_index] += 1;
-        imu_msg.header.seq = _seq[stream_index];
-        imu_msg.header.stamp = t;
-        _imu_publishers[stream_index].publish(imu_msg);
-        ROS_DEBUG("Publish %s stream", rs2_stream_to_string(frame.get_profile().stream_type()));
     }
-    publishMetadata(frame, _optical_frame_id[stream_index]);
-}
-
-void BaseRealSenseNode::pose_callback(rs2::frame frame)
-{
-    double frame_time = frame.get_timestamp();
-    bool placeholder_false(false);
-    if (_is_initialized_time_base.compare_exchange_strong(placeholder_false, true) )
+    if (0 != context->imu_publisher->getNumSubscribers())
     {
-        _is_initialized_time_base = setBaseTime(frame_time, frame.get_frame_timestamp_domain());
-    }
-
-    ROS_DEBUG("Frame arrived: stream: %s ; index: %d ; Timestamp Domain: %s",
-                rs2_stream_to_string(frame.get_profile().stream_type()),
-                frame.get_profile().stream_index(),
-                rs2_timestamp_domain_to_string(frame.get_frame_timestamp_domain()));
-    const auto& stream_index(POSE);
+        Eigen::Vector3f reading(crnt_reading.x, crnt_reading.y, crnt_reading.z);
+        bool publish(true);
+        if (context->imu_decimator)
+        {
+            double decimated_time;
+            Eigen::Vector3f decimated;
+            publish = context->imu_decimator->add(t.toSec(), reading, decimated_time, decimated);
+            if (publish)
+            {
+                t = ros::Time(decimated_time);
+                reading = decimated;
+            }
+        }
+        if (publish)
+        {
+            auto imu_msg = sensor_msgs::Imu();
+            ImuMessage_AddDefaultValues(imu_msg);
+            imu_msg.header.frame_id = *context->optical_frame_id;
+
+            if (GYRO == stream_index)
+            {
+                imu_msg.angular_velocity.x = reading.x();
+                imu_msg.angular_velocity.y = reading.y();
+                imu_msg.angular_velocity.z = reading.z();
+            }
+            else if (ACCEL == stream_index)
+            {
+                imu_msg.linear_acceleration.x = reading.x();
+                imu_msg.linear_acceleration.y = reading.y();
+                imu_msg.linear_acceleration.z = reading.z();
+            }
+            *context->seq += 1;
+            imu_msg.header.seq = *context->seq;
+            imu_msg.header.stamp = t;
+            context->imu_publisher->publish(imu_msg);
+            ROS_DEBUG("Publish %s stream", rs2_stream_to_string(frame.get_profile().stream_type()));
+        }
+    }
+    else if (context->imu_decimator)
+    {
+        context->imu_decimator->reset();
+    }
+    publishMetadata(frame, *context, *context->optical_frame_id);
+}
+
+void BaseRealSenseNode::setupImuPreintegration()
+{
+    if (!_imu_preintegration)
+        return;
+    _imu_preintegration_stream = _enable[DEPTH] ? DEPTH : INFRA1;
+    if (!_enable[_imu_preintegration_stream])
+    {
+        ROS_WARN("imu_preintegration needs the depth or the infra1 stream. It is disabled.");
+        return;
+    }
+    // With motion correction on, librealsense already applied the intrinsics to the readings.
+    bool corrected_by_librealsense(false);
+    for (rs2::sensor& sensor : _dev_sensors)
+    {
+        if (sensor.supports(RS2_OPTION_ENABLE_MOTION_CORRECTION))
+            corrected_by_librealsense = sensor.get_option(RS2_OPTION_ENABLE_MOTION_CORRECTION) > 0;
+    }
+    ImuPreintegrator::Calibration gyro(getImuCalibration(GYRO, corrected_by_librealsense, _angular_velocity_cov));
+    ImuPreintegrator::Calibration accel(getImuCalibration(ACCEL, corrected_by_librealsense, _linear_accel_cov));
+    ROS_INFO_STREAM("Pre-integrating the imu between " << STREAM_NAME(_imu_preintegration_stream) << " frames"
+                    << (corrected_by_librealsense ? ", corrected by librealsense." : ", corrected by the imu intrinsics."));
+    _imu_preintegrator = std::make_shared<ImuPreintegrator>(_node_handle.advertise<realsense2_camera::ImuPreintegration>("imu_preintegrated", 5),
+                                                            _optical_frame_id[GYRO], gyro, accel);
+}
+
+void BaseRealSenseNode::setupImuDecimation()
+{
+    if (_imu_decimation_factor <= 1)
+        return;
+    // Enough taps for the transition band to end before the output Nyquist frequency.
+    int taps(_imu_decimation_taps > 0 ? _imu_decimation_taps : 8 * _imu_decimation_factor + 1);
+    for (auto& stream : {GYRO, ACCEL})
+    {
+        if (!_enable[stream])
+            continue;
+        _imu_decimators[stream] = std::make_shared<ImuDecimator>(_imu_decimation_factor, taps, _imu_decimation_cutoff);
+        ROS_INFO_STREAM("Decimating " << STREAM_NAME(stream) << " by " << _imu_decimation_factor << " through a "
+                        << _imu_decimators[stream]->taps() << " tap low-pass filter.");
+    }
+}
+
+void BaseRealSenseNode::setupImuOrientation()
+{
+    if (!_imu_orientation)
+        return;
+    ROS_INFO("Estimating the imu orientation.");
+    _orientation_filter = std::make_shared<OrientationFilter>(_imu_orientation_gain);
+
+    ros::NodeHandle nh1(_node_handle, "imu_orientation");
+    std::shared_ptr<ddynamic_reconfigure::DDynamicReconfigure> ddynrec = std::make_shared<ddynamic_reconfigure::DDynamicReconfigure>(nh1);
+    ddynrec->registerVariable<double>(
+        "gain", _imu_orientation_gain,
+        [this](double new_value) { _orientation_filter->setGain(new_value); },
+        "Weight of the accel correction against the gyro integration", 0.0, 1.0);
+    ddynrec->registerVariable<double>(
+        "stddev", _imu_orientation_stddev.load(),
+        [this](double new_value) { _imu_orientation_stddev = new_value; },
+        "Standard deviation of the orientation, in radians", 0.0, 1.0);
+    ddynrec->publishServicesTopics();
+    _ddynrec.push_back(ddynrec);
+}
+
+ImuPreintegrator::Calibration BaseRealSenseNode::getImuCalibration(const stream_index_pair& stream_index, bool corrected_by_librealsense, double default_variance)
+{
+    ImuPreintegrator::Calibration calibration;
+    IMUInfo info(getImuInfo(stream_index));
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!corrected_by_librealsense)
+        {
+            for (int j = 0; j < 3; ++j)
+                calibration.scale(i, j) = info.data[i * 4 + j];
+            calibration.bias[i] = info.data[i * 4 + 3];
+        }
+        calibration.noise_variances[i] = info.noise_variances[i] > 0 ? info.noise_variances[i] : default_variance;
+    }
+    return calibration;
+}
+
+void BaseRealSenseNode::pose_callback(rs2::frame frame)
+{
+    double frame_time = frame.get_timestamp();
+    bool placeholder_false(false);
+    if (_is_initialized_time_base.compare_exchange_strong(placeholder_false, true) )
+    {
+        _is_initialized_time_base = setBaseTime(frame_time, frame.get_frame_timestamp_domain());
+    }
+
+    ROS_DEBUG("Frame arrived: stream: %s ; index: %d ; Timestamp Domain: %s",
+                rs2_stream_to_string(frame.get_profile().stream_type()),
+                frame.get_profile().stream_index(),
+                rs2_timestamp_domain_to_string(frame.get_frame_timestamp_domain()));
+    StreamContext* context(_stream_contexts.find(POSE));
+    if (!context || !context->imu_publisher)
+        return;
     rs2_pose pose = frame.as<rs2::pose_frame>().get_pose_data();
     ros::Time t(frameSystemTimeSec(frame));
 
@@ -1565,7 +2342,7 @@ void BaseRealSenseNode::pose_callback(rs2::frame frame)
     geometry_msgs::TransformStamped msg;
     msg.header.stamp = t;
     msg.header.frame_id = _odom_frame_id;
-    msg.child_frame_id = _frame_id[POSE];
+    msg.child_frame_id = *context->frame_id;
     msg.transform.translation.x = pose_msg.pose.position.x;
     msg.transform.translation.y = pose_msg.pose.position.y;
     msg.transform.translation.z = pose_msg.pose.position.z;
@@ -1576,7 +2353,7 @@ void BaseRealSenseNode::pose_callback(rs2::frame frame)
 
     if (_publish_odom_tf) br.sendTransform(msg);
 
-    if (0 != _imu_publishers[stream_index].getNumSubscribers())
+    if (0 != context->imu_publisher->getNumSubscribers())
     {
         double cov_pose(_linear_accel_cov * pow(10, 3-(int)pose.tracker_confidence));
         double cov_twist(_angular_velocity_cov * pow(10, 1-(int)pose.tracker_confidence));
@@ -1601,12 +2378,12 @@ void BaseRealSenseNode::pose_callback(rs2::frame frame)
 	
 
         nav_msgs::Odometry odom_msg;
-        _seq[stream_index] += 1;
+        *context->seq += 1;
 
         odom_msg.header.frame_id = _odom_frame_id;
-        odom_msg.child_frame_id = _frame_id[POSE];
+        odom_msg.child_frame_id = *context->frame_id;
         odom_msg.header.stamp = t;
-        odom_msg.header.seq = _seq[stream_index];
+        odom_msg.header.seq = *context->seq;
         odom_msg.pose.pose = pose_msg.pose;
         odom_msg.pose.covariance = {cov_pose, 0, 0, 0, 0, 0,
                                     0, cov_pose, 0, 0, 0, 0,
@@ -1622,16 +2399,219 @@ void BaseRealSenseNode::pose_callback(rs2::frame frame)
                                     0, 0, 0, cov_twist, 0, 0,
                                     0, 0, 0, 0, cov_twist, 0,
                                     0, 0, 0, 0, 0, cov_twist};
-        _imu_publishers[stream_index].publish(odom_msg);
+        context->imu_publisher->publish(odom_msg);
         ROS_DEBUG("Publish %s stream", rs2_stream_to_string(frame.get_profile().stream_type()));
     }
-    publishMetadata(frame, _frame_id[POSE]);
+    publishMetadata(frame, *context, *context->frame_id);
+}
+
+void BaseRealSenseNode::setupProcessingEngine()
+{
+    if (_processing_threads <= 0)
+        return;
+    ROS_INFO_STREAM("Processing frames on " << _processing_threads << " worker threads.");
+    _processing_engine.reset(new ProcessingEngine());
+    ProcessingEngine::Handler handler = [this](rs2::frame frame){frame_callback(frame);};
+    std::size_t queue_size(std::max(1, _processing_queue_size));
+    // The syncer delivers framesets, and single frames it could not match. Both publish through the outputs of
+    // their streams, so they share one queue, which keeps each stream on one worker at a time.
+    if (_sync_frames)
+    {
+        _frameset_queue = _processing_engine->addQueue("frameset", queue_size, _drop_policy, handler);
+    }
+    else
+    {
+        for (auto& stream : IMAGE_STREAMS)
+        {
+            if (_enable[stream])
+            {
+                _processing_queues[stream] = _processing_engine->addQueue(STREAM_NAME(stream), queue_size, _stream_drop_policy[stream], handler);
+            }
+        }
+    }
+
+    if (!_processing_diagnostics)
+    {
+        _processing_diagnostics = std::make_shared<diagnostic_updater::Updater>(ros::NodeHandle(), ros::NodeHandle("~"), ros::this_node::getName() + "_processing");
+        _processing_diagnostics->setHardwareID(_serial_no);
+    }
+    for (std::size_t queue_id = 0; queue_id < _processing_engine->numQueues(); ++queue_id)
+    {
+        uint64_t last_dropped(0);
+        _processing_diagnostics->add(_processing_engine->stats(queue_id).name + " queue",
+            [this, queue_id, last_dropped](diagnostic_updater::DiagnosticStatusWrapper& status) mutable
+            {
+                ProcessingEngine::QueueStats stats(_processing_engine->stats(queue_id));
+                if (stats.dropped > last_dropped)
+                    status.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Dropping frames");
+                else
+                    status.summary(diagnostic_msgs::DiagnosticStatus::OK, "OK");
+                last_dropped = stats.dropped;
+                status.add("Policy", dropPolicyName(stats.policy));
+                status.add("Capacity", stats.capacity);
+                status.add("Depth", stats.depth);
+                status.add("Max depth", stats.max_depth);
+                status.add("Pushed", stats.pushed);
+                status.add("Processed", stats.processed);
+                status.add("Dropped", stats.dropped);
+            });
+    }
+    _processing_engine->start(_processing_threads);
+}
+
+void BaseRealSenseNode::setupFilterPipeline()
+{
+    if (!_pipeline_filters || !_sync_frames)
+        return;
+    _filter_pipeline.reset(new FilterPipeline<FramesetJob>(std::max(1, _pipeline_queue_size)));
+    _filter_pipeline->addStage("depth_conditioning", [this](FramesetJob& job){conditionFrameset(job);});
+    for (const NamedFilter& nfilter : _filters)
+    {
+        _filter_pipeline->addStage(nfilter._name, [this, nfilter](FramesetJob& job){applyFilter(nfilter, job);});
+    }
+    _filter_pipeline->addStage("publish", [this](FramesetJob& job)
+    {
+        publishFrameset(job);
+        _synced_imu_publisher->framePublished(job.t);
+    });
+    // A frameset dropped on the way still releases the imu messages held back for it.
+    _filter_pipeline->setDropHandler([this](FramesetJob& job)
+    {
+        _synced_imu_publisher->framePublished(job.t);
+    });
+    ROS_INFO_STREAM("Running the filters as a pipeline of " << _filter_pipeline->numStages() << " stages.");
+    _filter_pipeline->start();
+
+    if (!_processing_diagnostics)
+    {
+        _processing_diagnostics = std::make_shared<diagnostic_updater::Updater>(ros::NodeHandle(), ros::NodeHandle("~"), ros::this_node::getName() + "_processing");
+        _processing_diagnostics->setHardwareID(_serial_no);
+    }
+    uint64_t last_dropped(0);
+    _processing_diagnostics->add("filter pipeline",
+        [this, last_dropped](diagnostic_updater::DiagnosticStatusWrapper& status) mutable
+        {
+            uint64_t dropped(_filter_pipeline->dropped());
+            if (dropped > last_dropped)
+                status.summary(diagnostic_msgs::DiagnosticStatus::WARN, "Dropping frames");
+            else
+                status.summary(diagnostic_msgs::DiagnosticStatus::OK, "OK");
+            last_dropped = dropped;
+            status.add("Stages", _filter_pipeline->numStages());
+            status.add("In flight", _filter_pipeline->inFlight());
+            status.add("Pushed", _filter_pipeline->pushed());
+            status.add("Dropped", dropped);
+        });
+}
+
+void BaseRealSenseNode::setupStreamContexts()
+{
+    for (auto& stream : IMAGE_STREAMS)
+    {
+        if (!_enable[stream] || _image_publishers.find(stream) == _image_publishers.end())
+            continue;
+        StreamContext& context(_stream_contexts.add(stream));
+        context.frame_id = &_frame_id[stream];
+        context.optical_frame_id = &_optical_frame_id[stream];
+        context.seq = &_seq[stream];
+
+        StreamOutput& output(context.output);
+        output.image = &_image[stream];
+        output.scaled_image = &_depth_scaled_image[stream];
+        output.info_publisher = &_info_publisher.at(stream);
+        output.image_publisher = &_image_publishers.at(stream);
+        auto frame_image_publisher = _frame_image_publishers.find(stream);
+        if (frame_image_publisher != _frame_image_publishers.end())
+            output.frame_image_publisher = &frame_image_publisher->second;
+        auto rvl_publisher = _rvl_publishers.find(stream);
+        if (rvl_publisher != _rvl_publishers.end())
+            output.rvl_publisher = rvl_publisher->second.get();
+        auto metadata_publisher = _metadata_publishers.find(stream);
+        if (metadata_publisher != _metadata_publishers.end())
+            context.metadata_publisher = output.metadata_publisher = metadata_publisher->second.get();
+        output.seq = &_seq[stream];
+        output.camera_info = &_camera_info[stream];
+        output.encoding = &_encoding[stream.first];
+
+        if (_depth_aligned_image_publishers.find(stream) != _depth_aligned_image_publishers.end())
+        {
+            StreamOutput& aligned_output(context.aligned_output);
+            aligned_output.image = &_depth_aligned_image[stream];
+            aligned_output.scaled_image = &_depth_scaled_image[stream];
+            aligned_output.info_publisher = &_depth_aligned_info_publisher.at(stream);
+            aligned_output.image_publisher = &_depth_aligned_image_publishers.at(stream);
+            auto aligned_frame_image_publisher = _depth_aligned_frame_image_publishers.find(stream);
+            if (aligned_frame_image_publisher != _depth_aligned_frame_image_publishers.end())
+                aligned_output.frame_image_publisher = &aligned_frame_image_publisher->second;
+            auto aligned_rvl_publisher = _depth_aligned_rvl_publishers.find(stream);
+            if (aligned_rvl_publisher != _depth_aligned_rvl_publishers.end())
+                aligned_output.rvl_publisher = aligned_rvl_publisher->second.get();
+            aligned_output.seq = &_depth_aligned_seq[stream];
+            aligned_output.camera_info = &_depth_aligned_camera_info[stream];
+            aligned_output.encoding = &_depth_aligned_encoding[stream.first];
+        }
+
+        auto processing_queue = _processing_queues.find(stream);
+        if (processing_queue != _processing_queues.end())
+        {
+            context.has_processing_queue = true;
+            context.processing_queue = processing_queue->second;
+        }
+    }
+    for (auto& stream : HID_STREAMS)
+    {
+        if (!_enable[stream])
+            continue;
+        StreamContext& context(_stream_contexts.add(stream));
+        context.frame_id = &_frame_id[stream];
+        context.optical_frame_id = &_optical_frame_id[stream];
+        context.seq = &_seq[stream];
+        auto imu_publisher = _imu_publishers.find(stream);
+        if (imu_publisher != _imu_publishers.end())
+            context.imu_publisher = &imu_publisher->second;
+        auto imu_batch_publisher = _imu_batch_publishers.find(stream);
+        if (imu_batch_publisher != _imu_batch_publishers.end())
+            context.imu_batch_publisher = imu_batch_publisher->second.get();
+        auto imu_decimator = _imu_decimators.find(stream);
+        if (imu_decimator != _imu_decimators.end())
+            context.imu_decimator = imu_decimator->second.get();
+        auto metadata_publisher = _metadata_publishers.find(stream);
+        if (metadata_publisher != _metadata_publishers.end())
+            context.metadata_publisher = metadata_publisher->second.get();
+    }
+}
+
+void BaseRealSenseNode::publish_processing_update()
+{
+    if (_processing_diagnostics)
+        _processing_diagnostics->update();
+}
+
+// Called on the librealsense threads. With processing_threads, frames only pass through the queue of their stream,
+// or, when syncing, through the frameset queue.
+void BaseRealSenseNode::dispatchFrame(rs2::frame frame)
+{
+    if (_processing_engine)
+    {
+        if (_sync_frames)
+        {
+            _processing_engine->push(_frameset_queue, frame);
+            return;
+        }
+        StreamContext* context(_stream_contexts.find(frame.get_profile()));
+        if (context && context->has_processing_queue)
+        {
+            _processing_engine->push(context->processing_queue, frame);
+            return;
+        }
+    }
+    frame_callback(frame);
 }
 
 void BaseRealSenseNode::frame_callback(rs2::frame frame)
 {
-    _synced_imu_publisher->Pause();
-    
+    ros::Time t;
+    bool holding_imu(false);
     try{
         double frame_time = frame.get_timestamp();
 
@@ -1644,7 +2624,28 @@ void BaseRealSenseNode::frame_callback(rs2::frame frame)
             _is_initialized_time_base = setBaseTime(frame_time, frame.get_frame_timestamp_domain());
         }
 
-        ros::Time t(frameSystemTimeSec(frame));
+        t = ros::Time(frameSystemTimeSec(frame));
+        _synced_imu_publisher->frameArrived(t);
+        if (_imu_batch_mode == ImuBatchMode::FRAMES)
+        {
+            if (_united_imu_batch_publisher)
+                _united_imu_batch_publisher->frameArrived(t.toSec());
+            for (auto& imu_batch_publisher : _imu_batch_publishers)
+                imu_batch_publisher.second->frameArrived(t.toSec());
+        }
+        if (_imu_preintegrator)
+        {
+            // Intervals are bounded by the timestamps of the preintegration stream's own frames.
+            rs2::frame preintegration_frame(frame);
+            if (frame.is<rs2::frameset>())
+                preintegration_frame = frame.as<rs2::frameset>().first_or_default(_imu_preintegration_stream.first);
+            if (preintegration_frame && preintegration_frame.get_profile().stream_type() == _imu_preintegration_stream.first
+                && preintegration_frame.get_profile().stream_index() == _imu_preintegration_stream.second)
+            {
+                _imu_preintegrator->frameArrived(frameSystemTimeSec(preintegration_frame));
+            }
+        }
+        holding_imu = true;
         if (frame.is<rs2::frameset>())
         {
             ROS_DEBUG("Frameset arrived.");
@@ -1662,125 +2663,182 @@ void BaseRealSenseNode::frame_callback(rs2::frame frame)
                             rs2_stream_to_string(stream_type), stream_index, rs2_format_to_string(stream_format), stream_unique_id, frame.get_frame_number(), frame_time, t.toNSec());
                 runFirstFrameInitialization(stream_type);
             }
-            // Clip depth_frame for max range:
-            rs2::depth_frame original_depth_frame = frameset.get_depth_frame();
-            bool is_color_frame(frameset.get_color_frame());
-            if (original_depth_frame && _clipping_distance > 0)
+            if (_filter_demand_changed.exchange(false))
+                updateFilterDemand();
+            FramesetJob job;
+            job.frameset = frameset;
+            job.t = t;
+            job.frame_time = frame_time;
+            job.condition_depth = _depth_demanded;
+            job.filters = _filter_demand;
+            job.aligned_targets = _align_target_demand;
+            if (_filter_pipeline)
             {
-                clip_depth(original_depth_frame, _clipping_distance);
+                // The pipeline reports the frameset to the imu publisher once published, or dropped by a stage.
+                if (_filter_pipeline->push(job))
+                    holding_imu = false;
             }
-
-            ROS_DEBUG("num_filters: %d", static_cast<int>(_filters.size()));
-            for (std::vector<NamedFilter>::const_iterator filter_it = _filters.begin(); filter_it != _filters.end(); filter_it++)
-            {
-                ROS_DEBUG("Applying filter: %s", filter_it->_name.c_str());
-                if ((filter_it->_name == "pointcloud") && (!original_depth_frame))
-                    continue;
-                if ((filter_it->_name == "align_to_color") && (!is_color_frame))
-                    continue;
-                frameset = filter_it->_filter->process(frameset);
-            }
-
-            ROS_DEBUG("List of frameset after applying filters: size: %d", static_cast<int>(frameset.size()));
-            bool sent_depth_frame(false);
-            for (auto it = frameset.begin(); it != frameset.end(); ++it)
-            {
-                auto f = (*it);
-                auto stream_type = f.get_profile().stream_type();
-                auto stream_index = f.get_profile().stream_index();
-                auto stream_format = f.get_profile().format();
-                stream_index_pair sip{stream_type,stream_index};
-
-                ROS_DEBUG("Frameset contain (%s, %d, %s) frame. frame_number: %llu ; frame_TS: %f ; ros_TS(NSec): %lu",
-                            rs2_stream_to_string(stream_type), stream_index, rs2_format_to_string(stream_format), f.get_frame_number(), frame_time, t.toNSec());
-                if (f.is<rs2::video_frame>())
-                    ROS_DEBUG_STREAM("frame: " << f.as<rs2::video_frame>().get_width() << " x " << f.as<rs2::video_frame>().get_height());
-
-                if (f.is<rs2::points>())
-                {
-                    publishPointCloud(f.as<rs2::points>(), t, frameset);
-                    continue;
-                }
-                if (stream_type == RS2_STREAM_DEPTH)
-                {
-                    if (sent_depth_frame) continue;
-                    sent_depth_frame = true;
-                    if (_align_depth && is_color_frame)
-                    {
-                        publishFrame(f, t, COLOR,
-                                    _depth_aligned_image,
-                                    _depth_aligned_info_publisher,
-                                    _depth_aligned_image_publishers,
-                                    false,
-                                    _depth_aligned_seq,
-                                    _depth_aligned_camera_info,
-                                    _depth_aligned_encoding);
-                        continue;
-                    }
-                }
-                publishFrame(f, t,
-                                sip,
-                                _image,
-                                _info_publisher,
-                                _image_publishers,
-                                true,
-                                _seq,
-                                _camera_info,
-                                _encoding);
-            }
-            if (original_depth_frame && _align_depth)
+            else
             {
-                rs2::frame frame_to_send;
-                if (_colorizer)
-                    frame_to_send = _colorizer->process(original_depth_frame);
-                else
-                    frame_to_send = original_depth_frame;
-
-                publishFrame(frame_to_send, t,
-                                DEPTH,
-                                _image,
-                                _info_publisher,
-                                _image_publishers,
-                                true,
-                                _seq,
-                                _camera_info,
-                                _encoding);
+                conditionFrameset(job);
+                ROS_DEBUG("num_filters: %d", static_cast<int>(_filters.size()));
+                for (const NamedFilter& nfilter : _filters)
+                    applyFilter(nfilter, job);
+                publishFrameset(job);
             }
         }
         else if (frame.is<rs2::video_frame>())
         {
-            auto stream_type = frame.get_profile().stream_type();
-            auto stream_index = frame.get_profile().stream_index();
+            rs2::stream_profile profile(frame.get_profile());
+            auto stream_type = profile.stream_type();
+            auto stream_index = profile.stream_index();
             ROS_DEBUG("Single video frame arrived (%s, %d). frame_number: %llu ; frame_TS: %f ; ros_TS(NSec): %lu",
                         rs2_stream_to_string(stream_type), stream_index, frame.get_frame_number(), frame_time, t.toNSec());
             runFirstFrameInitialization(stream_type);
 
-            stream_index_pair sip{stream_type,stream_index};
-            if (frame.is<rs2::depth_frame>())
+            FramesetJob job;
+            job.single_frame = frame;
+            job.t = t;
+            job.frame_time = frame_time;
+            if (_filter_pipeline)
             {
-                if (_clipping_distance > 0)
-                {
-                    clip_depth(frame, _clipping_distance);
-                }
+                // Published by the publish stage too, which owns the stream outputs the framesets are published to.
+                if (_filter_pipeline->push(job))
+                    holding_imu = false;
+            }
+            else
+            {
+                publishFrameset(job);
             }
-            publishFrame(frame, t,
-                            sip,
-                            _image,
-                            _info_publisher,
-                            _image_publishers,
-                            true,
-                            _seq,
-                            _camera_info,
-                            _encoding);
         }
     }
     catch(const std::exception& ex)
     {
         ROS_ERROR_STREAM("An error has occurred during frame callback: " << ex.what());
     }
-    _synced_imu_publisher->Resume();
+    if (holding_imu)
+        _synced_imu_publisher->framePublished(t);
 } // frame_callback
 
+void BaseRealSenseNode::conditionFrameset(FramesetJob& job)
+{
+    if (job.single_frame)
+        return;
+    // Clip depth_frame for range and mask it by confidence before any filter uses it. Without filters,
+    // clipping is left to publishFrame, which does it in the same pass as rescaling the published image.
+    rs2::depth_frame original_depth_frame = job.frameset.get_depth_frame();
+    job.has_depth = static_cast<bool>(original_depth_frame);
+    bool is_depth_clipped(_clipping_distance > 0 || _min_distance > 0);
+    bool is_confidence_masked(_confidence_threshold > 0 && job.frameset.first_or_default(RS2_STREAM_CONFIDENCE));
+    if (job.condition_depth && original_depth_frame && ((is_depth_clipped && !_filters.empty()) || is_confidence_masked))
+    {
+        job.frameset = _depth_conditioning_filter->process(job.frameset);
+    }
+    job.unaligned_depth_frame = job.frameset.get_depth_frame();
+}
+
+void BaseRealSenseNode::applyFilter(const NamedFilter& nfilter, FramesetJob& job)
+{
+    if (job.single_frame || !(job.filters & nfilter._mask))
+        return;
+    ROS_DEBUG("Applying filter: %s", nfilter._name.c_str());
+    if (nfilter._name == "pointcloud")
+    {
+        if (!job.has_depth)
+            return;
+        // The generated pointcloud is built from the depth when publishing, in place of rs2::pointcloud.
+        job.generate_pointcloud = canGeneratePointCloud(job.frameset);
+        if (job.generate_pointcloud)
+            return;
+    }
+    if (nfilter._name == "align_depth")
+    {
+        if (!job.has_depth)
+            return;
+        // alignDepthFrames runs within process(), on this thread.
+        _align_stage_targets = job.aligned_targets;
+        job.frameset = nfilter._filter->process(job.frameset);
+        job.depth_aligned_to_color = _depth_aligned_to_color;
+        job.aligned_depth_frames.swap(_aligned_depth_frames);
+        _aligned_depth_frames.clear();
+        return;
+    }
+    job.frameset = nfilter._filter->process(job.frameset);
+    // The depth published unaligned, or aligned to other streams than color, is colorized here rather than when
+    // publishing, so the colorizer is only used by its own stage.
+    if (nfilter._filter == _colorizer && _align_depth)
+    {
+        if (job.unaligned_depth_frame)
+            job.unaligned_depth_frame = _colorizer->process(job.unaligned_depth_frame);
+        for (std::pair<stream_index_pair, rs2::frame>& aligned : job.aligned_depth_frames)
+            aligned.second = _colorizer->process(aligned.second);
+    }
+}
+
+void BaseRealSenseNode::publishFrameset(const FramesetJob& job)
+{
+    const ros::Time& t(job.t);
+    if (job.single_frame)
+    {
+        StreamContext* context(_stream_contexts.find(job.single_frame.get_profile()));
+        if (context && context->output.isValid())
+            publishFrame(job.single_frame, t, context->output);
+        return;
+    }
+    ROS_DEBUG("List of frameset after applying filters: size: %d", static_cast<int>(job.frameset.size()));
+    bool sent_depth_frame(false);
+    for (auto it = job.frameset.begin(); it != job.frameset.end(); ++it)
+    {
+        auto f = (*it);
+        rs2::stream_profile profile(f.get_profile());
+        auto stream_type = profile.stream_type();
+        auto stream_index = profile.stream_index();
+        auto stream_format = profile.format();
+
+        ROS_DEBUG("Frameset contain (%s, %d, %s) frame. frame_number: %llu ; frame_TS: %f ; ros_TS(NSec): %lu",
+                    rs2_stream_to_string(stream_type), stream_index, rs2_format_to_string(stream_format), f.get_frame_number(), job.frame_time, t.toNSec());
+        if (f.is<rs2::video_frame>())
+            ROS_DEBUG_STREAM("frame: " << f.as<rs2::video_frame>().get_width() << " x " << f.as<rs2::video_frame>().get_height());
+
+        if (f.is<rs2::points>())
+        {
+            publishPointCloud(f.as<rs2::points>(), t, job.frameset, job.depth_aligned_to_color);
+            continue;
+        }
+        if (stream_type == RS2_STREAM_DEPTH)
+        {
+            if (sent_depth_frame) continue;
+            sent_depth_frame = true;
+            if (_align_depth)
+            {
+                // The depth topic is published from the unaligned depth below. The depth of the frameset is only
+                // aligned if this job ran align_depth and found a color frame, whatever align_depth is set to.
+                StreamContext* color_context(_stream_contexts.find(COLOR));
+                if (job.depth_aligned_to_color && color_context && color_context->aligned_output.isValid())
+                    publishFrame(f, t, color_context->aligned_output);
+                continue;
+            }
+        }
+        StreamContext* context(_stream_contexts.find(stream_type, stream_index));
+        if (context && context->output.isValid())
+            publishFrame(f, t, context->output);
+    }
+    if (job.unaligned_depth_frame && _align_depth)
+    {
+        StreamContext* depth_context(_stream_contexts.find(DEPTH));
+        if (depth_context && depth_context->output.isValid())
+            publishFrame(job.unaligned_depth_frame, t, depth_context->output);
+    }
+    for (const std::pair<stream_index_pair, rs2::frame>& aligned : job.aligned_depth_frames)
+    {
+        StreamContext* context(_stream_contexts.find(aligned.first));
+        if (context && context->aligned_output.isValid())
+            publishFrame(aligned.second, t, context->aligned_output);
+    }
+    if (job.generate_pointcloud)
+        publishPointCloud(rs2::points(), t, job.frameset, job.depth_aligned_to_color);
+}
+
 void BaseRealSenseNode::multiple_message_callback(rs2::frame frame, imu_sync_method sync_method)
 {
     auto stream = frame.get_profile().stream_type();
@@ -1795,7 +2853,7 @@ void BaseRealSenseNode::multiple_message_callback(rs2::frame frame, imu_sync_met
             pose_callback(frame);
             break;
         default:
-            frame_callback(frame);
+            dispatchFrame(frame);
     }
 }
 
@@ -1842,6 +2900,18 @@ void BaseRealSenseNode::setupStreams()
             }
         }
 
+        if (_auto_streams)
+        {
+            // Streams are opened by the auto_streams thread once they have subscribers.
+            for (const std::pair<stream_index_pair, std::vector<rs2::stream_profile>>& profile : _enabled_profiles)
+            {
+                if (_sensors[profile.first].is<rs2::depth_sensor>())
+                    _depth_scale_meters = _sensors[profile.first].as<rs2::depth_sensor>().get_depth_scale();
+            }
+            _auto_streams_t = std::make_shared<std::thread>([this](){autoStreams();});
+            return;
+        }
+
         // Streaming IMAGES
         std::map<std::string, std::vector<rs2::stream_profile> > profiles;
         std::map<std::string, rs2::sensor> active_sensors;
@@ -2155,18 +3225,191 @@ void BaseRealSenseNode::publishIntrinsics()
     }
 }
 
-void reverse_memcpy(unsigned char* dst, const unsigned char* src, size_t n)
+rs2::frame BaseRealSenseNode::findPointCloudTexture(const rs2::frameset& frameset, rs2_stream texture_source_id) const
 {
-    size_t i;
+    std::set<rs2_format> available_formats{ rs2_format::RS2_FORMAT_RGB8, rs2_format::RS2_FORMAT_Y8 };
 
-    for (i=0; i < n; ++i)
-        dst[n-1-i] = src[i];
+    auto texture_frame_itr = std::find_if(frameset.begin(), frameset.end(), [&texture_source_id, &available_formats] (rs2::frame f)
+                            {return (rs2_stream(f.get_profile().stream_type()) == texture_source_id) &&
+                                        (available_formats.find(f.get_profile().format()) != available_formats.end()); });
+    return texture_frame_itr == frameset.end() ? rs2::frame() : *texture_frame_itr;
+}
 
+// The pointcloud generator covers dense Z16 depth, textured by streams with a distortion model it supports.
+// Only pointcloud_lut enables it; the other framesets go through rs2::pointcloud.
+bool BaseRealSenseNode::canGeneratePointCloud(const rs2::frameset& frameset) const
+{
+    if (!_pointcloud_lut)
+        return false;
+    rs2::depth_frame depth(frameset.get_depth_frame());
+    if (!depth || depth.get_profile().format() != RS2_FORMAT_Z16 ||
+        depth.get_stride_in_bytes() != depth.get_width() * static_cast<int>(sizeof(uint16_t)))
+        return false;
+    rs2_stream texture_source_id = static_cast<rs2_stream>(_pointcloud_filter->get_option(rs2_option::RS2_OPTION_STREAM_FILTER));
+    if (texture_source_id == RS2_STREAM_ANY)
+        return true;
+    // Without a texture frame, publishPointCloud warns and skips the frameset whichever way it is built.
+    rs2::frame texture(findPointCloudTexture(frameset, texture_source_id));
+    if (!texture)
+        return true;
+    PixelProjection projection;
+    rs2_extrinsics identity = {{1, 0, 0, 0, 1, 0, 0, 0, 1}, {0, 0, 0}};
+    bool supported(PixelProjection::create(texture.get_profile().as<rs2::video_stream_profile>().get_intrinsics(), identity, projection));
+    if (!supported)
+        ROS_WARN_STREAM_ONCE("pointcloud_lut does not support the distortion model of the " << rs2_stream_to_string(texture_source_id) << " texture. Generating the pointcloud with librealsense.");
+    return supported;
+}
+
+bool BaseRealSenseNode::configurePointCloudGenerator(const rs2::depth_frame& depth, const rs2::frame& texture)
+{
+    // The tables only change with the profiles, e.g. when the decimation filter changes the depth resolution.
+    rs2::video_stream_profile depth_profile(depth.get_profile().as<rs2::video_stream_profile>());
+    float units(depth.get_units());
+    if (depth_profile.unique_id() != _pointcloud_generator_depth_id || units != _pointcloud_generator_units)
+    {
+        _pointcloud_generator.configure(depth_profile.get_intrinsics(), units);
+        _pointcloud_generator_depth_id = depth_profile.unique_id();
+        _pointcloud_generator_units = units;
+        _pointcloud_generator_texture_id = -1;
+        _pointcloud_generator_textured = false;
+    }
+    if (!texture)
+        return true;
+    rs2::video_stream_profile texture_profile(texture.get_profile().as<rs2::video_stream_profile>());
+    if (texture_profile.unique_id() != _pointcloud_generator_texture_id)
+    {
+        _pointcloud_generator_texture_id = texture_profile.unique_id();
+        _pointcloud_generator_textured = _pointcloud_generator.setTexture(texture_profile.get_intrinsics(),
+                                                                          depth_profile.get_extrinsics_to(texture_profile));
+    }
+    return _pointcloud_generator_textured;
 }
 
-void BaseRealSenseNode::publishPointCloud(rs2::points pc, const ros::Time& t, const rs2::frameset& frameset)
+void BaseRealSenseNode::setupPointCloudCrop()
 {
-    if (0 == _pointcloud_publisher.getNumSubscribers())
+    _pointcloud_to_base = rs2_extrinsics({{1, 0, 0, 0, 1, 0, 0, 0, 1}, {0, 0, 0}});
+    if (!_pointcloud)
+        return;
+    // The box limits in the base frame are in ROS axes (x forward, y left, z up), the optical z, -x and -y.
+    stream_index_pair cloud_stream(_align_depth_to_color ? COLOR : DEPTH);
+    rs2_extrinsics ex;
+    try
+    {
+        ex = getAProfile(cloud_stream).get_extrinsics_to(getAProfile(_base_stream));
+    }
+    catch (std::exception& e)
+    {
+        ROS_WARN_STREAM("Pointcloud crop: " << e.what() << " : using unity as the extrinsics to the base frame.");
+        ex = rs2_extrinsics({{1, 0, 0, 0, 1, 0, 0, 0, 1}, {0, 0, 0}});
+    }
+    for (int j = 0; j < 3; ++j)
+    {
+        _pointcloud_to_base.rotation[j * 3 + 0] = ex.rotation[j * 3 + 2];
+        _pointcloud_to_base.rotation[j * 3 + 1] = -ex.rotation[j * 3 + 0];
+        _pointcloud_to_base.rotation[j * 3 + 2] = -ex.rotation[j * 3 + 1];
+    }
+    _pointcloud_to_base.translation[0] = ex.translation[2];
+    _pointcloud_to_base.translation[1] = -ex.translation[0];
+    _pointcloud_to_base.translation[2] = -ex.translation[1];
+    {
+        std::lock_guard<std::mutex> lock(_crop_mutex);
+        updateCropVolume();
+        if (!_crop_volume.empty())
+            ROS_INFO_STREAM("Cropping the pointcloud to " << _crop_volume.num_planes << " planes.");
+    }
+}
+
+void BaseRealSenseNode::registerPointCloudCropOptions()
+{
+    if (!_pointcloud)
+        return;
+    ros::NodeHandle nh1(_node_handle, "pointcloud_crop");
+    std::shared_ptr<ddynamic_reconfigure::DDynamicReconfigure> ddynrec = std::make_shared<ddynamic_reconfigure::DDynamicReconfigure>(nh1);
+    auto set_crop_param = [this](double& param, double new_value)
+    {
+        std::lock_guard<std::mutex> lock(_crop_mutex);
+        param = new_value;
+        updateCropVolume();
+    };
+    ddynrec->registerVariable<bool>(
+        "box", _crop_params.box,
+        [this](bool new_value)
+        {
+            std::lock_guard<std::mutex> lock(_crop_mutex);
+            _crop_params.box = new_value;
+            updateCropVolume();
+        },
+        "Crop the pointcloud to the box");
+    ddynrec->registerEnumVariable<int>(
+        "box_frame", _crop_params.box_in_base_frame ? 1 : 0,
+        [this](int new_value)
+        {
+            std::lock_guard<std::mutex> lock(_crop_mutex);
+            _crop_params.box_in_base_frame = (new_value == 1);
+            updateCropVolume();
+        },
+        "Frame of the box limits", std::map<std::string, int>{{"optical", 0}, {"base", 1}});
+    const std::string axes("xyz");
+    for (int i = 0; i < 3; ++i)
+    {
+        ddynrec->registerVariable<double>(
+            std::string("box_min_") + axes[i], _crop_params.box_min[i],
+            [this, i, set_crop_param](double new_value) { set_crop_param(_crop_params.box_min[i], new_value); },
+            std::string("Lower limit of the box along ") + axes[i] + ", in meters", -100.0, 100.0);
+        ddynrec->registerVariable<double>(
+            std::string("box_max_") + axes[i], _crop_params.box_max[i],
+            [this, i, set_crop_param](double new_value) { set_crop_param(_crop_params.box_max[i], new_value); },
+            std::string("Upper limit of the box along ") + axes[i] + ", in meters", -100.0, 100.0);
+    }
+    ddynrec->registerVariable<double>(
+        "near", _crop_params.near,
+        [this, set_crop_param](double new_value) { set_crop_param(_crop_params.near, new_value); },
+        "Minimal depth of the points, in meters. 0 disables it", 0.0, 100.0);
+    ddynrec->registerVariable<double>(
+        "far", _crop_params.far,
+        [this, set_crop_param](double new_value) { set_crop_param(_crop_params.far, new_value); },
+        "Maximal depth of the points, in meters. 0 disables it", 0.0, 100.0);
+    ddynrec->registerVariable<double>(
+        "horizontal_fov", _crop_params.horizontal_fov,
+        [this, set_crop_param](double new_value) { set_crop_param(_crop_params.horizontal_fov, new_value); },
+        "Horizontal field of view kept around the optical axis, in degrees. 0 disables it", 0.0, 180.0);
+    ddynrec->registerVariable<double>(
+        "vertical_fov", _crop_params.vertical_fov,
+        [this, set_crop_param](double new_value) { set_crop_param(_crop_params.vertical_fov, new_value); },
+        "Vertical field of view kept around the optical axis, in degrees. 0 disables it", 0.0, 180.0);
+    ddynrec->publishServicesTopics();
+    _ddynrec.push_back(ddynrec);
+}
+
+// Called with _crop_mutex held.
+void BaseRealSenseNode::updateCropVolume()
+{
+    CropVolume volume;
+    if (_crop_params.box)
+    {
+        float box_min[3], box_max[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            box_min[i] = static_cast<float>(_crop_params.box_min[i]);
+            box_max[i] = static_cast<float>(_crop_params.box_max[i]);
+        }
+        rs2_extrinsics identity = {{1, 0, 0, 0, 1, 0, 0, 0, 1}, {0, 0, 0}};
+        volume.addBox(box_min, box_max, _crop_params.box_in_base_frame ? _pointcloud_to_base : identity);
+    }
+    volume.addRange(static_cast<float>(_crop_params.near), static_cast<float>(_crop_params.far));
+    volume.addFrustum(static_cast<float>(_crop_params.horizontal_fov * M_PI / 180.0),
+                      static_cast<float>(_crop_params.vertical_fov * M_PI / 180.0));
+    _crop_volume = volume;
+}
+
+void BaseRealSenseNode::publishPointCloud(rs2::points pc, const ros::Time& t, const rs2::frameset& frameset, bool depth_aligned_to_color)
+{
+    // With voxel_only the downsampled cloud is published on the pointcloud topic, in place of the full one.
+    bool is_voxelized(_voxel_leaf_size > 0);
+    ros::Publisher& voxel_publisher(_voxel_only ? _pointcloud_publisher : _voxel_pointcloud_publisher);
+    bool publish_points(0 != _pointcloud_publisher.getNumSubscribers() && !(is_voxelized && _voxel_only));
+    bool publish_voxels(is_voxelized && 0 != voxel_publisher.getNumSubscribers());
+    if (!publish_points && !publish_voxels)
         return;
     ROS_INFO_STREAM_ONCE("publishing " << (_ordered_pc ? "" : "un") << "ordered pointcloud.");
 
@@ -2174,15 +3417,11 @@ void BaseRealSenseNode::publishPointCloud(rs2::points pc, const ros::Time& t, co
     bool use_texture = texture_source_id != RS2_STREAM_ANY;
     static int warn_count(0);
     static const int DISPLAY_WARN_NUMBER(5);
-    rs2::frameset::iterator texture_frame_itr = frameset.end();
+    rs2::frame texture_source_frame;
     if (use_texture)
     {
-        std::set<rs2_format> available_formats{ rs2_format::RS2_FORMAT_RGB8, rs2_format::RS2_FORMAT_Y8 };
-
-        texture_frame_itr = std::find_if(frameset.begin(), frameset.end(), [&texture_source_id, &available_formats] (rs2::frame f)
-                                {return (rs2_stream(f.get_profile().stream_type()) == texture_source_id) &&
-                                            (available_formats.find(f.get_profile().format()) != available_formats.end()); });
-        if (texture_frame_itr == frameset.end())
+        texture_source_frame = findPointCloudTexture(frameset, texture_source_id);
+        if (!texture_source_frame)
         {
             warn_count++;
             std::string texture_source_name = _pointcloud_filter->get_option_value_description(rs2_option::RS2_OPTION_STREAM_FILTER, static_cast<float>(texture_source_id));
@@ -2192,118 +3431,141 @@ void BaseRealSenseNode::publishPointCloud(rs2::points pc, const ros::Time& t, co
         warn_count = 0;
     }
 
-    int texture_width(0), texture_height(0);
-    int num_colors(0);
-
-    const rs2::vertex* vertex = pc.get_vertices();
-    const rs2::texture_coordinate* color_point = pc.get_texture_coordinates();
-
-    rs2_intrinsics depth_intrin = pc.get_profile().as<rs2::video_stream_profile>().get_intrinsics();
+    rs2::depth_frame depth_frame(frameset.get_depth_frame());
+    // The texture source may have changed to one the generator does not support since the frameset was checked.
+    if (!pc && !configurePointCloudGenerator(depth_frame, texture_source_frame))
+        return;
+    rs2_intrinsics depth_intrin = (pc ? rs2::frame(pc) : rs2::frame(depth_frame)).get_profile().as<rs2::video_stream_profile>().get_intrinsics();
+    size_t num_points(pc ? pc.size() : _pointcloud_generator.size());
 
-    sensor_msgs::PointCloud2Modifier modifier(_msg_pointcloud);
-    modifier.setPointCloud2FieldsByString(1, "xyz");
-    modifier.resize(pc.size());
+    // Each frame gets its own message out of the pool, so it can be published by pointer: nodelets in the
+    // same manager receive it without serialization and it is recycled after they all release it.
+    sensor_msgs::PointCloud2::Ptr msg_pointcloud = _pointcloud_pool.acquire();
+    msg_pointcloud->is_bigendian = false;
     if (_ordered_pc)
     {
-        _msg_pointcloud.width = depth_intrin.width;
-        _msg_pointcloud.height = depth_intrin.height;
-        _msg_pointcloud.is_dense = false;
+        msg_pointcloud->width = depth_intrin.width;
+        msg_pointcloud->height = depth_intrin.height;
+        msg_pointcloud->is_dense = false;
+    }
+    else
+    {
+        msg_pointcloud->width = num_points;
+        msg_pointcloud->height = 1;
     }
 
-    vertex = pc.get_vertices();
-    size_t valid_count(0);
+    PointCloudAssembler::Texture texture;
     if (use_texture)
     {
-        rs2::video_frame texture_frame = (*texture_frame_itr).as<rs2::video_frame>();
-        texture_width = texture_frame.get_width();
-        texture_height = texture_frame.get_height();
-        num_colors = texture_frame.get_bytes_per_pixel();
-        uint8_t* color_data = (uint8_t*)texture_frame.get_data();
-        std::string format_str;
+        rs2::video_frame texture_frame = texture_source_frame.as<rs2::video_frame>();
+        texture.data = static_cast<const uint8_t*>(texture_frame.get_data());
+        texture.width = texture_frame.get_width();
+        texture.height = texture_frame.get_height();
+        texture.bytes_per_pixel = texture_frame.get_bytes_per_pixel();
         switch(texture_frame.get_profile().format())
         {
             case RS2_FORMAT_RGB8:
-                format_str = "rgb";
-                break;
             case RS2_FORMAT_Y8:
-                format_str = "intensity";
                 break;
             default:
                 throw std::runtime_error("Unhandled texture format passed in pointcloud " + std::to_string(texture_frame.get_profile().format()));
         }
-        _msg_pointcloud.point_step = addPointField(_msg_pointcloud, format_str.c_str(), 1, sensor_msgs::PointField::FLOAT32, _msg_pointcloud.point_step);
-        _msg_pointcloud.row_step = _msg_pointcloud.width * _msg_pointcloud.point_step;
-        _msg_pointcloud.data.resize(_msg_pointcloud.height * _msg_pointcloud.row_step);
-
-        sensor_msgs::PointCloud2Iterator<float>iter_x(_msg_pointcloud, "x");
-        sensor_msgs::PointCloud2Iterator<float>iter_y(_msg_pointcloud, "y");
-        sensor_msgs::PointCloud2Iterator<float>iter_z(_msg_pointcloud, "z");
-        sensor_msgs::PointCloud2Iterator<uint8_t>iter_color(_msg_pointcloud, format_str);
-        color_point = pc.get_texture_coordinates();
-
-        float color_pixel[2];
-        for (size_t point_idx=0; point_idx < pc.size(); point_idx++, vertex++, color_point++)
-        {
-            float i(color_point->u);
-            float j(color_point->v);
-            bool valid_color_pixel(i >= 0.f && i <=1.f && j >= 0.f && j <=1.f);
-            bool valid_pixel(vertex->z > 0 && (valid_color_pixel || _allow_no_texture_points));
-            if (valid_pixel || _ordered_pc)
-            {
-                *iter_x = vertex->x;
-                *iter_y = vertex->y;
-                *iter_z = vertex->z;
+    }
+    int bytes_per_pixel(use_texture ? texture.bytes_per_pixel : 0);
+    pointcloud_layout::setFields(*msg_pointcloud, _pointcloud_layout, bytes_per_pixel);
+    if (msg_pointcloud->point_step != PointCloudAssembler::pointStep(use_texture ? &texture : nullptr, _pointcloud_layout))
+        throw std::runtime_error("Unexpected pointcloud point step " + std::to_string(msg_pointcloud->point_step));
+    msg_pointcloud->row_step = msg_pointcloud->width * msg_pointcloud->point_step;
 
-                if (valid_color_pixel)
-                {
-                    color_pixel[0] = i * texture_width;
-                    color_pixel[1] = j * texture_height;
-                    int pixx = static_cast<int>(color_pixel[0]);
-                    int pixy = static_cast<int>(color_pixel[1]);
-                    int offset = (pixy * texture_width + pixx) * num_colors;
-                    reverse_memcpy(&(*iter_color), color_data+offset, num_colors);  // PointCloud2 order of rgb is bgr.
-                }
-                ++iter_x; ++iter_y; ++iter_z;
-                ++iter_color;
-                ++valid_count;
-            }
-        }
+    // The voxel grid works on the XYZ32 layout. With a compact layout the cloud is assembled as XYZ32 into
+    // a scratch buffer and both outputs are converted from there.
+    bool assemble_xyz32(publish_voxels && _pointcloud_layout != PointCloudLayout::XYZ32);
+    uint32_t xyz32_step(PointCloudAssembler::pointStep(use_texture ? &texture : nullptr));
+    uint8_t* points_out;
+    if (assemble_xyz32)
+    {
+        _xyz32_points.resize(num_points * xyz32_step);
+        points_out = _xyz32_points.data();
     }
     else
     {
-        std::string format_str = "intensity";
-        _msg_pointcloud.row_step = _msg_pointcloud.width * _msg_pointcloud.point_step;
-        _msg_pointcloud.data.resize(_msg_pointcloud.height * _msg_pointcloud.row_step);
-
-        sensor_msgs::PointCloud2Iterator<float>iter_x(_msg_pointcloud, "x");
-        sensor_msgs::PointCloud2Iterator<float>iter_y(_msg_pointcloud, "y");
-        sensor_msgs::PointCloud2Iterator<float>iter_z(_msg_pointcloud, "z");
+        msg_pointcloud->data.resize(msg_pointcloud->height * msg_pointcloud->row_step);
+        points_out = msg_pointcloud->data.data();
+    }
+    PointCloudLayout points_layout(assemble_xyz32 ? PointCloudLayout::XYZ32 : _pointcloud_layout);
+    CropVolume crop;
+    {
+        std::lock_guard<std::mutex> lock(_crop_mutex);
+        crop = _crop_volume;
+    }
+    const CropVolume* crop_volume(crop.empty() ? nullptr : &crop);
+    size_t valid_count;
+    if (pc)
+    {
+        valid_count = _pointcloud_assembler.assemble(reinterpret_cast<const float*>(pc.get_vertices()),
+                                                     reinterpret_cast<const float*>(pc.get_texture_coordinates()),
+                                                     pc.size(), use_texture ? &texture : nullptr,
+                                                     _ordered_pc, _allow_no_texture_points, points_layout, points_out, crop_volume);
+    }
+    else
+    {
+        valid_count = _pointcloud_generator.generate(static_cast<const uint16_t*>(depth_frame.get_data()), use_texture ? &texture : nullptr,
+                                                     _ordered_pc, _allow_no_texture_points, points_layout, points_out, crop_volume);
+    }
+    if (assemble_xyz32 && publish_points)
+    {
+        msg_pointcloud->data.resize(valid_count * msg_pointcloud->point_step);
+        PointCloudAssembler::convert(_xyz32_points.data(), valid_count, bytes_per_pixel, _pointcloud_layout, msg_pointcloud->data.data());
+    }
 
-        for (size_t point_idx=0; point_idx < pc.size(); point_idx++, vertex++)
+    msg_pointcloud->header.stamp = t;
+    if (depth_aligned_to_color) msg_pointcloud->header.frame_id = _optical_frame_id[COLOR];
+    else              msg_pointcloud->header.frame_id = _optical_frame_id[DEPTH];
+    if (!_ordered_pc)
+    {
+        msg_pointcloud->width = valid_count;
+        msg_pointcloud->height = 1;
+        msg_pointcloud->is_dense = true;
+        msg_pointcloud->row_step = msg_pointcloud->width * msg_pointcloud->point_step;
+        msg_pointcloud->data.resize(msg_pointcloud->row_step);
+    }
+
+    if (publish_voxels)
+    {
+        sensor_msgs::PointCloud2::Ptr msg_voxels = _pointcloud_pool.acquire();
+        msg_voxels->header = msg_pointcloud->header;
+        msg_voxels->is_bigendian = false;
+        size_t voxel_count;
+        if (assemble_xyz32)
+        {
+            // Voxel centroids have no pixel position, so a z16 cloud is downsampled into xyz16.
+            PointCloudLayout voxel_layout(_pointcloud_layout == PointCloudLayout::Z16 ? PointCloudLayout::XYZ16 : _pointcloud_layout);
+            pointcloud_layout::setFields(*msg_voxels, voxel_layout, bytes_per_pixel);
+            _xyz32_voxels.resize(valid_count * xyz32_step);
+            voxel_count = _voxel_grid.filter(_xyz32_points.data(), valid_count, xyz32_step, use_texture,
+                                             _voxel_leaf_size, _voxel_min_points, _xyz32_voxels.data());
+            msg_voxels->data.resize(voxel_count * msg_voxels->point_step);
+            PointCloudAssembler::convert(_xyz32_voxels.data(), voxel_count, bytes_per_pixel, voxel_layout, msg_voxels->data.data());
+        }
+        else
         {
-            bool valid_pixel(vertex->z > 0);
-            if (valid_pixel || _ordered_pc)
-            {
-                *iter_x = vertex->x;
-                *iter_y = vertex->y;
-                *iter_z = vertex->z;
-
-                ++iter_x; ++iter_y; ++iter_z;
-                ++valid_count;
-            }
+            msg_voxels->fields = msg_pointcloud->fields;
+            msg_voxels->point_step = msg_pointcloud->point_step;
+            msg_voxels->data.resize(valid_count * msg_voxels->point_step);
+            voxel_count = _voxel_grid.filter(msg_pointcloud->data.data(), valid_count, msg_voxels->point_step, use_texture,
+                                             _voxel_leaf_size, _voxel_min_points, msg_voxels->data.data());
+            msg_voxels->data.resize(voxel_count * msg_voxels->point_step);
         }
+        msg_voxels->width = voxel_count;
+        msg_voxels->height = 1;
+        msg_voxels->row_step = msg_voxels->width * msg_voxels->point_step;
+        msg_voxels->is_dense = true;
+        voxel_publisher.publish(msg_voxels);
     }
-    _msg_pointcloud.header.stamp = t;
-    if (_align_depth) _msg_pointcloud.header.frame_id = _optical_frame_id[COLOR];
-    else              _msg_pointcloud.header.frame_id = _optical_frame_id[DEPTH];
-    if (!_ordered_pc)
+    if (publish_points)
     {
-        _msg_pointcloud.width = valid_count;
-        _msg_pointcloud.height = 1;
-        _msg_pointcloud.is_dense = true;
-        modifier.resize(valid_count);
+        _pointcloud_publisher.publish(msg_pointcloud);
     }
-    _pointcloud_publisher.publish(_msg_pointcloud);
 }
 
 
@@ -2361,14 +3623,7 @@ IMUInfo BaseRealSenseNode::getImuInfo(const stream_index_pair& stream_index)
 }
 
 void BaseRealSenseNode::publishFrame(rs2::frame f, const ros::Time& t,
-                                     const stream_index_pair& stream,
-                                     std::map<stream_index_pair, cv::Mat>& images,
-                                     const std::map<stream_index_pair, ros::Publisher>& info_publishers,
-                                     const std::map<stream_index_pair, ImagePublisherWithFrequencyDiagnostics>& image_publishers,
-                                     const bool is_publishMetadata,
-                                     std::map<stream_index_pair, int>& seq,
-                                     std::map<stream_index_pair, sensor_msgs::CameraInfo>& camera_info,
-                                     const std::map<rs2_stream, std::string>& encoding,
+                                     const StreamOutput& output,
                                      bool copy_data_from_frame)
 {
     ROS_DEBUG("publishFrame(...)");
@@ -2382,96 +3637,119 @@ void BaseRealSenseNode::publishFrame(rs2::frame f, const ros::Time& t,
         height = image.get_height();
         bpp = image.get_bytes_per_pixel();
     }
-    auto& image = images[stream];
+    cv::Mat& image = *output.image;
 
     if (copy_data_from_frame)
     {
-        if (images[stream].size() != cv::Size(width, height))
+        if (image.size() != cv::Size(width, height))
         {
             image.create(height, width, image.type());
         }
         image.data = (uint8_t*)f.get_data();
     }
-    if (f.is<rs2::depth_frame>())
-    {
-        image = fix_depth_scale(image, _depth_scaled_image[stream]);
-    }
 
-    ++(seq[stream]);
-    auto& info_publisher = info_publishers.at(stream);
-    auto& image_publisher = image_publishers.at(stream);
+    int seq = ++(*output.seq);
+    const ros::Publisher& info_publisher = *output.info_publisher;
+    const ImagePublisherWithFrequencyDiagnostics& image_publisher = *output.image_publisher;
 
     image_publisher.second->tick();
     if(0 != info_publisher.getNumSubscribers() ||
        0 != image_publisher.first.getNumSubscribers())
     {
-        auto& cam_info = camera_info.at(stream);
+        sensor_msgs::CameraInfo& cam_info = *output.camera_info;
         if (cam_info.width != width)
         {
             updateStreamCalibData(f.get_profile().as<rs2::video_stream_profile>());
         }
         cam_info.header.stamp = t;
-        cam_info.header.seq = seq[stream];
+        cam_info.header.seq = seq;
         info_publisher.publish(cam_info);
 
-        sensor_msgs::ImagePtr img;
-        img = cv_bridge::CvImage(std_msgs::Header(), encoding.at(stream.first), image).toImageMsg();
-        img->width = width;
-        img->height = height;
-        img->is_bigendian = false;
-        img->step = width * bpp;
-        img->header.frame_id = cam_info.header.frame_id;
-        img->header.stamp = t;
-        img->header.seq = seq[stream];
-
-        image_publisher.first.publish(img);
+        // Depth is clipped and rescaled to millimeters in a single pass, straight into the published buffer.
+        DepthConditioning depth_conditioning;
+        if (f.is<rs2::depth_frame>())
+        {
+            depth_conditioning = getDepthConditioning(true);
+        }
+        bool condition_depth(!depth_conditioning.isIdentity());
+
+        // When all of the image subscribers use the raw transport, publish a message backed by the frame's own
+        // buffer. Other transports need the sensor_msgs::Image published through image_transport.
+        const ros::Publisher* frame_image_publisher = output.frame_image_publisher;
+        uint32_t raw_subscribers = frame_image_publisher ? frame_image_publisher->getNumSubscribers() : 0;
+        if (0 != raw_subscribers && raw_subscribers == image_publisher.first.getNumSubscribers())
+        {
+            bool is_frame_buffer(!condition_depth && image.data == static_cast<const uint8_t*>(f.get_data()));
+            FrameImagePtr img = createFrameImage(is_frame_buffer ? f : rs2::frame(), height, width * bpp);
+            if (condition_depth)
+            {
+                conditionDepth(reinterpret_cast<const uint16_t*>(image.data), nullptr,
+                               reinterpret_cast<uint16_t*>(img->data.data()), img->data.size() / sizeof(uint16_t), depth_conditioning);
+            }
+            else if (img->data.data() != image.data)
+            {
+                memcpy(img->data.data(), image.data, img->data.size());
+            }
+            const std::string& img_encoding(*output.encoding);
+            img->encoding.assign(img_encoding.begin(), img_encoding.end());
+            img->width = width;
+            img->is_bigendian = false;
+            img->header.frame_id.assign(cam_info.header.frame_id.begin(), cam_info.header.frame_id.end());
+            img->header.stamp = t;
+            img->header.seq = seq;
+
+            frame_image_publisher->publish(img);
+        }
+        else
+        {
+            cv::Mat& published_image = condition_depth ? *output.scaled_image : image;
+            if (condition_depth)
+            {
+                CV_Assert(image.isContinuous() && image.depth() == _image_format[RS2_STREAM_DEPTH]);
+                published_image.create(image.rows, image.cols, image.type());
+                conditionDepth(image.ptr<uint16_t>(), nullptr, published_image.ptr<uint16_t>(), image.total(), depth_conditioning);
+            }
+
+            sensor_msgs::ImagePtr img;
+            img = cv_bridge::CvImage(std_msgs::Header(), *output.encoding, published_image).toImageMsg();
+            img->width = width;
+            img->height = height;
+            img->is_bigendian = false;
+            img->step = width * bpp;
+            img->header.frame_id = cam_info.header.frame_id;
+            img->header.stamp = t;
+            img->header.seq = seq;
+
+            image_publisher.first.publish(img);
+        }
         ROS_DEBUG("%s stream published", rs2_stream_to_string(f.get_profile().stream_type()));
     }
-    if (is_publishMetadata)
+
+    // Compressed depth is conditioned and encoded on the worker threads.
+    RvlDepthPublisher* rvl_publisher = output.rvl_publisher;
+    if (rvl_publisher && 0 != rvl_publisher->getNumSubscribers() &&
+        f.is<rs2::depth_frame>() && f.get_profile().format() == RS2_FORMAT_Z16)
+    {
+        std_msgs::Header header;
+        header.frame_id = output.camera_info->header.frame_id;
+        header.stamp = t;
+        header.seq = seq;
+        if (!rvl_publisher->publish(f, header, getDepthConditioning(true)))
+        {
+            ROS_WARN_STREAM_THROTTLE(5, "RVL encoding is falling behind, dropping " << rs2_stream_to_string(f.get_profile().stream_type()) << " frames. Consider raising rvl_threads.");
+        }
+    }
+    if (output.metadata_publisher)
     {
-        auto& cam_info = camera_info.at(stream);
-        publishMetadata(f, cam_info.header.frame_id);
+        output.metadata_publisher->publish(f, ros::Time(frameSystemTimeSec(f)), output.camera_info->header.frame_id);
     }
 }
 
-void BaseRealSenseNode::publishMetadata(rs2::frame f, const std::string& frame_id)
+void BaseRealSenseNode::publishMetadata(rs2::frame f, const StreamContext& context, const std::string& frame_id)
 {
-    stream_index_pair stream = {f.get_profile().stream_type(), f.get_profile().stream_index()};    
-    if (_metadata_publishers.find(stream) != _metadata_publishers.end())
+    if (context.metadata_publisher)
     {
-        ros::Time t(frameSystemTimeSec(f));
-        auto& md_publisher = _metadata_publishers.at(stream);
-        if (0 != md_publisher->getNumSubscribers())
-        {
-            realsense2_camera::Metadata msg;
-            msg.header.frame_id = frame_id;
-            msg.header.stamp = t;
-            std::stringstream json_data;
-            const char* separator = ",";
-            json_data << "{";
-            // Add additional fields:
-            json_data << "\"" << "frame_number" << "\":" << f.get_frame_number();
-            json_data << separator << "\"" << "clock_domain" << "\":" << "\"" << create_graph_resource_name(rs2_timestamp_domain_to_string(f.get_frame_timestamp_domain())) << "\"";
-            json_data << separator << "\"" << "frame_timestamp" << "\":" << std::fixed << f.get_timestamp();
-
-            for (auto i = 0; i < RS2_FRAME_METADATA_COUNT; i++)
-            {
-                if (f.supports_frame_metadata((rs2_frame_metadata_value)i))
-                {
-                    rs2_frame_metadata_value mparam = (rs2_frame_metadata_value)i;
-                    std::string name = create_graph_resource_name(rs2_frame_metadata_to_string(mparam));
-                    if (RS2_FRAME_METADATA_FRAME_TIMESTAMP == i)
-                    {
-                        name = "hw_timestamp";
-                    }
-                    rs2_metadata_type val = f.get_frame_metadata(mparam);
-                    json_data << separator << "\"" << name << "\":" << val;
-                }
-            }
-            json_data << "}";
-            msg.json_data = json_data.str();
-            md_publisher->publish(msg);
-        }
+        context.metadata_publisher->publish(f, ros::Time(frameSystemTimeSec(f)), frame_id);
     }
 }
 
@@ -2506,6 +3784,7 @@ void BaseRealSenseNode::startMonitoring()
             {
                 publish_temperature();
                 publish_frequency_update();
+                publish_processing_update();
             }
         }
     };
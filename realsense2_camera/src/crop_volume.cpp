@@ -0,0 +1,173 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/crop_volume.h"
+#include <bitset>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RS2_CROP_VOLUME_X86
+#include <immintrin.h>
+#endif
+
+namespace realsense2_camera
+{
+    typedef std::size_t (*CropVerticesFunc)(const CropVolume& volume, const float* vertices, std::size_t count, uint8_t* masks);
+    typedef std::size_t (*CropDepthFunc)(const CropVolume& volume, const uint16_t* depth, const float* const rays[3], std::size_t count, uint8_t* masks);
+
+    static inline std::size_t countBits(uint8_t mask)
+    {
+        return std::bitset<8>(mask).count();
+    }
+
+    static std::size_t cropVerticesScalar(const CropVolume& volume, const float* vertices, std::size_t count, uint8_t* masks)
+    {
+        std::size_t inside_count(0);
+        for (std::size_t group = 0; group < count; group += 8)
+        {
+            uint8_t mask(masks[group / 8]);
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                if (((mask >> bit) & 1) && !volume.contains(vertices + 3 * (group + bit)))
+                    mask &= ~(1u << bit);
+            }
+            masks[group / 8] = mask;
+            inside_count += countBits(mask);
+        }
+        return inside_count;
+    }
+
+    static std::size_t cropDepthScalar(const CropVolume& volume, const uint16_t* depth, const float* const rays[3], std::size_t count, uint8_t* masks)
+    {
+        std::size_t inside_count(0);
+        for (std::size_t group = 0; group < count; group += 8)
+        {
+            uint8_t mask(masks[group / 8]);
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                if (!((mask >> bit) & 1))
+                    continue;
+                std::size_t i(group + bit);
+                float z = static_cast<float>(depth[i]);
+                float xyz[3] = {z * rays[0][i], z * rays[1][i], z * rays[2][i]};
+                if (!volume.contains(xyz))
+                    mask &= ~(1u << bit);
+            }
+            masks[group / 8] = mask;
+            inside_count += countBits(mask);
+        }
+        return inside_count;
+    }
+
+#ifdef RS2_CROP_VOLUME_X86
+    struct CropPlanesAVX2
+    {
+        int num_planes;
+        __m256 normals[CropVolume::max_planes][3];
+        __m256 offsets[CropVolume::max_planes];
+    };
+
+    __attribute__((target("avx2")))
+    static void broadcastPlanesAVX2(const CropVolume& volume, CropPlanesAVX2& planes)
+    {
+        planes.num_planes = volume.num_planes;
+        for (int i = 0; i < volume.num_planes; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+                planes.normals[i][c] = _mm256_set1_ps(volume.normals[i][c]);
+            planes.offsets[i] = _mm256_set1_ps(volume.offsets[i]);
+        }
+    }
+
+    // Mask of the points inside, as contains() computes it: a point is only outside when it is below a plane.
+    __attribute__((target("avx2")))
+    static inline uint8_t insideAVX2(const CropPlanesAVX2& planes, __m256 x, __m256 y, __m256 z)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int i = 0; i < planes.num_planes; ++i)
+        {
+            const __m256* n = planes.normals[i];
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[0], x), _mm256_mul_ps(n[1], y)), _mm256_mul_ps(n[2], z)),
+                                     planes.offsets[i]);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, zero, _CMP_NLT_UQ));
+        }
+        return static_cast<uint8_t>(_mm256_movemask_ps(inside));
+    }
+
+    __attribute__((target("avx2")))
+    static std::size_t cropVerticesAVX2(const CropVolume& volume, const float* vertices, std::size_t count, uint8_t* masks)
+    {
+        CropPlanesAVX2 planes;
+        broadcastPlanesAVX2(volume, planes);
+        const __m256i index = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+        std::size_t inside_count(0);
+        std::size_t group = 0;
+        for (; group + 8 <= count; group += 8)
+        {
+            uint8_t mask(masks[group / 8]);
+            if (mask)
+            {
+                const float* points = vertices + 3 * group;
+                mask &= insideAVX2(planes, _mm256_i32gather_ps(points, index, 4), _mm256_i32gather_ps(points + 1, index, 4),
+                                   _mm256_i32gather_ps(points + 2, index, 4));
+                masks[group / 8] = mask;
+                inside_count += countBits(mask);
+            }
+        }
+        return inside_count + cropVerticesScalar(volume, vertices + 3 * group, count - group, masks + group / 8);
+    }
+
+    __attribute__((target("avx2")))
+    static std::size_t cropDepthAVX2(const CropVolume& volume, const uint16_t* depth, const float* const rays[3], std::size_t count, uint8_t* masks)
+    {
+        CropPlanesAVX2 planes;
+        broadcastPlanesAVX2(volume, planes);
+        std::size_t inside_count(0);
+        std::size_t group = 0;
+        for (; group + 8 <= count; group += 8)
+        {
+            uint8_t mask(masks[group / 8]);
+            if (mask)
+            {
+                __m256 z = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + group))));
+                mask &= insideAVX2(planes, _mm256_mul_ps(z, _mm256_loadu_ps(rays[0] + group)), _mm256_mul_ps(z, _mm256_loadu_ps(rays[1] + group)),
+                                   _mm256_mul_ps(z, _mm256_loadu_ps(rays[2] + group)));
+                masks[group / 8] = mask;
+                inside_count += countBits(mask);
+            }
+        }
+        const float* const tail_rays[3] = {rays[0] + group, rays[1] + group, rays[2] + group};
+        return inside_count + cropDepthScalar(volume, depth + group, tail_rays, count - group, masks + group / 8);
+    }
+#endif
+
+    static CropVerticesFunc selectCropVerticesFunc()
+    {
+#ifdef RS2_CROP_VOLUME_X86
+        if (__builtin_cpu_supports("avx2"))
+            return cropVerticesAVX2;
+#endif
+        return cropVerticesScalar;
+    }
+
+    static CropDepthFunc selectCropDepthFunc()
+    {
+#ifdef RS2_CROP_VOLUME_X86
+        if (__builtin_cpu_supports("avx2"))
+            return cropDepthAVX2;
+#endif
+        return cropDepthScalar;
+    }
+
+    std::size_t CropVolume::crop(const float* vertices, std::size_t count, uint8_t* masks) const
+    {
+        static const CropVerticesFunc crop_vertices(selectCropVerticesFunc());
+        return crop_vertices(*this, vertices, count, masks);
+    }
+
+    std::size_t CropVolume::crop(const uint16_t* depth, const float* const rays[3], std::size_t count, uint8_t* masks) const
+    {
+        static const CropDepthFunc crop_depth(selectCropDepthFunc());
+        return crop_depth(*this, depth, rays, count, masks);
+    }
+}
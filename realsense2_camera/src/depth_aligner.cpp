@@ -0,0 +1,327 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/depth_aligner.h"
+#include <librealsense2/rsutil.h>
+#include <algorithm>
+#include <climits>
+
+
+namespace realsense2_camera
+{
+    // Target rows filled by one thread at a time.
+    static const int band_rows = 16;
+
+    // Maps a depth point to its target pixel.
+    static inline void projectPoint(float px, float py, float pz, const DepthAligner::Projection& p, int& u, int& v)
+    {
+        float x, y;
+        projectToPixel(px, py, pz, p, x, y);
+        u = static_cast<int>(x + 0.5f);
+        v = static_cast<int>(y + 0.5f);
+    }
+
+    void DepthAligner::projectRowScalar(const uint16_t* depth, int width, const float* const rays_top[3], const float* const rays_bottom[3],
+                                        const Projection* const* projections, const Rectangles* rectangles, std::size_t num_targets,
+                                        int* first_rows, int* last_rows)
+    {
+        for (std::size_t t = 0; t < num_targets; ++t)
+        {
+            first_rows[t] = INT_MAX;
+            last_rows[t] = -1;
+        }
+        for (int i = 0; i < width; ++i)
+        {
+            float z = static_cast<float>(depth[i]);
+            // The corners are deprojected once, for all targets.
+            float top[3] = {z * rays_top[0][i], z * rays_top[1][i], z * rays_top[2][i]};
+            float bottom[3] = {z * rays_bottom[0][i + 1], z * rays_bottom[1][i + 1], z * rays_bottom[2][i + 1]};
+            for (std::size_t t = 0; t < num_targets; ++t)
+            {
+                const Projection& projection(*projections[t]);
+                int x0(0), y0(0), x1(-1), y1(-1);
+                if (depth[i])
+                {
+                    projectPoint(top[0], top[1], top[2], projection, x0, y0);
+                    projectPoint(bottom[0], bottom[1], bottom[2], projection, x1, y1);
+                    bool is_valid = (x0 >= 0 && y0 >= 0 && x1 < projection.width && y1 < projection.height && x1 >= x0 && y1 >= y0);
+                    if (is_valid)
+                    {
+                        first_rows[t] = std::min(first_rows[t], y0);
+                        last_rows[t] = std::max(last_rows[t], y1);
+                    }
+                    else
+                    {
+                        x0 = y0 = 0;
+                        x1 = y1 = -1;
+                    }
+                }
+                rectangles[t].x0[i] = static_cast<int16_t>(x0);
+                rectangles[t].y0[i] = static_cast<int16_t>(y0);
+                rectangles[t].x1[i] = static_cast<int16_t>(x1);
+                rectangles[t].y1[i] = static_cast<int16_t>(y1);
+            }
+        }
+    }
+
+#ifdef RS2_PIXEL_PROJECTION_X86
+    __attribute__((target("avx2")))
+    static inline void projectPoint8AVX2(__m256 px, __m256 py, __m256 pz, const PixelProjectionAVX2& p, __m256i& u_out, __m256i& v_out)
+    {
+        const __m256 half = _mm256_set1_ps(0.5f);
+        __m256 x, y;
+        projectToPixel8AVX2(px, py, pz, p, x, y);
+        u_out = _mm256_cvttps_epi32(_mm256_add_ps(x, half));
+        v_out = _mm256_cvttps_epi32(_mm256_add_ps(y, half));
+    }
+
+    __attribute__((target("avx2")))
+    static inline void store8AVX2(int16_t* to, __m256i values)
+    {
+        // Packing works within 128 bit lanes; the values are in int16 range.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(values, values), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(to), _mm256_castsi256_si128(packed));
+    }
+
+    __attribute__((target("avx2")))
+    static void projectRowAVX2Impl(const uint16_t* depth, int width, const float* const rays_top[3], const float* const rays_bottom[3],
+                                   const DepthAligner::Projection* const* projections, const DepthAligner::Rectangles* rectangles,
+                                   std::size_t num_targets, int* first_rows, int* last_rows)
+    {
+        PixelProjectionAVX2 v[DepthAligner::max_targets];
+        __m256i widths[DepthAligner::max_targets];
+        __m256i heights[DepthAligner::max_targets];
+        __m256i first[DepthAligner::max_targets];
+        __m256i last[DepthAligner::max_targets];
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi32(1);
+        const __m256i minus_one = _mm256_set1_epi32(-1);
+        const __m256i int_max = _mm256_set1_epi32(INT_MAX);
+        for (std::size_t t = 0; t < num_targets; ++t)
+        {
+            broadcastAVX2(*projections[t], v[t]);
+            widths[t] = _mm256_set1_epi32(projections[t]->width);
+            heights[t] = _mm256_set1_epi32(projections[t]->height);
+            first[t] = int_max;
+            last[t] = minus_one;
+        }
+
+        int i = 0;
+        for (; i + 8 <= width; i += 8)
+        {
+            __m256i raw = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + i)));
+            __m256i no_depth = _mm256_cmpeq_epi32(raw, zero);
+            __m256 z = _mm256_cvtepi32_ps(raw);
+            // The corners are deprojected once and stay in registers for all targets.
+            __m256 top_x = _mm256_mul_ps(z, _mm256_loadu_ps(rays_top[0] + i));
+            __m256 top_y = _mm256_mul_ps(z, _mm256_loadu_ps(rays_top[1] + i));
+            __m256 top_z = _mm256_mul_ps(z, _mm256_loadu_ps(rays_top[2] + i));
+            __m256 bottom_x = _mm256_mul_ps(z, _mm256_loadu_ps(rays_bottom[0] + i + 1));
+            __m256 bottom_y = _mm256_mul_ps(z, _mm256_loadu_ps(rays_bottom[1] + i + 1));
+            __m256 bottom_z = _mm256_mul_ps(z, _mm256_loadu_ps(rays_bottom[2] + i + 1));
+            for (std::size_t t = 0; t < num_targets; ++t)
+            {
+                __m256i x0, y0, x1, y1;
+                projectPoint8AVX2(top_x, top_y, top_z, v[t], x0, y0);
+                projectPoint8AVX2(bottom_x, bottom_y, bottom_z, v[t], x1, y1);
+                // x0 >= 0, y0 >= 0, x1 < width, y1 < height, x1 >= x0 and y1 >= y0, for valid depth.
+                __m256i invalid = no_depth;
+                invalid = _mm256_or_si256(invalid, _mm256_cmpgt_epi32(zero, x0));
+                invalid = _mm256_or_si256(invalid, _mm256_cmpgt_epi32(zero, y0));
+                invalid = _mm256_or_si256(invalid, _mm256_cmpgt_epi32(_mm256_add_epi32(x1, one), widths[t]));
+                invalid = _mm256_or_si256(invalid, _mm256_cmpgt_epi32(_mm256_add_epi32(y1, one), heights[t]));
+                invalid = _mm256_or_si256(invalid, _mm256_cmpgt_epi32(x0, x1));
+                invalid = _mm256_or_si256(invalid, _mm256_cmpgt_epi32(y0, y1));
+                x0 = _mm256_andnot_si256(invalid, x0);
+                y0 = _mm256_andnot_si256(invalid, y0);
+                x1 = _mm256_blendv_epi8(x1, minus_one, invalid);
+                y1 = _mm256_blendv_epi8(y1, minus_one, invalid);
+                first[t] = _mm256_min_epi32(first[t], _mm256_blendv_epi8(y0, int_max, invalid));
+                last[t] = _mm256_max_epi32(last[t], y1);
+                store8AVX2(rectangles[t].x0 + i, x0);
+                store8AVX2(rectangles[t].y0 + i, y0);
+                store8AVX2(rectangles[t].x1 + i, x1);
+                store8AVX2(rectangles[t].y1 + i, y1);
+            }
+        }
+
+        const float* const tail_top[3] = {rays_top[0] + i, rays_top[1] + i, rays_top[2] + i};
+        const float* const tail_bottom[3] = {rays_bottom[0] + i, rays_bottom[1] + i, rays_bottom[2] + i};
+        DepthAligner::Rectangles tail[DepthAligner::max_targets] = {};
+        for (std::size_t t = 0; t < num_targets; ++t)
+            tail[t] = {rectangles[t].x0 + i, rectangles[t].y0 + i, rectangles[t].x1 + i, rectangles[t].y1 + i};
+        DepthAligner::projectRowScalar(depth + i, width - i, tail_top, tail_bottom, projections, tail, num_targets, first_rows, last_rows);
+        for (std::size_t t = 0; t < num_targets; ++t)
+        {
+            alignas(32) int firsts[8], lasts[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(firsts), first[t]);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lasts), last[t]);
+            for (int lane = 0; lane < 8; ++lane)
+            {
+                first_rows[t] = std::min(first_rows[t], firsts[lane]);
+                last_rows[t] = std::max(last_rows[t], lasts[lane]);
+            }
+        }
+    }
+#endif
+
+    DepthAligner::ProjectRowFunc DepthAligner::projectRowAVX2()
+    {
+#ifdef RS2_PIXEL_PROJECTION_X86
+        if (__builtin_cpu_supports("avx2"))
+            return projectRowAVX2Impl;
+#endif
+        return nullptr;
+    }
+
+    static DepthAligner::ProjectRowFunc selectProjectRowFunc()
+    {
+        if (DepthAligner::projectRowAVX2())
+            return DepthAligner::projectRowAVX2();
+        return DepthAligner::projectRowScalar;
+    }
+
+    DepthAligner::DepthAligner() :
+        _depth_width(0),
+        _depth_height(0)
+    {}
+
+    bool DepthAligner::configure(const rs2_intrinsics& depth, float depth_scale_meters)
+    {
+        _targets.clear();
+        _depth_width = _depth_height = 0;
+        if (depth.width <= 0 || depth.height <= 0)
+            return false;
+
+        // The corners of pixel (x, y) are at (x -+ 0.5, y -+ 0.5), so corner (x, y) is the top-left one of pixel (x, y).
+        const int corners_width(depth.width + 1);
+        const std::size_t num_corners(static_cast<std::size_t>(corners_width) * (depth.height + 1));
+        for (int i = 0; i < 3; ++i)
+            _rays[i].resize(num_corners);
+        for (int y = 0; y <= depth.height; ++y)
+        {
+            for (int x = 0; x < corners_width; ++x)
+            {
+                float pixel[2] = {x - 0.5f, y - 0.5f};
+                float point[3];
+                rs2_deproject_pixel_to_point(point, &depth, pixel, 1.0f);
+                std::size_t index(static_cast<std::size_t>(y) * corners_width + x);
+                for (int i = 0; i < 3; ++i)
+                    _rays[i][index] = point[i] * depth_scale_meters;
+            }
+        }
+        _depth_width = depth.width;
+        _depth_height = depth.height;
+        return true;
+    }
+
+    bool DepthAligner::addTarget(const rs2_intrinsics& target, const rs2_extrinsics& depth_to_target)
+    {
+        if (_depth_width <= 0 || _targets.size() >= max_targets ||
+            target.width <= 0 || target.height <= 0 || target.width > SHRT_MAX || target.height > SHRT_MAX)
+            return false;
+        Target added;
+        if (!PixelProjection::create(target, depth_to_target, added.projection))
+            return false;
+        const std::size_t num_pixels(static_cast<std::size_t>(_depth_width) * _depth_height);
+        for (int i = 0; i < 4; ++i)
+            added.rectangles[i].resize(num_pixels);
+        added.first_rows.resize(_depth_height);
+        added.last_rows.resize(_depth_height);
+        _targets.push_back(std::move(added));
+        return true;
+    }
+
+    void DepthAligner::align(const uint16_t* depth, uint16_t* const* aligned)
+    {
+        static const ProjectRowFunc project_row(selectProjectRowFunc());
+        const int width(_depth_width);
+        const int corners_width(width + 1);
+
+        std::size_t num_active(0);
+        Target* active[max_targets];
+        const Projection* projections[max_targets];
+        uint16_t* outputs[max_targets];
+        for (std::size_t t = 0; t < _targets.size(); ++t)
+        {
+            if (!aligned[t])
+                continue;
+            active[num_active] = &_targets[t];
+            projections[num_active] = &_targets[t].projection;
+            outputs[num_active] = aligned[t];
+            ++num_active;
+        }
+        if (num_active == 0)
+            return;
+
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (int row = 0; row < _depth_height; ++row)
+        {
+            std::size_t top(static_cast<std::size_t>(row) * corners_width);
+            std::size_t bottom(top + corners_width);
+            const float* const rays_top[3] = {&_rays[0][top], &_rays[1][top], &_rays[2][top]};
+            const float* const rays_bottom[3] = {&_rays[0][bottom], &_rays[1][bottom], &_rays[2][bottom]};
+            std::size_t begin(static_cast<std::size_t>(row) * width);
+            Rectangles rectangles[max_targets];
+            int first_rows[max_targets], last_rows[max_targets];
+            for (std::size_t t = 0; t < num_active; ++t)
+            {
+                std::vector<int16_t>* planes(active[t]->rectangles);
+                rectangles[t] = {&planes[0][begin], &planes[1][begin], &planes[2][begin], &planes[3][begin]};
+            }
+            project_row(depth + begin, width, rays_top, rays_bottom, projections, rectangles, num_active, first_rows, last_rows);
+            for (std::size_t t = 0; t < num_active; ++t)
+            {
+                active[t]->first_rows[row] = first_rows[t];
+                active[t]->last_rows[row] = last_rows[t];
+            }
+        }
+
+        // Bands of all targets are spread over the threads together.
+        int band_begin[max_targets + 1] = {0};
+        for (std::size_t t = 0; t < num_active; ++t)
+            band_begin[t + 1] = band_begin[t] + (projections[t]->height + band_rows - 1) / band_rows;
+        const int num_bands(band_begin[num_active]);
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (int job = 0; job < num_bands; ++job)
+        {
+            std::size_t t(0);
+            while (job >= band_begin[t + 1])
+                ++t;
+            const Target& target(*active[t]);
+            const int target_width(target.projection.width);
+            const int band_first((job - band_begin[t]) * band_rows);
+            const int band_last(std::min(band_first + band_rows, target.projection.height) - 1);
+            uint16_t* band_out(outputs[t] + static_cast<std::size_t>(band_first) * target_width);
+            std::fill(band_out, band_out + static_cast<std::size_t>(band_last - band_first + 1) * target_width, 0);
+            for (int row = 0; row < _depth_height; ++row)
+            {
+                if (target.first_rows[row] > band_last || target.last_rows[row] < band_first)
+                    continue;
+                std::size_t begin(static_cast<std::size_t>(row) * width);
+                const int16_t* x0(&target.rectangles[0][begin]);
+                const int16_t* y0(&target.rectangles[1][begin]);
+                const int16_t* x1(&target.rectangles[2][begin]);
+                const int16_t* y1(&target.rectangles[3][begin]);
+                for (int i = 0; i < width; ++i)
+                {
+                    const int first(std::max<int>(y0[i], band_first));
+                    const int last(std::min<int>(y1[i], band_last));
+                    if (first > last)
+                        continue;
+                    const uint16_t value(depth[begin + i]);
+                    for (int y = first; y <= last; ++y)
+                    {
+                        uint16_t* out(outputs[t] + static_cast<std::size_t>(y) * target_width);
+                        for (int x = x0[i]; x <= x1[i]; ++x)
+                            out[x] = (out[x] && out[x] < value) ? out[x] : value;
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,248 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/depth_kernels.h"
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RS2_DEPTH_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define RS2_DEPTH_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace realsense2_camera
+{
+namespace depth_kernels
+{
+    static const float meter_to_mm = 0.001f;
+    static const float max_depth_value = 65535.0f;
+
+    // Reference conversion. The vector kernels perform the same two single precision operations, in the same
+    // order, so their results match it bit for bit.
+    static inline uint16_t rescaleValue(uint16_t from, float depth_scale_meters)
+    {
+        float value = static_cast<float>(from) * depth_scale_meters;
+        value = value / meter_to_mm;
+        return (value >= max_depth_value) ? 65535 : static_cast<uint16_t>(value);
+    }
+
+    void conditionDepthScalar(const uint16_t* from, const uint8_t* confidence, uint16_t* to, std::size_t count, const DepthConditioning& conditioning)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            uint16_t value = from[i];
+            bool is_valid = (value >= conditioning.min_value && value <= conditioning.max_value &&
+                             (!confidence || confidence[i] >= conditioning.confidence_threshold));
+            value = is_valid ? value : 0;
+            to[i] = conditioning.rescale ? rescaleValue(value, conditioning.depth_scale_meters) : value;
+        }
+    }
+
+#ifdef RS2_DEPTH_KERNELS_X86
+    __attribute__((target("sse4.1")))
+    static inline __m128i rescale8SSE41(__m128i raw, __m128 scale, __m128 mm, __m128 max_value)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(raw, zero));
+        lo = _mm_min_ps(_mm_div_ps(_mm_mul_ps(lo, scale), mm), max_value);
+        hi = _mm_min_ps(_mm_div_ps(_mm_mul_ps(hi, scale), mm), max_value);
+        return _mm_packus_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+    }
+
+    __attribute__((target("sse4.1")))
+    static void conditionDepthSSE41Impl(const uint16_t* from, const uint8_t* confidence, uint16_t* to, std::size_t count, const DepthConditioning& conditioning)
+    {
+        const __m128 scale = _mm_set1_ps(conditioning.depth_scale_meters);
+        const __m128 mm = _mm_set1_ps(meter_to_mm);
+        const __m128 max_value = _mm_set1_ps(max_depth_value);
+        const __m128i min_depth = _mm_set1_epi16(static_cast<short>(conditioning.min_value));
+        const __m128i max_depth = _mm_set1_epi16(static_cast<short>(conditioning.max_value));
+        const __m128i threshold = _mm_set1_epi8(static_cast<char>(conditioning.confidence_threshold));
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i));
+            // Unsigned comparisons: raw >= min_depth if max(raw, min_depth) == raw, and likewise for max_depth.
+            __m128i is_valid = _mm_and_si128(_mm_cmpeq_epi16(_mm_max_epu16(raw, min_depth), raw),
+                                             _mm_cmpeq_epi16(_mm_min_epu16(raw, max_depth), raw));
+            if (confidence)
+            {
+                __m128i conf = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(confidence + i));
+                __m128i is_confident = _mm_cmpeq_epi8(_mm_max_epu8(conf, threshold), conf);
+                is_valid = _mm_and_si128(is_valid, _mm_unpacklo_epi8(is_confident, is_confident));
+            }
+            raw = _mm_and_si128(raw, is_valid);
+            if (conditioning.rescale)
+                raw = rescale8SSE41(raw, scale, mm, max_value);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(to + i), raw);
+        }
+        conditionDepthScalar(from + i, confidence ? confidence + i : nullptr, to + i, count - i, conditioning);
+    }
+
+    __attribute__((target("avx2")))
+    static inline __m256i rescale16AVX2(__m256i raw, __m256 scale, __m256 mm, __m256 max_value)
+    {
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(raw)));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(raw, 1)));
+        lo = _mm256_min_ps(_mm256_div_ps(_mm256_mul_ps(lo, scale), mm), max_value);
+        hi = _mm256_min_ps(_mm256_div_ps(_mm256_mul_ps(hi, scale), mm), max_value);
+        // packus works within 128 bit lanes, restore the element order afterwards.
+        __m256i result = _mm256_packus_epi32(_mm256_cvttps_epi32(lo), _mm256_cvttps_epi32(hi));
+        return _mm256_permute4x64_epi64(result, _MM_SHUFFLE(3, 1, 2, 0));
+    }
+
+    __attribute__((target("avx2")))
+    static void conditionDepthAVX2Impl(const uint16_t* from, const uint8_t* confidence, uint16_t* to, std::size_t count, const DepthConditioning& conditioning)
+    {
+        const __m256 scale = _mm256_set1_ps(conditioning.depth_scale_meters);
+        const __m256 mm = _mm256_set1_ps(meter_to_mm);
+        const __m256 max_value = _mm256_set1_ps(max_depth_value);
+        const __m256i min_depth = _mm256_set1_epi16(static_cast<short>(conditioning.min_value));
+        const __m256i max_depth = _mm256_set1_epi16(static_cast<short>(conditioning.max_value));
+        const __m128i threshold = _mm_set1_epi8(static_cast<char>(conditioning.confidence_threshold));
+        std::size_t i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            __m256i raw = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + i));
+            __m256i is_valid = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(raw, min_depth), raw),
+                                                _mm256_cmpeq_epi16(_mm256_min_epu16(raw, max_depth), raw));
+            if (confidence)
+            {
+                __m128i conf = _mm_loadu_si128(reinterpret_cast<const __m128i*>(confidence + i));
+                __m128i is_confident = _mm_cmpeq_epi8(_mm_max_epu8(conf, threshold), conf);
+                is_valid = _mm256_and_si256(is_valid, _mm256_cvtepi8_epi16(is_confident));
+            }
+            raw = _mm256_and_si256(raw, is_valid);
+            if (conditioning.rescale)
+                raw = rescale16AVX2(raw, scale, mm, max_value);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + i), raw);
+        }
+        conditionDepthScalar(from + i, confidence ? confidence + i : nullptr, to + i, count - i, conditioning);
+    }
+#endif
+
+#ifdef RS2_DEPTH_KERNELS_NEON
+    static inline uint16x8_t rescale8NEON(uint16x8_t raw, float32x4_t scale, float32x4_t mm, float32x4_t max_value)
+    {
+        float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(raw)));
+        float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(raw)));
+        lo = vminq_f32(vdivq_f32(vmulq_f32(lo, scale), mm), max_value);
+        hi = vminq_f32(vdivq_f32(vmulq_f32(hi, scale), mm), max_value);
+        return vcombine_u16(vqmovn_u32(vcvtq_u32_f32(lo)), vqmovn_u32(vcvtq_u32_f32(hi)));
+    }
+
+    static void conditionDepthNEONImpl(const uint16_t* from, const uint8_t* confidence, uint16_t* to, std::size_t count, const DepthConditioning& conditioning)
+    {
+        const float32x4_t scale = vdupq_n_f32(conditioning.depth_scale_meters);
+        const float32x4_t mm = vdupq_n_f32(meter_to_mm);
+        const float32x4_t max_value = vdupq_n_f32(max_depth_value);
+        const uint16x8_t min_depth = vdupq_n_u16(conditioning.min_value);
+        const uint16x8_t max_depth = vdupq_n_u16(conditioning.max_value);
+        const uint8x8_t threshold = vdup_n_u8(conditioning.confidence_threshold);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            uint16x8_t raw = vld1q_u16(from + i);
+            uint16x8_t is_valid = vandq_u16(vcgeq_u16(raw, min_depth), vcleq_u16(raw, max_depth));
+            if (confidence)
+            {
+                uint8x8_t is_confident = vcge_u8(vld1_u8(confidence + i), threshold);
+                is_valid = vandq_u16(is_valid, vreinterpretq_u16_s16(vmovl_s8(vreinterpret_s8_u8(is_confident))));
+            }
+            raw = vandq_u16(raw, is_valid);
+            if (conditioning.rescale)
+                raw = rescale8NEON(raw, scale, mm, max_value);
+            vst1q_u16(to + i, raw);
+        }
+        conditionDepthScalar(from + i, confidence ? confidence + i : nullptr, to + i, count - i, conditioning);
+    }
+#endif
+
+    ConditionDepthFunc conditionDepthSSE41()
+    {
+#ifdef RS2_DEPTH_KERNELS_X86
+        if (__builtin_cpu_supports("sse4.1"))
+            return conditionDepthSSE41Impl;
+#endif
+        return nullptr;
+    }
+
+    ConditionDepthFunc conditionDepthAVX2()
+    {
+#ifdef RS2_DEPTH_KERNELS_X86
+        if (__builtin_cpu_supports("avx2"))
+            return conditionDepthAVX2Impl;
+#endif
+        return nullptr;
+    }
+
+    ConditionDepthFunc conditionDepthNEON()
+    {
+#ifdef RS2_DEPTH_KERNELS_NEON
+        return conditionDepthNEONImpl;
+#else
+        return nullptr;
+#endif
+    }
+
+    struct DepthKernels
+    {
+        DepthKernels() : _condition(conditionDepthScalar), _name("scalar")
+        {
+            if (conditionDepthAVX2())
+            {
+                _condition = conditionDepthAVX2();
+                _name = "avx2";
+            }
+            else if (conditionDepthSSE41())
+            {
+                _condition = conditionDepthSSE41();
+                _name = "sse4.1";
+            }
+            else if (conditionDepthNEON())
+            {
+                _condition = conditionDepthNEON();
+                _name = "neon";
+            }
+        }
+        ConditionDepthFunc _condition;
+        const char* _name;
+    };
+
+    static const DepthKernels& selectedDepthKernels()
+    {
+        static const DepthKernels kernels;
+        return kernels;
+    }
+
+    const char* depthKernelsName()
+    {
+        return selectedDepthKernels()._name;
+    }
+}
+
+    void conditionDepth(const uint16_t* from, const uint8_t* confidence, uint16_t* to, std::size_t count, const DepthConditioning& conditioning)
+    {
+        // 16K pixels: the input, output and confidence of a tile take 80KB, which stays in a core's L2 cache.
+        static const std::size_t tile_size = 16 * 1024;
+        depth_kernels::ConditionDepthFunc kernel(depth_kernels::selectedDepthKernels()._condition);
+        if (conditioning.confidence_threshold == 0)
+            confidence = nullptr;
+
+        long num_tiles = static_cast<long>((count + tile_size - 1) / tile_size);
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (long tile = 0; tile < num_tiles; ++tile)
+        {
+            std::size_t begin = static_cast<std::size_t>(tile) * tile_size;
+            std::size_t tile_count = std::min(tile_size, count - begin);
+            kernel(from + begin, confidence ? confidence + begin : nullptr, to + begin, tile_count, conditioning);
+        }
+    }
+}
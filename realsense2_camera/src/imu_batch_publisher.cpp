@@ -0,0 +1,115 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/imu_batch_publisher.h"
+#include <algorithm>
+#include <cmath>
+
+namespace realsense2_camera
+{
+    namespace
+    {
+        // The time offsets are 32 bit nanoseconds.
+        const double MAX_BATCH_DURATION = 4.0;
+    }
+
+    bool parseImuBatchMode(const std::string& name, ImuBatchMode& mode)
+    {
+        if (name == "none")         mode = ImuBatchMode::NONE;
+        else if (name == "samples") mode = ImuBatchMode::SAMPLES;
+        else if (name == "frames")  mode = ImuBatchMode::FRAMES;
+        else return false;
+        return true;
+    }
+
+    ImuBatchPublisher::ImuBatchPublisher(ros::Publisher publisher, const std::string& frame_id, ImuBatchMode mode, std::size_t batch_size,
+                                         bool has_gyro, bool has_accel, double angular_velocity_cov, double linear_accel_cov) :
+        _publisher(publisher),
+        _frame_id(frame_id),
+        _mode(mode),
+        _batch_size(std::max<std::size_t>(batch_size, 1)),
+        _has_gyro(has_gyro),
+        _has_accel(has_accel),
+        _angular_velocity_cov(angular_velocity_cov),
+        _linear_accel_cov(linear_accel_cov),
+        _window_start(-1),
+        _seq(0)
+    {
+        _samples.reserve(_batch_size);
+    }
+
+    void ImuBatchPublisher::add(double time, const Eigen::Vector3d& gyro, const Eigen::Vector3d& accel)
+    {
+        std::lock_guard<std::mutex> lock_guard(_mutex);
+        if (!_samples.empty() && (_samples.size() >= _batch_size || time - _samples.front().time >= MAX_BATCH_DURATION))
+        {
+            publishBatch(_samples.size(), _samples.back().time);
+        }
+        Sample sample;
+        sample.time = time;
+        for (int i = 0; i < 3; ++i)
+        {
+            sample.gyro[i] = static_cast<float>(gyro[i]);
+            sample.accel[i] = static_cast<float>(accel[i]);
+        }
+        _samples.push_back(sample);
+        if (_mode == ImuBatchMode::SAMPLES && _samples.size() >= _batch_size)
+        {
+            publishBatch(_samples.size(), time);
+        }
+    }
+
+    void ImuBatchPublisher::frameArrived(double time)
+    {
+        if (_mode != ImuBatchMode::FRAMES)
+            return;
+        std::lock_guard<std::mutex> lock_guard(_mutex);
+        // The frames of a frameset, and frames of other streams taken at the same time, share the window.
+        if (time <= _window_start)
+            return;
+        std::size_t count(0);
+        while (count < _samples.size() && _samples[count].time <= time)
+            ++count;
+        if (count > 0)
+            publishBatch(count, time);
+        else
+            _window_start = time;
+    }
+
+    void ImuBatchPublisher::clear()
+    {
+        std::lock_guard<std::mutex> lock_guard(_mutex);
+        _samples.clear();
+        _window_start = -1;
+    }
+
+    void ImuBatchPublisher::publishBatch(std::size_t count, double window_end)
+    {
+        realsense2_camera::ImuBatch msg;
+        const double first_time(_samples.front().time);
+        msg.header.seq = ++_seq;
+        msg.header.stamp = ros::Time(first_time);
+        msg.header.frame_id = _frame_id;
+        msg.window_start = ros::Time(_window_start < 0 ? first_time : std::min(_window_start, first_time));
+        msg.window_end = ros::Time(window_end);
+        msg.time_offsets.resize(count);
+        if (_has_gyro)
+            msg.angular_velocity.resize(3 * count);
+        if (_has_accel)
+            msg.linear_acceleration.resize(3 * count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const Sample& sample(_samples[i]);
+            msg.time_offsets[i] = static_cast<uint32_t>(std::llround((sample.time - first_time) * 1e9));
+            if (_has_gyro)
+                std::copy(sample.gyro, sample.gyro + 3, msg.angular_velocity.begin() + 3 * i);
+            if (_has_accel)
+                std::copy(sample.accel, sample.accel + 3, msg.linear_acceleration.begin() + 3 * i);
+        }
+        msg.angular_velocity_covariance = { _angular_velocity_cov, 0.0, 0.0, 0.0, _angular_velocity_cov, 0.0, 0.0, 0.0, _angular_velocity_cov};
+        msg.linear_acceleration_covariance = { _linear_accel_cov, 0.0, 0.0, 0.0, _linear_accel_cov, 0.0, 0.0, 0.0, _linear_accel_cov};
+        _samples.erase(_samples.begin(), _samples.begin() + count);
+        _window_start = window_end;
+        _publisher.publish(msg);
+    }
+}
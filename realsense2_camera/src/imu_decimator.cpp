@@ -0,0 +1,69 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/imu_decimator.h"
+#include <algorithm>
+#include <cmath>
+
+namespace realsense2_camera
+{
+    ImuDecimator::ImuDecimator(int factor, int taps, double cutoff) :
+        _factor(std::max(factor, 1)),
+        _position(0),
+        _filled(0),
+        _phase(0)
+    {
+        const std::size_t count(static_cast<std::size_t>(std::max(taps, 1)) | 1);
+        // Cycles per input sample.
+        const double cutoff_frequency(std::min(std::max(cutoff, 0.01), 1.0) * 0.5 / _factor);
+        const double center(0.5 * (count - 1));
+        std::vector<double> taps_double(count);
+        double sum(0);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            double x(i - center);
+            double sinc(x == 0 ? 2 * cutoff_frequency : std::sin(2 * M_PI * cutoff_frequency * x) / (M_PI * x));
+            double window(count == 1 ? 1.0 : 0.54 - 0.46 * std::cos(2 * M_PI * i / (count - 1)));
+            taps_double[i] = sinc * window;
+            sum += taps_double[i];
+        }
+        _taps.resize(count);
+        for (std::size_t i = 0; i < count; ++i)
+            _taps[i] = static_cast<float>(taps_double[i] / sum);
+        _history.resize(2 * count, Eigen::Array4f::Zero());
+        _times.resize(count, 0);
+    }
+
+    void ImuDecimator::reset()
+    {
+        _position = 0;
+        _filled = 0;
+        _phase = 0;
+    }
+
+    bool ImuDecimator::add(double time, const Eigen::Vector3f& reading, double& out_time, Eigen::Vector3f& out)
+    {
+        const std::size_t count(_taps.size());
+        if (_filled > 0 && time <= _times[(_position + count - 1) % count])
+            return false;
+        const Eigen::Array4f x(reading.x(), reading.y(), reading.z(), 0);
+        _history[_position] = x;
+        _history[_position + count] = x;
+        _times[_position] = time;
+        _position = (_position + 1) % count;
+        _filled = std::min(_filled + 1, count);
+        _phase = std::min(_phase + 1, _factor);
+        if (_filled < count || _phase < _factor)
+            return false;
+        _phase = 0;
+
+        // The oldest reading is at _position, the newest count - 1 after it. The taps are symmetric.
+        const Eigen::Array4f* history(&_history[_position]);
+        Eigen::Array4f sum(Eigen::Array4f::Zero());
+        for (std::size_t i = 0; i < count; ++i)
+            sum += _taps[i] * history[i];
+        out = sum.head<3>().matrix();
+        out_time = _times[(_position + count / 2) % count];
+        return true;
+    }
+}
@@ -0,0 +1,183 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/imu_preintegrator.h"
+#include <algorithm>
+#include <cmath>
+
+namespace realsense2_camera
+{
+    namespace
+    {
+        // Without frames the samples would pile up; an interval longer than this is not integrated.
+        const double MAX_INTERVAL = 1.0;
+
+        Eigen::Matrix3d skew(const Eigen::Vector3d& v)
+        {
+            Eigen::Matrix3d m;
+            m <<     0, -v.z(),  v.y(),
+                 v.z(),      0, -v.x(),
+                -v.y(),  v.x(),      0;
+            return m;
+        }
+
+        Eigen::Matrix3d expSO3(const Eigen::Vector3d& phi)
+        {
+            double angle(phi.norm());
+            if (angle < 1e-12)
+                return Eigen::Matrix3d::Identity() + skew(phi);
+            return Eigen::AngleAxisd(angle, phi / angle).toRotationMatrix();
+        }
+
+        Eigen::Matrix3d rightJacobianSO3(const Eigen::Vector3d& phi)
+        {
+            double angle(phi.norm());
+            Eigen::Matrix3d phi_x(skew(phi));
+            if (angle < 1e-6)
+                return Eigen::Matrix3d::Identity() - 0.5 * phi_x;
+            double angle2(angle * angle);
+            return Eigen::Matrix3d::Identity() - (1.0 - std::cos(angle)) / angle2 * phi_x
+                                               + (angle - std::sin(angle)) / (angle2 * angle) * phi_x * phi_x;
+        }
+    }
+
+    ImuPreintegrator::ImuPreintegrator(ros::Publisher publisher, const std::string& frame_id, const Calibration& gyro, const Calibration& accel) :
+        _publisher(publisher),
+        _frame_id(frame_id),
+        _gyro(gyro),
+        _accel(accel),
+        _last_frame_time(-1),
+        _seq(0)
+    {
+        _samples.reserve(1024);
+    }
+
+    void ImuPreintegrator::add(double time, const Eigen::Vector3d& gyro, const Eigen::Vector3d& accel)
+    {
+        std::lock_guard<std::mutex> lock_guard(_mutex);
+        if (!_samples.empty() && time <= _samples.back().time)
+            return;
+        Sample sample;
+        sample.time = time;
+        sample.gyro = _gyro.scale * gyro - _gyro.bias;
+        sample.accel = _accel.scale * accel - _accel.bias;
+        _samples.push_back(sample);
+        // Without frames keep only what the next interval may need.
+        if (_samples.back().time - _samples.front().time > 2 * MAX_INTERVAL)
+        {
+            std::size_t keep(0);
+            while (keep < _samples.size() && _samples[keep].time < time - MAX_INTERVAL)
+                ++keep;
+            _samples.erase(_samples.begin(), _samples.begin() + (keep > 0 ? keep - 1 : 0));
+        }
+    }
+
+    void ImuPreintegrator::frameArrived(double time)
+    {
+        realsense2_camera::ImuPreintegration msg;
+        {
+            std::lock_guard<std::mutex> lock_guard(_mutex);
+            // The frames of a frameset share the interval.
+            if (time <= _last_frame_time)
+                return;
+            double start(_last_frame_time);
+            _last_frame_time = time;
+            if (start < 0 || time - start > MAX_INTERVAL || _samples.empty() || _samples.front().time > start)
+            {
+                // No reading covers the start of the interval. Drop the samples the next interval won't need.
+                std::size_t count(0);
+                while (count < _samples.size() && _samples[count].time <= time)
+                    ++count;
+                _samples.erase(_samples.begin(), _samples.begin() + (count > 0 ? count - 1 : 0));
+                return;
+            }
+            msg.start = ros::Time(start);
+            integrate(time, msg);
+        }
+        _publisher.publish(msg);
+    }
+
+    void ImuPreintegrator::clear()
+    {
+        std::lock_guard<std::mutex> lock_guard(_mutex);
+        _samples.clear();
+        _last_frame_time = -1;
+    }
+
+    void ImuPreintegrator::integrate(double time, realsense2_camera::ImuPreintegration& msg)
+    {
+        const double start(msg.start.toSec());
+        const Eigen::Matrix3d gyro_noise(_gyro.noise_variances.asDiagonal());
+        const Eigen::Matrix3d accel_noise(_accel.noise_variances.asDiagonal());
+
+        Eigen::Matrix3d delta_r(Eigen::Matrix3d::Identity());
+        Eigen::Vector3d delta_v(Eigen::Vector3d::Zero());
+        Eigen::Vector3d delta_p(Eigen::Vector3d::Zero());
+        Covariance covariance(Covariance::Zero());
+        Covariance a(Covariance::Identity());
+        msg.sample_count = 0;
+
+        // The sample in effect at the start is the last one up to it.
+        std::size_t first(0);
+        while (first + 1 < _samples.size() && _samples[first + 1].time <= start)
+            ++first;
+        std::size_t last(first);
+        for (std::size_t i = first; i < _samples.size() && _samples[i].time < time; ++i)
+        {
+            last = i;
+            const Sample& sample(_samples[i]);
+            double from(std::max(sample.time, start));
+            double to((i + 1 < _samples.size()) ? std::min(_samples[i + 1].time, time) : time);
+            double dt(to - from);
+            if (dt <= 0)
+                continue;
+
+            Eigen::Vector3d phi(sample.gyro * dt);
+            Eigen::Matrix3d step_r(expSO3(phi));
+            Eigen::Matrix3d accel_x(skew(sample.accel));
+            Eigen::Matrix3d r_accel_x(delta_r * accel_x);
+
+            // Error state [rotation, velocity, position]; noise of this reading enters through b and c.
+            a.setIdentity();
+            a.block<3,3>(0,0) = step_r.transpose();
+            a.block<3,3>(3,0) = -r_accel_x * dt;
+            a.block<3,3>(6,0) = -0.5 * r_accel_x * dt * dt;
+            a.block<3,3>(6,3) = Eigen::Matrix3d::Identity() * dt;
+            Eigen::Matrix<double, 9, 3> b(Eigen::Matrix<double, 9, 3>::Zero());
+            b.block<3,3>(0,0) = rightJacobianSO3(phi) * dt;
+            Eigen::Matrix<double, 9, 3> c(Eigen::Matrix<double, 9, 3>::Zero());
+            c.block<3,3>(3,0) = delta_r * dt;
+            c.block<3,3>(6,0) = 0.5 * delta_r * dt * dt;
+            covariance = a * covariance * a.transpose() + b * gyro_noise * b.transpose() + c * accel_noise * c.transpose();
+
+            Eigen::Vector3d r_accel(delta_r * sample.accel);
+            delta_p += delta_v * dt + 0.5 * r_accel * dt * dt;
+            delta_v += r_accel * dt;
+            delta_r = delta_r * step_r;
+            msg.sample_count++;
+        }
+
+        Eigen::Quaterniond q(delta_r);
+        q.normalize();
+        msg.header.seq = ++_seq;
+        msg.header.stamp = ros::Time(time);
+        msg.header.frame_id = _frame_id;
+        msg.delta_time = time - start;
+        msg.delta_rotation.x = q.x();
+        msg.delta_rotation.y = q.y();
+        msg.delta_rotation.z = q.z();
+        msg.delta_rotation.w = q.w();
+        msg.delta_velocity.x = delta_v.x();
+        msg.delta_velocity.y = delta_v.y();
+        msg.delta_velocity.z = delta_v.z();
+        msg.delta_position.x = delta_p.x();
+        msg.delta_position.y = delta_p.y();
+        msg.delta_position.z = delta_p.z();
+        for (int row = 0; row < 9; ++row)
+            for (int col = 0; col < 9; ++col)
+                msg.covariance[row * 9 + col] = covariance(row, col);
+
+        // The last sample integrated is in effect at the start of the next interval.
+        _samples.erase(_samples.begin(), _samples.begin() + last);
+    }
+}
@@ -0,0 +1,128 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/metadata_publisher.h"
+#include "../include/realsense_node_factory.h"
+#include <realsense2_camera/BinaryMetadata.h>
+#include <realsense2_camera/Metadata.h>
+#include <realsense2_camera/MetadataFields.h>
+#include <cstdio>
+
+namespace realsense2_camera
+{
+    MetadataPublisher::MetadataPublisher(ros::NodeHandle& node_handle, const std::string& stream_name, const std::set<std::string>& selected_fields,
+                                         const ros::SubscriberStatusCallback& status_changed) :
+        _json_publisher(node_handle.advertise<realsense2_camera::Metadata>(stream_name + "/metadata", 1, status_changed, status_changed)),
+        _binary_publisher(node_handle.advertise<realsense2_camera::BinaryMetadata>(stream_name + "/binary_metadata", 1, status_changed, status_changed)),
+        _fields_publisher(node_handle.advertise<realsense2_camera::MetadataFields>(stream_name + "/metadata_fields", 1, true)),
+        _selected_fields(selected_fields),
+        _profile_id(-1)
+    {
+        for (int i = 0; i < RS2_TIMESTAMP_DOMAIN_COUNT; ++i)
+        {
+            _clock_domain_names.push_back(create_graph_resource_name(rs2_timestamp_domain_to_string(static_cast<rs2_timestamp_domain>(i))));
+        }
+    }
+
+    uint32_t MetadataPublisher::getNumSubscribers() const
+    {
+        return _json_publisher.getNumSubscribers() + _binary_publisher.getNumSubscribers();
+    }
+
+    void MetadataPublisher::publish(rs2::frame f, const ros::Time& t, const std::string& frame_id)
+    {
+        std::lock_guard<std::mutex> lock_guard(_mutex);
+        // The supported fields are a property of the profile, which only changes when the stream is reopened.
+        if (f.get_profile().unique_id() != _profile_id)
+        {
+            updateFields(f);
+        }
+        if (0 != _json_publisher.getNumSubscribers())
+        {
+            publishJson(f, t, frame_id);
+        }
+        if (0 != _binary_publisher.getNumSubscribers())
+        {
+            publishBinary(f, t, frame_id);
+        }
+    }
+
+    void MetadataPublisher::updateFields(const rs2::frame& f)
+    {
+        _profile_id = f.get_profile().unique_id();
+        _fields.clear();
+        std::set<std::string> missing_fields(_selected_fields);
+        realsense2_camera::MetadataFields msg;
+        for (int i = 0; i < RS2_FRAME_METADATA_COUNT; i++)
+        {
+            rs2_frame_metadata_value id = static_cast<rs2_frame_metadata_value>(i);
+            if (!f.supports_frame_metadata(id))
+                continue;
+            Field field;
+            field.id = id;
+            field.name = (RS2_FRAME_METADATA_FRAME_TIMESTAMP == id) ? "hw_timestamp" : create_graph_resource_name(rs2_frame_metadata_to_string(id));
+            if (!_selected_fields.empty() && !_selected_fields.count(field.name))
+                continue;
+            missing_fields.erase(field.name);
+            field.json_key = ",\"" + field.name + "\":";
+            _fields.push_back(field);
+            msg.ids.push_back(static_cast<uint16_t>(id));
+            msg.names.push_back(field.name);
+        }
+        for (const std::string& name : missing_fields)
+        {
+            ROS_WARN_STREAM("Metadata field " << name << " is not supported by the " << rs2_stream_to_string(f.get_profile().stream_type()) << " stream.");
+        }
+        _fields_publisher.publish(msg);
+    }
+
+    void MetadataPublisher::publishJson(const rs2::frame& f, const ros::Time& t, const std::string& frame_id)
+    {
+        realsense2_camera::Metadata msg;
+        msg.header.frame_id = frame_id;
+        msg.header.stamp = t;
+        std::string& json_data(msg.json_data);
+        json_data.reserve(32 * (_fields.size() + 3));
+        json_data += "{\"frame_number\":";
+        json_data += std::to_string(f.get_frame_number());
+        json_data += ",\"clock_domain\":\"";
+        rs2_timestamp_domain clock_domain(f.get_frame_timestamp_domain());
+        json_data += (clock_domain < static_cast<int>(_clock_domain_names.size())) ? _clock_domain_names[clock_domain] : std::string();
+        // Same format as std::fixed.
+        char frame_timestamp[64];
+        snprintf(frame_timestamp, sizeof(frame_timestamp), "%f", f.get_timestamp());
+        json_data += "\",\"frame_timestamp\":";
+        json_data += frame_timestamp;
+        for (const Field& field : _fields)
+        {
+            if (f.supports_frame_metadata(field.id))
+            {
+                json_data += field.json_key;
+                json_data += std::to_string(f.get_frame_metadata(field.id));
+            }
+        }
+        json_data += "}";
+        _json_publisher.publish(msg);
+    }
+
+    void MetadataPublisher::publishBinary(const rs2::frame& f, const ros::Time& t, const std::string& frame_id)
+    {
+        realsense2_camera::BinaryMetadata msg;
+        msg.header.frame_id = frame_id;
+        msg.header.stamp = t;
+        msg.frame_number = f.get_frame_number();
+        msg.frame_timestamp = f.get_timestamp();
+        msg.clock_domain = static_cast<uint8_t>(f.get_frame_timestamp_domain());
+        msg.ids.reserve(_fields.size());
+        msg.values.reserve(_fields.size());
+        for (const Field& field : _fields)
+        {
+            if (f.supports_frame_metadata(field.id))
+            {
+                msg.ids.push_back(static_cast<uint16_t>(field.id));
+                msg.values.push_back(f.get_frame_metadata(field.id));
+            }
+        }
+        _binary_publisher.publish(msg);
+    }
+}
@@ -0,0 +1,73 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/orientation_filter.h"
+#include <cmath>
+
+namespace realsense2_camera
+{
+    namespace
+    {
+        // A gap longer than this, e.g. after the stream restarted, is not integrated.
+        const double MAX_TIME_STEP = 0.5;
+    }
+
+    OrientationFilter::OrientationFilter(double gain) :
+        _gain(gain),
+        _orientation(Eigen::Quaterniond::Identity()),
+        _last_time(0),
+        _initialized(false)
+    {}
+
+    const Eigen::Quaterniond& OrientationFilter::update(double time, const Eigen::Vector3d& gyro, const Eigen::Vector3d& accel)
+    {
+        const double accel_norm(accel.norm());
+        if (!_initialized)
+        {
+            if (accel_norm == 0)
+                return _orientation;
+            // Rotate the measured up direction onto the world z axis.
+            _orientation = Eigen::Quaterniond::FromTwoVectors(accel / accel_norm, Eigen::Vector3d::UnitZ());
+            _last_time = time;
+            _initialized = true;
+            return _orientation;
+        }
+        const double dt(time - _last_time);
+        _last_time = time;
+        if (dt <= 0 || dt > MAX_TIME_STEP)
+            return _orientation;
+
+        const double q0(_orientation.w()), q1(_orientation.x()), q2(_orientation.y()), q3(_orientation.z());
+        // Rate of change of the orientation from the gyro: 0.5 * q * (0, gyro).
+        double q_dot0 = 0.5 * (-q1 * gyro.x() - q2 * gyro.y() - q3 * gyro.z());
+        double q_dot1 = 0.5 * ( q0 * gyro.x() + q2 * gyro.z() - q3 * gyro.y());
+        double q_dot2 = 0.5 * ( q0 * gyro.y() - q1 * gyro.z() + q3 * gyro.x());
+        double q_dot3 = 0.5 * ( q0 * gyro.z() + q1 * gyro.y() - q2 * gyro.x());
+
+        // Gradient of the error between the measured up direction and the one the orientation predicts.
+        if (accel_norm > 0)
+        {
+            const Eigen::Vector3d a(accel / accel_norm);
+            const double f0 = 2.0 * (q1 * q3 - q0 * q2) - a.x();
+            const double f1 = 2.0 * (q0 * q1 + q2 * q3) - a.y();
+            const double f2 = 2.0 * (0.5 - q1 * q1 - q2 * q2) - a.z();
+            double s0 = -2.0 * q2 * f0 + 2.0 * q1 * f1;
+            double s1 =  2.0 * q3 * f0 + 2.0 * q0 * f1 - 4.0 * q1 * f2;
+            double s2 = -2.0 * q0 * f0 + 2.0 * q3 * f1 - 4.0 * q2 * f2;
+            double s3 =  2.0 * q1 * f0 + 2.0 * q2 * f1;
+            const double s_norm(std::sqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3));
+            if (s_norm > 0)
+            {
+                const double gain(_gain.load());
+                q_dot0 -= gain * s0 / s_norm;
+                q_dot1 -= gain * s1 / s_norm;
+                q_dot2 -= gain * s2 / s_norm;
+                q_dot3 -= gain * s3 / s_norm;
+            }
+        }
+
+        _orientation = Eigen::Quaterniond(q0 + q_dot0 * dt, q1 + q_dot1 * dt, q2 + q_dot2 * dt, q3 + q_dot3 * dt);
+        _orientation.normalize();
+        return _orientation;
+    }
+}
@@ -0,0 +1,360 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/pointcloud_assembler.h"
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RS2_POINTCLOUD_ASSEMBLER_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define RS2_POINTCLOUD_ASSEMBLER_NEON
+#include <arm_neon.h>
+#endif
+
+namespace realsense2_camera
+{
+    // Multiple of 8 so that every chunk starts at a whole byte of the validity masks.
+    static const std::size_t chunk_size = 8192;
+
+    static inline std::size_t countBits(uint8_t mask)
+    {
+        return std::bitset<8>(mask).count();
+    }
+
+    // Texture pixel of a valid texture coordinate. A coordinate of exactly 1 maps to the last pixel.
+    static inline int32_t colorOffset(float u, float v, const PointCloudAssembler::ClassifyParams& params)
+    {
+        int pixx = std::min(static_cast<int>(u * params.texture_width), params.texture_width - 1);
+        int pixy = std::min(static_cast<int>(v * params.texture_height), params.texture_height - 1);
+        return (pixy * params.texture_width + pixx) * params.bytes_per_pixel;
+    }
+
+    std::size_t PointCloudAssembler::classifyScalar(const float* vertices, const float* texture_coordinates, std::size_t count,
+                                                    const ClassifyParams& params, uint8_t* valid_masks, int32_t* color_offsets)
+    {
+        std::size_t valid_count(0);
+        for (std::size_t i = 0; i < count; i += 8)
+        {
+            uint8_t mask(0);
+            for (std::size_t j = i; j < std::min(i + 8, count); ++j)
+            {
+                bool valid_pixel(vertices[3 * j + 2] > 0);
+                if (params.textured)
+                {
+                    float u(texture_coordinates[2 * j]);
+                    float v(texture_coordinates[2 * j + 1]);
+                    bool valid_color_pixel(u >= 0.f && u <= 1.f && v >= 0.f && v <= 1.f);
+                    valid_pixel = valid_pixel && (valid_color_pixel || params.allow_no_texture_points);
+                    color_offsets[j] = valid_color_pixel ? colorOffset(u, v, params) : -1;
+                }
+                mask |= static_cast<uint8_t>(valid_pixel) << (j - i);
+            }
+            valid_masks[i / 8] = mask;
+            valid_count += countBits(mask);
+        }
+        return valid_count;
+    }
+
+#ifdef RS2_POINTCLOUD_ASSEMBLER_X86
+    __attribute__((target("avx2")))
+    static std::size_t classifyAVX2Impl(const float* vertices, const float* texture_coordinates, std::size_t count,
+                                        const PointCloudAssembler::ClassifyParams& params, uint8_t* valid_masks, int32_t* color_offsets)
+    {
+        const __m256i z_index = _mm256_setr_epi32(2, 5, 8, 11, 14, 17, 20, 23);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 width = _mm256_set1_ps(static_cast<float>(params.texture_width));
+        const __m256 height = _mm256_set1_ps(static_cast<float>(params.texture_height));
+        const __m256i max_x = _mm256_set1_epi32(params.texture_width - 1);
+        const __m256i max_y = _mm256_set1_epi32(params.texture_height - 1);
+        const __m256i row_size = _mm256_set1_epi32(params.texture_width);
+        const __m256i bytes_per_pixel = _mm256_set1_epi32(params.bytes_per_pixel);
+        const __m256 allow_no_texture = _mm256_castsi256_ps(_mm256_set1_epi32(params.allow_no_texture_points ? -1 : 0));
+
+        std::size_t valid_count(0);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 z = _mm256_i32gather_ps(vertices + 3 * i, z_index, 4);
+            __m256 valid_pixel = _mm256_cmp_ps(z, zero, _CMP_GT_OQ);
+            if (params.textured)
+            {
+                // Deinterleave 8 uv pairs; shuffle_ps works within 128 bit lanes, hence the permute.
+                __m256 uv_lo = _mm256_loadu_ps(texture_coordinates + 2 * i);
+                __m256 uv_hi = _mm256_loadu_ps(texture_coordinates + 2 * i + 8);
+                __m256 u = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(uv_lo, uv_hi, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0)));
+                __m256 v = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(uv_lo, uv_hi, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0)));
+                __m256 valid_color_pixel = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)),
+                                                         _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, one, _CMP_LE_OQ)));
+                valid_pixel = _mm256_and_ps(valid_pixel, _mm256_or_ps(valid_color_pixel, allow_no_texture));
+
+                // Invalid coordinates may convert to anything, they are replaced by -1 below.
+                __m256i pixx = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(u, width)), max_x);
+                __m256i pixy = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(v, height)), max_y);
+                __m256i offset = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_mullo_epi32(pixy, row_size), pixx), bytes_per_pixel);
+                offset = _mm256_or_si256(offset, _mm256_xor_si256(_mm256_castps_si256(valid_color_pixel), _mm256_set1_epi32(-1)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(color_offsets + i), offset);
+            }
+            uint8_t mask = static_cast<uint8_t>(_mm256_movemask_ps(valid_pixel));
+            valid_masks[i / 8] = mask;
+            valid_count += countBits(mask);
+        }
+        return valid_count + PointCloudAssembler::classifyScalar(vertices + 3 * i, texture_coordinates ? texture_coordinates + 2 * i : nullptr, count - i,
+                                                                 params, valid_masks + i / 8, color_offsets ? color_offsets + i : nullptr);
+    }
+#endif
+
+#ifdef RS2_POINTCLOUD_ASSEMBLER_NEON
+    static std::size_t classifyNEONImpl(const float* vertices, const float* texture_coordinates, std::size_t count,
+                                        const PointCloudAssembler::ClassifyParams& params, uint8_t* valid_masks, int32_t* color_offsets)
+    {
+        const uint32x4_t bits_lo = {1, 2, 4, 8};
+        const uint32x4_t bits_hi = {16, 32, 64, 128};
+        const float32x4_t zero = vdupq_n_f32(0.f);
+        const float32x4_t one = vdupq_n_f32(1.f);
+        const float32x4_t width = vdupq_n_f32(static_cast<float>(params.texture_width));
+        const float32x4_t height = vdupq_n_f32(static_cast<float>(params.texture_height));
+        const int32x4_t max_x = vdupq_n_s32(params.texture_width - 1);
+        const int32x4_t max_y = vdupq_n_s32(params.texture_height - 1);
+        const uint32x4_t allow_no_texture = vdupq_n_u32(params.allow_no_texture_points ? 0xffffffff : 0);
+
+        std::size_t valid_count(0);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            uint8_t mask(0);
+            for (std::size_t half = 0; half < 8; half += 4)
+            {
+                float32x4x3_t xyz = vld3q_f32(vertices + 3 * (i + half));
+                uint32x4_t valid_pixel = vcgtq_f32(xyz.val[2], zero);
+                if (params.textured)
+                {
+                    float32x4x2_t uv = vld2q_f32(texture_coordinates + 2 * (i + half));
+                    uint32x4_t valid_color_pixel = vandq_u32(vandq_u32(vcgeq_f32(uv.val[0], zero), vcleq_f32(uv.val[0], one)),
+                                                             vandq_u32(vcgeq_f32(uv.val[1], zero), vcleq_f32(uv.val[1], one)));
+                    valid_pixel = vandq_u32(valid_pixel, vorrq_u32(valid_color_pixel, allow_no_texture));
+
+                    int32x4_t pixx = vminq_s32(vcvtq_s32_f32(vmulq_f32(uv.val[0], width)), max_x);
+                    int32x4_t pixy = vminq_s32(vcvtq_s32_f32(vmulq_f32(uv.val[1], height)), max_y);
+                    int32x4_t offset = vmulq_n_s32(vmlaq_n_s32(pixx, pixy, params.texture_width), params.bytes_per_pixel);
+                    offset = vorrq_s32(offset, vreinterpretq_s32_u32(vmvnq_u32(valid_color_pixel)));
+                    vst1q_s32(color_offsets + i + half, offset);
+                }
+                mask |= static_cast<uint8_t>(vaddvq_u32(vandq_u32(valid_pixel, half ? bits_hi : bits_lo)));
+            }
+            valid_masks[i / 8] = mask;
+            valid_count += countBits(mask);
+        }
+        return valid_count + PointCloudAssembler::classifyScalar(vertices + 3 * i, texture_coordinates ? texture_coordinates + 2 * i : nullptr, count - i,
+                                                                 params, valid_masks + i / 8, color_offsets ? color_offsets + i : nullptr);
+    }
+#endif
+
+    PointCloudAssembler::ClassifyFunc PointCloudAssembler::classifyAVX2()
+    {
+#ifdef RS2_POINTCLOUD_ASSEMBLER_X86
+        if (__builtin_cpu_supports("avx2"))
+            return classifyAVX2Impl;
+#endif
+        return nullptr;
+    }
+
+    PointCloudAssembler::ClassifyFunc PointCloudAssembler::classifyNEON()
+    {
+#ifdef RS2_POINTCLOUD_ASSEMBLER_NEON
+        return classifyNEONImpl;
+#else
+        return nullptr;
+#endif
+    }
+
+    static PointCloudAssembler::ClassifyFunc selectClassifyFunc()
+    {
+        if (PointCloudAssembler::classifyAVX2())
+            return PointCloudAssembler::classifyAVX2();
+        if (PointCloudAssembler::classifyNEON())
+            return PointCloudAssembler::classifyNEON();
+        return PointCloudAssembler::classifyScalar;
+    }
+
+    static inline int lowestBit(unsigned int mask)
+    {
+#ifdef __GNUC__
+        return __builtin_ctz(mask);
+#else
+        int bit(0);
+        while (!(mask & 1))
+        {
+            mask >>= 1;
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    // Writes the points of [begin, end) selected by the validity masks (all of them for ordered clouds).
+    // BytesPerPixel is 0 without texture.
+    template <PointCloudLayout L, int BytesPerPixel>
+    static void writePoints(const float* vertices, const uint8_t* texture_data, const uint8_t* valid_masks, const int32_t* color_offsets,
+                            const uint8_t* crop_masks, std::size_t begin, std::size_t end, bool ordered, uint8_t* out)
+    {
+        static const uint32_t point_step(pointcloud_layout::Layout<L>::xyz_size + pointcloud_layout::Layout<L>::colorSize(BytesPerPixel));
+        static const float cropped_xyz[3] = {0, 0, 0};
+        for (std::size_t group = begin; group < end; group += 8)
+        {
+            unsigned int mask = ordered ? 0xff : valid_masks[group / 8];
+            unsigned int inside = crop_masks ? crop_masks[group / 8] : 0xff;
+            if (end - group < 8)
+                mask &= (1u << (end - group)) - 1;
+            // Iterating over the set bits avoids a hard to predict branch per point.
+            while (mask)
+            {
+                int bit = lowestBit(mask);
+                std::size_t i = group + bit;
+                mask &= mask - 1;
+                bool is_inside((inside >> bit) & 1);
+                // PointCloud2 order of rgb is bgr.
+                uint8_t color[BytesPerPixel ? BytesPerPixel : 1] = {0};
+                if (BytesPerPixel && is_inside && color_offsets[i] >= 0)
+                {
+                    const uint8_t* pixel = texture_data + color_offsets[i];
+                    for (int c = 0; c < BytesPerPixel; ++c)
+                        color[c] = pixel[BytesPerPixel - 1 - c];
+                }
+                pointcloud_layout::writePoint<L, BytesPerPixel>(out, is_inside ? vertices + 3 * i : cropped_xyz, color);
+                out += point_step;
+            }
+        }
+    }
+
+    template <PointCloudLayout L>
+    static void writePoints(const float* vertices, const PointCloudAssembler::Texture* texture, const uint8_t* valid_masks, const int32_t* color_offsets,
+                            const uint8_t* crop_masks, std::size_t begin, std::size_t end, bool ordered, uint8_t* out)
+    {
+        if (!texture)
+            writePoints<L, 0>(vertices, nullptr, valid_masks, nullptr, crop_masks, begin, end, ordered, out);
+        else if (texture->bytes_per_pixel == 3)
+            writePoints<L, 3>(vertices, texture->data, valid_masks, color_offsets, crop_masks, begin, end, ordered, out);
+        else
+            writePoints<L, 1>(vertices, texture->data, valid_masks, color_offsets, crop_masks, begin, end, ordered, out);
+    }
+
+    template <PointCloudLayout L, int BytesPerPixel>
+    static void convertPoints(const uint8_t* points, std::size_t count, uint8_t* out)
+    {
+        static const uint32_t point_step(pointcloud_layout::Layout<L>::xyz_size + pointcloud_layout::Layout<L>::colorSize(BytesPerPixel));
+        static const uint32_t xyz32_step(BytesPerPixel ? 20 : 16);
+        for (std::size_t i = 0; i < count; ++i, points += xyz32_step, out += point_step)
+        {
+            float xyz[3];
+            memcpy(xyz, points, sizeof(xyz));
+            pointcloud_layout::writePoint<L, BytesPerPixel>(out, xyz, points + 16);
+        }
+    }
+
+    template <PointCloudLayout L>
+    static void convertPoints(const uint8_t* points, std::size_t count, int bytes_per_pixel, uint8_t* out)
+    {
+        if (bytes_per_pixel == 0)
+            convertPoints<L, 0>(points, count, out);
+        else if (bytes_per_pixel == 3)
+            convertPoints<L, 3>(points, count, out);
+        else
+            convertPoints<L, 1>(points, count, out);
+    }
+
+    void PointCloudAssembler::convert(const uint8_t* points, std::size_t count, int bytes_per_pixel, PointCloudLayout layout, uint8_t* out)
+    {
+        switch (layout)
+        {
+            case PointCloudLayout::XYZ32:  memcpy(out, points, count * pointcloud_layout::pointStep(layout, bytes_per_pixel)); break;
+            case PointCloudLayout::XYZ16:  convertPoints<PointCloudLayout::XYZ16>(points, count, bytes_per_pixel, out); break;
+            case PointCloudLayout::XYZF16: convertPoints<PointCloudLayout::XYZF16>(points, count, bytes_per_pixel, out); break;
+            case PointCloudLayout::Z16:    convertPoints<PointCloudLayout::Z16>(points, count, bytes_per_pixel, out); break;
+        }
+    }
+
+    std::size_t PointCloudAssembler::assemble(const float* vertices, const float* texture_coordinates, std::size_t count,
+                                              const Texture* texture, bool ordered, bool allow_no_texture_points,
+                                              PointCloudLayout layout, uint8_t* out, const CropVolume* crop)
+    {
+        static const ClassifyFunc classify(selectClassifyFunc());
+        const uint32_t point_step(pointStep(texture, layout));
+        ClassifyParams params;
+        params.textured = (texture != nullptr);
+        params.allow_no_texture_points = allow_no_texture_points;
+        params.texture_width = texture ? texture->width : 0;
+        params.texture_height = texture ? texture->height : 0;
+        params.bytes_per_pixel = texture ? texture->bytes_per_pixel : 0;
+
+        long num_chunks = static_cast<long>((count + chunk_size - 1) / chunk_size);
+        _valid_masks.resize((count + 7) / 8);
+        _color_offsets.resize(texture ? count : 0);
+        _crop_masks.resize(crop && ordered ? _valid_masks.size() : 0);
+        _chunk_offsets.resize(num_chunks + 1);
+
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (long chunk = 0; chunk < num_chunks; ++chunk)
+        {
+            std::size_t begin = static_cast<std::size_t>(chunk) * chunk_size;
+            std::size_t chunk_count = std::min(chunk_size, count - begin);
+            std::size_t valid_count = classify(vertices + 3 * begin, texture ? texture_coordinates + 2 * begin : nullptr, chunk_count,
+                                               params, _valid_masks.data() + begin / 8, texture ? _color_offsets.data() + begin : nullptr);
+            if (crop)
+            {
+                // Ordered clouds keep every point, so their crop is tracked apart from the validity.
+                if (ordered)
+                {
+                    CropVolume::fillMasks(chunk_count, _crop_masks.data() + begin / 8);
+                    crop->crop(vertices + 3 * begin, chunk_count, _crop_masks.data() + begin / 8);
+                }
+                else
+                {
+                    valid_count = crop->crop(vertices + 3 * begin, chunk_count, _valid_masks.data() + begin / 8);
+                }
+            }
+            _chunk_offsets[chunk + 1] = valid_count;
+        }
+
+        // Exclusive prefix sum of the valid point counts gives every chunk its first output point.
+        _chunk_offsets[0] = 0;
+        for (long chunk = 0; chunk < num_chunks; ++chunk)
+        {
+            _chunk_offsets[chunk + 1] = ordered ? (chunk + 1) * chunk_size : _chunk_offsets[chunk] + _chunk_offsets[chunk + 1];
+        }
+
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (long chunk = 0; chunk < num_chunks; ++chunk)
+        {
+            std::size_t begin = static_cast<std::size_t>(chunk) * chunk_size;
+            std::size_t end = std::min(begin + chunk_size, count);
+            uint8_t* point_out = out + _chunk_offsets[chunk] * point_step;
+            const uint8_t* crop_masks(_crop_masks.empty() ? nullptr : _crop_masks.data());
+            switch (layout)
+            {
+                case PointCloudLayout::XYZ32:
+                    writePoints<PointCloudLayout::XYZ32>(vertices, texture, _valid_masks.data(), _color_offsets.data(), crop_masks, begin, end, ordered, point_out);
+                    break;
+                case PointCloudLayout::XYZ16:
+                    writePoints<PointCloudLayout::XYZ16>(vertices, texture, _valid_masks.data(), _color_offsets.data(), crop_masks, begin, end, ordered, point_out);
+                    break;
+                case PointCloudLayout::XYZF16:
+                    writePoints<PointCloudLayout::XYZF16>(vertices, texture, _valid_masks.data(), _color_offsets.data(), crop_masks, begin, end, ordered, point_out);
+                    break;
+                case PointCloudLayout::Z16:
+                    writePoints<PointCloudLayout::Z16>(vertices, texture, _valid_masks.data(), _color_offsets.data(), crop_masks, begin, end, ordered, point_out);
+                    break;
+            }
+        }
+        return ordered ? count : _chunk_offsets[num_chunks];
+    }
+}
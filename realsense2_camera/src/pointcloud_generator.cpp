@@ -0,0 +1,340 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/pointcloud_generator.h"
+#include <librealsense2/rsutil.h>
+#include <algorithm>
+#include <bitset>
+
+namespace realsense2_camera
+{
+    // Multiple of 8 so that every chunk starts at a whole byte of the validity masks.
+    static const std::size_t chunk_size = 8192;
+
+    static inline std::size_t countBits(uint8_t mask)
+    {
+        return std::bitset<8>(mask).count();
+    }
+
+    std::size_t PointCloudGenerator::classifyScalar(const uint16_t* depth, const float* const rays[3], std::size_t count,
+                                                    const ClassifyParams& params, uint8_t* valid_masks, int32_t* color_offsets)
+    {
+        const PixelProjection* texture(params.texture);
+        std::size_t valid_count(0);
+        for (std::size_t i = 0; i < count; i += 8)
+        {
+            uint8_t mask(0);
+            for (std::size_t j = i; j < std::min(i + 8, count); ++j)
+            {
+                bool valid_pixel(depth[j] > 0);
+                if (texture)
+                {
+                    bool valid_color_pixel(false);
+                    int32_t color_offset(-1);
+                    if (valid_pixel)
+                    {
+                        // Texture coordinates and pixel as rs2::pointcloud and PointCloudAssembler compute them.
+                        float z = static_cast<float>(depth[j]);
+                        float pixel_x, pixel_y;
+                        projectToPixel(z * rays[0][j], z * rays[1][j], z * rays[2][j], *texture, pixel_x, pixel_y);
+                        float u = pixel_x / texture->width;
+                        float v = pixel_y / texture->height;
+                        valid_color_pixel = (u >= 0.f && u <= 1.f && v >= 0.f && v <= 1.f);
+                        if (valid_color_pixel)
+                        {
+                            int pixx = std::min(static_cast<int>(u * texture->width), texture->width - 1);
+                            int pixy = std::min(static_cast<int>(v * texture->height), texture->height - 1);
+                            color_offset = (pixy * texture->width + pixx) * params.bytes_per_pixel;
+                        }
+                    }
+                    valid_pixel = valid_pixel && (valid_color_pixel || params.allow_no_texture_points);
+                    color_offsets[j] = color_offset;
+                }
+                mask |= static_cast<uint8_t>(valid_pixel) << (j - i);
+            }
+            valid_masks[i / 8] = mask;
+            valid_count += countBits(mask);
+        }
+        return valid_count;
+    }
+
+#ifdef RS2_PIXEL_PROJECTION_X86
+    __attribute__((target("avx2")))
+    static std::size_t classifyAVX2Impl(const uint16_t* depth, const float* const rays[3], std::size_t count,
+                                        const PointCloudGenerator::ClassifyParams& params, uint8_t* valid_masks, int32_t* color_offsets)
+    {
+        const PixelProjection* texture(params.texture);
+        PixelProjectionAVX2 projection;
+        if (texture)
+            broadcastAVX2(*texture, projection);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256 zero_ps = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 width = _mm256_set1_ps(static_cast<float>(texture ? texture->width : 0));
+        const __m256 height = _mm256_set1_ps(static_cast<float>(texture ? texture->height : 0));
+        const __m256i max_x = _mm256_set1_epi32(texture ? texture->width - 1 : 0);
+        const __m256i max_y = _mm256_set1_epi32(texture ? texture->height - 1 : 0);
+        const __m256i row_size = _mm256_set1_epi32(texture ? texture->width : 0);
+        const __m256i bytes_per_pixel = _mm256_set1_epi32(params.bytes_per_pixel);
+        const __m256 allow_no_texture = _mm256_castsi256_ps(_mm256_set1_epi32(params.allow_no_texture_points ? -1 : 0));
+
+        std::size_t valid_count(0);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i raw = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + i)));
+            __m256 valid_pixel = _mm256_castsi256_ps(_mm256_xor_si256(_mm256_cmpeq_epi32(raw, zero), _mm256_set1_epi32(-1)));
+            if (texture)
+            {
+                __m256 z = _mm256_cvtepi32_ps(raw);
+                __m256 pixel_x, pixel_y;
+                projectToPixel8AVX2(_mm256_mul_ps(z, _mm256_loadu_ps(rays[0] + i)), _mm256_mul_ps(z, _mm256_loadu_ps(rays[1] + i)),
+                                    _mm256_mul_ps(z, _mm256_loadu_ps(rays[2] + i)), projection, pixel_x, pixel_y);
+                __m256 u = _mm256_div_ps(pixel_x, width);
+                __m256 v = _mm256_div_ps(pixel_y, height);
+                __m256 valid_color_pixel = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(u, zero_ps, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)),
+                                                         _mm256_and_ps(_mm256_cmp_ps(v, zero_ps, _CMP_GE_OQ), _mm256_cmp_ps(v, one, _CMP_LE_OQ)));
+                valid_color_pixel = _mm256_and_ps(valid_color_pixel, valid_pixel);
+                valid_pixel = _mm256_and_ps(valid_pixel, _mm256_or_ps(valid_color_pixel, allow_no_texture));
+
+                // Invalid coordinates may convert to anything, they are replaced by -1 below.
+                __m256i pixx = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(u, width)), max_x);
+                __m256i pixy = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(v, height)), max_y);
+                __m256i offset = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_mullo_epi32(pixy, row_size), pixx), bytes_per_pixel);
+                offset = _mm256_or_si256(offset, _mm256_xor_si256(_mm256_castps_si256(valid_color_pixel), _mm256_set1_epi32(-1)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(color_offsets + i), offset);
+            }
+            uint8_t mask = static_cast<uint8_t>(_mm256_movemask_ps(valid_pixel));
+            valid_masks[i / 8] = mask;
+            valid_count += countBits(mask);
+        }
+        const float* const tail_rays[3] = {rays[0] + i, rays[1] + i, rays[2] + i};
+        return valid_count + PointCloudGenerator::classifyScalar(depth + i, tail_rays, count - i, params, valid_masks + i / 8,
+                                                                 color_offsets ? color_offsets + i : nullptr);
+    }
+#endif
+
+    PointCloudGenerator::ClassifyFunc PointCloudGenerator::classifyAVX2()
+    {
+#ifdef RS2_PIXEL_PROJECTION_X86
+        if (__builtin_cpu_supports("avx2"))
+            return classifyAVX2Impl;
+#endif
+        return nullptr;
+    }
+
+    static PointCloudGenerator::ClassifyFunc selectClassifyFunc()
+    {
+        if (PointCloudGenerator::classifyAVX2())
+            return PointCloudGenerator::classifyAVX2();
+        return PointCloudGenerator::classifyScalar;
+    }
+
+    static inline int lowestBit(unsigned int mask)
+    {
+#ifdef __GNUC__
+        return __builtin_ctz(mask);
+#else
+        int bit(0);
+        while (!(mask & 1))
+        {
+            mask >>= 1;
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    // Writes the points of [begin, end) selected by the validity masks (all of them for ordered clouds).
+    // BytesPerPixel is 0 without texture. Without color offsets, the texture is registered to the depth.
+    template <PointCloudLayout L, int BytesPerPixel>
+    static void writePoints(const uint16_t* depth, const std::vector<float>* rays, const uint8_t* texture_data, const uint8_t* valid_masks,
+                            const int32_t* color_offsets, const uint8_t* crop_masks, std::size_t begin, std::size_t end, bool ordered, uint8_t* out)
+    {
+        static const uint32_t point_step(pointcloud_layout::Layout<L>::xyz_size + pointcloud_layout::Layout<L>::colorSize(BytesPerPixel));
+        for (std::size_t group = begin; group < end; group += 8)
+        {
+            unsigned int mask = ordered ? 0xff : valid_masks[group / 8];
+            unsigned int inside = crop_masks ? crop_masks[group / 8] : 0xff;
+            if (end - group < 8)
+                mask &= (1u << (end - group)) - 1;
+            // Iterating over the set bits avoids a hard to predict branch per point.
+            while (mask)
+            {
+                int bit = lowestBit(mask);
+                std::size_t i = group + bit;
+                mask &= mask - 1;
+                bool is_inside((inside >> bit) & 1);
+                float z = static_cast<float>(depth[i]);
+                float xyz[3] = {0, 0, 0};
+                if (is_inside)
+                {
+                    xyz[0] = z * rays[0][i];
+                    xyz[1] = z * rays[1][i];
+                    xyz[2] = z * rays[2][i];
+                }
+                // PointCloud2 order of rgb is bgr.
+                uint8_t color[BytesPerPixel ? BytesPerPixel : 1] = {0};
+                int32_t color_offset(!is_inside ? -1 : color_offsets ? color_offsets[i] : (depth[i] ? static_cast<int32_t>(i) * BytesPerPixel : -1));
+                if (BytesPerPixel && color_offset >= 0)
+                {
+                    const uint8_t* pixel = texture_data + color_offset;
+                    for (int c = 0; c < BytesPerPixel; ++c)
+                        color[c] = pixel[BytesPerPixel - 1 - c];
+                }
+                pointcloud_layout::writePoint<L, BytesPerPixel>(out, xyz, color);
+                out += point_step;
+            }
+        }
+    }
+
+    template <PointCloudLayout L>
+    static void writePoints(const uint16_t* depth, const std::vector<float>* rays, const PointCloudAssembler::Texture* texture, const uint8_t* valid_masks,
+                            const int32_t* color_offsets, const uint8_t* crop_masks, std::size_t begin, std::size_t end, bool ordered, uint8_t* out)
+    {
+        if (!texture)
+            writePoints<L, 0>(depth, rays, nullptr, valid_masks, nullptr, crop_masks, begin, end, ordered, out);
+        else if (texture->bytes_per_pixel == 3)
+            writePoints<L, 3>(depth, rays, texture->data, valid_masks, color_offsets, crop_masks, begin, end, ordered, out);
+        else
+            writePoints<L, 1>(depth, rays, texture->data, valid_masks, color_offsets, crop_masks, begin, end, ordered, out);
+    }
+
+    static bool isRegistered(const rs2_intrinsics& depth, const rs2_intrinsics& texture, const rs2_extrinsics& depth_to_texture)
+    {
+        static const float identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+        return std::equal(identity, identity + 9, depth_to_texture.rotation) &&
+               depth_to_texture.translation[0] == 0 && depth_to_texture.translation[1] == 0 && depth_to_texture.translation[2] == 0 &&
+               depth.width == texture.width && depth.height == texture.height &&
+               depth.fx == texture.fx && depth.fy == texture.fy && depth.ppx == texture.ppx && depth.ppy == texture.ppy &&
+               depth.model == texture.model && std::equal(depth.coeffs, depth.coeffs + 5, texture.coeffs);
+    }
+
+    PointCloudGenerator::PointCloudGenerator() :
+        _width(0),
+        _height(0),
+        _depth_intrinsics(),
+        _has_texture(false),
+        _registered(false),
+        _texture()
+    {}
+
+    bool PointCloudGenerator::configure(const rs2_intrinsics& depth, float depth_scale_meters)
+    {
+        _has_texture = false;
+        _registered = false;
+        _width = _height = 0;
+        if (depth.width <= 0 || depth.height <= 0)
+            return false;
+        const std::size_t num_pixels(static_cast<std::size_t>(depth.width) * depth.height);
+        for (int i = 0; i < 3; ++i)
+            _rays[i].resize(num_pixels);
+        for (int y = 0; y < depth.height; ++y)
+        {
+            for (int x = 0; x < depth.width; ++x)
+            {
+                float pixel[2] = {static_cast<float>(x), static_cast<float>(y)};
+                float point[3];
+                rs2_deproject_pixel_to_point(point, &depth, pixel, 1.0f);
+                std::size_t index(static_cast<std::size_t>(y) * depth.width + x);
+                for (int i = 0; i < 3; ++i)
+                    _rays[i][index] = point[i] * depth_scale_meters;
+            }
+        }
+        _width = depth.width;
+        _height = depth.height;
+        _depth_intrinsics = depth;
+        return true;
+    }
+
+    bool PointCloudGenerator::setTexture(const rs2_intrinsics& texture, const rs2_extrinsics& depth_to_texture)
+    {
+        _registered = _width > 0 && isRegistered(_depth_intrinsics, texture, depth_to_texture);
+        _has_texture = _registered || (texture.width > 0 && texture.height > 0 && PixelProjection::create(texture, depth_to_texture, _texture));
+        return _has_texture;
+    }
+
+    std::size_t PointCloudGenerator::generate(const uint16_t* depth, const PointCloudAssembler::Texture* texture, bool ordered,
+                                              bool allow_no_texture_points, PointCloudLayout layout, uint8_t* out,
+                                              const CropVolume* crop)
+    {
+        static const ClassifyFunc classify(selectClassifyFunc());
+        if (texture && !_has_texture)
+            texture = nullptr;
+        const std::size_t count(size());
+        const uint32_t point_step(PointCloudAssembler::pointStep(texture, layout));
+        // A registered texture only takes the depth's validity; the points find their color at their own pixel.
+        bool project(texture && !_registered);
+        ClassifyParams params;
+        params.texture = project ? &_texture : nullptr;
+        params.allow_no_texture_points = allow_no_texture_points;
+        params.bytes_per_pixel = texture ? texture->bytes_per_pixel : 0;
+
+        long num_chunks = static_cast<long>((count + chunk_size - 1) / chunk_size);
+        _valid_masks.resize((count + 7) / 8);
+        _color_offsets.resize(project ? count : 0);
+        _crop_masks.resize(crop && ordered ? _valid_masks.size() : 0);
+        _chunk_offsets.resize(num_chunks + 1);
+
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (long chunk = 0; chunk < num_chunks; ++chunk)
+        {
+            std::size_t begin = static_cast<std::size_t>(chunk) * chunk_size;
+            std::size_t chunk_count = std::min(chunk_size, count - begin);
+            const float* const rays[3] = {&_rays[0][begin], &_rays[1][begin], &_rays[2][begin]};
+            std::size_t valid_count = classify(depth + begin, rays, chunk_count, params, _valid_masks.data() + begin / 8,
+                                               project ? _color_offsets.data() + begin : nullptr);
+            if (crop)
+            {
+                // Ordered clouds keep every point, so their crop is tracked apart from the validity.
+                if (ordered)
+                {
+                    CropVolume::fillMasks(chunk_count, _crop_masks.data() + begin / 8);
+                    crop->crop(depth + begin, rays, chunk_count, _crop_masks.data() + begin / 8);
+                }
+                else
+                {
+                    valid_count = crop->crop(depth + begin, rays, chunk_count, _valid_masks.data() + begin / 8);
+                }
+            }
+            _chunk_offsets[chunk + 1] = valid_count;
+        }
+
+        // Exclusive prefix sum of the valid point counts gives every chunk its first output point.
+        _chunk_offsets[0] = 0;
+        for (long chunk = 0; chunk < num_chunks; ++chunk)
+        {
+            _chunk_offsets[chunk + 1] = ordered ? (chunk + 1) * chunk_size : _chunk_offsets[chunk] + _chunk_offsets[chunk + 1];
+        }
+
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (long chunk = 0; chunk < num_chunks; ++chunk)
+        {
+            std::size_t begin = static_cast<std::size_t>(chunk) * chunk_size;
+            std::size_t end = std::min(begin + chunk_size, count);
+            uint8_t* point_out = out + _chunk_offsets[chunk] * point_step;
+            const int32_t* color_offsets(project ? _color_offsets.data() : nullptr);
+            const uint8_t* crop_masks(_crop_masks.empty() ? nullptr : _crop_masks.data());
+            switch (layout)
+            {
+                case PointCloudLayout::XYZ32:
+                    writePoints<PointCloudLayout::XYZ32>(depth, _rays, texture, _valid_masks.data(), color_offsets, crop_masks, begin, end, ordered, point_out);
+                    break;
+                case PointCloudLayout::XYZ16:
+                    writePoints<PointCloudLayout::XYZ16>(depth, _rays, texture, _valid_masks.data(), color_offsets, crop_masks, begin, end, ordered, point_out);
+                    break;
+                case PointCloudLayout::XYZF16:
+                    writePoints<PointCloudLayout::XYZF16>(depth, _rays, texture, _valid_masks.data(), color_offsets, crop_masks, begin, end, ordered, point_out);
+                    break;
+                case PointCloudLayout::Z16:
+                    writePoints<PointCloudLayout::Z16>(depth, _rays, texture, _valid_masks.data(), color_offsets, crop_masks, begin, end, ordered, point_out);
+                    break;
+            }
+        }
+        return ordered ? count : _chunk_offsets[num_chunks];
+    }
+}
@@ -0,0 +1,230 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/processing_engine.h"
+#include <ros/ros.h>
+#include <chrono>
+
+namespace realsense2_camera
+{
+    bool parseDropPolicy(const std::string& name, DropPolicy& policy)
+    {
+        if (name == "drop_oldest")      policy = DropPolicy::DROP_OLDEST;
+        else if (name == "drop_newest") policy = DropPolicy::DROP_NEWEST;
+        else if (name == "block")       policy = DropPolicy::BLOCK;
+        else return false;
+        return true;
+    }
+
+    const char* dropPolicyName(DropPolicy policy)
+    {
+        switch (policy)
+        {
+            case DropPolicy::DROP_OLDEST: return "drop_oldest";
+            case DropPolicy::DROP_NEWEST: return "drop_newest";
+            default:                      return "block";
+        }
+    }
+
+    ProcessingEngine::Queue::Queue(const std::string& name, std::size_t capacity, DropPolicy policy, Handler handler) :
+        _name(name),
+        _capacity(std::max<std::size_t>(capacity, 1)),
+        _policy(policy),
+        _handler(handler),
+        _frames(_capacity),
+        _depth(0),
+        _max_depth(0),
+        _pushed(0),
+        _processed(0),
+        _dropped(0)
+    {
+        _busy.clear();
+    }
+
+    ProcessingEngine::ProcessingEngine() :
+        _stop(false),
+        _generation(0),
+        _sleeping_workers(0)
+    {}
+
+    ProcessingEngine::~ProcessingEngine()
+    {
+        stop();
+    }
+
+    std::size_t ProcessingEngine::addQueue(const std::string& name, std::size_t capacity, DropPolicy policy, Handler handler)
+    {
+        _queues.emplace_back(new Queue(name, capacity, policy, handler));
+        return _queues.size() - 1;
+    }
+
+    void ProcessingEngine::start(std::size_t num_threads)
+    {
+        for (std::size_t i = 0; i < num_threads; ++i)
+            _threads.emplace_back([this, i]() { run(i); });
+    }
+
+    void ProcessingEngine::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock_guard(_mutex);
+            _stop = true;
+        }
+        _work_cv.notify_all();
+        _room_cv.notify_all();
+        for (std::thread& thread : _threads)
+            thread.join();
+        _threads.clear();
+
+        for (std::unique_ptr<Queue>& queue : _queues)
+        {
+            rs2::frame frame;
+            while (queue->_frames.try_pop(frame))
+            {
+                --queue->_depth;
+                ++queue->_dropped;
+            }
+        }
+    }
+
+    // Takes a place in the queue. _depth counts the taken places, so the queue holds at most _capacity frames.
+    bool ProcessingEngine::reserve(Queue& queue)
+    {
+        std::size_t depth = queue._depth.load();
+        do
+        {
+            if (depth >= queue._capacity)
+                return false;
+        } while (!queue._depth.compare_exchange_weak(depth, depth + 1));
+
+        std::size_t max_depth = queue._max_depth.load();
+        while (depth + 1 > max_depth && !queue._max_depth.compare_exchange_weak(max_depth, depth + 1));
+        return true;
+    }
+
+    void ProcessingEngine::push(std::size_t queue_id, rs2::frame frame)
+    {
+        Queue& queue = *_queues[queue_id];
+        ++queue._pushed;
+        if (_stop)
+        {
+            ++queue._dropped;
+            return;
+        }
+        while (!reserve(queue))
+        {
+            if (_stop || queue._policy == DropPolicy::DROP_NEWEST)
+            {
+                ++queue._dropped;
+                return;
+            }
+            if (queue._policy == DropPolicy::DROP_OLDEST)
+            {
+                rs2::frame oldest;
+                if (queue._frames.try_pop(oldest))
+                {
+                    --queue._depth;
+                    ++queue._dropped;
+                }
+                else
+                {
+                    // A worker is taking it.
+                    std::this_thread::yield();
+                }
+            }
+            else
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _room_cv.wait_for(lock, std::chrono::milliseconds(1));
+            }
+        }
+        // The place is reserved, a cell frees up as soon as a concurrent pop completes.
+        while (!queue._frames.try_push(frame))
+            std::this_thread::yield();
+        wakeWorkers();
+    }
+
+    void ProcessingEngine::wakeWorkers()
+    {
+        ++_generation;
+        if (_sleeping_workers > 0)
+        {
+            // Taking the mutex ensures that a worker that saw the old generation is already waiting.
+            {
+                std::lock_guard<std::mutex> lock_guard(_mutex);
+            }
+            _work_cv.notify_one();
+        }
+    }
+
+    bool ProcessingEngine::processOne(Queue& queue)
+    {
+        if (queue._busy.test_and_set(std::memory_order_acquire))
+            return false;
+        rs2::frame frame;
+        bool popped(queue._frames.try_pop(frame));
+        if (popped)
+        {
+            --queue._depth;
+            if (queue._policy == DropPolicy::BLOCK)
+                _room_cv.notify_all();
+            try
+            {
+                queue._handler(frame);
+            }
+            catch(const std::exception& ex)
+            {
+                ROS_ERROR_STREAM("Processing of " << queue._name << " failed: " << ex.what());
+            }
+            ++queue._processed;
+        }
+        queue._busy.clear(std::memory_order_release);
+        return popped;
+    }
+
+    void ProcessingEngine::run(std::size_t first_queue)
+    {
+        const std::size_t num_queues(_queues.size());
+        if (!num_queues)
+            return;
+        std::size_t next_queue(first_queue % num_queues);
+        while (!_stop)
+        {
+            // Read before looking at the queues: a push after this point changes it and keeps the worker awake.
+            // A frame pushed while its queue is busy is found by the busy worker, which looks again when done.
+            uint64_t generation = _generation.load();
+            bool processed(false);
+            for (std::size_t i = 0; i < num_queues && !processed; ++i)
+            {
+                std::size_t queue_id = (next_queue + i) % num_queues;
+                if (processOne(*_queues[queue_id]))
+                {
+                    processed = true;
+                    next_queue = (queue_id + 1) % num_queues;
+                }
+            }
+            if (processed)
+                continue;
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            ++_sleeping_workers;
+            _work_cv.wait(lock, [this, generation]() { return _stop || _generation.load() != generation; });
+            --_sleeping_workers;
+        }
+    }
+
+    ProcessingEngine::QueueStats ProcessingEngine::stats(std::size_t queue_id) const
+    {
+        const Queue& queue = *_queues[queue_id];
+        QueueStats stats;
+        stats.name = queue._name;
+        stats.policy = queue._policy;
+        stats.capacity = queue._capacity;
+        stats.depth = queue._depth.load();
+        stats.max_depth = queue._max_depth.load();
+        stats.pushed = queue._pushed.load();
+        stats.processed = queue._processed.load();
+        stats.dropped = queue._dropped.load();
+        return stats;
+    }
+}
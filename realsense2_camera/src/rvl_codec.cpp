@@ -0,0 +1,196 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/rvl_codec.h"
+
+namespace realsense2_camera
+{
+namespace rvl
+{
+    namespace
+    {
+        class NibbleWriter
+        {
+            public:
+                explicit NibbleWriter(uint8_t* out) : _begin(out), _out(out), _word(0), _nibbles(0) {}
+
+                // 3 value bits per nibble, the high bit flags that more nibbles follow.
+                inline void writeVLE(uint32_t value)
+                {
+                    do
+                    {
+                        uint32_t nibble = value & 0x7;
+                        value >>= 3;
+                        if (value)
+                            nibble |= 0x8;
+                        _word = (_word << 4) | nibble;
+                        if (++_nibbles == 8)
+                            flush();
+                    } while (value);
+                }
+
+                std::size_t finish()
+                {
+                    if (_nibbles)
+                    {
+                        _word <<= 4 * (8 - _nibbles);
+                        flush();
+                    }
+                    return static_cast<std::size_t>(_out - _begin);
+                }
+
+            private:
+                inline void flush()
+                {
+                    _out[0] = static_cast<uint8_t>(_word);
+                    _out[1] = static_cast<uint8_t>(_word >> 8);
+                    _out[2] = static_cast<uint8_t>(_word >> 16);
+                    _out[3] = static_cast<uint8_t>(_word >> 24);
+                    _out += 4;
+                    _word = 0;
+                    _nibbles = 0;
+                }
+
+                uint8_t* _begin;
+                uint8_t* _out;
+                uint32_t _word;
+                int _nibbles;
+        };
+
+        class NibbleReader
+        {
+            public:
+                NibbleReader(const uint8_t* data, std::size_t size) : _in(data), _end(data + size - size % 4), _word(0), _nibbles(0) {}
+
+                // Returns false at the end of the data, or for a value that does not fit 32 bits.
+                inline bool readVLE(uint32_t& value)
+                {
+                    value = 0;
+                    for (int shift = 0; shift < 33; shift += 3)
+                    {
+                        if (!_nibbles)
+                        {
+                            if (_in == _end)
+                                return false;
+                            _word = static_cast<uint32_t>(_in[0]) | (static_cast<uint32_t>(_in[1]) << 8) |
+                                    (static_cast<uint32_t>(_in[2]) << 16) | (static_cast<uint32_t>(_in[3]) << 24);
+                            _in += 4;
+                            _nibbles = 8;
+                        }
+                        uint32_t nibble = _word >> 28;
+                        _word <<= 4;
+                        --_nibbles;
+                        value |= (nibble & 0x7) << shift;
+                        if (!(nibble & 0x8))
+                            return true;
+                    }
+                    return false;
+                }
+
+            private:
+                const uint8_t* _in;
+                const uint8_t* _end;
+                uint32_t _word;
+                int _nibbles;
+        };
+    }
+
+    static const uint32_t MAX_IMAGE_SIDE = 1 << 16;
+    static const std::size_t MAX_IMAGE_PIXELS = 1 << 26;
+
+    std::size_t maxEncodedSize(std::size_t count)
+    {
+        // A delta takes at most 6 nibbles and the length of a run of n pixels at most n nibbles. Only the
+        // leading zero run and the trailing valid run can be empty, at one nibble each.
+        return 4 * ((7 * count + 2 + 7) / 8);
+    }
+
+    std::size_t encode(const uint16_t* depth, std::size_t count, uint8_t* out)
+    {
+        NibbleWriter writer(out);
+        const uint16_t* end = depth + count;
+        int32_t previous = 0;
+        while (depth != end)
+        {
+            const uint16_t* run = depth;
+            while (depth != end && !*depth)
+                ++depth;
+            writer.writeVLE(static_cast<uint32_t>(depth - run));
+
+            run = depth;
+            while (depth != end && *depth)
+                ++depth;
+            writer.writeVLE(static_cast<uint32_t>(depth - run));
+
+            for (; run != depth; ++run)
+            {
+                int32_t delta = static_cast<int32_t>(*run) - previous;
+                writer.writeVLE((static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+                previous = *run;
+            }
+        }
+        return writer.finish();
+    }
+
+    bool decode(const uint8_t* data, std::size_t size, uint16_t* depth, std::size_t count)
+    {
+        NibbleReader reader(data, size);
+        uint16_t* end = depth + count;
+        int32_t previous = 0;
+        while (depth != end)
+        {
+            uint32_t zeros, nonzeros;
+            if (!reader.readVLE(zeros) || zeros > static_cast<std::size_t>(end - depth))
+                return false;
+            for (uint16_t* zeros_end = depth + zeros; depth != zeros_end; ++depth)
+                *depth = 0;
+
+            if (!reader.readVLE(nonzeros) || nonzeros > static_cast<std::size_t>(end - depth))
+                return false;
+            for (uint16_t* nonzeros_end = depth + nonzeros; depth != nonzeros_end; ++depth)
+            {
+                uint32_t positive;
+                if (!reader.readVLE(positive))
+                    return false;
+                int32_t delta = static_cast<int32_t>(positive >> 1) ^ -static_cast<int32_t>(positive & 1);
+                previous += delta;
+                *depth = static_cast<uint16_t>(previous);
+            }
+        }
+        return true;
+    }
+
+    std::size_t encodeImage(const uint16_t* depth, uint32_t width, uint32_t height, std::vector<uint8_t>& out)
+    {
+        std::size_t count = static_cast<std::size_t>(width) * height;
+        out.resize(IMAGE_HEADER_SIZE + maxEncodedSize(count));
+        for (int i = 0; i < 4; ++i)
+        {
+            out[i] = static_cast<uint8_t>(width >> (8 * i));
+            out[4 + i] = static_cast<uint8_t>(height >> (8 * i));
+        }
+        out.resize(IMAGE_HEADER_SIZE + encode(depth, count, out.data() + IMAGE_HEADER_SIZE));
+        return out.size();
+    }
+
+    bool decodeImage(const uint8_t* data, std::size_t size, std::vector<uint16_t>& depth, uint32_t& width, uint32_t& height)
+    {
+        if (size < IMAGE_HEADER_SIZE)
+            return false;
+        width = 0;
+        height = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            width |= static_cast<uint32_t>(data[i]) << (8 * i);
+            height |= static_cast<uint32_t>(data[4 + i]) << (8 * i);
+        }
+        // Zero runs cost next to nothing, so the payload size does not bound the image size. Refuse corrupt
+        // headers before allocating, with a limit far beyond any depth sensor.
+        std::size_t count = static_cast<std::size_t>(width) * height;
+        if (width > MAX_IMAGE_SIDE || height > MAX_IMAGE_SIDE || count > MAX_IMAGE_PIXELS)
+            return false;
+        depth.resize(count);
+        return decode(data + IMAGE_HEADER_SIZE, size - IMAGE_HEADER_SIZE, depth.data(), count);
+    }
+}
+}
@@ -0,0 +1,67 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/rvl_depth_publisher.h"
+#include "../include/rvl_codec.h"
+#include <vector>
+
+namespace realsense2_camera
+{
+    const std::string RvlDepthPublisher::FORMAT("16UC1; rvl");
+
+    RvlDepthPublisher::RvlDepthPublisher(ros::NodeHandle& node_handle, const std::string& topic, WorkerPool& workers,
+                                         const ros::SubscriberStatusCallback& status_changed) :
+        _publisher(node_handle.advertise<sensor_msgs::CompressedImage>(topic, 1, status_changed, status_changed)),
+        _workers(workers),
+        _pool(workers.size() + 2),
+        _next_ticket(0),
+        _next_publish_ticket(0)
+    {}
+
+    bool RvlDepthPublisher::publish(rs2::frame depth, const std_msgs::Header& header, const DepthConditioning& conditioning)
+    {
+        // Tickets are taken in queue order and the queue is FIFO, so every ticket taken is eventually released.
+        std::lock_guard<std::mutex> lock_guard(_mutex);
+        uint64_t ticket(_next_ticket);
+        if (!_workers.submit([this, depth, header, conditioning, ticket]() { encode(depth, header, conditioning, ticket); }))
+            return false;
+        ++_next_ticket;
+        return true;
+    }
+
+    void RvlDepthPublisher::encode(rs2::frame depth, const std_msgs::Header& header, const DepthConditioning& conditioning, uint64_t ticket)
+    {
+        sensor_msgs::CompressedImage::Ptr msg;
+        try
+        {
+            rs2::video_frame image(depth.as<rs2::video_frame>());
+            uint32_t width(image.get_width());
+            uint32_t height(image.get_height());
+            const uint16_t* data(static_cast<const uint16_t*>(image.get_data()));
+            if (!conditioning.isIdentity())
+            {
+                static thread_local std::vector<uint16_t> conditioned;
+                conditioned.resize(static_cast<std::size_t>(width) * height);
+                conditionDepth(data, nullptr, conditioned.data(), conditioned.size(), conditioning);
+                data = conditioned.data();
+            }
+            msg = _pool.acquire();
+            rvl::encodeImage(data, width, height, msg->data);
+            msg->header = header;
+            msg->format = FORMAT;
+        }
+        catch(const std::exception& ex)
+        {
+            ROS_ERROR_STREAM("Failed to encode depth frame: " << ex.what());
+            msg.reset();
+        }
+
+        // The turn of a failed frame still has to pass, or the following frames would wait forever.
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this, ticket]() { return _next_publish_ticket == ticket; });
+        if (msg)
+            _publisher.publish(msg);
+        ++_next_publish_ticket;
+        _cv.notify_all();
+    }
+}
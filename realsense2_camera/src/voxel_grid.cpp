@@ -0,0 +1,120 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/voxel_grid.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace realsense2_camera
+{
+    // std::floor is a library call unless the target has SSE4.1.
+    static inline int64_t floorToInt(float value)
+    {
+        int64_t truncated = static_cast<int64_t>(value);
+        return (value < static_cast<float>(truncated)) ? truncated - 1 : truncated;
+    }
+
+    // Voxel coordinates are packed into 21 bits each, enough for +-1km at a 1mm leaf size.
+    static inline uint64_t voxelKey(float x, float y, float z, float inverse_leaf_size)
+    {
+        static const int64_t bias = 1 << 20;
+        static const uint64_t mask = (1 << 21) - 1;
+        uint64_t ix = static_cast<uint64_t>(floorToInt(x * inverse_leaf_size) + bias) & mask;
+        uint64_t iy = static_cast<uint64_t>(floorToInt(y * inverse_leaf_size) + bias) & mask;
+        uint64_t iz = static_cast<uint64_t>(floorToInt(z * inverse_leaf_size) + bias) & mask;
+        return (ix << 42) | (iy << 21) | iz;
+    }
+
+    void VoxelGrid::prepareTable(std::size_t count)
+    {
+        // Keep the load factor at or below one half.
+        int table_bits(10);
+        while ((static_cast<std::size_t>(1) << table_bits) < 2 * count)
+            ++table_bits;
+        if (table_bits > _table_bits)
+        {
+            _table_bits = table_bits;
+            _table.assign(static_cast<std::size_t>(1) << _table_bits, Voxel());
+            for (Voxel& voxel : _table)
+                voxel.epoch = 0;
+            _epoch = 0;
+        }
+        if (++_epoch == 0)
+        {
+            for (Voxel& voxel : _table)
+                voxel.epoch = 0;
+            _epoch = 1;
+        }
+        _occupied.clear();
+    }
+
+    std::size_t VoxelGrid::filter(const uint8_t* points, std::size_t count, uint32_t point_step, bool has_color,
+                                  float leaf_size, int min_points, uint8_t* out)
+    {
+        prepareTable(count);
+        const float inverse_leaf_size(1.f / leaf_size);
+        const uint64_t table_mask((static_cast<uint64_t>(1) << _table_bits) - 1);
+
+        // Neighbouring points of a depth image mostly share a voxel, so remember the last one.
+        uint64_t last_key(0);
+        Voxel* last_voxel(nullptr);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const uint8_t* point = points + i * point_step;
+            float xyz[3];
+            memcpy(xyz, point, sizeof(xyz));
+            if (!(xyz[2] > 0) || !std::isfinite(xyz[0]) || !std::isfinite(xyz[1]) || !std::isfinite(xyz[2]))
+                continue;
+
+            uint64_t key = voxelKey(xyz[0], xyz[1], xyz[2], inverse_leaf_size);
+            if (!last_voxel || key != last_key)
+            {
+                uint64_t slot = (key * 0x9E3779B97F4A7C15ull) >> (64 - _table_bits);
+                while (_table[slot].epoch == _epoch && _table[slot].key != key)
+                    slot = (slot + 1) & table_mask;
+
+                last_voxel = &_table[slot];
+                last_key = key;
+                if (last_voxel->epoch != _epoch)
+                {
+                    last_voxel->key = key;
+                    last_voxel->epoch = _epoch;
+                    last_voxel->count = 0;
+                    memset(last_voxel->sum, 0, sizeof(last_voxel->sum));
+                    memset(last_voxel->color_sum, 0, sizeof(last_voxel->color_sum));
+                    _occupied.push_back(static_cast<uint32_t>(slot));
+                }
+            }
+            Voxel& voxel = *last_voxel;
+            ++voxel.count;
+            voxel.sum[0] += xyz[0];
+            voxel.sum[1] += xyz[1];
+            voxel.sum[2] += xyz[2];
+            if (has_color)
+            {
+                for (int c = 0; c < 4; ++c)
+                    voxel.color_sum[c] += point[16 + c];
+            }
+        }
+
+        std::size_t out_count(0);
+        for (uint32_t slot : _occupied)
+        {
+            const Voxel& voxel = _table[slot];
+            if (voxel.count < static_cast<uint32_t>(std::max(min_points, 1)))
+                continue;
+            uint8_t* point = out + out_count * point_step;
+            memset(point, 0, point_step);
+            float centroid[3] = {voxel.sum[0] / voxel.count, voxel.sum[1] / voxel.count, voxel.sum[2] / voxel.count};
+            memcpy(point, centroid, sizeof(centroid));
+            if (has_color)
+            {
+                for (int c = 0; c < 4; ++c)
+                    point[16 + c] = static_cast<uint8_t>((voxel.color_sum[c] + voxel.count / 2) / voxel.count);
+            }
+            ++out_count;
+        }
+        return out_count;
+    }
+}
@@ -0,0 +1,64 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/worker_pool.h"
+#include <ros/ros.h>
+
+namespace realsense2_camera
+{
+    WorkerPool::WorkerPool(std::size_t num_threads, std::size_t max_queued_jobs) :
+        _max_queued_jobs(max_queued_jobs),
+        _stop(false)
+    {
+        for (std::size_t i = 0; i < num_threads; ++i)
+            _threads.emplace_back([this]() { run(); });
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock_guard(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (std::thread& thread : _threads)
+            thread.join();
+    }
+
+    bool WorkerPool::submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock_guard(_mutex);
+            if (_jobs.size() >= _max_queued_jobs)
+                return false;
+            _jobs.push_back(std::move(job));
+        }
+        _cv.notify_one();
+        return true;
+    }
+
+    void WorkerPool::run()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+                // Queued jobs are dropped on shutdown.
+                if (_stop)
+                    return;
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+            try
+            {
+                job();
+            }
+            catch(const std::exception& ex)
+            {
+                ROS_ERROR_STREAM("Worker job failed: " << ex.what());
+            }
+        }
+    }
+}
@@ -0,0 +1,140 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/crop_volume.h"
+#include <gtest/gtest.h>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace realsense2_camera;
+
+namespace
+{
+    // A box turned around the y axis and shifted, depth limits, an angular frustum, all three, and no limit.
+    std::vector<std::pair<std::string, CropVolume> > volumes()
+    {
+        const float min[3] = {-0.5f, -0.4f, 0.5f};
+        const float max[3] = {0.6f, 0.3f, 2.5f};
+        const rs2_extrinsics to_box = {{0.9659f, 0, -0.2588f, 0, 1, 0, 0.2588f, 0, 0.9659f}, {0.1f, -0.05f, 0.2f}};
+        std::vector<std::pair<std::string, CropVolume> > result(5);
+        result[0].first = "box";
+        result[0].second.addBox(min, max, to_box);
+        result[1].first = "range";
+        result[1].second.addRange(0.4f, 3.0f);
+        result[2].first = "fov";
+        result[2].second.addFrustum(1.5f, 1.0f);
+        result[3].first = "box, range and fov";
+        result[3].second.addBox(min, max, to_box);
+        result[3].second.addRange(0.4f, 3.0f);
+        result[3].second.addFrustum(1.5f, 1.0f);
+        result[4].first = "empty";
+        return result;
+    }
+
+    // Depths of 0 to 5 m (in mm) with holes, along rays spanning a 90x70 degree view.
+    struct Points
+    {
+        std::vector<uint16_t> depth;
+        std::vector<float> rays[3];
+        std::vector<float> vertices;
+
+        Points(std::size_t count, unsigned seed)
+        {
+            std::mt19937 rng(seed);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                depth.push_back(rng() % 8 == 0 ? 0 : static_cast<uint16_t>(rng() % 5000));
+                rays[0].push_back(((rng() % 2001) - 1000.0f) / 1000.0f * 0.001f);
+                rays[1].push_back(((rng() % 2001) - 1000.0f) / 1000.0f * 0.0007f);
+                rays[2].push_back(0.001f);
+                for (int c = 0; c < 3; ++c)
+                    vertices.push_back(depth[i] * rays[c][i]);
+            }
+            // A point without coordinates, which contains() keeps as no plane rejects it.
+            if (count > 3)
+                vertices[3 * 3] = std::numeric_limits<float>::quiet_NaN();
+        }
+    };
+
+    // Masks of count points with some bits already cleared, as the validity of the points leaves them. The masks
+    // are sized past count, so writing beyond it shows.
+    std::vector<uint8_t> initialMasks(std::size_t count)
+    {
+        std::vector<uint8_t> masks((count + 7) / 8 + 4, 0x5a);
+        CropVolume::fillMasks(count, masks.data());
+        for (std::size_t i = 0; i < count; i += 5)
+            masks[i / 8] &= ~(1u << (i % 8));
+        return masks;
+    }
+
+    std::vector<uint8_t> expectedMasks(const CropVolume& volume, const std::vector<float>& vertices, std::size_t count,
+                                       std::size_t& inside_count)
+    {
+        std::vector<uint8_t> masks(initialMasks(count));
+        inside_count = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (!((masks[i / 8] >> (i % 8)) & 1))
+                continue;
+            if (volume.contains(&vertices[3 * i]))
+                ++inside_count;
+            else
+                masks[i / 8] &= ~(1u << (i % 8));
+        }
+        return masks;
+    }
+
+    void expectCropMatchesContains(const CropVolume& volume, const Points& points, std::size_t count)
+    {
+        std::size_t expected_count;
+        std::vector<uint8_t> expected(expectedMasks(volume, points.vertices, count, expected_count));
+
+        std::vector<uint8_t> masks(initialMasks(count));
+        std::size_t inside_count = volume.crop(points.vertices.data(), count, masks.data());
+        ASSERT_EQ(expected_count, inside_count) << "vertices";
+        ASSERT_EQ(expected, masks) << "vertices";
+
+        // The depth overload computes the same points from the depth and the rays, except the point without
+        // coordinates.
+        std::vector<float> depth_vertices;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+                depth_vertices.push_back(points.depth[i] * points.rays[c][i]);
+        }
+        expected = expectedMasks(volume, depth_vertices, count, expected_count);
+        const float* const rays[3] = {points.rays[0].data(), points.rays[1].data(), points.rays[2].data()};
+        masks = initialMasks(count);
+        inside_count = volume.crop(points.depth.data(), rays, count, masks.data());
+        ASSERT_EQ(expected_count, inside_count) << "depth";
+        ASSERT_EQ(expected, masks) << "depth";
+    }
+}
+
+// Counts that leave a tail for the scalar loop, including counts without a full group of 8.
+TEST(CropVolume, CropMatchesContainsOnTails)
+{
+    const Points points(48, 1);
+    for (const auto& volume : volumes())
+    {
+        for (std::size_t count = 0; count <= 43; ++count)
+        {
+            SCOPED_TRACE(volume.first + ": " + std::to_string(count) + " points");
+            expectCropMatchesContains(volume.second, points, count);
+        }
+    }
+}
+
+TEST(CropVolume, CropMatchesContains)
+{
+    const std::size_t count(848 * 480 + 3);
+    const Points points(count, 2);
+    for (const auto& volume : volumes())
+    {
+        SCOPED_TRACE(volume.first);
+        expectCropMatchesContains(volume.second, points, count);
+    }
+}
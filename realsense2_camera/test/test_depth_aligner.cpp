@@ -0,0 +1,220 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/depth_aligner.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace realsense2_camera;
+
+namespace
+{
+    typedef DepthAligner::ProjectRowFunc ProjectRowFunc;
+
+    // The vector kernels supported by the running CPU. The scalar kernel is the reference.
+    std::vector<std::pair<std::string, ProjectRowFunc> > vectorKernels()
+    {
+        std::vector<std::pair<std::string, ProjectRowFunc> > kernels;
+        if (DepthAligner::projectRowAVX2())
+            kernels.push_back(std::make_pair("avx2", DepthAligner::projectRowAVX2()));
+        return kernels;
+    }
+
+    rs2_intrinsics intrinsics(int width, int height, float fx, float fy, rs2_distortion model, std::vector<float> coeffs)
+    {
+        rs2_intrinsics result = {};
+        result.width = width;
+        result.height = height;
+        result.fx = fx;
+        result.fy = fy;
+        result.ppx = width / 2.0f - 3.25f;
+        result.ppy = height / 2.0f + 1.75f;
+        result.model = model;
+        std::copy(coeffs.begin(), coeffs.end(), result.coeffs);
+        return result;
+    }
+
+    const rs2_intrinsics depth_intrinsics(intrinsics(848, 480, 424.5f, 424.5f, RS2_DISTORTION_BROWN_CONRADY, {}));
+
+    // Color and infrared targets of a D400, with each supported distortion model, and a target far off the depth
+    // camera's view, whose rectangles mostly fall outside of it.
+    std::vector<std::pair<std::string, PixelProjection> > projections()
+    {
+        const rs2_extrinsics to_color = {{0.99998f, -0.0041f, 0.0048f, 0.0041f, 0.99999f, 0.0011f, -0.0048f, -0.0011f, 0.99998f},
+                                         {0.0148f, 0.0001f, 0.0002f}};
+        const rs2_extrinsics to_infra2 = {{1, 0, 0, 0, 1, 0, 0, 0, 1}, {-0.0501f, 0, 0}};
+        const rs2_extrinsics off_view = {{0.7071f, 0, 0.7071f, 0, 1, 0, -0.7071f, 0, 0.7071f}, {0.3f, 0.1f, -0.2f}};
+        const std::vector<float> coeffs = {0.1432f, -0.4631f, 0.0007f, -0.0011f, 0.4103f};
+        std::vector<std::pair<std::string, rs2_intrinsics> > targets = {
+            {"color without distortion", intrinsics(1280, 720, 910.3f, 909.8f, RS2_DISTORTION_NONE, {})},
+            {"color with Brown-Conrady", intrinsics(1280, 720, 910.3f, 909.8f, RS2_DISTORTION_BROWN_CONRADY, coeffs)},
+            {"color with modified Brown-Conrady", intrinsics(640, 480, 615.1f, 615.4f, RS2_DISTORTION_MODIFIED_BROWN_CONRADY, coeffs)},
+            {"color with inverse Brown-Conrady", intrinsics(1920, 1080, 1365.5f, 1364.7f, RS2_DISTORTION_INVERSE_BROWN_CONRADY, coeffs)}};
+        std::vector<std::pair<std::string, PixelProjection> > result;
+        for (const auto& target : targets)
+        {
+            result.emplace_back(target.first, PixelProjection());
+            PixelProjection::create(target.second, to_color, result.back().second);
+        }
+        result.emplace_back("infra2", PixelProjection());
+        PixelProjection::create(depth_intrinsics, to_infra2, result.back().second);
+        result.emplace_back("off the view", PixelProjection());
+        PixelProjection::create(intrinsics(320, 240, 300.0f, 300.0f, RS2_DISTORTION_NONE, {}), off_view, result.back().second);
+        return result;
+    }
+
+    // The corner rays above and below a depth row, as DepthAligner::configure() lays them out, at 1 mm units.
+    struct CornerRows
+    {
+        std::vector<float> top[3];
+        std::vector<float> bottom[3];
+
+        CornerRows(int row, int offset)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                top[i].resize(depth_intrinsics.width + 1);
+                bottom[i].resize(depth_intrinsics.width + 1);
+            }
+            for (int x = 0; x <= depth_intrinsics.width; ++x)
+            {
+                for (int dy = 0; dy < 2; ++dy)
+                {
+                    std::vector<float>* rays(dy ? bottom : top);
+                    // The depth pixels are shifted by offset, to start the kernel anywhere in a row.
+                    float ray_x = (x + offset - 0.5f - depth_intrinsics.ppx) / depth_intrinsics.fx;
+                    float ray_y = (row + dy - 0.5f - depth_intrinsics.ppy) / depth_intrinsics.fy;
+                    rays[0][x] = ray_x * 0.001f;
+                    rays[1][x] = ray_y * 0.001f;
+                    rays[2][x] = 0.001f;
+                }
+            }
+        }
+    };
+
+    // Depths of 0.2 m to 20 m with holes, and runs of equal depth, as a depth camera gives.
+    std::vector<uint16_t> depthRow(int width, unsigned seed)
+    {
+        std::mt19937 rng(seed);
+        std::vector<uint16_t> depth(width);
+        uint16_t value(1000);
+        for (int i = 0; i < width; ++i)
+        {
+            if (rng() % 4 == 0)
+                value = static_cast<uint16_t>(200 + rng() % 19800);
+            depth[i] = (rng() % 10 == 0) ? 0 : value;
+        }
+        return depth;
+    }
+
+    struct RowResult
+    {
+        std::vector<int16_t> planes[DepthAligner::max_targets][4];
+        int first_rows[DepthAligner::max_targets];
+        int last_rows[DepthAligner::max_targets];
+    };
+
+    // Runs kernel on width pixels of depth. The planes are sized past width, so writing beyond it shows.
+    RowResult projectRow(ProjectRowFunc kernel, const std::vector<uint16_t>& depth, int width, const CornerRows& corners,
+                         const std::vector<const PixelProjection*>& targets)
+    {
+        const float* const rays_top[3] = {corners.top[0].data(), corners.top[1].data(), corners.top[2].data()};
+        const float* const rays_bottom[3] = {corners.bottom[0].data(), corners.bottom[1].data(), corners.bottom[2].data()};
+        RowResult result;
+        DepthAligner::Rectangles rectangles[DepthAligner::max_targets];
+        for (std::size_t t = 0; t < targets.size(); ++t)
+        {
+            for (std::vector<int16_t>& plane : result.planes[t])
+                plane.assign(width + 16, 0x5a5a);
+            rectangles[t] = {result.planes[t][0].data(), result.planes[t][1].data(), result.planes[t][2].data(), result.planes[t][3].data()};
+        }
+        kernel(depth.data(), width, rays_top, rays_bottom, targets.data(), rectangles, targets.size(), result.first_rows, result.last_rows);
+        return result;
+    }
+
+    void expectSameRow(const RowResult& expected, const RowResult& actual, std::size_t num_targets)
+    {
+        for (std::size_t t = 0; t < num_targets; ++t)
+        {
+            SCOPED_TRACE("target " + std::to_string(t));
+            for (int i = 0; i < 4; ++i)
+                ASSERT_EQ(expected.planes[t][i], actual.planes[t][i]) << "plane " << "x0y0x1y1"[2 * i] << "x0y0x1y1"[2 * i + 1];
+            ASSERT_EQ(expected.first_rows[t], actual.first_rows[t]);
+            ASSERT_EQ(expected.last_rows[t], actual.last_rows[t]);
+        }
+    }
+}
+
+TEST(DepthAligner, VectorKernelsMatchScalarPerTarget)
+{
+    const auto targets(projections());
+    for (const auto& kernel : vectorKernels())
+    {
+        for (const auto& target : targets)
+        {
+            for (int row : {0, 1, 137, 240, 478, 479})
+            {
+                SCOPED_TRACE(kernel.first + ": " + target.first + ", depth row " + std::to_string(row));
+                CornerRows corners(row, 0);
+                std::vector<uint16_t> depth(depthRow(depth_intrinsics.width, row));
+                std::vector<const PixelProjection*> projection = {&target.second};
+                RowResult expected(projectRow(DepthAligner::projectRowScalar, depth, depth_intrinsics.width, corners, projection));
+                RowResult actual(projectRow(kernel.second, depth, depth_intrinsics.width, corners, projection));
+                expectSameRow(expected, actual, projection.size());
+            }
+        }
+    }
+}
+
+// align() projects each row into all the targets at once.
+TEST(DepthAligner, VectorKernelsMatchScalarForAllTargets)
+{
+    const auto targets(projections());
+    std::vector<const PixelProjection*> all;
+    for (const auto& target : targets)
+        all.push_back(&target.second);
+    for (const auto& kernel : vectorKernels())
+    {
+        for (int row = 0; row < depth_intrinsics.height; row += 7)
+        {
+            SCOPED_TRACE(kernel.first + ": depth row " + std::to_string(row));
+            CornerRows corners(row, 0);
+            std::vector<uint16_t> depth(depthRow(depth_intrinsics.width, 1000 + row));
+            RowResult expected(projectRow(DepthAligner::projectRowScalar, depth, depth_intrinsics.width, corners, all));
+            RowResult actual(projectRow(kernel.second, depth, depth_intrinsics.width, corners, all));
+            expectSameRow(expected, actual, all.size());
+        }
+    }
+}
+
+// Widths that leave a tail for the scalar loop, including rows without a full vector, and all-zero rows.
+TEST(DepthAligner, VectorKernelsMatchScalarOnTails)
+{
+    const auto targets(projections());
+    std::vector<const PixelProjection*> all;
+    for (const auto& target : targets)
+        all.push_back(&target.second);
+    for (const auto& kernel : vectorKernels())
+    {
+        for (int width = 0; width <= 35; ++width)
+        {
+            for (int offset : {0, 400, 830})
+            {
+                SCOPED_TRACE(kernel.first + ": " + std::to_string(width) + " pixels from " + std::to_string(offset));
+                CornerRows corners(200, offset);
+                std::vector<uint16_t> depth(depthRow(width, width + offset));
+                RowResult expected(projectRow(DepthAligner::projectRowScalar, depth, width, corners, all));
+                RowResult actual(projectRow(kernel.second, depth, width, corners, all));
+                expectSameRow(expected, actual, all.size());
+
+                std::vector<uint16_t> holes(width, 0);
+                expected = projectRow(DepthAligner::projectRowScalar, holes, width, corners, all);
+                actual = projectRow(kernel.second, holes, width, corners, all);
+                expectSameRow(expected, actual, all.size());
+            }
+        }
+    }
+}
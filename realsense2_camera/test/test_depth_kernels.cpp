@@ -0,0 +1,185 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/depth_kernels.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace realsense2_camera;
+using namespace realsense2_camera::depth_kernels;
+
+namespace
+{
+    // The vector kernels supported by the running CPU. The scalar kernel is the reference.
+    std::vector<std::pair<std::string, ConditionDepthFunc> > vectorKernels()
+    {
+        std::vector<std::pair<std::string, ConditionDepthFunc> > kernels;
+        if (conditionDepthSSE41())
+            kernels.push_back(std::make_pair("sse4.1", conditionDepthSSE41()));
+        if (conditionDepthAVX2())
+            kernels.push_back(std::make_pair("avx2", conditionDepthAVX2()));
+        if (conditionDepthNEON())
+            kernels.push_back(std::make_pair("neon", conditionDepthNEON()));
+        return kernels;
+    }
+
+    // Every Z16 value, followed by a few zeros and saturating values.
+    std::vector<uint16_t> allValues()
+    {
+        std::vector<uint16_t> values;
+        for (uint32_t value = 0; value <= 65535; ++value)
+            values.push_back(static_cast<uint16_t>(value));
+        values.insert(values.end(), 5, 0);
+        values.insert(values.end(), 5, 65535);
+        return values;
+    }
+
+    std::vector<uint8_t> confidences(std::size_t count)
+    {
+        std::vector<uint8_t> confidence(count);
+        for (std::size_t i = 0; i < count; ++i)
+            confidence[i] = static_cast<uint8_t>(i * 37 + i / 256);
+        return confidence;
+    }
+
+    DepthConditioning rescaling(float depth_scale_meters)
+    {
+        DepthConditioning conditioning;
+        conditioning.rescale = true;
+        conditioning.depth_scale_meters = depth_scale_meters;
+        return conditioning;
+    }
+
+    DepthConditioning clipping(bool rescale)
+    {
+        DepthConditioning conditioning(rescaling(0.00025f));
+        conditioning.rescale = rescale;
+        conditioning.min_value = 300;
+        conditioning.max_value = 40000;
+        conditioning.confidence_threshold = 128;
+        return conditioning;
+    }
+
+    // Depth units of the D400 (1 mm), L500 (0.25 mm) and D405 (0.1 mm) cameras, and coarser ones that saturate.
+    const float depth_scales[] = {0.001f, 0.00025f, 0.0001f, 0.000999987f, 0.0015f, 0.01f, 1.0f};
+}
+
+// The conversion the node always did: value * depth_scale / 0.001 in single precision, truncated, which rounds
+// some exact products down (1000 units of 0.25 mm give 249 mm). Values past 65535 mm now saturate.
+TEST(DepthKernels, ScalarMatchesTheOriginalConversion)
+{
+    std::vector<uint16_t> from(allValues());
+    for (float depth_scale : depth_scales)
+    {
+        SCOPED_TRACE("depth scale " + std::to_string(depth_scale));
+        std::vector<uint16_t> to(from.size());
+        conditionDepthScalar(from.data(), nullptr, to.data(), from.size(), rescaling(depth_scale));
+        for (std::size_t i = 0; i < from.size(); ++i)
+        {
+            float value = static_cast<float>(from[i]) * depth_scale / 0.001f;
+            uint16_t expected = value >= 65535.0f ? 65535 : static_cast<uint16_t>(value);
+            ASSERT_EQ(expected, to[i]) << "value " << from[i];
+        }
+    }
+}
+
+TEST(DepthKernels, ScalarKeepsZeroAndSaturates)
+{
+    std::vector<uint16_t> from = {0, 6553, 6554, 65535};
+    std::vector<uint16_t> to(from.size());
+    conditionDepthScalar(from.data(), nullptr, to.data(), from.size(), rescaling(0.01f));
+    EXPECT_EQ(0, to[0]);
+    EXPECT_LT(to[1], 65535);
+    EXPECT_EQ(65535, to[2]);
+    EXPECT_EQ(65535, to[3]);
+}
+
+TEST(DepthKernels, ScalarClipsAndMasks)
+{
+    std::vector<uint16_t> from = {299, 300, 1000, 1000, 40000, 40001};
+    std::vector<uint8_t> confidence = {255, 255, 128, 127, 255, 255};
+    std::vector<uint16_t> to(from.size());
+    conditionDepthScalar(from.data(), confidence.data(), to.data(), from.size(), clipping(false));
+    EXPECT_EQ(std::vector<uint16_t>({0, 300, 1000, 0, 40000, 0}), to);
+}
+
+TEST(DepthKernels, VectorKernelsMatchScalarOnAllValues)
+{
+    std::vector<uint16_t> from(allValues());
+    std::vector<uint8_t> confidence(confidences(from.size()));
+    std::vector<std::pair<std::string, DepthConditioning> > cases;
+    for (float depth_scale : depth_scales)
+        cases.push_back(std::make_pair("rescale at depth scale " + std::to_string(depth_scale), rescaling(depth_scale)));
+    cases.push_back(std::make_pair("clip", clipping(false)));
+    cases.push_back(std::make_pair("clip and rescale", clipping(true)));
+    for (const auto& kernel : vectorKernels())
+    {
+        for (const auto& conditioning : cases)
+        {
+            SCOPED_TRACE(kernel.first + ": " + conditioning.first);
+            std::vector<uint16_t> expected(from.size()), to(from.size());
+            conditionDepthScalar(from.data(), confidence.data(), expected.data(), from.size(), conditioning.second);
+            kernel.second(from.data(), confidence.data(), to.data(), from.size(), conditioning.second);
+            for (std::size_t i = 0; i < from.size(); ++i)
+                ASSERT_EQ(expected[i], to[i]) << "value " << from[i] << ", confidence " << int(confidence[i]);
+        }
+    }
+}
+
+// Counts that leave a tail for the scalar loop, starting at unaligned addresses.
+TEST(DepthKernels, VectorKernelsMatchScalarOnTails)
+{
+    std::vector<uint16_t> values(allValues());
+    for (const auto& kernel : vectorKernels())
+    {
+        for (std::size_t count = 0; count <= 67; ++count)
+        {
+            for (std::size_t offset = 0; offset < 3; ++offset)
+            {
+                SCOPED_TRACE(kernel.first + ": " + std::to_string(count) + " values at offset " + std::to_string(offset));
+                // Values spread over the whole range, so the tails see zeros, saturating and ordinary values.
+                std::vector<uint16_t> from(count + offset);
+                for (std::size_t i = 0; i < from.size(); ++i)
+                    from[i] = values[(i * 7919 + count * 104729) % values.size()];
+                std::vector<uint8_t> confidence(confidences(from.size()));
+                for (bool clip : {false, true})
+                {
+                    DepthConditioning conditioning(clip ? clipping(true) : rescaling(0.0015f));
+                    const uint8_t* p_confidence(clip ? confidence.data() + offset : nullptr);
+                    // The kernels must not write past count.
+                    std::vector<uint16_t> expected(from.size() + 16, 0xabcd), to(from.size() + 16, 0xabcd);
+                    conditionDepthScalar(from.data() + offset, p_confidence, expected.data() + offset, count, conditioning);
+                    kernel.second(from.data() + offset, p_confidence, to.data() + offset, count, conditioning);
+                    ASSERT_EQ(expected, to);
+                }
+            }
+        }
+    }
+}
+
+TEST(DepthKernels, VectorKernelsConditionInPlace)
+{
+    for (const auto& kernel : vectorKernels())
+    {
+        SCOPED_TRACE(kernel.first);
+        std::vector<uint16_t> expected(allValues()), in_place(allValues());
+        std::vector<uint8_t> confidence(confidences(expected.size()));
+        conditionDepthScalar(expected.data(), confidence.data(), expected.data(), expected.size(), clipping(true));
+        kernel.second(in_place.data(), confidence.data(), in_place.data(), in_place.size(), clipping(true));
+        ASSERT_EQ(expected, in_place);
+    }
+}
+
+// conditionDepth splits the buffer into tiles; the count leaves a partial last tile.
+TEST(DepthKernels, DispatchedKernelMatchesScalar)
+{
+    std::vector<uint16_t> from(allValues());
+    from.insert(from.end(), from.begin(), from.begin() + 12345);
+    std::vector<uint8_t> confidence(confidences(from.size()));
+    std::vector<uint16_t> expected(from.size()), to(from.size());
+    conditionDepthScalar(from.data(), confidence.data(), expected.data(), from.size(), clipping(true));
+    conditionDepth(from.data(), confidence.data(), to.data(), from.size(), clipping(true));
+    EXPECT_EQ(expected, to) << "selected kernel: " << depthKernelsName();
+}
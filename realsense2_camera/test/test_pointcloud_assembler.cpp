@@ -0,0 +1,228 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2018 Intel Corporation. All Rights Reserved
+
+#include "../include/pointcloud_assembler.h"
+#include <gtest/gtest.h>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace realsense2_camera;
+
+namespace
+{
+    typedef PointCloudAssembler::ClassifyFunc ClassifyFunc;
+
+    // The vector kernels supported by the running CPU. The scalar kernel is the reference.
+    std::vector<std::pair<std::string, ClassifyFunc> > vectorKernels()
+    {
+        std::vector<std::pair<std::string, ClassifyFunc> > kernels;
+        if (PointCloudAssembler::classifyAVX2())
+            kernels.push_back(std::make_pair("avx2", PointCloudAssembler::classifyAVX2()));
+        if (PointCloudAssembler::classifyNEON())
+            kernels.push_back(std::make_pair("neon", PointCloudAssembler::classifyNEON()));
+        return kernels;
+    }
+
+    const int texture_width(64);
+    const int texture_height(48);
+
+    // Points with and without depth (including negative and NaN depths), and texture coordinates inside, on the
+    // edges of and outside the texture, as rs2::pointcloud gives when the texture misses part of the depth view.
+    struct Points
+    {
+        std::vector<float> vertices;
+        std::vector<float> texture_coordinates;
+
+        Points(std::size_t count, unsigned seed)
+        {
+            std::mt19937 rng(seed);
+            std::uniform_real_distribution<float> coordinate(-0.2f, 1.2f);
+            const float nan(std::numeric_limits<float>::quiet_NaN());
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                float z;
+                switch (rng() % 10)
+                {
+                    case 0:  z = 0.0f; break;
+                    case 1:  z = -0.5f; break;
+                    case 2:  z = nan; break;
+                    default: z = 0.3f + (rng() % 10000) * 0.001f;
+                }
+                vertices.push_back(z * ((rng() % 200) - 100.0f) / 100.0f);
+                vertices.push_back(z * ((rng() % 200) - 100.0f) / 150.0f);
+                vertices.push_back(z);
+                for (int c = 0; c < 2; ++c)
+                {
+                    switch (rng() % 12)
+                    {
+                        case 0:  texture_coordinates.push_back(0.0f); break;
+                        case 1:  texture_coordinates.push_back(1.0f); break;
+                        case 2:  texture_coordinates.push_back(nan); break;
+                        default: texture_coordinates.push_back(coordinate(rng));
+                    }
+                }
+            }
+        }
+    };
+
+    std::vector<uint8_t> textureData(int bytes_per_pixel)
+    {
+        std::vector<uint8_t> data(texture_width * texture_height * bytes_per_pixel);
+        for (std::size_t i = 0; i < data.size(); ++i)
+            data[i] = static_cast<uint8_t>(i * 31 + i / 7);
+        return data;
+    }
+
+    PointCloudAssembler::ClassifyParams classifyParams(int bytes_per_pixel, bool allow_no_texture_points)
+    {
+        PointCloudAssembler::ClassifyParams params;
+        params.textured = (bytes_per_pixel != 0);
+        params.allow_no_texture_points = allow_no_texture_points;
+        params.texture_width = bytes_per_pixel ? texture_width : 0;
+        params.texture_height = bytes_per_pixel ? texture_height : 0;
+        params.bytes_per_pixel = bytes_per_pixel;
+        return params;
+    }
+
+    struct Classification
+    {
+        std::size_t valid_count;
+        std::vector<uint8_t> valid_masks;
+        std::vector<int32_t> color_offsets;
+    };
+
+    // Runs kernel on count points. The outputs are sized past count, so writing beyond it shows.
+    Classification classify(ClassifyFunc kernel, const Points& points, std::size_t count, const PointCloudAssembler::ClassifyParams& params)
+    {
+        Classification result;
+        result.valid_masks.assign((count + 7) / 8 + 4, 0x5a);
+        result.color_offsets.assign(params.textured ? count + 16 : 0, 0x5a5a5a5a);
+        result.valid_count = kernel(points.vertices.data(), params.textured ? points.texture_coordinates.data() : nullptr, count,
+                                    params, result.valid_masks.data(), params.textured ? result.color_offsets.data() : nullptr);
+        return result;
+    }
+
+    void expectSameClassification(const Classification& expected, const Classification& actual)
+    {
+        ASSERT_EQ(expected.valid_count, actual.valid_count);
+        ASSERT_EQ(expected.valid_masks, actual.valid_masks);
+        ASSERT_EQ(expected.color_offsets, actual.color_offsets);
+    }
+
+    // The xyz32 cloud written point by point from the classification of the scalar kernel.
+    template <int BytesPerPixel>
+    std::vector<uint8_t> scalarCloud(const Points& points, std::size_t count, const uint8_t* texture_data, bool ordered,
+                                     bool allow_no_texture_points)
+    {
+        const uint32_t point_step(pointcloud_layout::pointStep(PointCloudLayout::XYZ32, BytesPerPixel));
+        Classification classification(classify(PointCloudAssembler::classifyScalar, points, count,
+                                               classifyParams(BytesPerPixel, allow_no_texture_points)));
+        std::vector<uint8_t> cloud;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (!ordered && !((classification.valid_masks[i / 8] >> (i % 8)) & 1))
+                continue;
+            uint8_t color[BytesPerPixel ? BytesPerPixel : 1] = {0};
+            if (BytesPerPixel && classification.color_offsets[i] >= 0)
+            {
+                for (int c = 0; c < BytesPerPixel; ++c)
+                    color[c] = texture_data[classification.color_offsets[i] + BytesPerPixel - 1 - c];
+            }
+            cloud.resize(cloud.size() + point_step);
+            pointcloud_layout::writePoint<PointCloudLayout::XYZ32, BytesPerPixel>(&cloud[cloud.size() - point_step], &points.vertices[3 * i], color);
+        }
+        return cloud;
+    }
+
+    std::vector<uint8_t> scalarCloud(const Points& points, std::size_t count, int bytes_per_pixel, const uint8_t* texture_data,
+                                     bool ordered, bool allow_no_texture_points)
+    {
+        if (bytes_per_pixel == 3)
+            return scalarCloud<3>(points, count, texture_data, ordered, allow_no_texture_points);
+        if (bytes_per_pixel == 1)
+            return scalarCloud<1>(points, count, texture_data, ordered, allow_no_texture_points);
+        return scalarCloud<0>(points, count, texture_data, ordered, allow_no_texture_points);
+    }
+}
+
+// Counts that leave a tail for the scalar loop, including counts without a full vector.
+TEST(PointCloudAssembler, VectorKernelsMatchScalarOnTails)
+{
+    const Points points(64, 1);
+    for (const auto& kernel : vectorKernels())
+    {
+        for (int bytes_per_pixel : {0, 1, 3})
+        {
+            for (bool allow_no_texture_points : {false, true})
+            {
+                const PointCloudAssembler::ClassifyParams params(classifyParams(bytes_per_pixel, allow_no_texture_points));
+                for (std::size_t count = 0; count <= 40; ++count)
+                {
+                    SCOPED_TRACE(kernel.first + ": " + std::to_string(count) + " points, " + std::to_string(bytes_per_pixel) +
+                                 " bytes per pixel" + (allow_no_texture_points ? ", allowing points without texture" : ""));
+                    expectSameClassification(classify(PointCloudAssembler::classifyScalar, points, count, params),
+                                             classify(kernel.second, points, count, params));
+                }
+            }
+        }
+    }
+}
+
+TEST(PointCloudAssembler, VectorKernelsMatchScalar)
+{
+    const std::size_t count(848 * 480 + 5);
+    const Points points(count, 2);
+    for (const auto& kernel : vectorKernels())
+    {
+        for (int bytes_per_pixel : {0, 1, 3})
+        {
+            for (bool allow_no_texture_points : {false, true})
+            {
+                SCOPED_TRACE(kernel.first + ": " + std::to_string(bytes_per_pixel) + " bytes per pixel" +
+                             (allow_no_texture_points ? ", allowing points without texture" : ""));
+                const PointCloudAssembler::ClassifyParams params(classifyParams(bytes_per_pixel, allow_no_texture_points));
+                expectSameClassification(classify(PointCloudAssembler::classifyScalar, points, count, params),
+                                         classify(kernel.second, points, count, params));
+            }
+        }
+    }
+}
+
+// assemble() classifies with the kernel selected for the CPU and compacts the chunks in parallel. The counts cover
+// a partial chunk, chunks that end in a tail, and several whole chunks.
+TEST(PointCloudAssembler, AssembleMatchesScalarCloud)
+{
+    PointCloudAssembler assembler;
+    for (std::size_t count : {std::size_t(13), std::size_t(8192), std::size_t(8192 * 3 + 7), std::size_t(848 * 480 + 5)})
+    {
+        const Points points(count, static_cast<unsigned>(count));
+        for (int bytes_per_pixel : {0, 1, 3})
+        {
+            const std::vector<uint8_t> texture_data(textureData(bytes_per_pixel ? bytes_per_pixel : 1));
+            PointCloudAssembler::Texture texture = {texture_data.data(), texture_width, texture_height, bytes_per_pixel};
+            const uint32_t point_step(PointCloudAssembler::pointStep(bytes_per_pixel ? &texture : nullptr));
+            for (bool ordered : {false, true})
+            {
+                for (bool allow_no_texture_points : {false, true})
+                {
+                    SCOPED_TRACE(std::to_string(count) + " points, " + std::to_string(bytes_per_pixel) + " bytes per pixel, " +
+                                 (ordered ? "ordered" : "unordered") + (allow_no_texture_points ? ", allowing points without texture" : ""));
+                    std::vector<uint8_t> expected(scalarCloud(points, count, bytes_per_pixel, texture_data.data(), ordered, allow_no_texture_points));
+                    std::vector<uint8_t> actual((count + 1) * point_step, 0x5a);
+                    std::size_t written = assembler.assemble(points.vertices.data(), points.texture_coordinates.data(), count,
+                                                             bytes_per_pixel ? &texture : nullptr, ordered, allow_no_texture_points,
+                                                             PointCloudLayout::XYZ32, actual.data());
+                    ASSERT_EQ(expected.size() / point_step, written);
+                    // The bytes past the written points must be left alone.
+                    ASSERT_EQ(std::vector<uint8_t>((count + 1) * point_step - expected.size(), 0x5a),
+                              std::vector<uint8_t>(actual.begin() + expected.size(), actual.end()));
+                    actual.resize(expected.size());
+                    ASSERT_EQ(expected, actual);
+                }
+            }
+        }
+    }
+}